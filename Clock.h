@@ -0,0 +1,36 @@
+/*
+Clock.h
+
+A monotonic clock for timing things.  clock_gettime only turned up in
+Mac OS X 10.12, so the Mac uses mach_absolute_time.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+static inline uint64_t clockNanoseconds( void )
+{
+#ifdef __APPLE__
+	static mach_timebase_info_data_t timebase;
+	if ( timebase.denom == 0 )
+		mach_timebase_info( &timebase );
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+#endif
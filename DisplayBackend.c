@@ -0,0 +1,315 @@
+/*
+DisplayBackend.c
+
+Backend selection and the counting (and timing) wrappers around the
+backend function pointers.  See DisplayBackend.h.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "DisplayBackend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DisplayTrace.h"
+
+typedef struct
+{
+	const char *name;
+	displayBackend *(*create)( const char *options );
+	const char *help;
+} backendEntry;
+
+static const backendEntry backendTable[] =
+{
+#ifdef __APPLE__
+	{ "cg", backendCreateCG, "CoreGraphics (the real displays)" },
+#endif
+#ifdef __linux__
+	{ "drm", backendCreateDRM, "The kernel's DRM connectors in sysfs, read only: root=DIR (default /sys/class/drm),\n"
+	                           "      poll=MS (how often to look for hotplugs, default 1000)" },
+#endif
+#ifdef HAVE_XRANDR
+	{ "xrandr", backendCreateXRandR, "X11 RandR 1.2 outputs: display=NAME (default $DISPLAY)" },
+#endif
+	{ "sim", backendCreateSim, "Simulated displays: displays=N,modes=N,seed=N,shuffle=0|1,current=WxH[xBPPxHZ],edid=FILE,\n"
+	                           "      enum=US,list=US,cur=US,begin=US,configure=US,commit=US (latencies in microseconds),\n"
+	                           "      hotplug=MS,hotplugs=N,burst=N,burstgap=US (a display resets to its first mode every MS),\n"
+	                           "      settle=US (a change reads back that long after its commit),stuck=N (display N ignores changes)" },
+	{ "replay", backendCreateReplay, "A recording made with SetDisplay -R: file=PATH,timing=0|1 (wait as long as each call took\n"
+	                                 "      when it was recorded, default 1)" },
+};
+
+#define BACKEND_COUNT (sizeof(backendTable) / sizeof(backendTable[0]))
+
+// the queries can come from several threads at once
+#define COUNT_CALL(backend, call) __sync_fetch_and_add( &(backend)->stats.call, 1 )
+
+displayBackend *backendCreate( const char *spec )
+{
+	char name[32];
+	const char *options;
+	size_t len;
+	size_t ii;
+
+	if ( spec == NULL || *spec == '\0' )
+		spec = backendTable[0].name;
+
+	options = strchr( spec, ':' );
+	len = options ? (size_t)(options - spec) : strlen( spec );
+	if ( len >= sizeof(name) )
+		len = sizeof(name) - 1;
+	memcpy( name, spec, len );
+	name[len] = '\0';
+	options = options ? options + 1 : "";
+
+	for ( ii = 0; ii < BACKEND_COUNT; ii++ )
+	{
+		if ( strcmp( name, backendTable[ii].name ) == 0 )
+			return backendTable[ii].create( options );
+	}
+	printf( "Unknown display backend \"%s\"\n", name );
+	return NULL;
+}
+
+void backendDestroy( displayBackend *backend )
+{
+	if ( backend != NULL && backend->destroy != NULL )
+		backend->destroy( backend );
+}
+
+void backendUsage( void )
+{
+	size_t ii;
+
+	for ( ii = 0; ii < BACKEND_COUNT; ii++ )
+		printf( "    %-6s %s\n", backendTable[ii].name, backendTable[ii].help );
+}
+
+/////////////////
+
+displayErr backendGetOnlineDisplays( displayBackend *backend, uint32_t maxDisplays, displayID *displays, uint32_t *numDisplays )
+{
+	uint64_t started = traceStart( backend->trace );
+	displayErr err;
+
+	COUNT_CALL( backend, getOnlineDisplays );
+	err = backend->getOnlineDisplays( backend, maxDisplays, displays, numDisplays );
+	traceEnd( backend->trace, TRACE_DISPLAYS, kNullDisplay, started );
+	return err;
+}
+
+displayErr backendCopyOnlineDisplays( displayBackend *backend, displayID **displays, uint32_t *numDisplays )
+{
+	uint32_t count = 0, max;
+	displayErr err;
+
+	*displays = NULL;
+	*numDisplays = 0;
+	err = backendGetOnlineDisplays( backend, 0, NULL, &count );
+	while ( err == kDisplayNoErr )
+	{
+		// room for a few more, in case some turned up since they were counted
+		displayID *list;
+		max = count + 8;
+		list = realloc( *displays, max * sizeof(displayID) );
+		if ( list == NULL )
+		{
+			err = kDisplayErrNoMemory;
+			break;
+		}
+		*displays = list;
+		err = backendGetOnlineDisplays( backend, max, *displays, &count );
+		if ( err == kDisplayNoErr && count < max )
+		{
+			*numDisplays = count;
+			return kDisplayNoErr;
+		}
+		count = max * 2;
+	}
+	free( *displays );
+	*displays = NULL;
+	return err;
+}
+
+displayErr backendCopyModes( displayBackend *backend, displayID display, displayModeDesc **modes, size_t *count )
+{
+	uint64_t started = traceStart( backend->trace );
+	displayErr err;
+
+	COUNT_CALL( backend, copyModes );
+	err = backend->copyModes( backend, display, modes, count );
+	traceEnd( backend->trace, TRACE_LIST, display, started );
+	return err;
+}
+
+displayErr backendCurrentMode( displayBackend *backend, displayID display, displayModeDesc *mode, long *modeIndex )
+{
+	uint64_t started = traceStart( backend->trace );
+	displayErr err;
+
+	COUNT_CALL( backend, currentMode );
+	err = backend->currentMode( backend, display, mode, modeIndex );
+	traceEnd( backend->trace, TRACE_CURRENT, display, started );
+	return err;
+}
+
+displayID backendMainDisplay( displayBackend *backend )
+{
+	return backend->mainDisplay( backend );
+}
+
+displayErr backendIdentify( displayBackend *backend, displayID display, displayIdentity *identity )
+{
+	uint64_t started = traceStart( backend->trace );
+	displayErr err;
+
+	COUNT_CALL( backend, identify );
+	memset( identity, 0, sizeof(displayIdentity) );
+	if ( backend->identify == NULL )
+		return kDisplayErrNotSupported;
+	err = backend->identify( backend, display, identity );
+	traceEnd( backend->trace, TRACE_IDENTIFY, display, started );
+	return err;
+}
+
+int identityIsKnown( const displayIdentity *identity )
+{
+	return identity->vendor != 0 || identity->model != 0 || identity->serial != 0 || identity->edidHash != 0;
+}
+
+displayID backendMirrorOf( displayBackend *backend, displayID display )
+{
+	uint64_t started = traceStart( backend->trace );
+	displayID master;
+
+	COUNT_CALL( backend, mirrorOf );
+	master = backend->mirrorOf( backend, display );
+	traceEnd( backend->trace, TRACE_MIRROR, display, started );
+	return master;
+}
+
+displayErr backendCopyEdid( displayBackend *backend, displayID display, uint8_t **edid, size_t *size )
+{
+	uint64_t started = traceStart( backend->trace );
+	displayErr err;
+
+	COUNT_CALL( backend, copyEdid );
+	*edid = NULL;
+	*size = 0;
+	if ( backend->copyEdid == NULL )
+		return kDisplayErrNotSupported;
+	err = backend->copyEdid( backend, display, edid, size );
+	traceEnd( backend->trace, TRACE_EDID, display, started );
+	return err;
+}
+
+displayErr backendBeginConfiguration( displayBackend *backend, displayConfig **config )
+{
+	uint64_t started = traceStart( backend->trace );
+	displayErr err;
+
+	COUNT_CALL( backend, beginConfiguration );
+	err = backend->beginConfiguration( backend, config );
+	traceEnd( backend->trace, TRACE_BEGIN, kNullDisplay, started );
+	return err;
+}
+
+displayErr backendConfigureMode( displayBackend *backend, displayConfig *config, displayID display, size_t modeIndex )
+{
+	uint64_t started = traceStart( backend->trace );
+	displayErr err;
+
+	COUNT_CALL( backend, configureMode );
+	err = backend->configureMode( backend, config, display, modeIndex );
+	traceEnd( backend->trace, TRACE_CONFIGURE, display, started );
+	return err;
+}
+
+displayErr backendConfigureMirror( displayBackend *backend, displayConfig *config, displayID display, displayID master )
+{
+	uint64_t started = traceStart( backend->trace );
+	displayErr err;
+
+	COUNT_CALL( backend, configureMirror );
+	err = backend->configureMirror( backend, config, display, master );
+	traceEnd( backend->trace, TRACE_CONFIGURE, display, started );
+	return err;
+}
+
+displayErr backendCompleteConfiguration( displayBackend *backend, displayConfig *config, int permanently )
+{
+	uint64_t started = traceStart( backend->trace );
+	displayErr err;
+
+	COUNT_CALL( backend, completeConfiguration );
+	err = backend->completeConfiguration( backend, config, permanently );
+	traceEnd( backend->trace, TRACE_COMMIT, kNullDisplay, started );
+	return err;
+}
+
+displayErr backendCancelConfiguration( displayBackend *backend, displayConfig *config )
+{
+	uint64_t started = traceStart( backend->trace );
+	displayErr err;
+
+	COUNT_CALL( backend, cancelConfiguration );
+	err = backend->cancelConfiguration( backend, config );
+	traceEnd( backend->trace, TRACE_CANCEL, kNullDisplay, started );
+	return err;
+}
+
+displayErr backendWaitForEvents( displayBackend *backend, long timeoutMs, displayEvent *events, size_t maxEvents, size_t *numEvents )
+{
+	COUNT_CALL( backend, waitForEvents );
+	*numEvents = 0;
+	if ( backend->waitForEvents == NULL )
+		return kDisplayErrNotSupported;
+	return backend->waitForEvents( backend, timeoutMs, events, maxEvents, numEvents );
+}
+
+/////////////////
+
+static const char *findOption( const char *options, const char *key )
+{
+	size_t keyLen = strlen( key );
+	const char *p = options;
+
+	while ( p != NULL && *p != '\0' )
+	{
+		if ( strncmp( p, key, keyLen ) == 0 && p[keyLen] == '=' )
+			return p + keyLen + 1;
+		p = strchr( p, ',' );
+		if ( p != NULL )
+			p++;
+	}
+	return NULL;
+}
+
+int backendOptionLong( const char *options, const char *key, long *value )
+{
+	const char *p = findOption( options, key );
+
+	if ( p == NULL )
+		return 0;
+	*value = strtol( p, NULL, 0 );
+	return 1;
+}
+
+int backendOptionString( const char *options, const char *key, char *value, size_t size )
+{
+	const char *p = findOption( options, key );
+	size_t len;
+
+	if ( p == NULL || size == 0 )
+		return 0;
+	len = strcspn( p, "," );
+	if ( len >= size )
+		len = size - 1;
+	memcpy( value, p, len );
+	value[len] = '\0';
+	return 1;
+}
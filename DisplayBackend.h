@@ -0,0 +1,222 @@
+/*
+DisplayBackend.h
+
+The display backend interface.  Everything SetDisplay needs from the
+window server goes through one of these: the online display list, the
+mode list of a display, the current mode of a display, and a
+begin/configure/commit transaction.  The CoreGraphics calls SetDisplay
+was written against are one implementation (DisplayBackendCG.c), the
+Linux kernel's DRM connectors in sysfs (DisplayBackendDRM.c) and X11
+RandR (DisplayBackendXRandR.c) others, and the simulated backend
+(DisplayBackendSim.c) one more.
+
+Modes are handed out as plain arrays of displayModeDesc.  A mode is
+identified by its index in the array returned by copyModes, and that
+index is what gets passed back to configureMode.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef DISPLAYBACKEND_H
+#define DISPLAYBACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t displayID;
+typedef int displayErr;
+
+#define kDisplayNoErr            0
+#define kDisplayErrFailure       1000
+#define kDisplayErrIllegalArg    1001
+#define kDisplayErrNoMemory      1002
+#define kDisplayErrNotSupported  1003
+#define kDisplayErrNoMoreEvents  1004
+
+#define kNullDisplay             ((displayID)0)
+
+typedef struct
+{
+	size_t width;
+	size_t height;
+	size_t bitsPerPixel;
+	double refresh;
+} displayMode;
+
+typedef struct
+{
+	displayMode mode;
+	int usable;                 // CGDisplayModeGetIODisplayModeID() != 0
+	uint32_t ioModeID;
+} displayModeDesc;
+
+/*
+What a display is, as opposed to where it is plugged in today.  Display
+IDs can change between boots, this shouldn't.  All zero means the
+backend couldn't tell.
+*/
+typedef struct
+{
+	uint32_t vendor;
+	uint32_t model;
+	uint32_t serial;
+	uint32_t reserved;
+	uint64_t edidHash;
+} displayIdentity;
+
+/*
+Something happened to a display: it was plugged in, unplugged, or its
+mode or mirroring changed (including because SetDisplay changed it).
+timestamp is clockNanoseconds() of when the backend heard about it.
+*/
+#define DISPLAY_EVENT_ADDED   0x1
+#define DISPLAY_EVENT_REMOVED 0x2
+#define DISPLAY_EVENT_CHANGED 0x4
+
+typedef struct
+{
+	displayID display;
+	uint32_t flags;
+	uint64_t timestamp;
+} displayEvent;
+
+typedef struct
+{
+	unsigned long getOnlineDisplays;
+	unsigned long copyModes;
+	unsigned long currentMode;
+	unsigned long identify;
+	unsigned long mirrorOf;
+	unsigned long copyEdid;
+	unsigned long beginConfiguration;
+	unsigned long configureMode;
+	unsigned long configureMirror;
+	unsigned long completeConfiguration;
+	unsigned long cancelConfiguration;
+	unsigned long waitForEvents;
+} displayBackendStats;
+
+typedef struct displayConfig displayConfig;
+typedef struct displayBackend displayBackend;
+
+struct displayBackend
+{
+	const char *name;
+	void *ctx;
+	displayBackendStats stats;
+	int concurrentQueries;      // the queries, up to copyEdid, can be made from several threads at once
+	struct displayTrace *trace; // NULL, or where the wrappers below record how long each call took
+
+	displayErr (*getOnlineDisplays)( displayBackend *backend, uint32_t maxDisplays, displayID *displays, uint32_t *numDisplays );
+	displayErr (*copyModes)( displayBackend *backend, displayID display, displayModeDesc **modes, size_t *count );
+	displayErr (*currentMode)( displayBackend *backend, displayID display, displayModeDesc *mode, long *modeIndex );
+	displayID (*mainDisplay)( displayBackend *backend );
+	displayErr (*identify)( displayBackend *backend, displayID display, displayIdentity *identity );
+	displayID (*mirrorOf)( displayBackend *backend, displayID display );
+	displayErr (*copyEdid)( displayBackend *backend, displayID display, uint8_t **edid, size_t *size );
+
+	displayErr (*beginConfiguration)( displayBackend *backend, displayConfig **config );
+	displayErr (*configureMode)( displayBackend *backend, displayConfig *config, displayID display, size_t modeIndex );
+	displayErr (*configureMirror)( displayBackend *backend, displayConfig *config, displayID display, displayID master );
+	displayErr (*completeConfiguration)( displayBackend *backend, displayConfig *config, int permanently );
+	displayErr (*cancelConfiguration)( displayBackend *backend, displayConfig *config );
+
+	displayErr (*waitForEvents)( displayBackend *backend, long timeoutMs, displayEvent *events, size_t maxEvents, size_t *numEvents );
+
+	void (*destroy)( displayBackend *backend );
+};
+
+/*
+Creates a backend from a spec string of the form NAME[:KEY=VALUE,...].
+A NULL or empty spec gives the default backend for the platform
+("cg" on Mac OS X, "drm" on Linux, "sim" everywhere else).  Returns NULL and prints
+the reason when the spec is bad.
+*/
+displayBackend *backendCreate( const char *spec );
+void backendDestroy( displayBackend *backend );
+void backendUsage( void );
+
+displayBackend *backendCreateCG( const char *options );
+displayBackend *backendCreateDRM( const char *options );
+displayBackend *backendCreateSim( const char *options );
+displayBackend *backendCreateReplay( const char *options );
+displayBackend *backendCreateXRandR( const char *options );   // built with -DHAVE_XRANDR
+
+/*
+A backend in front of inner that writes what inner answered, and how
+long it took, to path when it is destroyed (DisplayBackendReplay.c),
+nothing with a NULL path.  inner's trace moves to it, and it destroys
+inner.  NULL when out of memory.
+*/
+displayBackend *backendCreateRecorder( displayBackend *inner, const char *path );
+
+/*
+What a recorder would write to its file, taken now (whatever nothing
+asked about yet is asked for first), into *data to be freed by the
+caller.  Returns 0, or -1 if backend isn't
+a recorder or out of memory.
+*/
+int backendTakeRecording( displayBackend *backend, uint8_t **data, size_t *size );
+
+/*
+The replay backend playing back a recording already in memory (one
+machine of a fleet corpus, see SetDisplayFleet.c) instead of a file,
+timing as the option.  data is copied from, it can go as soon as this
+returns.  NULL when it isn't a recording or out of memory.
+*/
+displayBackend *backendCreateReplayData( const void *data, size_t size, int timing );
+
+/*
+The recording in data without how long anything took, just what the
+backend answered, into *answers to be freed by the caller: two
+machines that answered the same then have the same recording.
+Returns 0, or -1 if data isn't a recording or out of memory.
+*/
+int backendRecordingAnswers( const void *data, size_t size, uint8_t **answers, size_t *answersSize );
+
+/*
+The rest of SetDisplay calls these instead of the function pointers so
+that every backend call gets counted (and, with a trace, timed) the
+same way.
+
+getOnlineDisplays with NULL displays only counts them.
+backendCopyOnlineDisplays gets them all, however many there are, in a
+malloc'd array the caller frees.
+*/
+displayErr backendGetOnlineDisplays( displayBackend *backend, uint32_t maxDisplays, displayID *displays, uint32_t *numDisplays );
+displayErr backendCopyOnlineDisplays( displayBackend *backend, displayID **displays, uint32_t *numDisplays );
+displayErr backendCopyModes( displayBackend *backend, displayID display, displayModeDesc **modes, size_t *count );
+displayErr backendCurrentMode( displayBackend *backend, displayID display, displayModeDesc *mode, long *modeIndex );
+displayID backendMainDisplay( displayBackend *backend );
+displayErr backendIdentify( displayBackend *backend, displayID display, displayIdentity *identity );
+int identityIsKnown( const displayIdentity *identity );
+displayID backendMirrorOf( displayBackend *backend, displayID display );
+
+/*
+The display's EDID, malloc'd, as the monitor sent it (see Edid.h).
+kDisplayErrNotSupported if the backend can't get at it.
+*/
+displayErr backendCopyEdid( displayBackend *backend, displayID display, uint8_t **edid, size_t *size );
+
+displayErr backendBeginConfiguration( displayBackend *backend, displayConfig **config );
+displayErr backendConfigureMode( displayBackend *backend, displayConfig *config, displayID display, size_t modeIndex );
+displayErr backendConfigureMirror( displayBackend *backend, displayConfig *config, displayID display, displayID master );
+displayErr backendCompleteConfiguration( displayBackend *backend, displayConfig *config, int permanently );
+displayErr backendCancelConfiguration( displayBackend *backend, displayConfig *config );
+
+/*
+Waits up to timeoutMs (forever if negative) for display events and
+returns what arrived, which may be nothing.  kDisplayErrNoMoreEvents
+means none will ever come (a simulated script ran out).
+*/
+displayErr backendWaitForEvents( displayBackend *backend, long timeoutMs, displayEvent *events, size_t maxEvents, size_t *numEvents );
+
+/*
+Option string helpers for backend specs ("displays=4,modes=200").
+Each returns 1 if KEY was found and stores its value.
+*/
+int backendOptionLong( const char *options, const char *key, long *value );
+int backendOptionString( const char *options, const char *key, char *value, size_t size );
+
+#endif
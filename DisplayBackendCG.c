@@ -0,0 +1,419 @@
+/*
+DisplayBackendCG.c
+
+The CoreGraphics display backend.  These are the calls SetDisplay has
+always made, moved behind the displayBackend interface.
+
+Requires Mac OS X 10.6 or later
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifdef __APPLE__
+
+#include <ApplicationServices/ApplicationServices.h>
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#include <IOKit/graphics/IOGraphicsLib.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DisplayBackend.h"
+#include "Clock.h"
+
+#define MAX_EVENTS   64
+
+/*
+configureMode takes an index into the array copyModes returned, so the
+CFArray behind each display's mode list is kept until the display asks
+for its modes again or the backend goes away.  There are as many of
+these as displays have been seen, each allocated on its own so that
+growing the table doesn't move one another thread is using.
+*/
+typedef struct
+{
+	CGDirectDisplayID display;
+	CFArrayRef modes;
+} cgDisplayModes;
+
+typedef struct
+{
+	pthread_mutex_t lock;       // the queries can come from several threads
+	cgDisplayModes **displays;
+	int numDisplays;
+	int maxDisplays;
+
+	// filled in by the reconfiguration callback while the run loop runs
+	int listening;
+	displayEvent events[MAX_EVENTS];
+	size_t numEvents;
+} cgBackend;
+
+struct displayConfig
+{
+	CGDisplayConfigRef configRef;
+};
+
+/*
+A Core Foundation reference the block it is declared in owns: it is
+released however the block is left, so an early return can't leak it.
+Everything CG hands over with Copy or Create in its name goes in one.
+
+	cgOwned CFArrayRef modes = CGDisplayCopyAllDisplayModes( display, NULL );
+*/
+#define cgOwned __attribute__((cleanup(releaseOwned)))
+
+static void releaseOwned( void *ref )
+{
+	CFTypeRef held = *(CFTypeRef *)ref;
+
+	if ( held != NULL )
+		CFRelease( held );
+}
+
+size_t displayBitsPerPixel( CGDisplayModeRef mode )
+{
+	size_t depth = 0;
+	cgOwned CFStringRef pixEnc = CGDisplayModeCopyPixelEncoding(mode);
+
+	if ( pixEnc == NULL )
+		return 0;
+	if(CFStringCompare(pixEnc, CFSTR(IO32BitDirectPixels), kCFCompareCaseInsensitive) == kCFCompareEqualTo)
+		depth = 32;
+	else if(CFStringCompare(pixEnc, CFSTR(IO16BitDirectPixels), kCFCompareCaseInsensitive) == kCFCompareEqualTo)
+		depth = 16;
+	else if(CFStringCompare(pixEnc, CFSTR(IO8BitIndexedPixels), kCFCompareCaseInsensitive) == kCFCompareEqualTo)
+		depth = 8;
+
+	return depth;
+}
+
+static void describeMode( CGDisplayModeRef modeRef, displayModeDesc *desc )
+{
+	desc->mode.width = CGDisplayModeGetWidth(modeRef);
+	desc->mode.height = CGDisplayModeGetHeight(modeRef);
+	desc->mode.bitsPerPixel = displayBitsPerPixel(modeRef);
+	desc->mode.refresh = CGDisplayModeGetRefreshRate(modeRef);
+	desc->ioModeID = CGDisplayModeGetIODisplayModeID(modeRef);
+	desc->usable = desc->ioModeID ? 1 : 0;
+}
+
+/*
+Call with cg->lock held.
+*/
+static cgDisplayModes *slotForDisplay( cgBackend *cg, CGDirectDisplayID display )
+{
+	cgDisplayModes *slot;
+	int ii;
+
+	for ( ii = 0; ii < cg->numDisplays; ii++ )
+	{
+		if ( cg->displays[ii]->display == display )
+			return cg->displays[ii];
+	}
+	if ( cg->numDisplays == cg->maxDisplays )
+	{
+		int maxDisplays = cg->maxDisplays ? cg->maxDisplays * 2 : 16;
+		cgDisplayModes **displays = realloc( cg->displays, maxDisplays * sizeof(cgDisplayModes *) );
+		if ( displays == NULL )
+			return NULL;
+		cg->displays = displays;
+		cg->maxDisplays = maxDisplays;
+	}
+	slot = calloc( 1, sizeof(cgDisplayModes) );
+	if ( slot == NULL )
+		return NULL;
+	slot->display = display;
+	cg->displays[cg->numDisplays++] = slot;
+	return slot;
+}
+
+/*
+The display's mode array, retained, or NULL if it hasn't listed its
+modes yet.
+*/
+static CFArrayRef copySlotModes( cgBackend *cg, CGDirectDisplayID display )
+{
+	cgDisplayModes *slot;
+	CFArrayRef modes = NULL;
+
+	pthread_mutex_lock( &cg->lock );
+	slot = slotForDisplay( cg, display );
+	if ( slot != NULL && slot->modes != NULL )
+		modes = CFRetain( slot->modes );
+	pthread_mutex_unlock( &cg->lock );
+	return modes;
+}
+
+static displayErr cgGetOnlineDisplays( displayBackend *backend, uint32_t maxDisplays, displayID *displays, uint32_t *numDisplays )
+{
+	CGDisplayCount count;
+	CGDisplayErr err;
+
+	// with NULL displays this just counts them
+	//err = CGGetActiveDisplayList(maxDisplays, displays, &count); // active only
+	err = CGGetOnlineDisplayList(maxDisplays, displays, &count); // active, mirrored, or sleeping
+	*numDisplays = count;
+	return err;
+}
+
+static displayErr cgCopyModes( displayBackend *backend, displayID display, displayModeDesc **modes, size_t *count )
+{
+	cgBackend *cg = backend->ctx;
+	cgDisplayModes *slot;
+	cgOwned CFArrayRef dictModes = CGDisplayCopyAllDisplayModes (display, NULL);
+	cgOwned CFArrayRef oldModes = NULL;
+	CFIndex index, numModes;
+
+	if ( dictModes == NULL )
+		return kCGErrorIllegalArgument;
+	pthread_mutex_lock( &cg->lock );
+	slot = slotForDisplay( cg, display );
+	if ( slot != NULL )
+	{
+		oldModes = slot->modes;
+		slot->modes = CFRetain( dictModes );     // the slot keeps its own
+	}
+	pthread_mutex_unlock( &cg->lock );
+	if ( slot == NULL )
+		return kDisplayErrNoMemory;
+
+	numModes = CFArrayGetCount (dictModes);
+	*modes = calloc( numModes ? numModes : 1, sizeof(displayModeDesc) );
+	if ( *modes == NULL )
+		return kDisplayErrNoMemory;
+	for (index = 0; index < numModes; index++)
+		describeMode( (CGDisplayModeRef)CFArrayGetValueAtIndex( dictModes, index ), &(*modes)[index] );
+	*count = numModes;
+	return kDisplayNoErr;
+}
+
+static displayErr cgCurrentMode( displayBackend *backend, displayID display, displayModeDesc *mode, long *modeIndex )
+{
+	cgBackend *cg = backend->ctx;
+	cgOwned CGDisplayModeRef modeRef = CGDisplayCopyDisplayMode( display );
+	cgOwned CFArrayRef modes = NULL;
+	CFIndex index, count;
+
+	if ( modeRef == NULL )
+		return kCGErrorIllegalArgument;
+	describeMode( modeRef, mode );
+
+	*modeIndex = -1;
+	modes = copySlotModes( cg, display );
+	if ( modes == NULL )
+		return kDisplayNoErr;
+	count = CFArrayGetCount( modes );
+	for ( index = 0; index < count; index++ )
+	{
+		if ( CFEqual( CFArrayGetValueAtIndex( modes, index ), modeRef ) )
+		{
+			*modeIndex = index;
+			break;
+		}
+	}
+	return kDisplayNoErr;
+}
+
+static displayID cgMainDisplay( displayBackend *backend )
+{
+	return CGMainDisplayID();
+}
+
+static displayErr cgIdentify( displayBackend *backend, displayID display, displayIdentity *identity )
+{
+	identity->vendor = CGDisplayVendorNumber( display );
+	identity->model = CGDisplayModelNumber( display );
+	identity->serial = CGDisplaySerialNumber( display );
+	return kDisplayNoErr;
+}
+
+/*
+The EDID IOKit kept from when the monitor was last read, which outlasts
+a KVM switching away.  CGDisplayIOServicePort is deprecated but still
+the only way from a display ID to its framebuffer.
+*/
+static displayErr cgCopyEdid( displayBackend *backend, displayID display, uint8_t **edid, size_t *size )
+{
+	cgOwned CFDictionaryRef info = IODisplayCreateInfoDictionary( CGDisplayIOServicePort( display ), kIODisplayOnlyPreferredName );
+	CFDataRef data;
+	displayErr err = kDisplayErrNotSupported;
+
+	if ( info == NULL )
+		return kDisplayErrNotSupported;
+	data = CFDictionaryGetValue( info, CFSTR(kIODisplayEDIDKey) );
+	if ( data != NULL && CFGetTypeID( data ) == CFDataGetTypeID() && CFDataGetLength( data ) > 0 )
+	{
+		*size = CFDataGetLength( data );
+		*edid = malloc( *size );
+		if ( *edid != NULL )
+		{
+			memcpy( *edid, CFDataGetBytePtr( data ), *size );
+			err = kDisplayNoErr;
+		}
+		else
+		{
+			*size = 0;
+			err = kDisplayErrNoMemory;
+		}
+	}
+	return err;
+}
+
+static displayID cgMirrorOf( displayBackend *backend, displayID display )
+{
+	return CGDisplayMirrorsDisplay( display );
+}
+
+static displayErr cgBeginConfiguration( displayBackend *backend, displayConfig **config )
+{
+	CGError err;
+
+	*config = malloc( sizeof(displayConfig) );
+	if ( *config == NULL )
+		return kDisplayErrNoMemory;
+	err = CGBeginDisplayConfiguration( &(*config)->configRef );
+	if ( err != kCGErrorSuccess )
+	{
+		free( *config );
+		*config = NULL;
+	}
+	return err;
+}
+
+static displayErr cgConfigureMode( displayBackend *backend, displayConfig *config, displayID display, size_t modeIndex )
+{
+	cgBackend *cg = backend->ctx;
+	cgOwned CFArrayRef modes = copySlotModes( cg, display );
+	CGDisplayModeRef modeRef;
+
+	if ( modes == NULL || modeIndex >= (size_t)CFArrayGetCount( modes ) )
+		return kCGErrorIllegalArgument;
+	modeRef = (CGDisplayModeRef)CFArrayGetValueAtIndex( modes, modeIndex );
+	return CGConfigureDisplayWithDisplayMode( config->configRef, display, modeRef, NULL );
+}
+
+static displayErr cgConfigureMirror( displayBackend *backend, displayConfig *config, displayID display, displayID master )
+{
+	return CGConfigureDisplayMirrorOfDisplay( config->configRef, display, master == kNullDisplay ? kCGNullDirectDisplay : master );
+}
+
+static displayErr cgCompleteConfiguration( displayBackend *backend, displayConfig *config, int permanently )
+{
+	CGError err;
+
+	err = CGCompleteDisplayConfiguration( config->configRef, permanently ? kCGConfigurePermanently : kCGConfigureForSession );
+	free( config );
+	return err;
+}
+
+static displayErr cgCancelConfiguration( displayBackend *backend, displayConfig *config )
+{
+	CGError err;
+
+	err = CGCancelDisplayConfiguration( config->configRef );
+	free( config );
+	return err;
+}
+
+static void cgReconfigured( CGDirectDisplayID display, CGDisplayChangeSummaryFlags flags, void *userInfo )
+{
+	cgBackend *cg = userInfo;
+	uint32_t eventFlags = 0;
+
+	// every change is announced once before it happens and once after,
+	// only the after counts
+	if ( flags & kCGDisplayBeginConfigurationFlag )
+		return;
+	if ( flags & kCGDisplayAddFlag )
+		eventFlags |= DISPLAY_EVENT_ADDED;
+	if ( flags & kCGDisplayRemoveFlag )
+		eventFlags |= DISPLAY_EVENT_REMOVED;
+	if ( flags & (kCGDisplaySetModeFlag | kCGDisplayMirrorFlag | kCGDisplayUnMirrorFlag | kCGDisplayEnabledFlag |
+			kCGDisplayDisabledFlag | kCGDisplayDesktopShapeChangedFlag) )
+		eventFlags |= DISPLAY_EVENT_CHANGED;
+	if ( eventFlags == 0 || cg->numEvents == MAX_EVENTS )
+		return;
+	cg->events[cg->numEvents].display = display;
+	cg->events[cg->numEvents].flags = eventFlags;
+	cg->events[cg->numEvents].timestamp = clockNanoseconds();
+	cg->numEvents++;
+}
+
+static displayErr cgWaitForEvents( displayBackend *backend, long timeoutMs, displayEvent *events, size_t maxEvents, size_t *numEvents )
+{
+	cgBackend *cg = backend->ctx;
+	size_t count;
+
+	if ( !cg->listening )
+	{
+		CGError err = CGDisplayRegisterReconfigurationCallback( cgReconfigured, cg );
+		if ( err != kCGErrorSuccess )
+			return err;
+		cg->listening = 1;
+	}
+	if ( cg->numEvents == 0 )
+		CFRunLoopRunInMode( kCFRunLoopDefaultMode, timeoutMs < 0 ? 1e10 : timeoutMs / 1000.0, true );
+
+	count = cg->numEvents < maxEvents ? cg->numEvents : maxEvents;
+	memcpy( events, cg->events, count * sizeof(displayEvent) );
+	memmove( cg->events, cg->events + count, (cg->numEvents - count) * sizeof(displayEvent) );
+	cg->numEvents -= count;
+	*numEvents = count;
+	return kDisplayNoErr;
+}
+
+static void cgDestroy( displayBackend *backend )
+{
+	cgBackend *cg = backend->ctx;
+	int ii;
+
+	if ( cg->listening )
+		CGDisplayRemoveReconfigurationCallback( cgReconfigured, cg );
+	for ( ii = 0; ii < cg->numDisplays; ii++ )
+	{
+		if ( cg->displays[ii]->modes != NULL )
+			CFRelease( cg->displays[ii]->modes );
+		free( cg->displays[ii] );
+	}
+	free( cg->displays );
+	pthread_mutex_destroy( &cg->lock );
+	free( cg );
+	free( backend );
+}
+
+displayBackend *backendCreateCG( const char *options )
+{
+	displayBackend *backend = calloc( 1, sizeof(displayBackend) );
+	cgBackend *cg = calloc( 1, sizeof(cgBackend) );
+
+	if ( backend == NULL || cg == NULL )
+	{
+		free( backend );
+		free( cg );
+		return NULL;
+	}
+	pthread_mutex_init( &cg->lock, NULL );
+	backend->name = "cg";
+	backend->ctx = cg;
+	backend->concurrentQueries = 1;
+	backend->getOnlineDisplays = cgGetOnlineDisplays;
+	backend->copyModes = cgCopyModes;
+	backend->currentMode = cgCurrentMode;
+	backend->mainDisplay = cgMainDisplay;
+	backend->identify = cgIdentify;
+	backend->copyEdid = cgCopyEdid;
+	backend->mirrorOf = cgMirrorOf;
+	backend->beginConfiguration = cgBeginConfiguration;
+	backend->configureMode = cgConfigureMode;
+	backend->configureMirror = cgConfigureMirror;
+	backend->completeConfiguration = cgCompleteConfiguration;
+	backend->cancelConfiguration = cgCancelConfiguration;
+	backend->waitForEvents = cgWaitForEvents;
+	backend->destroy = cgDestroy;
+	return backend;
+}
+
+#endif
@@ -0,0 +1,725 @@
+/*
+DisplayBackendDRM.c
+
+The displays of a Linux machine as the kernel's DRM drivers show them
+in sysfs: a directory per connector, /sys/class/drm/card0-HDMI-A-1 and
+so on, with its status, the modes the driver will drive it at and the
+monitor's EDID.
+
+	-B drm
+	-B drm:root=fixtures/two-monitors,poll=500
+
+root is where the connector directories are (/sys/class/drm by
+default), so a copy of them taken on another machine works as well as
+the real ones (see the README).
+
+sysfs has one file per attribute and nothing to read several with, so
+getting the online displays is one pass over root that opens each
+connector's directory once and reads status from it, and the EDID for
+the connected ones.  Everything else is kept from the pass before: a
+connector's modes are only read again when it is new, or its status or
+its EDID changed.  The pass is made when the displays are counted
+(getOnlineDisplays with no array); the array is filled from it.
+
+sysfs doesn't say which mode a connector is driven at, only which mode
+the driver would pick (the first one listed), so that is what
+currentMode returns.  Setting modes takes KMS and the DRM master, which
+a window server already holds, so there is no configuration here:
+beginConfiguration is kDisplayErrNotSupported.  Events come from
+making the pass every poll milliseconds and comparing.
+
+Requires Linux 2.6.30 or later (openat and the edid attribute)
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifdef __linux__
+
+#include "DisplayBackend.h"
+#include "Clock.h"
+#include "Edid.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DRM_ROOT        "/sys/class/drm"
+#define DRM_MAX_NAME    64
+#define DRM_ORDINAL     0x800000    // display IDs for connectors without a connector_id
+
+typedef struct
+{
+	char name[DRM_MAX_NAME];    // card0-HDMI-A-1
+	displayID display;
+	int connected;
+	uint8_t *edid;
+	size_t edidSize;
+	displayModeDesc *modes;
+	size_t numModes;
+	displayIdentity identity;
+	uint64_t stamp;             // hash of the EDID and the modes, to tell a change
+} drmConnector;
+
+typedef struct
+{
+	displayID display;
+	uint64_t stamp;
+} drmSeen;
+
+typedef struct
+{
+	char root[1024];
+	long pollInterval;          // milliseconds
+
+	pthread_mutex_t lock;       // everything below
+	drmConnector *connectors;   // the last pass, sorted by name, connected or not
+	size_t numConnectors;
+	char *buf;                  // what an attribute is read into
+	size_t bufSize;
+
+	// the online displays as last reported by waitForEvents, and events not yet collected
+	drmSeen *seen;
+	size_t numSeen;
+	displayEvent *pending;
+	size_t numPending;
+} drmBackend;
+
+static void drmSleep( long msec )
+{
+	struct timespec ts;
+
+	if ( msec <= 0 )
+		return;
+	ts.tv_sec = msec / 1000;
+	ts.tv_nsec = (msec % 1000) * 1000000;
+	while ( nanosleep( &ts, &ts ) == -1 && errno == EINTR )
+		;
+}
+
+static uint64_t drmHash( uint64_t hash, const void *data, size_t size )
+{
+	const uint8_t *p = data;
+	size_t ii;
+
+	// FNV-1a
+	for ( ii = 0; ii < size; ii++ )
+		hash = (hash ^ p[ii]) * 0x100000001b3ull;
+	return hash;
+}
+
+/*
+Reads the attribute into drm->buf, NUL terminated.  Returns its
+length, or -1 if there is no such attribute.
+*/
+static long drmRead( drmBackend *drm, int dirFd, const char *attribute )
+{
+	int fd = openat( dirFd, attribute, O_RDONLY );
+	size_t length = 0;
+
+	if ( fd < 0 )
+		return -1;
+	for ( ;; )
+	{
+		ssize_t got;
+
+		if ( length + 1 >= drm->bufSize )
+		{
+			char *grown = realloc( drm->buf, drm->bufSize * 2 );
+			if ( grown == NULL )
+				break;
+			drm->buf = grown;
+			drm->bufSize *= 2;
+		}
+		got = read( fd, drm->buf + length, drm->bufSize - length - 1 );
+		if ( got < 0 && errno == EINTR )
+			continue;
+		if ( got <= 0 )
+			break;
+		length += (size_t)got;
+	}
+	close( fd );
+	drm->buf[length] = '\0';
+	return (long)length;
+}
+
+static int drmByRefreshDown( const void *a, const void *b )
+{
+	double ra = ((const displayModeDesc *)a)->mode.refresh;
+	double rb = ((const displayModeDesc *)b)->mode.refresh;
+
+	return ra < rb ? 1 : ra > rb ? -1 : 0;
+}
+
+/*
+The modes attribute is one WIDTHxHEIGHT a line, the driver's pick
+first, with no refresh rate; a size the driver has at several rates is
+listed once per rate, fastest first.  The rates come from the EDID:
+the k-th line of a size gets the k-th fastest rate the EDID has for it,
+and 0 (not known, like a Mac's built-in panel) when it has no more.
+Interlaced modes ("1920x1080i") are left out, there is no asking for
+one.  ioModeID is the line number.
+*/
+static displayModeDesc *drmParseModes( const char *text, const uint8_t *edid, size_t edidSize, size_t *count )
+{
+	displayModeDesc *modes, *edidList = NULL;
+	char *taken = NULL;
+	size_t numLines = 1, numEdid = 0, line = 0, ii;
+	const char *p;
+
+	for ( p = text; *p; p++ )
+		numLines += *p == '\n';
+	modes = malloc( numLines * sizeof(displayModeDesc) );
+	if ( modes == NULL )
+		return NULL;
+	if ( edidSize != 0 )
+	{
+		edidList = malloc( EDID_MAX_MODES * sizeof(displayModeDesc) );
+		numEdid = edidList ? edidModes( edid, edidSize, edidList, EDID_MAX_MODES ) : 0;
+		taken = calloc( numEdid ? numEdid : 1, 1 );
+		if ( taken == NULL )
+			numEdid = 0;
+		qsort( edidList, numEdid, sizeof(displayModeDesc), drmByRefreshDown );
+	}
+
+	*count = 0;
+	for ( p = text; *p; line++ )
+	{
+		const char *end = strchr( p, '\n' );
+		unsigned int width, height;
+		char interlaced = 0;
+		displayModeDesc *desc;
+
+		if ( end == NULL )
+			end = p + strlen( p );
+		if ( sscanf( p, "%ux%u%c", &width, &height, &interlaced ) >= 2 && interlaced != 'i' && width && height )
+		{
+			desc = &modes[(*count)++];
+			memset( desc, 0, sizeof(displayModeDesc) );
+			desc->mode.width = width;
+			desc->mode.height = height;
+			desc->mode.bitsPerPixel = 32;
+			desc->usable = 1;
+			desc->ioModeID = (uint32_t)line + 1;
+			for ( ii = 0; ii < numEdid; ii++ )
+			{
+				if ( !taken[ii] && edidList[ii].mode.width == width && edidList[ii].mode.height == height )
+				{
+					desc->mode.refresh = edidList[ii].mode.refresh;
+					taken[ii] = 1;
+					break;
+				}
+			}
+		}
+		p = *end ? end + 1 : end;
+	}
+	free( edidList );
+	free( taken );
+	return modes;
+}
+
+static void drmFreeConnector( drmConnector *conn )
+{
+	free( conn->edid );
+	free( conn->modes );
+	conn->edid = NULL;
+	conn->modes = NULL;
+	conn->edidSize = conn->numModes = 0;
+}
+
+static int drmByName( const void *a, const void *b )
+{
+	return strcmp( ((const drmConnector *)a)->name, ((const drmConnector *)b)->name );
+}
+
+/*
+Reads what changed of one connector into conn, moving what didn't
+over from before (NULL if it is new).
+*/
+static void drmScanConnector( drmBackend *drm, int rootFd, drmConnector *conn, drmConnector *before, uint32_t ordinal )
+{
+	int fd = openat( rootFd, conn->name, O_RDONLY | O_DIRECTORY );
+	unsigned int card = 0;
+	long length;
+
+	sscanf( conn->name, "card%u-", &card );
+	if ( before != NULL )
+		conn->display = before->display;
+	if ( fd < 0 )
+		return;
+
+	length = drmRead( drm, fd, "status" );
+	conn->connected = length > 0 && strncmp( drm->buf, "disconnected", 12 ) != 0;
+
+	if ( conn->display == kNullDisplay )
+	{
+		long id = drmRead( drm, fd, "connector_id" ) > 0 ? atol( drm->buf ) : 0;
+		if ( id <= 0 || id >= DRM_ORDINAL )
+			id = DRM_ORDINAL + ordinal;
+		conn->display = ((displayID)(card + 1) << 24) | (displayID)id;
+	}
+	if ( !conn->connected )
+	{
+		close( fd );
+		return;
+	}
+
+	length = drmRead( drm, fd, "edid" );
+	if ( length < 0 )
+		length = 0;
+	// without an EDID (a KVM, a dock, a virtual output) nothing says it is the same monitor: read the modes
+	if ( length > 0 && before != NULL && before->connected && before->edidSize == (size_t)length &&
+			memcmp( before->edid, drm->buf, (size_t)length ) == 0 )
+	{
+		// the same monitor as last time, and so the same modes
+		conn->edid = before->edid;
+		conn->edidSize = before->edidSize;
+		conn->modes = before->modes;
+		conn->numModes = before->numModes;
+		conn->identity = before->identity;
+		conn->stamp = before->stamp;
+		before->edid = NULL;
+		before->modes = NULL;
+		close( fd );
+		return;
+	}
+
+	if ( length > 0 && (conn->edid = malloc( (size_t)length )) != NULL )
+	{
+		memcpy( conn->edid, drm->buf, (size_t)length );
+		conn->edidSize = (size_t)length;
+		edidIdentity( conn->edid, conn->edidSize, &conn->identity );
+	}
+	conn->stamp = drmHash( 0xcbf29ce484222325ull, conn->edid, conn->edidSize );
+	if ( drmRead( drm, fd, "modes" ) > 0 )
+	{
+		conn->stamp = drmHash( conn->stamp, drm->buf, strlen( drm->buf ) );
+		conn->modes = drmParseModes( drm->buf, conn->edid, conn->edidSize, &conn->numModes );
+		if ( conn->modes == NULL )
+			conn->numModes = 0;
+	}
+	close( fd );
+}
+
+/*
+One pass over root.  Call with the lock held.
+*/
+static displayErr drmScan( drmBackend *drm )
+{
+	DIR *dir = opendir( drm->root );
+	drmConnector *connectors = NULL;
+	size_t numConnectors = 0, maxConnectors = 0, ii, jj;
+	uint32_t ordinal = 0;
+	struct dirent *entry;
+
+	if ( dir == NULL )
+		return kDisplayErrFailure;
+	while ( (entry = readdir( dir )) != NULL )
+	{
+		unsigned int card;
+		int skip = -1;
+
+		// card0-HDMI-A-1, not card0 or renderD128
+		if ( sscanf( entry->d_name, "card%u-%n", &card, &skip ) < 1 || skip < 0 || strlen( entry->d_name ) >= DRM_MAX_NAME )
+			continue;
+		if ( numConnectors == maxConnectors )
+		{
+			size_t grownMax = maxConnectors ? maxConnectors * 2 : drm->numConnectors + 16;
+			drmConnector *grown = realloc( connectors, grownMax * sizeof(drmConnector) );
+			if ( grown == NULL )
+				break;
+			connectors = grown;
+			maxConnectors = grownMax;
+		}
+		memset( &connectors[numConnectors], 0, sizeof(drmConnector) );
+		strcpy( connectors[numConnectors++].name, entry->d_name );
+	}
+	qsort( connectors, numConnectors, sizeof(drmConnector), drmByName );
+
+	// both lists are sorted, so the connector from before is found by walking along
+	for ( ii = 0, jj = 0; ii < numConnectors; ii++ )
+	{
+		drmConnector *before = NULL;
+		int order = 1;
+
+		while ( jj < drm->numConnectors && (order = strcmp( drm->connectors[jj].name, connectors[ii].name )) < 0 )
+			jj++;
+		if ( jj < drm->numConnectors && order == 0 )
+			before = &drm->connectors[jj];
+		drmScanConnector( drm, dirfd( dir ), &connectors[ii], before, ordinal++ );
+	}
+	closedir( dir );
+
+	for ( ii = 0; ii < drm->numConnectors; ii++ )
+		drmFreeConnector( &drm->connectors[ii] );
+	free( drm->connectors );
+	drm->connectors = connectors;
+	drm->numConnectors = numConnectors;
+	return kDisplayNoErr;
+}
+
+static drmConnector *drmFind( drmBackend *drm, displayID display )
+{
+	size_t ii;
+
+	for ( ii = 0; ii < drm->numConnectors; ii++ )
+	{
+		if ( drm->connectors[ii].display == display && drm->connectors[ii].connected )
+			return &drm->connectors[ii];
+	}
+	return NULL;
+}
+
+static displayErr drmGetOnlineDisplays( displayBackend *backend, uint32_t maxDisplays, displayID *displays, uint32_t *numDisplays )
+{
+	drmBackend *drm = backend->ctx;
+	displayErr err = kDisplayNoErr;
+	uint32_t count = 0;
+	size_t ii;
+
+	pthread_mutex_lock( &drm->lock );
+	if ( displays == NULL || drm->connectors == NULL )
+		err = drmScan( drm );
+	for ( ii = 0; err == kDisplayNoErr && ii < drm->numConnectors; ii++ )
+	{
+		if ( !drm->connectors[ii].connected )
+			continue;
+		if ( displays != NULL )
+		{
+			if ( count == maxDisplays )
+				break;
+			displays[count] = drm->connectors[ii].display;
+		}
+		count++;
+	}
+	pthread_mutex_unlock( &drm->lock );
+	*numDisplays = count;
+	return err;
+}
+
+static displayErr drmCopyModes( displayBackend *backend, displayID display, displayModeDesc **modes, size_t *count )
+{
+	drmBackend *drm = backend->ctx;
+	displayErr err = kDisplayNoErr;
+	drmConnector *conn;
+
+	pthread_mutex_lock( &drm->lock );
+	conn = drmFind( drm, display );
+	if ( conn == NULL )
+		err = kDisplayErrIllegalArg;
+	else if ( (*modes = malloc( (conn->numModes ? conn->numModes : 1) * sizeof(displayModeDesc) )) == NULL )
+		err = kDisplayErrNoMemory;
+	else
+	{
+		memcpy( *modes, conn->modes, conn->numModes * sizeof(displayModeDesc) );
+		*count = conn->numModes;
+	}
+	pthread_mutex_unlock( &drm->lock );
+	return err;
+}
+
+static displayErr drmCurrentMode( displayBackend *backend, displayID display, displayModeDesc *mode, long *modeIndex )
+{
+	drmBackend *drm = backend->ctx;
+	displayModeDesc preferred;
+	drmConnector *conn;
+
+	pthread_mutex_lock( &drm->lock );
+	conn = drmFind( drm, display );
+	if ( conn == NULL )
+	{
+		pthread_mutex_unlock( &drm->lock );
+		return kDisplayErrIllegalArg;
+	}
+	if ( conn->numModes > 0 )
+	{
+		*mode = conn->modes[0];
+		*modeIndex = 0;
+	}
+	else
+	{
+		// no modes listed: the EDID's preferred mode, or what the kernel falls back to without one
+		memset( mode, 0, sizeof(displayModeDesc) );
+		if ( edidModes( conn->edid, conn->edidSize, &preferred, 1 ) == 1 )
+			*mode = preferred;
+		else
+		{
+			mode->mode.width = 1024;
+			mode->mode.height = 768;
+			mode->mode.bitsPerPixel = 32;
+			mode->mode.refresh = 60;
+		}
+		*modeIndex = -1;
+	}
+	pthread_mutex_unlock( &drm->lock );
+	return kDisplayNoErr;
+}
+
+/*
+The built-in panel if there is one, otherwise the first display.
+*/
+static displayID drmMainDisplay( displayBackend *backend )
+{
+	drmBackend *drm = backend->ctx;
+	displayID main = kNullDisplay;
+	size_t ii;
+
+	pthread_mutex_lock( &drm->lock );
+	for ( ii = 0; ii < drm->numConnectors; ii++ )
+	{
+		const drmConnector *conn = &drm->connectors[ii];
+		const char *type = strchr( conn->name, '-' ) + 1;
+
+		if ( !conn->connected )
+			continue;
+		if ( strncmp( type, "eDP-", 4 ) == 0 || strncmp( type, "LVDS-", 5 ) == 0 || strncmp( type, "DSI-", 4 ) == 0 )
+		{
+			main = conn->display;
+			break;
+		}
+		if ( main == kNullDisplay )
+			main = conn->display;
+	}
+	pthread_mutex_unlock( &drm->lock );
+	return main;
+}
+
+static displayErr drmIdentify( displayBackend *backend, displayID display, displayIdentity *identity )
+{
+	drmBackend *drm = backend->ctx;
+	drmConnector *conn;
+
+	pthread_mutex_lock( &drm->lock );
+	conn = drmFind( drm, display );
+	if ( conn != NULL )
+		*identity = conn->identity;
+	pthread_mutex_unlock( &drm->lock );
+	return conn != NULL ? kDisplayNoErr : kDisplayErrIllegalArg;
+}
+
+static displayErr drmCopyEdid( displayBackend *backend, displayID display, uint8_t **edid, size_t *size )
+{
+	drmBackend *drm = backend->ctx;
+	displayErr err = kDisplayNoErr;
+	drmConnector *conn;
+
+	pthread_mutex_lock( &drm->lock );
+	conn = drmFind( drm, display );
+	if ( conn == NULL )
+		err = kDisplayErrIllegalArg;
+	else if ( conn->edidSize == 0 )
+		err = kDisplayErrNotSupported;
+	else if ( (*edid = malloc( conn->edidSize )) == NULL )
+		err = kDisplayErrNoMemory;
+	else
+	{
+		memcpy( *edid, conn->edid, conn->edidSize );
+		*size = conn->edidSize;
+	}
+	pthread_mutex_unlock( &drm->lock );
+	return err;
+}
+
+static displayID drmMirrorOf( displayBackend *backend, displayID display )
+{
+	// which CRTC drives which connector isn't in sysfs
+	return kNullDisplay;
+}
+
+static displayErr drmBeginConfiguration( displayBackend *backend, displayConfig **config )
+{
+	return kDisplayErrNotSupported;
+}
+
+static displayErr drmConfigureMode( displayBackend *backend, displayConfig *config, displayID display, size_t modeIndex )
+{
+	return kDisplayErrNotSupported;
+}
+
+static displayErr drmConfigureMirror( displayBackend *backend, displayConfig *config, displayID display, displayID master )
+{
+	return kDisplayErrNotSupported;
+}
+
+static displayErr drmCompleteConfiguration( displayBackend *backend, displayConfig *config, int permanently )
+{
+	return kDisplayErrNotSupported;
+}
+
+static displayErr drmCancelConfiguration( displayBackend *backend, displayConfig *config )
+{
+	return kDisplayNoErr;
+}
+
+static void drmQueueEvent( drmBackend *drm, displayID display, uint32_t flags, uint64_t now )
+{
+	displayEvent *pending = realloc( drm->pending, (drm->numPending + 1) * sizeof(displayEvent) );
+
+	if ( pending == NULL )
+		return;
+	drm->pending = pending;
+	drm->pending[drm->numPending].display = display;
+	drm->pending[drm->numPending].flags = flags;
+	drm->pending[drm->numPending].timestamp = now;
+	drm->numPending++;
+}
+
+/*
+Queues an event for every online display that is new, changed or gone
+since the last time, and remembers them for next time.  Call with the
+lock held.
+*/
+static void drmCompare( drmBackend *drm )
+{
+	drmSeen *seen = malloc( (drm->numConnectors ? drm->numConnectors : 1) * sizeof(drmSeen) );
+	uint64_t now = clockNanoseconds();
+	size_t numSeen = 0, ii, jj;
+
+	if ( seen == NULL )
+		return;
+	for ( ii = 0; ii < drm->numConnectors; ii++ )
+	{
+		const drmConnector *conn = &drm->connectors[ii];
+
+		if ( !conn->connected )
+			continue;
+		for ( jj = 0; jj < drm->numSeen; jj++ )
+		{
+			if ( drm->seen[jj].display == conn->display )
+				break;
+		}
+		if ( jj == drm->numSeen )
+			drmQueueEvent( drm, conn->display, DISPLAY_EVENT_ADDED, now );
+		else if ( drm->seen[jj].stamp != conn->stamp )
+			drmQueueEvent( drm, conn->display, DISPLAY_EVENT_CHANGED, now );
+		seen[numSeen].display = conn->display;
+		seen[numSeen++].stamp = conn->stamp;
+	}
+	for ( jj = 0; jj < drm->numSeen; jj++ )
+	{
+		for ( ii = 0; ii < numSeen; ii++ )
+		{
+			if ( seen[ii].display == drm->seen[jj].display )
+				break;
+		}
+		if ( ii == numSeen )
+			drmQueueEvent( drm, drm->seen[jj].display, DISPLAY_EVENT_REMOVED, now );
+	}
+	free( drm->seen );
+	drm->seen = seen;
+	drm->numSeen = numSeen;
+}
+
+static displayErr drmWaitForEvents( displayBackend *backend, long timeoutMs, displayEvent *events, size_t maxEvents, size_t *numEvents )
+{
+	drmBackend *drm = backend->ctx;
+	uint64_t deadline = timeoutMs < 0 ? UINT64_MAX : clockNanoseconds() + (uint64_t)timeoutMs * 1000000u;
+	displayErr err = kDisplayNoErr;
+
+	*numEvents = 0;
+	for ( ;; )
+	{
+		uint64_t now;
+
+		pthread_mutex_lock( &drm->lock );
+		if ( drm->numPending == 0 )
+		{
+			err = drmScan( drm );
+			if ( err == kDisplayNoErr )
+				drmCompare( drm );
+		}
+		if ( drm->numPending > 0 )
+		{
+			size_t count = drm->numPending < maxEvents ? drm->numPending : maxEvents;
+			memcpy( events, drm->pending, count * sizeof(displayEvent) );
+			memmove( drm->pending, drm->pending + count, (drm->numPending - count) * sizeof(displayEvent) );
+			drm->numPending -= count;
+			*numEvents = count;
+		}
+		pthread_mutex_unlock( &drm->lock );
+
+		now = clockNanoseconds();
+		if ( err != kDisplayNoErr || *numEvents > 0 || now >= deadline )
+			return err;
+		if ( deadline - now < (uint64_t)drm->pollInterval * 1000000u )
+			drmSleep( (long)((deadline - now + 999999) / 1000000) );
+		else
+			drmSleep( drm->pollInterval );
+	}
+}
+
+static void drmDestroy( displayBackend *backend )
+{
+	drmBackend *drm = backend->ctx;
+	size_t ii;
+
+	for ( ii = 0; ii < drm->numConnectors; ii++ )
+		drmFreeConnector( &drm->connectors[ii] );
+	free( drm->connectors );
+	free( drm->buf );
+	free( drm->seen );
+	free( drm->pending );
+	pthread_mutex_destroy( &drm->lock );
+	free( drm );
+	free( backend );
+}
+
+displayBackend *backendCreateDRM( const char *options )
+{
+	displayBackend *backend;
+	drmBackend *drm;
+
+	backend = calloc( 1, sizeof(displayBackend) );
+	drm = calloc( 1, sizeof(drmBackend) );
+	if ( backend == NULL || drm == NULL || (drm->buf = malloc( 4096 )) == NULL )
+	{
+		free( backend );
+		free( drm );
+		return NULL;
+	}
+	drm->bufSize = 4096;
+	strcpy( drm->root, DRM_ROOT );
+	backendOptionString( options, "root", drm->root, sizeof(drm->root) );
+	drm->pollInterval = 1000;
+	backendOptionLong( options, "poll", &drm->pollInterval );
+	if ( drm->pollInterval < 1 )
+		drm->pollInterval = 1;
+	pthread_mutex_init( &drm->lock, NULL );
+
+	backend->name = "drm";
+	backend->ctx = drm;
+	backend->getOnlineDisplays = drmGetOnlineDisplays;
+	backend->copyModes = drmCopyModes;
+	backend->currentMode = drmCurrentMode;
+	backend->mainDisplay = drmMainDisplay;
+	backend->identify = drmIdentify;
+	backend->copyEdid = drmCopyEdid;
+	backend->mirrorOf = drmMirrorOf;
+	backend->beginConfiguration = drmBeginConfiguration;
+	backend->configureMode = drmConfigureMode;
+	backend->configureMirror = drmConfigureMirror;
+	backend->completeConfiguration = drmCompleteConfiguration;
+	backend->cancelConfiguration = drmCancelConfiguration;
+	backend->waitForEvents = drmWaitForEvents;
+	backend->destroy = drmDestroy;
+
+	// what is there to start with isn't an event
+	if ( drmScan( drm ) != kDisplayNoErr )
+	{
+		printf( "drm: can't read %s\n", drm->root );
+		drmDestroy( backend );
+		return NULL;
+	}
+	drmCompare( drm );
+	drm->numPending = 0;
+	backend->concurrentQueries = 1;     // the queries take the lock
+	return backend;
+}
+
+#endif
@@ -0,0 +1,1277 @@
+/*
+DisplayBackendReplay.c
+
+A machine's displays taken away in a file: the recorder sits in front
+of another backend and writes down what it answered and how long each
+call took, and the replay backend plays that file back, the same
+answers after the same waits, anywhere.
+
+	SetDisplay -R lab-42.sdrc 1920 1080 32 60
+	SetDisplay -B replay:file=lab-42.sdrc 1920 1080 32 60
+
+The first answer to each question about a display is the one kept
+(what it was before SetDisplay changed anything), and whatever nothing
+asked about (a display matched from the mode cache has no mode list
+asked for) is asked for when the file is written, so a recording has
+everything.  The waits are kept in the order they happened, up to
+REPLAY_MAX_WAITS for each call and display; the replay waits them in
+that order, the last one over again when it runs out.  timing=0 plays
+it back as fast as it goes.  A configuration replays like the
+simulated backend's: the displays change mode and say so with events.
+Recordings can be made and played back in memory as well
+(backendTakeRecording, backendCreateReplayData), which is how a fleet
+corpus holds its machines (SetDisplayFleet.c).
+
+The file is little-endian and mostly unsigned LEB128 varints ("v"
+below):
+
+	u32 magic 'SDRC', v version, v length + backend name,
+	v concurrentQueries, v main display, waits of the display list,
+	v number of displays, then for each:
+		v display, v errors of copyModes, currentMode, identify, copyEdid
+		v vendor, v model, v serial, v reserved, u64 EDID hash
+		v current index + 1, mode, v mirrorOf
+		v number of modes, modes
+		v EDID length, the EDID
+		waits of copyModes, currentMode, identify, mirrorOf, copyEdid
+	waits of begin, configure, complete and cancel configuration
+
+A mode is v width, v height, v bits per pixel, v usable, v ioModeID
+and the refresh: v millihertz * 2 when that is exact, otherwise v 1
+and the double's 8 bytes.  Waits are v count and that many v
+microseconds.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "DisplayBackend.h"
+#include "Clock.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLAY_MAGIC     0x53445243 // 'SDRC'
+#define REPLAY_VERSION   1
+#define REPLAY_MAX_WAITS 16
+
+// the waits kept for each display
+enum { WAIT_LIST, WAIT_CURRENT, WAIT_IDENTIFY, WAIT_MIRROR, WAIT_EDID, DISPLAY_WAITS };
+
+// and for the backend as a whole
+enum { WAIT_DISPLAYS, WAIT_BEGIN, WAIT_CONFIGURE, WAIT_COMMIT, WAIT_CANCEL, BACKEND_WAITS };
+
+typedef struct
+{
+	uint32_t usec[REPLAY_MAX_WAITS];
+	uint32_t count;
+	uint32_t next;              // replay: the one to wait next
+} replayWaits;
+
+typedef struct
+{
+	displayID display;
+	int haveModes, haveCurrent, haveIdentity, haveMirror, haveEdid;
+	displayErr modesErr, currentErr, identifyErr, edidErr;
+	displayModeDesc *modes;
+	size_t numModes;
+	displayModeDesc current;
+	long currentIndex;
+	displayIdentity identity;
+	displayID mirrorOf;
+	uint8_t *edid;
+	size_t edidSize;
+	replayWaits waits[DISPLAY_WAITS];
+} replayDisplay;
+
+/*
+What a recorder or a replay knows about the displays.
+*/
+typedef struct
+{
+	pthread_mutex_t lock;
+	char *backendName;
+	int concurrentQueries;
+	int haveMain;
+	displayID mainDisplay;
+	replayDisplay *displays;
+	uint32_t numDisplays;
+	uint32_t maxDisplays;
+	replayWaits waits[BACKEND_WAITS];
+} replayState;
+
+static replayDisplay *findDisplay( replayState *state, displayID display )
+{
+	uint32_t ii;
+
+	for ( ii = 0; ii < state->numDisplays; ii++ )
+	{
+		if ( state->displays[ii].display == display )
+			return &state->displays[ii];
+	}
+	return NULL;
+}
+
+static replayDisplay *addDisplay( replayState *state, displayID display )
+{
+	replayDisplay *disp = findDisplay( state, display );
+
+	if ( disp != NULL )
+		return disp;
+	if ( state->numDisplays == state->maxDisplays )
+	{
+		uint32_t maxDisplays = state->maxDisplays ? state->maxDisplays * 2 : 8;
+		replayDisplay *displays = realloc( state->displays, maxDisplays * sizeof(replayDisplay) );
+		if ( displays == NULL )
+			return NULL;
+		state->displays = displays;
+		state->maxDisplays = maxDisplays;
+	}
+	disp = &state->displays[state->numDisplays++];
+	memset( disp, 0, sizeof(replayDisplay) );
+	disp->display = display;
+	disp->currentIndex = -1;
+	return disp;
+}
+
+static void freeState( replayState *state )
+{
+	uint32_t ii;
+
+	for ( ii = 0; ii < state->numDisplays; ii++ )
+	{
+		free( state->displays[ii].modes );
+		free( state->displays[ii].edid );
+	}
+	free( state->displays );
+	free( state->backendName );
+	pthread_mutex_destroy( &state->lock );
+}
+
+static void addWait( replayWaits *waits, uint64_t started )
+{
+	uint64_t usec = (clockNanoseconds() - started) / 1000;
+
+	if ( waits->count < REPLAY_MAX_WAITS )
+		waits->usec[waits->count++] = usec > UINT32_MAX ? UINT32_MAX : (uint32_t)usec;
+}
+
+/////////////////
+
+typedef struct
+{
+	uint8_t *data;
+	size_t size;
+	size_t max;
+	int failed;
+} replayWriter;
+
+static void putBytes( replayWriter *out, const void *bytes, size_t size )
+{
+	if ( size == 0 )
+		return;
+	if ( out->size + size > out->max )
+	{
+		size_t max = out->max ? out->max * 2 : 4096;
+		uint8_t *data;
+		while ( max < out->size + size )
+			max *= 2;
+		data = realloc( out->data, max );
+		if ( data == NULL )
+		{
+			out->failed = 1;
+			return;
+		}
+		out->data = data;
+		out->max = max;
+	}
+	memcpy( out->data + out->size, bytes, size );
+	out->size += size;
+}
+
+static void putVarint( replayWriter *out, uint64_t value )
+{
+	uint8_t bytes[10];
+	size_t count = 0;
+
+	do {
+		bytes[count] = value & 0x7f;
+		value >>= 7;
+		if ( value != 0 )
+			bytes[count] |= 0x80;
+		count++;
+	} while ( value != 0 );
+	putBytes( out, bytes, count );
+}
+
+static void putFixed( replayWriter *out, uint64_t value, size_t size )
+{
+	uint8_t bytes[8];
+	size_t ii;
+
+	for ( ii = 0; ii < size; ii++ )
+		bytes[ii] = (uint8_t)(value >> (8 * ii));
+	putBytes( out, bytes, size );
+}
+
+static void putMode( replayWriter *out, const displayModeDesc *desc )
+{
+	double refresh = desc->mode.refresh;
+	uint64_t millihertz = refresh > 0 && refresh < 1e9 ? (uint64_t)(refresh * 1000 + 0.5) : 0;
+
+	putVarint( out, desc->mode.width );
+	putVarint( out, desc->mode.height );
+	putVarint( out, desc->mode.bitsPerPixel );
+	putVarint( out, desc->usable ? 1 : 0 );
+	putVarint( out, desc->ioModeID );
+	if ( millihertz / 1000.0 == refresh )
+		putVarint( out, millihertz * 2 );
+	else
+	{
+		uint64_t bits;
+		memcpy( &bits, &refresh, sizeof(bits) );
+		putVarint( out, 1 );
+		putFixed( out, bits, 8 );
+	}
+}
+
+static void putWaits( replayWriter *out, const replayWaits *waits )
+{
+	uint32_t ii;
+
+	putVarint( out, waits->count );
+	for ( ii = 0; ii < waits->count; ii++ )
+		putVarint( out, waits->usec[ii] );
+}
+
+/*
+The state as a recording, into encoded.  Returns 0, or -1 out of
+memory with nothing left in encoded.
+*/
+static int encodeState( const replayState *state, replayWriter *encoded )
+{
+	replayWriter out;
+	uint32_t ii, ww;
+	size_t jj;
+
+	memset( &out, 0, sizeof(out) );
+	putFixed( &out, REPLAY_MAGIC, 4 );
+	putVarint( &out, REPLAY_VERSION );
+	putVarint( &out, strlen( state->backendName ) );
+	putBytes( &out, state->backendName, strlen( state->backendName ) );
+	putVarint( &out, (uint64_t)state->concurrentQueries );
+	putVarint( &out, state->mainDisplay );
+	putWaits( &out, &state->waits[WAIT_DISPLAYS] );
+	putVarint( &out, state->numDisplays );
+	for ( ii = 0; ii < state->numDisplays; ii++ )
+	{
+		const replayDisplay *disp = &state->displays[ii];
+
+		putVarint( &out, disp->display );
+		putVarint( &out, (uint64_t)disp->modesErr );
+		putVarint( &out, (uint64_t)disp->currentErr );
+		putVarint( &out, (uint64_t)disp->identifyErr );
+		putVarint( &out, (uint64_t)disp->edidErr );
+		putVarint( &out, disp->identity.vendor );
+		putVarint( &out, disp->identity.model );
+		putVarint( &out, disp->identity.serial );
+		putVarint( &out, disp->identity.reserved );
+		putFixed( &out, disp->identity.edidHash, 8 );
+		putVarint( &out, (uint64_t)(disp->currentIndex + 1) );
+		putMode( &out, &disp->current );
+		putVarint( &out, disp->mirrorOf );
+		putVarint( &out, disp->numModes );
+		for ( jj = 0; jj < disp->numModes; jj++ )
+			putMode( &out, &disp->modes[jj] );
+		putVarint( &out, disp->edidSize );
+		putBytes( &out, disp->edid, disp->edidSize );
+		for ( ww = 0; ww < DISPLAY_WAITS; ww++ )
+			putWaits( &out, &disp->waits[ww] );
+	}
+	for ( ww = WAIT_BEGIN; ww < BACKEND_WAITS; ww++ )
+		putWaits( &out, &state->waits[ww] );
+	if ( out.failed )
+	{
+		free( out.data );
+		return -1;
+	}
+	*encoded = out;
+	return 0;
+}
+
+static int writeState( const replayState *state, const char *path )
+{
+	replayWriter out;
+	char *tmpPath;
+	int fd, err = 0;
+
+	if ( encodeState( state, &out ) != 0 )
+		return -1;
+
+	// a new file renamed over the old, as the mode cache does
+	tmpPath = malloc( strlen( path ) + 32 );
+	if ( tmpPath == NULL )
+	{
+		free( out.data );
+		return -1;
+	}
+	sprintf( tmpPath, "%s.%ld", path, (long)getpid() );
+	fd = open( tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if ( fd < 0 || write( fd, out.data, out.size ) != (ssize_t)out.size )
+		err = -1;
+	if ( fd >= 0 && close( fd ) != 0 )
+		err = -1;
+	if ( err == 0 && rename( tmpPath, path ) != 0 )
+		err = -1;
+	if ( err != 0 )
+		unlink( tmpPath );
+	free( tmpPath );
+	free( out.data );
+	return err;
+}
+
+/////////////////
+
+typedef struct
+{
+	const uint8_t *p;
+	const uint8_t *end;
+	int bad;
+} replayReader;
+
+static uint64_t getVarint( replayReader *in )
+{
+	uint64_t value = 0;
+	int shift;
+
+	for ( shift = 0; shift < 64; shift += 7 )
+	{
+		uint8_t byte;
+		if ( in->p >= in->end )
+			break;
+		byte = *in->p++;
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		if ( !(byte & 0x80) )
+			return value;
+	}
+	in->bad = 1;
+	return 0;
+}
+
+static uint64_t getFixed( replayReader *in, size_t size )
+{
+	uint64_t value = 0;
+	size_t ii;
+
+	if ( (size_t)(in->end - in->p) < size )
+	{
+		in->bad = 1;
+		return 0;
+	}
+	for ( ii = 0; ii < size; ii++ )
+		value |= (uint64_t)in->p[ii] << (8 * ii);
+	in->p += size;
+	return value;
+}
+
+/*
+A count of things at least minSize bytes each, no more than what is
+left of the file could hold.
+*/
+static size_t getCount( replayReader *in, size_t minSize )
+{
+	uint64_t count = getVarint( in );
+
+	if ( count > (uint64_t)(in->end - in->p) / minSize )
+	{
+		in->bad = 1;
+		return 0;
+	}
+	return (size_t)count;
+}
+
+static void getMode( replayReader *in, displayModeDesc *desc )
+{
+	uint64_t refresh;
+
+	desc->mode.width = (size_t)getVarint( in );
+	desc->mode.height = (size_t)getVarint( in );
+	desc->mode.bitsPerPixel = (size_t)getVarint( in );
+	desc->usable = getVarint( in ) != 0;
+	desc->ioModeID = (uint32_t)getVarint( in );
+	refresh = getVarint( in );
+	if ( refresh & 1 )
+	{
+		uint64_t bits = getFixed( in, 8 );
+		memcpy( &desc->mode.refresh, &bits, sizeof(bits) );
+	}
+	else
+		desc->mode.refresh = (refresh / 2) / 1000.0;
+}
+
+static void getWaits( replayReader *in, replayWaits *waits )
+{
+	size_t count = getCount( in, 1 ), ii;
+
+	memset( waits, 0, sizeof(replayWaits) );
+	for ( ii = 0; ii < count; ii++ )
+	{
+		uint64_t usec = getVarint( in );
+		if ( ii < REPLAY_MAX_WAITS )
+			waits->usec[waits->count++] = usec > UINT32_MAX ? UINT32_MAX : (uint32_t)usec;
+	}
+}
+
+static int readState( replayState *state, const uint8_t *data, size_t size )
+{
+	replayReader in = { data, data + size, 0 };
+	size_t length, numDisplays, ii, jj;
+	uint32_t ww;
+
+	if ( getFixed( &in, 4 ) != REPLAY_MAGIC || getVarint( &in ) != REPLAY_VERSION )
+		return -1;
+	length = getCount( &in, 1 );
+	state->backendName = malloc( length + 1 );
+	if ( in.bad || state->backendName == NULL )
+		return -1;
+	memcpy( state->backendName, in.p, length );
+	state->backendName[length] = '\0';
+	in.p += length;
+	state->concurrentQueries = getVarint( &in ) != 0;
+	state->mainDisplay = (displayID)getVarint( &in );
+	state->haveMain = 1;
+	getWaits( &in, &state->waits[WAIT_DISPLAYS] );
+
+	numDisplays = getCount( &in, 16 );
+	for ( ii = 0; ii < numDisplays && !in.bad; ii++ )
+	{
+		replayDisplay *disp = addDisplay( state, (displayID)getVarint( &in ) );
+
+		if ( disp == NULL )
+			return -1;
+		disp->modesErr = (displayErr)getVarint( &in );
+		disp->currentErr = (displayErr)getVarint( &in );
+		disp->identifyErr = (displayErr)getVarint( &in );
+		disp->edidErr = (displayErr)getVarint( &in );
+		disp->identity.vendor = (uint32_t)getVarint( &in );
+		disp->identity.model = (uint32_t)getVarint( &in );
+		disp->identity.serial = (uint32_t)getVarint( &in );
+		disp->identity.reserved = (uint32_t)getVarint( &in );
+		disp->identity.edidHash = getFixed( &in, 8 );
+		disp->currentIndex = (long)getVarint( &in ) - 1;
+		getMode( &in, &disp->current );
+		disp->mirrorOf = (displayID)getVarint( &in );
+		disp->numModes = getCount( &in, 7 );
+		disp->modes = malloc( (disp->numModes ? disp->numModes : 1) * sizeof(displayModeDesc) );
+		if ( disp->modes == NULL )
+			return -1;
+		for ( jj = 0; jj < disp->numModes; jj++ )
+			getMode( &in, &disp->modes[jj] );
+		if ( disp->currentIndex >= (long)disp->numModes )
+			in.bad = 1;
+		disp->edidSize = getCount( &in, 1 );
+		if ( disp->edidSize != 0 && !in.bad )
+		{
+			disp->edid = malloc( disp->edidSize );
+			if ( disp->edid == NULL )
+				return -1;
+			memcpy( disp->edid, in.p, disp->edidSize );
+			in.p += disp->edidSize;
+		}
+		for ( ww = 0; ww < DISPLAY_WAITS; ww++ )
+			getWaits( &in, &disp->waits[ww] );
+	}
+	for ( ww = WAIT_BEGIN; ww < BACKEND_WAITS; ww++ )
+		getWaits( &in, &state->waits[ww] );
+	return in.bad ? -1 : 0;
+}
+
+/////////////////
+
+/*
+The recorder.  Every call goes to the backend behind it; the first
+answer to each question is kept, and how long each call took.
+*/
+typedef struct
+{
+	displayBackend *inner;
+	char *path;
+	replayState state;
+} recorder;
+
+static displayErr recGetOnlineDisplays( displayBackend *backend, uint32_t maxDisplays, displayID *displays, uint32_t *numDisplays )
+{
+	recorder *rec = backend->ctx;
+	uint64_t started = clockNanoseconds();
+	displayErr err = rec->inner->getOnlineDisplays( rec->inner, maxDisplays, displays, numDisplays );
+	uint32_t ii;
+
+	pthread_mutex_lock( &rec->state.lock );
+	addWait( &rec->state.waits[WAIT_DISPLAYS], started );
+	for ( ii = 0; err == kDisplayNoErr && displays != NULL && ii < *numDisplays; ii++ )
+		addDisplay( &rec->state, displays[ii] );
+	pthread_mutex_unlock( &rec->state.lock );
+	return err;
+}
+
+static displayErr recCopyModes( displayBackend *backend, displayID display, displayModeDesc **modes, size_t *count )
+{
+	recorder *rec = backend->ctx;
+	uint64_t started = clockNanoseconds();
+	displayErr err = rec->inner->copyModes( rec->inner, display, modes, count );
+	replayDisplay *disp;
+
+	pthread_mutex_lock( &rec->state.lock );
+	disp = addDisplay( &rec->state, display );
+	if ( disp != NULL )
+	{
+		addWait( &disp->waits[WAIT_LIST], started );
+		if ( !disp->haveModes )
+		{
+			disp->haveModes = 1;
+			disp->modesErr = err;
+			if ( err == kDisplayNoErr && (disp->modes = malloc( (*count ? *count : 1) * sizeof(displayModeDesc) )) != NULL )
+			{
+				memcpy( disp->modes, *modes, *count * sizeof(displayModeDesc) );
+				disp->numModes = *count;
+			}
+		}
+	}
+	pthread_mutex_unlock( &rec->state.lock );
+	return err;
+}
+
+static displayErr recCurrentMode( displayBackend *backend, displayID display, displayModeDesc *mode, long *modeIndex )
+{
+	recorder *rec = backend->ctx;
+	uint64_t started = clockNanoseconds();
+	displayErr err = rec->inner->currentMode( rec->inner, display, mode, modeIndex );
+	replayDisplay *disp;
+
+	pthread_mutex_lock( &rec->state.lock );
+	disp = addDisplay( &rec->state, display );
+	if ( disp != NULL )
+	{
+		addWait( &disp->waits[WAIT_CURRENT], started );
+		if ( !disp->haveCurrent )
+		{
+			disp->haveCurrent = 1;
+			disp->currentErr = err;
+			if ( err == kDisplayNoErr )
+			{
+				disp->current = *mode;
+				disp->currentIndex = *modeIndex;
+			}
+		}
+	}
+	pthread_mutex_unlock( &rec->state.lock );
+	return err;
+}
+
+static displayID recMainDisplay( displayBackend *backend )
+{
+	recorder *rec = backend->ctx;
+	displayID main = rec->inner->mainDisplay( rec->inner );
+
+	pthread_mutex_lock( &rec->state.lock );
+	if ( !rec->state.haveMain )
+	{
+		rec->state.haveMain = 1;
+		rec->state.mainDisplay = main;
+	}
+	pthread_mutex_unlock( &rec->state.lock );
+	return main;
+}
+
+static displayErr recIdentify( displayBackend *backend, displayID display, displayIdentity *identity )
+{
+	recorder *rec = backend->ctx;
+	uint64_t started = clockNanoseconds();
+	displayErr err = rec->inner->identify ? rec->inner->identify( rec->inner, display, identity ) : kDisplayErrNotSupported;
+	replayDisplay *disp;
+
+	pthread_mutex_lock( &rec->state.lock );
+	disp = addDisplay( &rec->state, display );
+	if ( disp != NULL )
+	{
+		addWait( &disp->waits[WAIT_IDENTIFY], started );
+		if ( !disp->haveIdentity )
+		{
+			disp->haveIdentity = 1;
+			disp->identifyErr = err;
+			if ( err == kDisplayNoErr )
+				disp->identity = *identity;
+		}
+	}
+	pthread_mutex_unlock( &rec->state.lock );
+	return err;
+}
+
+static displayID recMirrorOf( displayBackend *backend, displayID display )
+{
+	recorder *rec = backend->ctx;
+	uint64_t started = clockNanoseconds();
+	displayID mirrorOf = rec->inner->mirrorOf( rec->inner, display );
+	replayDisplay *disp;
+
+	pthread_mutex_lock( &rec->state.lock );
+	disp = addDisplay( &rec->state, display );
+	if ( disp != NULL )
+	{
+		addWait( &disp->waits[WAIT_MIRROR], started );
+		if ( !disp->haveMirror )
+		{
+			disp->haveMirror = 1;
+			disp->mirrorOf = mirrorOf;
+		}
+	}
+	pthread_mutex_unlock( &rec->state.lock );
+	return mirrorOf;
+}
+
+static displayErr recCopyEdid( displayBackend *backend, displayID display, uint8_t **edid, size_t *size )
+{
+	recorder *rec = backend->ctx;
+	uint64_t started = clockNanoseconds();
+	displayErr err = rec->inner->copyEdid ? rec->inner->copyEdid( rec->inner, display, edid, size ) : kDisplayErrNotSupported;
+	replayDisplay *disp;
+
+	pthread_mutex_lock( &rec->state.lock );
+	disp = addDisplay( &rec->state, display );
+	if ( disp != NULL )
+	{
+		addWait( &disp->waits[WAIT_EDID], started );
+		if ( !disp->haveEdid )
+		{
+			disp->haveEdid = 1;
+			disp->edidErr = err;
+			if ( err == kDisplayNoErr && *size != 0 && (disp->edid = malloc( *size )) != NULL )
+			{
+				memcpy( disp->edid, *edid, *size );
+				disp->edidSize = *size;
+			}
+		}
+	}
+	pthread_mutex_unlock( &rec->state.lock );
+	return err;
+}
+
+/*
+The configuration calls only have their waits kept; a replay works out
+what they do itself.
+*/
+static displayErr recBeginConfiguration( displayBackend *backend, displayConfig **config )
+{
+	recorder *rec = backend->ctx;
+	uint64_t started = clockNanoseconds();
+	displayErr err = rec->inner->beginConfiguration( rec->inner, config );
+
+	pthread_mutex_lock( &rec->state.lock );
+	addWait( &rec->state.waits[WAIT_BEGIN], started );
+	pthread_mutex_unlock( &rec->state.lock );
+	return err;
+}
+
+static displayErr recConfigureMode( displayBackend *backend, displayConfig *config, displayID display, size_t modeIndex )
+{
+	recorder *rec = backend->ctx;
+	uint64_t started = clockNanoseconds();
+	displayErr err = rec->inner->configureMode( rec->inner, config, display, modeIndex );
+
+	pthread_mutex_lock( &rec->state.lock );
+	addWait( &rec->state.waits[WAIT_CONFIGURE], started );
+	pthread_mutex_unlock( &rec->state.lock );
+	return err;
+}
+
+static displayErr recConfigureMirror( displayBackend *backend, displayConfig *config, displayID display, displayID master )
+{
+	recorder *rec = backend->ctx;
+
+	return rec->inner->configureMirror( rec->inner, config, display, master );
+}
+
+static displayErr recCompleteConfiguration( displayBackend *backend, displayConfig *config, int permanently )
+{
+	recorder *rec = backend->ctx;
+	uint64_t started = clockNanoseconds();
+	displayErr err = rec->inner->completeConfiguration( rec->inner, config, permanently );
+
+	pthread_mutex_lock( &rec->state.lock );
+	addWait( &rec->state.waits[WAIT_COMMIT], started );
+	pthread_mutex_unlock( &rec->state.lock );
+	return err;
+}
+
+static displayErr recCancelConfiguration( displayBackend *backend, displayConfig *config )
+{
+	recorder *rec = backend->ctx;
+	uint64_t started = clockNanoseconds();
+	displayErr err = rec->inner->cancelConfiguration( rec->inner, config );
+
+	pthread_mutex_lock( &rec->state.lock );
+	addWait( &rec->state.waits[WAIT_CANCEL], started );
+	pthread_mutex_unlock( &rec->state.lock );
+	return err;
+}
+
+static displayErr recWaitForEvents( displayBackend *backend, long timeoutMs, displayEvent *events, size_t maxEvents, size_t *numEvents )
+{
+	recorder *rec = backend->ctx;
+
+	if ( rec->inner->waitForEvents == NULL )
+		return kDisplayErrNotSupported;
+	return rec->inner->waitForEvents( rec->inner, timeoutMs, events, maxEvents, numEvents );
+}
+
+/*
+Asks for what nothing asked for, so the recording has all of it.
+*/
+static void recFillIn( recorder *rec )
+{
+	displayBackend *inner = rec->inner;
+	uint32_t ii;
+
+	if ( !rec->state.haveMain )
+		rec->state.mainDisplay = inner->mainDisplay( inner );
+	for ( ii = 0; ii < rec->state.numDisplays; ii++ )
+	{
+		replayDisplay *disp = &rec->state.displays[ii];
+
+		if ( !disp->haveModes )
+		{
+			displayModeDesc *modes = NULL;
+			size_t count = 0;
+			disp->modesErr = inner->copyModes( inner, disp->display, &modes, &count );
+			if ( disp->modesErr == kDisplayNoErr )
+			{
+				disp->modes = modes;
+				disp->numModes = count;
+			}
+		}
+		if ( !disp->haveCurrent )
+			disp->currentErr = inner->currentMode( inner, disp->display, &disp->current, &disp->currentIndex );
+		if ( !disp->haveIdentity )
+			disp->identifyErr = inner->identify ? inner->identify( inner, disp->display, &disp->identity ) : kDisplayErrNotSupported;
+		if ( !disp->haveMirror )
+			disp->mirrorOf = inner->mirrorOf( inner, disp->display );
+		if ( !disp->haveEdid )
+			disp->edidErr = inner->copyEdid ? inner->copyEdid( inner, disp->display, &disp->edid, &disp->edidSize ) : kDisplayErrNotSupported;
+		if ( disp->edidErr != kDisplayNoErr )
+		{
+			disp->edid = NULL;
+			disp->edidSize = 0;
+		}
+	}
+}
+
+static void recDestroy( displayBackend *backend )
+{
+	recorder *rec = backend->ctx;
+
+	if ( rec->path != NULL )
+	{
+		recFillIn( rec );
+		if ( writeState( &rec->state, rec->path ) != 0 )
+			printf( "Cannot write %s\n", rec->path );
+	}
+	backendDestroy( rec->inner );
+	freeState( &rec->state );
+	free( rec->path );
+	free( rec );
+	free( backend );
+}
+
+displayBackend *backendCreateRecorder( displayBackend *inner, const char *path )
+{
+	displayBackend *backend = calloc( 1, sizeof(displayBackend) );
+	recorder *rec = calloc( 1, sizeof(recorder) );
+
+	if ( backend == NULL || rec == NULL || (path != NULL && (rec->path = strdup( path )) == NULL) ||
+			(rec->state.backendName = strdup( inner->name )) == NULL )
+	{
+		if ( rec != NULL )
+			free( rec->path );
+		free( backend );
+		free( rec );
+		return NULL;
+	}
+	pthread_mutex_init( &rec->state.lock, NULL );
+	rec->inner = inner;
+	rec->state.concurrentQueries = inner->concurrentQueries;
+
+	backend->name = inner->name;
+	backend->ctx = rec;
+	backend->concurrentQueries = inner->concurrentQueries;
+	backend->trace = inner->trace;
+	inner->trace = NULL;
+	backend->getOnlineDisplays = recGetOnlineDisplays;
+	backend->copyModes = recCopyModes;
+	backend->currentMode = recCurrentMode;
+	backend->mainDisplay = recMainDisplay;
+	backend->identify = recIdentify;
+	backend->copyEdid = recCopyEdid;
+	backend->mirrorOf = recMirrorOf;
+	backend->beginConfiguration = recBeginConfiguration;
+	backend->configureMode = recConfigureMode;
+	backend->configureMirror = recConfigureMirror;
+	backend->completeConfiguration = recCompleteConfiguration;
+	backend->cancelConfiguration = recCancelConfiguration;
+	backend->waitForEvents = recWaitForEvents;
+	backend->destroy = recDestroy;
+	return backend;
+}
+
+int backendTakeRecording( displayBackend *backend, uint8_t **data, size_t *size )
+{
+	recorder *rec;
+	replayWriter out;
+
+	if ( backend == NULL || backend->destroy != recDestroy )
+		return -1;
+	rec = backend->ctx;
+	recFillIn( rec );
+	if ( encodeState( &rec->state, &out ) != 0 )
+		return -1;
+	*data = out.data;
+	*size = out.size;
+	return 0;
+}
+
+/////////////////
+
+/*
+The replay.  The answers never change but for the current modes and
+mirroring, which a configuration changes.
+*/
+typedef struct
+{
+	replayState state;
+	int timing;                 // timing=0 doesn't wait
+
+	displayEvent *pending;      // from committed configurations
+	size_t numPending;
+	size_t maxPending;
+} replayBackend;
+
+typedef struct
+{
+	displayID display;
+	long modeIndex;             // -1 when only the mirroring changes
+	int mirrorSet;
+	displayID mirrorOf;
+} replayChange;
+
+struct displayConfig
+{
+	replayChange *changes;
+	size_t numChanges;
+	size_t maxChanges;
+};
+
+/*
+Waits the next of the waits, the last one again once they run out.
+*/
+static void replayWait( replayBackend *rp, replayWaits *waits )
+{
+	struct timespec ts;
+	uint32_t next, usec;
+
+	if ( !rp->timing || waits->count == 0 )
+		return;
+	next = __sync_fetch_and_add( &waits->next, 1 );
+	usec = waits->usec[next < waits->count ? next : waits->count - 1];
+	if ( usec == 0 )
+		return;
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (long)(usec % 1000000) * 1000;
+	while ( nanosleep( &ts, &ts ) == -1 && errno == EINTR )
+		;
+}
+
+static displayErr replayGetOnlineDisplays( displayBackend *backend, uint32_t maxDisplays, displayID *displays, uint32_t *numDisplays )
+{
+	replayBackend *rp = backend->ctx;
+	uint32_t ii;
+
+	replayWait( rp, &rp->state.waits[WAIT_DISPLAYS] );
+	if ( displays == NULL )
+	{
+		*numDisplays = rp->state.numDisplays;
+		return kDisplayNoErr;
+	}
+	for ( ii = 0; ii < rp->state.numDisplays && ii < maxDisplays; ii++ )
+		displays[ii] = rp->state.displays[ii].display;
+	*numDisplays = ii;
+	return kDisplayNoErr;
+}
+
+static displayErr replayCopyModes( displayBackend *backend, displayID display, displayModeDesc **modes, size_t *count )
+{
+	replayBackend *rp = backend->ctx;
+	replayDisplay *disp = findDisplay( &rp->state, display );
+
+	if ( disp == NULL )
+		return kDisplayErrIllegalArg;
+	replayWait( rp, &disp->waits[WAIT_LIST] );
+	if ( disp->modesErr != kDisplayNoErr )
+		return disp->modesErr;
+	*modes = malloc( (disp->numModes ? disp->numModes : 1) * sizeof(displayModeDesc) );
+	if ( *modes == NULL )
+		return kDisplayErrNoMemory;
+	memcpy( *modes, disp->modes, disp->numModes * sizeof(displayModeDesc) );
+	*count = disp->numModes;
+	return kDisplayNoErr;
+}
+
+static displayErr replayCurrentMode( displayBackend *backend, displayID display, displayModeDesc *mode, long *modeIndex )
+{
+	replayBackend *rp = backend->ctx;
+	replayDisplay *disp = findDisplay( &rp->state, display );
+
+	if ( disp == NULL )
+		return kDisplayErrIllegalArg;
+	replayWait( rp, &disp->waits[WAIT_CURRENT] );
+	if ( disp->currentErr != kDisplayNoErr )
+		return disp->currentErr;
+	pthread_mutex_lock( &rp->state.lock );
+	*mode = disp->current;
+	*modeIndex = disp->currentIndex;
+	pthread_mutex_unlock( &rp->state.lock );
+	return kDisplayNoErr;
+}
+
+static displayID replayMainDisplay( displayBackend *backend )
+{
+	replayBackend *rp = backend->ctx;
+
+	return rp->state.mainDisplay;
+}
+
+static displayErr replayIdentify( displayBackend *backend, displayID display, displayIdentity *identity )
+{
+	replayBackend *rp = backend->ctx;
+	replayDisplay *disp = findDisplay( &rp->state, display );
+
+	if ( disp == NULL )
+		return kDisplayErrIllegalArg;
+	replayWait( rp, &disp->waits[WAIT_IDENTIFY] );
+	if ( disp->identifyErr == kDisplayNoErr )
+		*identity = disp->identity;
+	return disp->identifyErr;
+}
+
+static displayErr replayCopyEdid( displayBackend *backend, displayID display, uint8_t **edid, size_t *size )
+{
+	replayBackend *rp = backend->ctx;
+	replayDisplay *disp = findDisplay( &rp->state, display );
+
+	if ( disp == NULL )
+		return kDisplayErrIllegalArg;
+	replayWait( rp, &disp->waits[WAIT_EDID] );
+	if ( disp->edidErr != kDisplayNoErr )
+		return disp->edidErr;
+	*edid = malloc( disp->edidSize ? disp->edidSize : 1 );
+	if ( *edid == NULL )
+		return kDisplayErrNoMemory;
+	memcpy( *edid, disp->edid, disp->edidSize );
+	*size = disp->edidSize;
+	return kDisplayNoErr;
+}
+
+static displayID replayMirrorOf( displayBackend *backend, displayID display )
+{
+	replayBackend *rp = backend->ctx;
+	replayDisplay *disp = findDisplay( &rp->state, display );
+	displayID mirrorOf;
+
+	if ( disp == NULL )
+		return kNullDisplay;
+	replayWait( rp, &disp->waits[WAIT_MIRROR] );
+	pthread_mutex_lock( &rp->state.lock );
+	mirrorOf = disp->mirrorOf;
+	pthread_mutex_unlock( &rp->state.lock );
+	return mirrorOf;
+}
+
+static displayErr replayBeginConfiguration( displayBackend *backend, displayConfig **config )
+{
+	replayBackend *rp = backend->ctx;
+
+	replayWait( rp, &rp->state.waits[WAIT_BEGIN] );
+	*config = calloc( 1, sizeof(displayConfig) );
+	return *config ? kDisplayNoErr : kDisplayErrNoMemory;
+}
+
+static replayChange *replayChangeFor( displayConfig *config, displayID display )
+{
+	size_t ii;
+
+	for ( ii = 0; ii < config->numChanges; ii++ )
+	{
+		if ( config->changes[ii].display == display )
+			return &config->changes[ii];
+	}
+	if ( config->numChanges == config->maxChanges )
+	{
+		size_t maxChanges = config->maxChanges ? config->maxChanges * 2 : 8;
+		replayChange *changes = realloc( config->changes, maxChanges * sizeof(replayChange) );
+		if ( changes == NULL )
+			return NULL;
+		config->changes = changes;
+		config->maxChanges = maxChanges;
+	}
+	memset( &config->changes[config->numChanges], 0, sizeof(replayChange) );
+	config->changes[config->numChanges].display = display;
+	config->changes[config->numChanges].modeIndex = -1;
+	return &config->changes[config->numChanges++];
+}
+
+static displayErr replayConfigureMode( displayBackend *backend, displayConfig *config, displayID display, size_t modeIndex )
+{
+	replayBackend *rp = backend->ctx;
+	replayDisplay *disp = findDisplay( &rp->state, display );
+	replayChange *change;
+
+	replayWait( rp, &rp->state.waits[WAIT_CONFIGURE] );
+	if ( disp == NULL || modeIndex >= disp->numModes )
+		return kDisplayErrIllegalArg;
+	change = replayChangeFor( config, display );
+	if ( change == NULL )
+		return kDisplayErrNoMemory;
+	change->modeIndex = (long)modeIndex;
+	return kDisplayNoErr;
+}
+
+static displayErr replayConfigureMirror( displayBackend *backend, displayConfig *config, displayID display, displayID master )
+{
+	replayBackend *rp = backend->ctx;
+	replayChange *change;
+
+	if ( findDisplay( &rp->state, display ) == NULL || (master != kNullDisplay && findDisplay( &rp->state, master ) == NULL) )
+		return kDisplayErrIllegalArg;
+	change = replayChangeFor( config, display );
+	if ( change == NULL )
+		return kDisplayErrNoMemory;
+	change->mirrorSet = 1;
+	change->mirrorOf = master;
+	return kDisplayNoErr;
+}
+
+static void replayQueueEvent( replayBackend *rp, displayID display, uint32_t flags )
+{
+	if ( rp->numPending == rp->maxPending )
+	{
+		size_t maxPending = rp->maxPending ? rp->maxPending * 2 : 16;
+		displayEvent *pending = realloc( rp->pending, maxPending * sizeof(displayEvent) );
+		if ( pending == NULL )
+			return;
+		rp->pending = pending;
+		rp->maxPending = maxPending;
+	}
+	rp->pending[rp->numPending].display = display;
+	rp->pending[rp->numPending].flags = flags;
+	rp->pending[rp->numPending].timestamp = clockNanoseconds();
+	rp->numPending++;
+}
+
+static displayErr replayCompleteConfiguration( displayBackend *backend, displayConfig *config, int permanently )
+{
+	replayBackend *rp = backend->ctx;
+	size_t ii;
+
+	replayWait( rp, &rp->state.waits[WAIT_COMMIT] );
+	pthread_mutex_lock( &rp->state.lock );
+	for ( ii = 0; ii < config->numChanges; ii++ )
+	{
+		replayChange *change = &config->changes[ii];
+		replayDisplay *disp = findDisplay( &rp->state, change->display );
+		if ( change->modeIndex >= 0 )
+		{
+			disp->current = disp->modes[change->modeIndex];
+			disp->currentIndex = change->modeIndex;
+		}
+		if ( change->mirrorSet )
+			disp->mirrorOf = change->mirrorOf;
+		replayQueueEvent( rp, change->display, DISPLAY_EVENT_CHANGED );
+	}
+	pthread_mutex_unlock( &rp->state.lock );
+	free( config->changes );
+	free( config );
+	return kDisplayNoErr;
+}
+
+static displayErr replayCancelConfiguration( displayBackend *backend, displayConfig *config )
+{
+	replayBackend *rp = backend->ctx;
+
+	replayWait( rp, &rp->state.waits[WAIT_CANCEL] );
+	free( config->changes );
+	free( config );
+	return kDisplayNoErr;
+}
+
+/*
+Only the events of configurations committed here: nothing is plugged
+in or out of a recording.
+*/
+static displayErr replayWaitForEvents( displayBackend *backend, long timeoutMs, displayEvent *events, size_t maxEvents, size_t *numEvents )
+{
+	replayBackend *rp = backend->ctx;
+	size_t count;
+
+	pthread_mutex_lock( &rp->state.lock );
+	if ( rp->numPending == 0 )
+	{
+		pthread_mutex_unlock( &rp->state.lock );
+		return kDisplayErrNoMoreEvents;
+	}
+	count = rp->numPending < maxEvents ? rp->numPending : maxEvents;
+	memcpy( events, rp->pending, count * sizeof(displayEvent) );
+	memmove( rp->pending, rp->pending + count, (rp->numPending - count) * sizeof(displayEvent) );
+	rp->numPending -= count;
+	pthread_mutex_unlock( &rp->state.lock );
+	*numEvents = count;
+	return kDisplayNoErr;
+}
+
+static void replayDestroy( displayBackend *backend )
+{
+	replayBackend *rp = backend->ctx;
+
+	freeState( &rp->state );
+	free( rp->pending );
+	free( rp );
+	free( backend );
+}
+
+static int replayLoad( replayState *state, const char *path )
+{
+	FILE *file = fopen( path, "rb" );
+	uint8_t *data = NULL;
+	long size;
+	int err = -1;
+
+	if ( file == NULL )
+		return -1;
+	if ( fseek( file, 0, SEEK_END ) == 0 && (size = ftell( file )) > 0 && fseek( file, 0, SEEK_SET ) == 0 &&
+			(data = malloc( (size_t)size )) != NULL && fread( data, 1, (size_t)size, file ) == (size_t)size )
+		err = readState( state, data, (size_t)size );
+	free( data );
+	fclose( file );
+	return err;
+}
+
+int backendRecordingAnswers( const void *data, size_t size, uint8_t **answers, size_t *answersSize )
+{
+	replayState state;
+	replayWriter out;
+	uint32_t ii, ww;
+	int err;
+
+	memset( &state, 0, sizeof(state) );
+	pthread_mutex_init( &state.lock, NULL );
+	err = readState( &state, data, size );
+	if ( err == 0 )
+	{
+		for ( ww = 0; ww < BACKEND_WAITS; ww++ )
+			state.waits[ww].count = 0;
+		for ( ii = 0; ii < state.numDisplays; ii++ )
+		{
+			for ( ww = 0; ww < DISPLAY_WAITS; ww++ )
+				state.displays[ii].waits[ww].count = 0;
+		}
+		err = encodeState( &state, &out );
+	}
+	freeState( &state );
+	if ( err != 0 )
+		return -1;
+	*answers = out.data;
+	*answersSize = out.size;
+	return 0;
+}
+
+/*
+The backend around a loaded replay, which it takes.
+*/
+static displayBackend *replayBackendFor( replayBackend *rp )
+{
+	displayBackend *backend = calloc( 1, sizeof(displayBackend) );
+
+	if ( backend == NULL )
+	{
+		freeState( &rp->state );
+		free( rp );
+		return NULL;
+	}
+	backend->name = "replay";
+	backend->ctx = rp;
+	backend->concurrentQueries = rp->state.concurrentQueries;
+	backend->getOnlineDisplays = replayGetOnlineDisplays;
+	backend->copyModes = replayCopyModes;
+	backend->currentMode = replayCurrentMode;
+	backend->mainDisplay = replayMainDisplay;
+	backend->identify = replayIdentify;
+	backend->copyEdid = replayCopyEdid;
+	backend->mirrorOf = replayMirrorOf;
+	backend->beginConfiguration = replayBeginConfiguration;
+	backend->configureMode = replayConfigureMode;
+	backend->configureMirror = replayConfigureMirror;
+	backend->completeConfiguration = replayCompleteConfiguration;
+	backend->cancelConfiguration = replayCancelConfiguration;
+	backend->waitForEvents = replayWaitForEvents;
+	backend->destroy = replayDestroy;
+	return backend;
+}
+
+displayBackend *backendCreateReplay( const char *options )
+{
+	replayBackend *rp;
+	char path[1024] = "";
+	long timing = 1;
+
+	backendOptionString( options, "file", path, sizeof(path) );
+	backendOptionLong( options, "timing", &timing );
+	if ( path[0] == '\0' )
+	{
+		printf( "replay: say which recording with file=PATH\n" );
+		return NULL;
+	}
+
+	rp = calloc( 1, sizeof(replayBackend) );
+	if ( rp == NULL )
+		return NULL;
+	pthread_mutex_init( &rp->state.lock, NULL );
+	if ( replayLoad( &rp->state, path ) != 0 )
+	{
+		printf( "replay: %s isn't a recording\n", path );
+		freeState( &rp->state );
+		free( rp );
+		return NULL;
+	}
+	rp->timing = timing != 0;
+	return replayBackendFor( rp );
+}
+
+displayBackend *backendCreateReplayData( const void *data, size_t size, int timing )
+{
+	replayBackend *rp = calloc( 1, sizeof(replayBackend) );
+
+	if ( rp == NULL )
+		return NULL;
+	pthread_mutex_init( &rp->state.lock, NULL );
+	if ( readState( &rp->state, data, size ) != 0 )
+	{
+		freeState( &rp->state );
+		free( rp );
+		return NULL;
+	}
+	rp->timing = timing != 0;
+	return replayBackendFor( rp );
+}
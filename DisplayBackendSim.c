@@ -0,0 +1,631 @@
+/*
+DisplayBackendSim.c
+
+A simulated display backend.  It has no window server behind it, so it
+builds everywhere and gives the same answers every run: the displays,
+their mode lists and their current modes are all generated from the
+backend options, and every call can be made to take a fixed amount of
+time so the matcher and the apply path can be timed off a Mac.
+
+	-B sim:displays=4,modes=500,list=2000,commit=300000
+
+With hotplug=MS it also plays a KVM being switched away and back: every
+MS milliseconds the next display drops to its first mode and sends a
+burst of events about it.  Committing a configuration sends events for
+the displays it changed, the way the window server does.
+
+settle=US has a committed change read back only that long after the
+commit, the way a monitor behind a slow KVM takes a while to come up in
+the new mode, and stuck=N has the Nth display (from 1) take no change at
+all and stay as it was, though the commit succeeds.
+
+With edid=FILE every display has that EDID (see Edid.h); with modes=0
+as well that is a monitor behind a KVM that the window server knows no
+modes for, driven at 640x480.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "DisplayBackend.h"
+#include "Clock.h"
+#include "Edid.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SIM_FIRST_DISPLAY 0x5d000001
+
+static const size_t simResolutions[][2] =
+{
+	{ 640, 480 }, { 800, 600 }, { 1024, 768 }, { 1152, 864 }, { 1280, 720 },
+	{ 1280, 800 }, { 1280, 960 }, { 1280, 1024 }, { 1360, 768 }, { 1366, 768 },
+	{ 1440, 900 }, { 1600, 900 }, { 1600, 1200 }, { 1680, 1050 }, { 1920, 1080 },
+	{ 1920, 1200 }, { 2048, 1152 }, { 2560, 1080 }, { 2560, 1440 }, { 2560, 1600 },
+	{ 3440, 1440 }, { 3840, 2160 },
+};
+static const size_t simDepths[] = { 32, 16, 8 };
+static const double simRefreshRates[] = { 60, 75, 85, 59.94 };
+
+#define SIM_COUNT(a) (sizeof(a) / sizeof((a)[0]))
+#define SIM_STANDARD_MODES (SIM_COUNT(simResolutions) * SIM_COUNT(simDepths) * SIM_COUNT(simRefreshRates))
+
+typedef struct
+{
+	displayIdentity identity;
+	displayModeDesc *modes;
+	size_t numModes;
+	long current;
+	displayID mirrorOf;
+
+	// a committed change that doesn't read back until settleAt, settle=US
+	int settling;
+	long settlingMode;          // -1 when only the mirroring changes
+	int settlingMirrorSet;
+	displayID settlingMirrorOf;
+	uint64_t settleAt;
+} simDisplay;
+
+typedef struct
+{
+	simDisplay *displays;
+	uint32_t numDisplays;
+	uint8_t *edid;              // edid=FILE, NULL without
+	size_t edidSize;
+
+	// latencies, in microseconds
+	long enumLatency;
+	long listLatency;
+	long currentLatency;
+	long beginLatency;
+	long configureLatency;
+	long commitLatency;
+	long settleLatency;         // before a committed change reads back
+	long stuck;                 // the display that ignores changes, from 1, 0 for none
+
+	// hotplug script
+	long hotplugInterval;       // milliseconds, 0 for none
+	long hotplugs;
+	long burst;
+	long burstGap;              // microseconds between the events of a burst
+	uint64_t start;
+	long nextScripted;
+
+	// events from committed configurations, not yet collected
+	displayEvent *pending;
+	size_t numPending;
+	size_t maxPending;
+} simBackend;
+
+typedef struct
+{
+	displayID display;
+	long modeIndex;             // -1 when only the mirroring changes
+	int mirrorSet;
+	displayID mirrorOf;
+} simChange;
+
+struct displayConfig
+{
+	simChange *changes;
+	size_t numChanges;
+	size_t maxChanges;
+};
+
+static void simSleep( long usec )
+{
+	struct timespec ts;
+
+	if ( usec <= 0 )
+		return;
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while ( nanosleep( &ts, &ts ) == -1 && errno == EINTR )
+		;
+}
+
+static uint32_t simRandom( uint32_t *state )
+{
+	// xorshift32, good enough to make mode lists look unsorted
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/*
+What the display reads back as.  The queries can run on several threads
+at once, so this only looks; simSettle makes a settled change stick.
+*/
+static void simShown( const simDisplay *disp, long *current, displayID *mirrorOf )
+{
+	*current = disp->current;
+	*mirrorOf = disp->mirrorOf;
+	if ( !disp->settling || clockNanoseconds() < disp->settleAt )
+		return;
+	if ( disp->settlingMode >= 0 )
+		*current = disp->settlingMode;
+	if ( disp->settlingMirrorSet )
+		*mirrorOf = disp->settlingMirrorOf;
+}
+
+static void simSettle( simDisplay *disp )
+{
+	if ( !disp->settling )
+		return;
+	if ( disp->settlingMode >= 0 )
+		disp->current = disp->settlingMode;
+	if ( disp->settlingMirrorSet )
+		disp->mirrorOf = disp->settlingMirrorOf;
+	disp->settling = 0;
+}
+
+static void simGenerateModes( simDisplay *disp, size_t numModes, uint32_t seed, int shuffle )
+{
+	size_t ii;
+	uint32_t state = seed ? seed : 1;
+
+	disp->modes = calloc( numModes ? numModes : 1, sizeof(displayModeDesc) );
+	disp->numModes = numModes;
+	for ( ii = 0; ii < numModes; ii++ )
+	{
+		displayModeDesc *desc = &disp->modes[ii];
+		size_t combo = ii % SIM_STANDARD_MODES;
+		size_t res = combo / (SIM_COUNT(simDepths) * SIM_COUNT(simRefreshRates));
+		size_t depth = (combo / SIM_COUNT(simRefreshRates)) % SIM_COUNT(simDepths);
+		size_t rate = combo % SIM_COUNT(simRefreshRates);
+
+		if ( ii < SIM_STANDARD_MODES ) {
+			desc->mode.width = simResolutions[res][0];
+			desc->mode.height = simResolutions[res][1];
+		} else {
+			// past the standard list make up resolutions, the way a KVM
+			// forwarding someone else's EDID overrides can
+			desc->mode.width = 640 + (simRandom( &state ) % 3200) / 8 * 8;
+			desc->mode.height = 480 + (simRandom( &state ) % 1800) / 2 * 2;
+		}
+		desc->mode.bitsPerPixel = simDepths[depth];
+		desc->mode.refresh = simRefreshRates[rate];
+		desc->ioModeID = desc->mode.bitsPerPixel >= 16 ? (uint32_t)ii + 1 : 0;
+		desc->usable = desc->ioModeID ? 1 : 0;
+	}
+
+	if ( shuffle ) {
+		for ( ii = numModes; ii > 1; ii-- )
+		{
+			size_t jj = simRandom( &state ) % ii;
+			displayModeDesc tmp = disp->modes[ii - 1];
+			disp->modes[ii - 1] = disp->modes[jj];
+			disp->modes[jj] = tmp;
+		}
+	}
+}
+
+static simDisplay *simFindDisplay( simBackend *sim, displayID display )
+{
+	if ( display < SIM_FIRST_DISPLAY || display - SIM_FIRST_DISPLAY >= sim->numDisplays )
+		return NULL;
+	return &sim->displays[display - SIM_FIRST_DISPLAY];
+}
+
+static displayErr simGetOnlineDisplays( displayBackend *backend, uint32_t maxDisplays, displayID *displays, uint32_t *numDisplays )
+{
+	simBackend *sim = backend->ctx;
+	uint32_t ii;
+
+	simSleep( sim->enumLatency );
+	if ( displays == NULL )
+	{
+		*numDisplays = sim->numDisplays;
+		return kDisplayNoErr;
+	}
+	for ( ii = 0; ii < sim->numDisplays && ii < maxDisplays; ii++ )
+		displays[ii] = SIM_FIRST_DISPLAY + ii;
+	*numDisplays = ii;
+	return kDisplayNoErr;
+}
+
+static displayErr simCopyModes( displayBackend *backend, displayID display, displayModeDesc **modes, size_t *count )
+{
+	simBackend *sim = backend->ctx;
+	simDisplay *disp = simFindDisplay( sim, display );
+
+	if ( disp == NULL )
+		return kDisplayErrIllegalArg;
+	simSleep( sim->listLatency );
+	*modes = malloc( (disp->numModes ? disp->numModes : 1) * sizeof(displayModeDesc) );
+	if ( *modes == NULL )
+		return kDisplayErrNoMemory;
+	memcpy( *modes, disp->modes, disp->numModes * sizeof(displayModeDesc) );
+	*count = disp->numModes;
+	return kDisplayNoErr;
+}
+
+static displayErr simCurrentMode( displayBackend *backend, displayID display, displayModeDesc *mode, long *modeIndex )
+{
+	simBackend *sim = backend->ctx;
+	simDisplay *disp = simFindDisplay( sim, display );
+	displayID mirrorOf;
+	long current;
+
+	if ( disp == NULL )
+		return kDisplayErrIllegalArg;
+	simSleep( sim->currentLatency );
+	simShown( disp, &current, &mirrorOf );
+	if ( current < 0 )
+	{
+		// no mode list: what a Mac drives a monitor it knows nothing about at
+		memset( mode, 0, sizeof(displayModeDesc) );
+		mode->mode.width = 640;
+		mode->mode.height = 480;
+		mode->mode.bitsPerPixel = 32;
+		mode->mode.refresh = 60;
+		*modeIndex = -1;
+		return kDisplayNoErr;
+	}
+	*mode = disp->modes[current];
+	*modeIndex = current;
+	return kDisplayNoErr;
+}
+
+static displayID simMainDisplay( displayBackend *backend )
+{
+	simBackend *sim = backend->ctx;
+
+	return sim->numDisplays ? SIM_FIRST_DISPLAY : kNullDisplay;
+}
+
+static displayErr simIdentify( displayBackend *backend, displayID display, displayIdentity *identity )
+{
+	simBackend *sim = backend->ctx;
+	simDisplay *disp = simFindDisplay( sim, display );
+
+	if ( disp == NULL )
+		return kDisplayErrIllegalArg;
+	*identity = disp->identity;
+	return kDisplayNoErr;
+}
+
+static displayErr simCopyEdid( displayBackend *backend, displayID display, uint8_t **edid, size_t *size )
+{
+	simBackend *sim = backend->ctx;
+
+	if ( simFindDisplay( sim, display ) == NULL )
+		return kDisplayErrIllegalArg;
+	if ( sim->edid == NULL )
+		return kDisplayErrNotSupported;
+	*edid = malloc( sim->edidSize );
+	if ( *edid == NULL )
+		return kDisplayErrNoMemory;
+	memcpy( *edid, sim->edid, sim->edidSize );
+	*size = sim->edidSize;
+	return kDisplayNoErr;
+}
+
+static displayID simMirrorOf( displayBackend *backend, displayID display )
+{
+	simBackend *sim = backend->ctx;
+	simDisplay *disp = simFindDisplay( sim, display );
+	displayID mirrorOf;
+	long current;
+
+	if ( disp == NULL )
+		return kNullDisplay;
+	simShown( disp, &current, &mirrorOf );
+	return mirrorOf;
+}
+
+static displayErr simBeginConfiguration( displayBackend *backend, displayConfig **config )
+{
+	simBackend *sim = backend->ctx;
+
+	simSleep( sim->beginLatency );
+	*config = calloc( 1, sizeof(displayConfig) );
+	return *config ? kDisplayNoErr : kDisplayErrNoMemory;
+}
+
+static simChange *simChangeFor( displayConfig *config, displayID display )
+{
+	size_t ii;
+
+	for ( ii = 0; ii < config->numChanges; ii++ )
+	{
+		if ( config->changes[ii].display == display )
+			return &config->changes[ii];
+	}
+	if ( config->numChanges == config->maxChanges )
+	{
+		size_t maxChanges = config->maxChanges ? config->maxChanges * 2 : 8;
+		simChange *changes = realloc( config->changes, maxChanges * sizeof(simChange) );
+		if ( changes == NULL )
+			return NULL;
+		config->changes = changes;
+		config->maxChanges = maxChanges;
+	}
+	memset( &config->changes[config->numChanges], 0, sizeof(simChange) );
+	config->changes[config->numChanges].display = display;
+	config->changes[config->numChanges].modeIndex = -1;
+	return &config->changes[config->numChanges++];
+}
+
+static displayErr simConfigureMode( displayBackend *backend, displayConfig *config, displayID display, size_t modeIndex )
+{
+	simBackend *sim = backend->ctx;
+	simDisplay *disp = simFindDisplay( sim, display );
+	simChange *change;
+
+	simSleep( sim->configureLatency );
+	if ( disp == NULL || modeIndex >= disp->numModes )
+		return kDisplayErrIllegalArg;
+	change = simChangeFor( config, display );
+	if ( change == NULL )
+		return kDisplayErrNoMemory;
+	change->modeIndex = (long)modeIndex;
+	return kDisplayNoErr;
+}
+
+static displayErr simConfigureMirror( displayBackend *backend, displayConfig *config, displayID display, displayID master )
+{
+	simBackend *sim = backend->ctx;
+	simChange *change;
+
+	if ( simFindDisplay( sim, display ) == NULL || (master != kNullDisplay && simFindDisplay( sim, master ) == NULL) )
+		return kDisplayErrIllegalArg;
+	change = simChangeFor( config, display );
+	if ( change == NULL )
+		return kDisplayErrNoMemory;
+	change->mirrorSet = 1;
+	change->mirrorOf = master;
+	return kDisplayNoErr;
+}
+
+static void simQueueEvent( simBackend *sim, displayID display, uint32_t flags )
+{
+	if ( sim->numPending == sim->maxPending )
+	{
+		size_t maxPending = sim->maxPending ? sim->maxPending * 2 : 16;
+		displayEvent *pending = realloc( sim->pending, maxPending * sizeof(displayEvent) );
+		if ( pending == NULL )
+			return;
+		sim->pending = pending;
+		sim->maxPending = maxPending;
+	}
+	sim->pending[sim->numPending].display = display;
+	sim->pending[sim->numPending].flags = flags;
+	sim->pending[sim->numPending].timestamp = clockNanoseconds();
+	sim->numPending++;
+}
+
+static displayErr simCompleteConfiguration( displayBackend *backend, displayConfig *config, int permanently )
+{
+	simBackend *sim = backend->ctx;
+	size_t ii;
+
+	simSleep( sim->commitLatency );
+	for ( ii = 0; ii < config->numChanges; ii++ )
+	{
+		simChange *change = &config->changes[ii];
+		simDisplay *disp = simFindDisplay( sim, change->display );
+		simSettle( disp );
+		if ( sim->stuck > 0 && disp == &sim->displays[sim->stuck - 1] )
+			continue;   // nothing happens, and nothing says so
+		if ( sim->settleLatency > 0 ) {
+			disp->settling = 1;
+			disp->settlingMode = change->modeIndex;
+			disp->settlingMirrorSet = change->mirrorSet;
+			disp->settlingMirrorOf = change->mirrorOf;
+			disp->settleAt = clockNanoseconds() + (uint64_t)sim->settleLatency * 1000u;
+		} else {
+			if ( change->modeIndex >= 0 )
+				disp->current = change->modeIndex;
+			if ( change->mirrorSet )
+				disp->mirrorOf = change->mirrorOf;
+		}
+		if ( sim->hotplugInterval > 0 )
+			simQueueEvent( sim, change->display, DISPLAY_EVENT_CHANGED );
+	}
+	free( config->changes );
+	free( config );
+	return kDisplayNoErr;
+}
+
+static displayErr simCancelConfiguration( displayBackend *backend, displayConfig *config )
+{
+	free( config->changes );
+	free( config );
+	return kDisplayNoErr;
+}
+
+static uint64_t simScriptedTime( simBackend *sim, long event )
+{
+	long hotplug = event / sim->burst;
+	long burstEvent = event % sim->burst;
+
+	return sim->start + (uint64_t)(hotplug + 1) * sim->hotplugInterval * 1000000u + (uint64_t)burstEvent * sim->burstGap * 1000u;
+}
+
+static displayErr simWaitForEvents( displayBackend *backend, long timeoutMs, displayEvent *events, size_t maxEvents, size_t *numEvents )
+{
+	simBackend *sim = backend->ctx;
+	uint64_t now = clockNanoseconds();
+	uint64_t deadline = timeoutMs < 0 ? UINT64_MAX : now + (uint64_t)timeoutMs * 1000000u;
+	long lastScripted = sim->hotplugInterval > 0 ? sim->hotplugs * sim->burst : 0;
+	size_t count = 0;
+
+	if ( sim->numPending > 0 )
+	{
+		count = sim->numPending < maxEvents ? sim->numPending : maxEvents;
+		memcpy( events, sim->pending, count * sizeof(displayEvent) );
+		memmove( sim->pending, sim->pending + count, (sim->numPending - count) * sizeof(displayEvent) );
+		sim->numPending -= count;
+		*numEvents = count;
+		return kDisplayNoErr;
+	}
+	if ( sim->nextScripted >= lastScripted )
+		return kDisplayErrNoMoreEvents;
+
+	if ( simScriptedTime( sim, sim->nextScripted ) > deadline )
+	{
+		simSleep( (long)((deadline - now) / 1000) );
+		return kDisplayNoErr;
+	}
+	if ( simScriptedTime( sim, sim->nextScripted ) > now )
+		simSleep( (long)((simScriptedTime( sim, sim->nextScripted ) - now) / 1000) );
+
+	// everything that is due by now, so a burst can come in together
+	now = clockNanoseconds();
+	while ( count < maxEvents && sim->nextScripted < lastScripted && simScriptedTime( sim, sim->nextScripted ) <= now )
+	{
+		long hotplug = sim->nextScripted / sim->burst;
+		long burstEvent = sim->nextScripted % sim->burst;
+		simDisplay *disp = &sim->displays[hotplug % sim->numDisplays];
+
+		simSettle( disp );
+		if ( burstEvent == 0 && disp->numModes > 0 )
+			disp->current = 0;  // what the KVM came back with
+		events[count].display = SIM_FIRST_DISPLAY + (displayID)(hotplug % sim->numDisplays);
+		events[count].flags = burstEvent == sim->burst - 1 ? DISPLAY_EVENT_ADDED : DISPLAY_EVENT_CHANGED;
+		events[count].timestamp = simScriptedTime( sim, sim->nextScripted );
+		count++;
+		sim->nextScripted++;
+	}
+	*numEvents = count;
+	return kDisplayNoErr;
+}
+
+static void simDestroy( displayBackend *backend )
+{
+	simBackend *sim = backend->ctx;
+	uint32_t ii;
+
+	for ( ii = 0; ii < sim->numDisplays; ii++ )
+		free( sim->displays[ii].modes );
+	free( sim->displays );
+	free( sim->edid );
+	free( sim->pending );
+	free( sim );
+	free( backend );
+}
+
+static long simInitialMode( simDisplay *disp, const char *current )
+{
+	size_t width = 0, height = 0, bpp = 0;
+	double refresh = -1;
+	size_t ii;
+	int fields;
+
+	if ( disp->numModes == 0 )
+		return -1;
+	fields = current[0] ? sscanf( current, "%zux%zux%zux%lf", &width, &height, &bpp, &refresh ) : 0;
+	if ( fields < 2 )
+		return 0;
+	for ( ii = 0; ii < disp->numModes; ii++ )
+	{
+		const displayMode *mode = &disp->modes[ii].mode;
+		if ( mode->width == width && mode->height == height && (fields < 3 || mode->bitsPerPixel == bpp) &&
+				(fields < 4 || mode->refresh == refresh) )
+			return (long)ii;
+	}
+	return 0;
+}
+
+displayBackend *backendCreateSim( const char *options )
+{
+	displayBackend *backend;
+	simBackend *sim;
+	long numDisplays = 1;
+	long numModes = SIM_STANDARD_MODES;
+	long seed = 1;
+	long shuffle = 0;
+	char current[32] = "";
+	char edidPath[1024] = "";
+	uint32_t ii;
+
+	backendOptionLong( options, "displays", &numDisplays );
+	backendOptionLong( options, "modes", &numModes );
+	backendOptionLong( options, "seed", &seed );
+	backendOptionLong( options, "shuffle", &shuffle );
+	backendOptionString( options, "current", current, sizeof(current) );
+	backendOptionString( options, "edid", edidPath, sizeof(edidPath) );
+	if ( numDisplays < 0 || numModes < 0 )
+	{
+		printf( "sim: displays and modes must not be negative\n" );
+		return NULL;
+	}
+
+	backend = calloc( 1, sizeof(displayBackend) );
+	sim = calloc( 1, sizeof(simBackend) );
+	if ( backend == NULL || sim == NULL )
+	{
+		free( backend );
+		free( sim );
+		return NULL;
+	}
+	if ( edidPath[0] && edidLoad( edidPath, &sim->edid, &sim->edidSize ) != 0 )
+	{
+		printf( "sim: no EDID in %s\n", edidPath );
+		free( backend );
+		free( sim );
+		return NULL;
+	}
+	backendOptionLong( options, "enum", &sim->enumLatency );
+	backendOptionLong( options, "list", &sim->listLatency );
+	backendOptionLong( options, "cur", &sim->currentLatency );
+	backendOptionLong( options, "begin", &sim->beginLatency );
+	backendOptionLong( options, "configure", &sim->configureLatency );
+	backendOptionLong( options, "commit", &sim->commitLatency );
+	backendOptionLong( options, "settle", &sim->settleLatency );
+	backendOptionLong( options, "stuck", &sim->stuck );
+	if ( sim->stuck > numDisplays )
+		sim->stuck = 0;
+	sim->hotplugs = 1;
+	sim->burst = 3;
+	sim->burstGap = 20000;
+	backendOptionLong( options, "hotplug", &sim->hotplugInterval );
+	backendOptionLong( options, "hotplugs", &sim->hotplugs );
+	backendOptionLong( options, "burst", &sim->burst );
+	backendOptionLong( options, "burstgap", &sim->burstGap );
+	if ( sim->burst < 1 )
+		sim->burst = 1;
+	if ( numDisplays == 0 )
+		sim->hotplugInterval = 0;
+	sim->start = clockNanoseconds();
+
+	sim->numDisplays = (uint32_t)numDisplays;
+	sim->displays = calloc( numDisplays ? numDisplays : 1, sizeof(simDisplay) );
+	for ( ii = 0; ii < sim->numDisplays; ii++ )
+	{
+		simGenerateModes( &sim->displays[ii], (size_t)numModes, (uint32_t)seed + ii, (int)shuffle );
+		sim->displays[ii].current = simInitialMode( &sim->displays[ii], current );
+		sim->displays[ii].mirrorOf = kNullDisplay;
+		// the model number stands for the generated mode list, so a
+		// differently generated display is a different monitor
+		sim->displays[ii].identity.vendor = 0x5d;
+		sim->displays[ii].identity.model = (uint32_t)(numModes * 2654435761u) ^ (uint32_t)(seed << 16) ^ (uint32_t)shuffle;
+		sim->displays[ii].identity.serial = ii + 1;
+	}
+
+	backend->name = "sim";
+	backend->ctx = sim;
+	backend->concurrentQueries = 1;     // the queries only read
+	backend->getOnlineDisplays = simGetOnlineDisplays;
+	backend->copyModes = simCopyModes;
+	backend->currentMode = simCurrentMode;
+	backend->mainDisplay = simMainDisplay;
+	backend->identify = simIdentify;
+	backend->copyEdid = simCopyEdid;
+	backend->mirrorOf = simMirrorOf;
+	backend->beginConfiguration = simBeginConfiguration;
+	backend->configureMode = simConfigureMode;
+	backend->configureMirror = simConfigureMirror;
+	backend->completeConfiguration = simCompleteConfiguration;
+	backend->cancelConfiguration = simCancelConfiguration;
+	backend->waitForEvents = simWaitForEvents;
+	backend->destroy = simDestroy;
+	return backend;
+}
@@ -0,0 +1,918 @@
+/*
+DisplayBackendXRandR.c
+
+The X11 backend: the outputs of an X server with RandR 1.2 or later,
+which unlike sysfs (DisplayBackendDRM.c) can be set.
+
+	-B xrandr
+	-B xrandr:display=:99
+
+Build with -DHAVE_XRANDR and link with -lXrandr -lX11; without
+HAVE_XRANDR this is left out.
+
+Every X request that has a reply is a round trip to the server, so the
+displays are listed from one fetch of the screen resources and what
+each output and CRTC is, and every query after that is answered from
+it.  The resources are fetched with XRRGetScreenResourcesCurrent,
+which returns what the server knows without probing the outputs (that
+can take the server hundreds of milliseconds); only when that knows
+no modes at all, as before anything has probed, are they fetched the
+slow way.  A configuration is collected and applied when it is
+completed, all of it inside one server grab: the CRTCs that must be
+turned off first, the screen size once, then the CRTCs that change,
+so nothing else sees it half done and nothing is set twice.
+
+A display is an output; its mode list is the output's modes, less the
+interlaced ones.  An output mirrors the first output whose CRTC has
+the same position and size.  Configurations don't outlive the X
+server, permanently is ignored.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifdef HAVE_XRANDR
+
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrandr.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DisplayBackend.h"
+#include "Clock.h"
+#include "Edid.h"
+
+#define XR_MAX_EVENTS 64
+
+typedef struct
+{
+	RROutput output;
+	RRCrtc crtc;                // None when the output is off
+	RRCrtc *crtcs;              // the CRTCs that can drive it
+	int numCrtcs;
+	displayModeDesc *modes;
+	RRMode *modeIDs;
+	size_t numModes;
+	long current;               // index into modes, -1 if off or in a mode it doesn't list
+	displayID mirrorOf;
+	uint8_t *edid;
+	size_t edidSize;
+	int edidStale;              // the output changed since the EDID was read
+	displayIdentity identity;
+} xrOutput;
+
+typedef struct
+{
+	RRCrtc crtc;
+	RRMode mode;                // None when off
+	int x, y;
+	unsigned int width, height;
+	Rotation rotation;
+	RROutput *outputs;
+	int numOutputs;
+} xrCrtc;
+
+typedef struct
+{
+	Display *dpy;
+	Window root;
+	int eventBase, errorBase;
+	int major, minor;
+	Atom edidAtom;
+	int minWidth, minHeight, maxWidth, maxHeight;
+	int listening;
+
+	// the last fetch, and the connected outputs and the CRTCs as they were then
+	XRRScreenResources *resources;
+	xrOutput *outputs;
+	size_t numOutputs;
+	xrCrtc *crtcs;
+	int numCrtcs;
+	RROutput primary;
+
+	displayEvent events[XR_MAX_EVENTS];
+	size_t numEvents;
+} xrBackend;
+
+typedef struct
+{
+	RROutput output;
+	RRMode mode;                // None when only the mirroring changes
+	int mirrorSet;
+	RROutput mirrorOf;
+} xrChange;
+
+struct displayConfig
+{
+	xrChange *changes;
+	size_t numChanges;
+	size_t maxChanges;
+};
+
+/*
+X errors arrive whenever the server gets round to them, and go to a
+handler for the whole process.  While a configuration is applied they
+are caught here instead of ending SetDisplay.
+*/
+static int xrErrorCode;
+
+static int xrTrapError( Display *dpy, XErrorEvent *error )
+{
+	xrErrorCode = error->error_code;
+	return 0;
+}
+
+static const XRRModeInfo *xrModeInfo( const XRRScreenResources *resources, RRMode mode )
+{
+	int ii;
+
+	for ( ii = 0; ii < resources->nmode; ii++ )
+	{
+		if ( resources->modes[ii].id == mode )
+			return &resources->modes[ii];
+	}
+	return NULL;
+}
+
+static double xrRefresh( const XRRModeInfo *info )
+{
+	double lines = info->vTotal;
+
+	if ( info->modeFlags & RR_DoubleScan )
+		lines *= 2;
+	if ( info->hTotal == 0 || lines == 0 )
+		return 0;
+	// to the hundredth, as the window server on a Mac gives it
+	return (double)(long)(info->dotClock / (info->hTotal * lines) * 100 + 0.5) / 100;
+}
+
+static void xrFreeOutput( xrOutput *out )
+{
+	free( out->crtcs );
+	free( out->modes );
+	free( out->modeIDs );
+	free( out->edid );
+}
+
+static void xrFreeSnapshot( xrBackend *xr )
+{
+	size_t ii;
+	int cc;
+
+	for ( ii = 0; ii < xr->numOutputs; ii++ )
+		xrFreeOutput( &xr->outputs[ii] );
+	free( xr->outputs );
+	for ( cc = 0; cc < xr->numCrtcs; cc++ )
+		free( xr->crtcs[cc].outputs );
+	free( xr->crtcs );
+	if ( xr->resources != NULL )
+		XRRFreeScreenResources( xr->resources );
+	xr->outputs = NULL;
+	xr->numOutputs = 0;
+	xr->crtcs = NULL;
+	xr->numCrtcs = 0;
+	xr->resources = NULL;
+}
+
+static xrOutput *xrFind( xrBackend *xr, displayID display )
+{
+	size_t ii;
+
+	for ( ii = 0; ii < xr->numOutputs; ii++ )
+	{
+		if ( xr->outputs[ii].output == display )
+			return &xr->outputs[ii];
+	}
+	return NULL;
+}
+
+static xrCrtc *xrFindCrtc( xrCrtc *crtcs, int numCrtcs, RRCrtc crtc )
+{
+	int cc;
+
+	for ( cc = 0; cc < numCrtcs; cc++ )
+	{
+		if ( crtcs[cc].crtc == crtc )
+			return &crtcs[cc];
+	}
+	return NULL;
+}
+
+static void xrReadEdid( xrBackend *xr, xrOutput *out )
+{
+	unsigned char *data = NULL;
+	unsigned long numItems = 0, bytesAfter;
+	Atom type;
+	int format;
+
+	if ( xr->edidAtom == None )
+		return;
+	if ( XRRGetOutputProperty( xr->dpy, out->output, xr->edidAtom, 0, 256, False, False, AnyPropertyType,
+			&type, &format, &numItems, &bytesAfter, &data ) == Success && type == XA_INTEGER && format == 8 && numItems > 0 )
+	{
+		out->edid = malloc( numItems );
+		if ( out->edid != NULL )
+		{
+			memcpy( out->edid, data, numItems );
+			out->edidSize = numItems;
+			edidIdentity( out->edid, out->edidSize, &out->identity );
+		}
+	}
+	if ( data != NULL )
+		XFree( data );
+}
+
+/*
+What an output is and can do, from its output info.  The EDID is
+carried over from the last fetch unless the output changed since.
+*/
+static void xrDescribeOutput( xrBackend *xr, const XRRScreenResources *resources, xrOutput *out, const XRROutputInfo *info,
+		xrOutput *before )
+{
+	int ii;
+
+	out->crtc = info->crtc;
+	out->crtcs = malloc( (info->ncrtc ? info->ncrtc : 1) * sizeof(RRCrtc) );
+	if ( out->crtcs != NULL )
+	{
+		memcpy( out->crtcs, info->crtcs, info->ncrtc * sizeof(RRCrtc) );
+		out->numCrtcs = info->ncrtc;
+	}
+	out->modes = malloc( (info->nmode ? info->nmode : 1) * sizeof(displayModeDesc) );
+	out->modeIDs = malloc( (info->nmode ? info->nmode : 1) * sizeof(RRMode) );
+	for ( ii = 0; out->modes != NULL && out->modeIDs != NULL && ii < info->nmode; ii++ )
+	{
+		const XRRModeInfo *mode = xrModeInfo( resources, info->modes[ii] );
+		displayModeDesc *desc = &out->modes[out->numModes];
+
+		if ( mode == NULL || (mode->modeFlags & RR_Interlace) )
+			continue;
+		memset( desc, 0, sizeof(displayModeDesc) );
+		desc->mode.width = mode->width;
+		desc->mode.height = mode->height;
+		desc->mode.bitsPerPixel = 32;
+		desc->mode.refresh = xrRefresh( mode );
+		desc->usable = 1;
+		desc->ioModeID = (uint32_t)mode->id;
+		out->modeIDs[out->numModes++] = mode->id;
+	}
+
+	if ( before != NULL && !before->edidStale )
+	{
+		out->edid = before->edid;
+		out->edidSize = before->edidSize;
+		out->identity = before->identity;
+		before->edid = NULL;
+	}
+	else
+		xrReadEdid( xr, out );
+}
+
+/*
+Fetches the screen resources and the connected outputs and the CRTCs,
+replacing the last fetch.
+*/
+static displayErr xrFetch( xrBackend *xr )
+{
+	XRRScreenResources *resources = NULL;
+	xrOutput *outputs;
+	xrCrtc *crtcs;
+	size_t numOutputs = 0, ii, jj;
+	int oo, cc;
+
+	if ( xr->major > 1 || xr->minor >= 3 )
+		resources = XRRGetScreenResourcesCurrent( xr->dpy, xr->root );
+	if ( resources != NULL && resources->nmode == 0 )
+	{
+		// nothing has probed the outputs yet
+		XRRFreeScreenResources( resources );
+		resources = NULL;
+	}
+	if ( resources == NULL )
+		resources = XRRGetScreenResources( xr->dpy, xr->root );
+	if ( resources == NULL )
+		return kDisplayErrFailure;
+
+	outputs = calloc( resources->noutput ? resources->noutput : 1, sizeof(xrOutput) );
+	crtcs = calloc( resources->ncrtc ? resources->ncrtc : 1, sizeof(xrCrtc) );
+	if ( outputs == NULL || crtcs == NULL )
+	{
+		free( outputs );
+		free( crtcs );
+		XRRFreeScreenResources( resources );
+		return kDisplayErrNoMemory;
+	}
+
+	for ( cc = 0; cc < resources->ncrtc; cc++ )
+	{
+		XRRCrtcInfo *info = XRRGetCrtcInfo( xr->dpy, resources, resources->crtcs[cc] );
+
+		crtcs[cc].crtc = resources->crtcs[cc];
+		if ( info == NULL )
+			continue;
+		crtcs[cc].mode = info->mode;
+		crtcs[cc].x = info->x;
+		crtcs[cc].y = info->y;
+		crtcs[cc].width = info->width;
+		crtcs[cc].height = info->height;
+		crtcs[cc].rotation = info->rotation;
+		crtcs[cc].outputs = malloc( (info->noutput ? info->noutput : 1) * sizeof(RROutput) );
+		if ( crtcs[cc].outputs != NULL )
+		{
+			memcpy( crtcs[cc].outputs, info->outputs, info->noutput * sizeof(RROutput) );
+			crtcs[cc].numOutputs = info->noutput;
+		}
+		XRRFreeCrtcInfo( info );
+	}
+
+	for ( oo = 0; oo < resources->noutput; oo++ )
+	{
+		XRROutputInfo *info = XRRGetOutputInfo( xr->dpy, resources, resources->outputs[oo] );
+		xrOutput *out = &outputs[numOutputs];
+
+		if ( info == NULL )
+			continue;
+		if ( info->connection == RR_Connected )
+		{
+			out->output = resources->outputs[oo];
+			xrDescribeOutput( xr, resources, out, info, xrFind( xr, (displayID)out->output ) );
+			numOutputs++;
+		}
+		XRRFreeOutputInfo( info );
+	}
+	xrFreeSnapshot( xr );
+	xr->resources = resources;
+	xr->outputs = outputs;
+	xr->numOutputs = numOutputs;
+	xr->crtcs = crtcs;
+	xr->numCrtcs = resources->ncrtc;
+	xr->primary = xr->major > 1 || xr->minor >= 3 ? XRRGetOutputPrimary( xr->dpy, xr->root ) : None;
+
+	// where each output is now, and what it mirrors
+	for ( ii = 0; ii < numOutputs; ii++ )
+	{
+		xrOutput *out = &outputs[ii];
+		const xrCrtc *crtc = xrFindCrtc( crtcs, xr->numCrtcs, out->crtc );
+
+		out->current = -1;
+		out->mirrorOf = kNullDisplay;
+		if ( crtc == NULL || crtc->mode == None )
+			continue;
+		for ( jj = 0; jj < out->numModes; jj++ )
+		{
+			if ( out->modeIDs[jj] == crtc->mode )
+				out->current = (long)jj;
+		}
+		for ( jj = 0; jj < ii; jj++ )
+		{
+			const xrCrtc *other = xrFindCrtc( crtcs, xr->numCrtcs, outputs[jj].crtc );
+			if ( other != NULL && other->mode != None && other->x == crtc->x && other->y == crtc->y &&
+					other->width == crtc->width && other->height == crtc->height )
+			{
+				out->mirrorOf = outputs[jj].mirrorOf != kNullDisplay ? outputs[jj].mirrorOf : (displayID)outputs[jj].output;
+				break;
+			}
+		}
+	}
+	return kDisplayNoErr;
+}
+
+static displayErr xrGetOnlineDisplays( displayBackend *backend, uint32_t maxDisplays, displayID *displays, uint32_t *numDisplays )
+{
+	xrBackend *xr = backend->ctx;
+	uint32_t ii;
+
+	if ( displays == NULL || xr->resources == NULL )
+	{
+		displayErr err = xrFetch( xr );
+		if ( err != kDisplayNoErr )
+			return err;
+	}
+	if ( displays == NULL )
+	{
+		*numDisplays = (uint32_t)xr->numOutputs;
+		return kDisplayNoErr;
+	}
+	for ( ii = 0; ii < xr->numOutputs && ii < maxDisplays; ii++ )
+		displays[ii] = (displayID)xr->outputs[ii].output;
+	*numDisplays = ii;
+	return kDisplayNoErr;
+}
+
+static displayErr xrCopyModes( displayBackend *backend, displayID display, displayModeDesc **modes, size_t *count )
+{
+	xrOutput *out = xrFind( backend->ctx, display );
+
+	if ( out == NULL )
+		return kDisplayErrIllegalArg;
+	*modes = malloc( (out->numModes ? out->numModes : 1) * sizeof(displayModeDesc) );
+	if ( *modes == NULL )
+		return kDisplayErrNoMemory;
+	memcpy( *modes, out->modes, out->numModes * sizeof(displayModeDesc) );
+	*count = out->numModes;
+	return kDisplayNoErr;
+}
+
+static displayErr xrCurrentMode( displayBackend *backend, displayID display, displayModeDesc *mode, long *modeIndex )
+{
+	xrBackend *xr = backend->ctx;
+	xrOutput *out = xrFind( xr, display );
+	const xrCrtc *crtc;
+	const XRRModeInfo *info;
+
+	if ( out == NULL )
+		return kDisplayErrIllegalArg;
+	*modeIndex = out->current;
+	if ( out->current >= 0 )
+	{
+		*mode = out->modes[out->current];
+		return kDisplayNoErr;
+	}
+	// off (all zero), or in a mode it doesn't list
+	memset( mode, 0, sizeof(displayModeDesc) );
+	crtc = xrFindCrtc( xr->crtcs, xr->numCrtcs, out->crtc );
+	info = crtc != NULL && crtc->mode != None ? xrModeInfo( xr->resources, crtc->mode ) : NULL;
+	if ( info != NULL )
+	{
+		mode->mode.width = info->width;
+		mode->mode.height = info->height;
+		mode->mode.bitsPerPixel = 32;
+		mode->mode.refresh = xrRefresh( info );
+		mode->ioModeID = (uint32_t)info->id;
+	}
+	return kDisplayNoErr;
+}
+
+static displayID xrMainDisplay( displayBackend *backend )
+{
+	xrBackend *xr = backend->ctx;
+
+	if ( xr->primary != None && xrFind( xr, (displayID)xr->primary ) != NULL )
+		return (displayID)xr->primary;
+	return xr->numOutputs ? (displayID)xr->outputs[0].output : kNullDisplay;
+}
+
+static displayErr xrIdentify( displayBackend *backend, displayID display, displayIdentity *identity )
+{
+	xrOutput *out = xrFind( backend->ctx, display );
+
+	if ( out == NULL )
+		return kDisplayErrIllegalArg;
+	*identity = out->identity;
+	return kDisplayNoErr;
+}
+
+static displayErr xrCopyEdid( displayBackend *backend, displayID display, uint8_t **edid, size_t *size )
+{
+	xrOutput *out = xrFind( backend->ctx, display );
+
+	if ( out == NULL )
+		return kDisplayErrIllegalArg;
+	if ( out->edidSize == 0 )
+		return kDisplayErrNotSupported;
+	*edid = malloc( out->edidSize );
+	if ( *edid == NULL )
+		return kDisplayErrNoMemory;
+	memcpy( *edid, out->edid, out->edidSize );
+	*size = out->edidSize;
+	return kDisplayNoErr;
+}
+
+static displayID xrMirrorOf( displayBackend *backend, displayID display )
+{
+	xrOutput *out = xrFind( backend->ctx, display );
+
+	return out ? out->mirrorOf : kNullDisplay;
+}
+
+static displayErr xrBeginConfiguration( displayBackend *backend, displayConfig **config )
+{
+	*config = calloc( 1, sizeof(displayConfig) );
+	return *config ? kDisplayNoErr : kDisplayErrNoMemory;
+}
+
+static xrChange *xrChangeFor( displayConfig *config, RROutput output )
+{
+	size_t ii;
+
+	for ( ii = 0; ii < config->numChanges; ii++ )
+	{
+		if ( config->changes[ii].output == output )
+			return &config->changes[ii];
+	}
+	if ( config->numChanges == config->maxChanges )
+	{
+		size_t maxChanges = config->maxChanges ? config->maxChanges * 2 : 8;
+		xrChange *changes = realloc( config->changes, maxChanges * sizeof(xrChange) );
+		if ( changes == NULL )
+			return NULL;
+		config->changes = changes;
+		config->maxChanges = maxChanges;
+	}
+	memset( &config->changes[config->numChanges], 0, sizeof(xrChange) );
+	config->changes[config->numChanges].output = output;
+	return &config->changes[config->numChanges++];
+}
+
+static displayErr xrConfigureMode( displayBackend *backend, displayConfig *config, displayID display, size_t modeIndex )
+{
+	xrOutput *out = xrFind( backend->ctx, display );
+	xrChange *change;
+
+	if ( out == NULL || modeIndex >= out->numModes )
+		return kDisplayErrIllegalArg;
+	change = xrChangeFor( config, out->output );
+	if ( change == NULL )
+		return kDisplayErrNoMemory;
+	change->mode = out->modeIDs[modeIndex];
+	return kDisplayNoErr;
+}
+
+static displayErr xrConfigureMirror( displayBackend *backend, displayConfig *config, displayID display, displayID master )
+{
+	xrBackend *xr = backend->ctx;
+	xrChange *change;
+
+	if ( xrFind( xr, display ) == NULL || (master != kNullDisplay && xrFind( xr, master ) == NULL) )
+		return kDisplayErrIllegalArg;
+	change = xrChangeFor( config, (RROutput)display );
+	if ( change == NULL )
+		return kDisplayErrNoMemory;
+	change->mirrorSet = 1;
+	change->mirrorOf = (RROutput)master;
+	return kDisplayNoErr;
+}
+
+static void xrSizeCrtc( xrBackend *xr, xrCrtc *crtc )
+{
+	const XRRModeInfo *info = xrModeInfo( xr->resources, crtc->mode );
+
+	if ( info == NULL )
+		return;
+	if ( crtc->rotation & (RR_Rotate_90 | RR_Rotate_270) )
+	{
+		crtc->width = info->height;
+		crtc->height = info->width;
+	}
+	else
+	{
+		crtc->width = info->width;
+		crtc->height = info->height;
+	}
+}
+
+/*
+Works out the CRTCs as the configuration leaves them, into next (a
+copy of xr->crtcs with the outputs arrays shared), and marks the ones
+that change.
+*/
+static displayErr xrLayout( xrBackend *xr, const displayConfig *config, xrCrtc *next, char *changed )
+{
+	size_t ii;
+	int cc;
+
+	memcpy( next, xr->crtcs, xr->numCrtcs * sizeof(xrCrtc) );
+	memset( changed, 0, xr->numCrtcs );
+
+	// modes first, then where the mirrors go
+	for ( ii = 0; ii < config->numChanges; ii++ )
+	{
+		const xrChange *change = &config->changes[ii];
+		xrOutput *out = xrFind( xr, (displayID)change->output );
+		xrCrtc *crtc;
+
+		if ( out == NULL )
+			return kDisplayErrIllegalArg;
+		if ( change->mode == None )
+			continue;
+		crtc = xrFindCrtc( next, xr->numCrtcs, out->crtc );
+		if ( crtc == NULL )
+		{
+			// the output is off: any CRTC it can use that is off too, to the right of the rest
+			int jj, right = 0;
+			for ( jj = 0; crtc == NULL && jj < out->numCrtcs; jj++ )
+			{
+				xrCrtc *spare = xrFindCrtc( next, xr->numCrtcs, out->crtcs[jj] );
+				if ( spare != NULL && spare->mode == None && !changed[spare - next] )
+					crtc = spare;
+			}
+			if ( crtc == NULL )
+				return kDisplayErrFailure;
+			for ( cc = 0; cc < xr->numCrtcs; cc++ )
+			{
+				if ( next[cc].mode != None && next[cc].x + (int)next[cc].width > right )
+					right = next[cc].x + (int)next[cc].width;
+			}
+			crtc->x = right;
+			crtc->y = 0;
+			crtc->rotation = RR_Rotate_0;
+			crtc->outputs = &out->output;
+			crtc->numOutputs = 1;
+		}
+		if ( crtc->mode != change->mode )
+		{
+			crtc->mode = change->mode;
+			xrSizeCrtc( xr, crtc );
+			changed[crtc - next] = 1;
+		}
+	}
+	for ( ii = 0; ii < config->numChanges; ii++ )
+	{
+		const xrChange *change = &config->changes[ii];
+		xrOutput *out = xrFind( xr, (displayID)change->output );
+		xrCrtc *crtc = xrFindCrtc( next, xr->numCrtcs, out->crtc );
+		int x, y;
+
+		if ( !change->mirrorSet || crtc == NULL || crtc->mode == None )
+			continue;
+		if ( change->mirrorOf != None )
+		{
+			xrOutput *master = xrFind( xr, (displayID)change->mirrorOf );
+			xrCrtc *masterCrtc = xrFindCrtc( next, xr->numCrtcs, master->crtc );
+			if ( masterCrtc == NULL || masterCrtc->mode == None )
+				return kDisplayErrIllegalArg;
+			x = masterCrtc->x;
+			y = masterCrtc->y;
+		}
+		else if ( out->mirrorOf == kNullDisplay )
+			continue;
+		else
+		{
+			// out of the mirror set: to the right of everything else
+			x = 0;
+			y = 0;
+			for ( cc = 0; cc < xr->numCrtcs; cc++ )
+			{
+				if ( &next[cc] != crtc && next[cc].mode != None && next[cc].x + (int)next[cc].width > x )
+					x = next[cc].x + (int)next[cc].width;
+			}
+		}
+		if ( crtc->x != x || crtc->y != y )
+		{
+			crtc->x = x;
+			crtc->y = y;
+			changed[crtc - next] = 1;
+		}
+	}
+	return kDisplayNoErr;
+}
+
+static displayErr xrCompleteConfiguration( displayBackend *backend, displayConfig *config, int permanently )
+{
+	xrBackend *xr = backend->ctx;
+	xrCrtc *next = calloc( xr->numCrtcs ? xr->numCrtcs : 1, sizeof(xrCrtc) );
+	char *changed = calloc( xr->numCrtcs ? xr->numCrtcs : 1, 1 );
+	int (*oldHandler)( Display *, XErrorEvent * );
+	int width = 0, height = 0, screen = DefaultScreen( xr->dpy );
+	unsigned int rootWidth, rootHeight, border, depth;
+	Window root;
+	int x, y;
+	displayErr err = kDisplayNoErr;
+	int cc;
+
+	if ( next == NULL || changed == NULL )
+		err = kDisplayErrNoMemory;
+	else
+		err = xrLayout( xr, config, next, changed );
+	free( config->changes );
+	free( config );
+	if ( err != kDisplayNoErr )
+	{
+		free( next );
+		free( changed );
+		return err;
+	}
+
+	for ( cc = 0; cc < xr->numCrtcs; cc++ )
+	{
+		if ( next[cc].mode == None )
+			continue;
+		if ( next[cc].x + (int)next[cc].width > width )
+			width = next[cc].x + (int)next[cc].width;
+		if ( next[cc].y + (int)next[cc].height > height )
+			height = next[cc].y + (int)next[cc].height;
+	}
+	if ( width < xr->minWidth )
+		width = xr->minWidth;
+	if ( height < xr->minHeight )
+		height = xr->minHeight;
+	if ( (xr->maxWidth && width > xr->maxWidth) || (xr->maxHeight && height > xr->maxHeight) )
+	{
+		free( next );
+		free( changed );
+		return kDisplayErrIllegalArg;
+	}
+
+	XSync( xr->dpy, False );
+	xrErrorCode = Success;
+	oldHandler = XSetErrorHandler( xrTrapError );
+	XGrabServer( xr->dpy );
+
+	// what changes and doesn't fit the new screen goes off first
+	for ( cc = 0; cc < xr->numCrtcs && err == kDisplayNoErr; cc++ )
+	{
+		const xrCrtc *crtc = &xr->crtcs[cc];
+		if ( changed[cc] && crtc->mode != None && (crtc->x + (int)crtc->width > width || crtc->y + (int)crtc->height > height) )
+		{
+			if ( XRRSetCrtcConfig( xr->dpy, xr->resources, crtc->crtc, CurrentTime, 0, 0, None, RR_Rotate_0, NULL, 0 ) != RRSetConfigSuccess )
+				err = kDisplayErrFailure;
+		}
+	}
+	// Xlib's idea of the screen size is only as new as the last event about it
+	if ( err == kDisplayNoErr && XGetGeometry( xr->dpy, xr->root, &root, &x, &y, &rootWidth, &rootHeight, &border, &depth ) &&
+			(width != (int)rootWidth || height != (int)rootHeight) )
+	{
+		// keep the DPI
+		int mmWidth = (int)((double)width * DisplayWidthMM( xr->dpy, screen ) / DisplayWidth( xr->dpy, screen ) + 0.5);
+		int mmHeight = (int)((double)height * DisplayHeightMM( xr->dpy, screen ) / DisplayHeight( xr->dpy, screen ) + 0.5);
+		XRRSetScreenSize( xr->dpy, xr->root, width, height, mmWidth, mmHeight );
+	}
+	for ( cc = 0; cc < xr->numCrtcs && err == kDisplayNoErr; cc++ )
+	{
+		const xrCrtc *crtc = &next[cc];
+		if ( changed[cc] && XRRSetCrtcConfig( xr->dpy, xr->resources, crtc->crtc, CurrentTime, crtc->x, crtc->y, crtc->mode,
+				crtc->rotation, crtc->outputs, crtc->numOutputs ) != RRSetConfigSuccess )
+			err = kDisplayErrFailure;
+	}
+
+	XUngrabServer( xr->dpy );
+	XSync( xr->dpy, False );
+	XSetErrorHandler( oldHandler );
+	if ( err == kDisplayNoErr && xrErrorCode != Success )
+		err = kDisplayErrFailure;
+	free( next );
+	free( changed );
+
+	// what it is now, for whoever asks next
+	xrFetch( xr );
+	return err;
+}
+
+static displayErr xrCancelConfiguration( displayBackend *backend, displayConfig *config )
+{
+	free( config->changes );
+	free( config );
+	return kDisplayNoErr;
+}
+
+static void xrQueueEvent( xrBackend *xr, displayID display, uint32_t flags )
+{
+	size_t ii;
+	xrOutput *out = xrFind( xr, display );
+
+	if ( out != NULL )
+		out->edidStale = 1;
+	for ( ii = 0; ii < xr->numEvents; ii++ )
+	{
+		if ( xr->events[ii].display == display )
+		{
+			xr->events[ii].flags |= flags;
+			return;
+		}
+	}
+	if ( xr->numEvents == XR_MAX_EVENTS )
+		return;
+	xr->events[xr->numEvents].display = display;
+	xr->events[xr->numEvents].flags = flags;
+	xr->events[xr->numEvents].timestamp = clockNanoseconds();
+	xr->numEvents++;
+}
+
+static void xrHandleEvent( xrBackend *xr, XEvent *event )
+{
+	XRRUpdateConfiguration( event );
+	if ( event->type == xr->eventBase + RRNotify )
+	{
+		XRRNotifyEvent *notify = (XRRNotifyEvent *)event;
+
+		if ( notify->subtype == RRNotify_OutputChange )
+		{
+			XRROutputChangeNotifyEvent *change = (XRROutputChangeNotifyEvent *)event;
+			int known = xrFind( xr, (displayID)change->output ) != NULL;
+
+			if ( change->connection == RR_Connected )
+				xrQueueEvent( xr, (displayID)change->output, known ? DISPLAY_EVENT_CHANGED : DISPLAY_EVENT_ADDED );
+			else if ( known )
+				xrQueueEvent( xr, (displayID)change->output, DISPLAY_EVENT_REMOVED );
+		}
+		else if ( notify->subtype == RRNotify_CrtcChange )
+		{
+			XRRCrtcChangeNotifyEvent *change = (XRRCrtcChangeNotifyEvent *)event;
+			const xrCrtc *crtc = xrFindCrtc( xr->crtcs, xr->numCrtcs, change->crtc );
+			int oo;
+
+			for ( oo = 0; crtc != NULL && oo < crtc->numOutputs; oo++ )
+				xrQueueEvent( xr, (displayID)crtc->outputs[oo], DISPLAY_EVENT_CHANGED );
+		}
+	}
+}
+
+static displayErr xrWaitForEvents( displayBackend *backend, long timeoutMs, displayEvent *events, size_t maxEvents, size_t *numEvents )
+{
+	xrBackend *xr = backend->ctx;
+	uint64_t deadline = timeoutMs < 0 ? UINT64_MAX : clockNanoseconds() + (uint64_t)timeoutMs * 1000000u;
+	size_t count;
+
+	if ( !xr->listening )
+	{
+		XRRSelectInput( xr->dpy, xr->root, RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask );
+		XFlush( xr->dpy );
+		xr->listening = 1;
+	}
+	while ( xr->numEvents == 0 )
+	{
+		struct pollfd pfd;
+		uint64_t now;
+
+		while ( XPending( xr->dpy ) )
+		{
+			XEvent event;
+			XNextEvent( xr->dpy, &event );
+			xrHandleEvent( xr, &event );
+		}
+		now = clockNanoseconds();
+		if ( xr->numEvents != 0 || now >= deadline )
+			break;
+		pfd.fd = ConnectionNumber( xr->dpy );
+		pfd.events = POLLIN;
+		poll( &pfd, 1, deadline == UINT64_MAX ? -1 : (int)((deadline - now + 999999) / 1000000) );
+	}
+
+	count = xr->numEvents < maxEvents ? xr->numEvents : maxEvents;
+	memcpy( events, xr->events, count * sizeof(displayEvent) );
+	memmove( xr->events, xr->events + count, (xr->numEvents - count) * sizeof(displayEvent) );
+	xr->numEvents -= count;
+	*numEvents = count;
+	return kDisplayNoErr;
+}
+
+static void xrDestroy( displayBackend *backend )
+{
+	xrBackend *xr = backend->ctx;
+
+	xrFreeSnapshot( xr );
+	XCloseDisplay( xr->dpy );
+	free( xr );
+	free( backend );
+}
+
+displayBackend *backendCreateXRandR( const char *options )
+{
+	displayBackend *backend;
+	xrBackend *xr;
+	char name[256] = "";
+
+	backendOptionString( options, "display", name, sizeof(name) );
+	backend = calloc( 1, sizeof(displayBackend) );
+	xr = calloc( 1, sizeof(xrBackend) );
+	if ( backend == NULL || xr == NULL )
+	{
+		free( backend );
+		free( xr );
+		return NULL;
+	}
+	xr->dpy = XOpenDisplay( name[0] ? name : NULL );
+	if ( xr->dpy == NULL )
+	{
+		printf( "xrandr: can't open display %s\n", name[0] ? name : XDisplayName( NULL ) );
+		free( backend );
+		free( xr );
+		return NULL;
+	}
+	if ( !XRRQueryExtension( xr->dpy, &xr->eventBase, &xr->errorBase ) ||
+			!XRRQueryVersion( xr->dpy, &xr->major, &xr->minor ) || (xr->major == 1 && xr->minor < 2) )
+	{
+		printf( "xrandr: %s doesn't have RandR 1.2\n", DisplayString( xr->dpy ) );
+		XCloseDisplay( xr->dpy );
+		free( backend );
+		free( xr );
+		return NULL;
+	}
+	xr->root = DefaultRootWindow( xr->dpy );
+	xr->edidAtom = XInternAtom( xr->dpy, "EDID", True );
+	XRRGetScreenSizeRange( xr->dpy, xr->root, &xr->minWidth, &xr->minHeight, &xr->maxWidth, &xr->maxHeight );
+
+	backend->name = "xrandr";
+	backend->ctx = xr;
+	backend->getOnlineDisplays = xrGetOnlineDisplays;
+	backend->copyModes = xrCopyModes;
+	backend->currentMode = xrCurrentMode;
+	backend->mainDisplay = xrMainDisplay;
+	backend->identify = xrIdentify;
+	backend->copyEdid = xrCopyEdid;
+	backend->mirrorOf = xrMirrorOf;
+	backend->beginConfiguration = xrBeginConfiguration;
+	backend->configureMode = xrConfigureMode;
+	backend->configureMirror = xrConfigureMirror;
+	backend->completeConfiguration = xrCompleteConfiguration;
+	backend->cancelConfiguration = xrCancelConfiguration;
+	backend->waitForEvents = xrWaitForEvents;
+	backend->destroy = xrDestroy;
+	// concurrentQueries stays 0: one Display connection, and Xlib without XInitThreads
+	return backend;
+}
+
+#endif
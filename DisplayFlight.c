@@ -0,0 +1,263 @@
+/*
+DisplayFlight.c
+
+See DisplayFlight.h.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "DisplayFlight.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define FLIGHT_READ_TRIES 10000     // a writer that died mid-write leaves seq odd for good
+
+struct displayFlight
+{
+	int fd;
+	int writable;
+	flightSlot *slot;
+	int leading;
+};
+
+static uint64_t flightTime( void )
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return (uint64_t)tv.tv_sec * 1000000u + (uint64_t)tv.tv_usec;
+}
+
+displayFlight *flightOpen( const char *path )
+{
+	displayFlight *flight = calloc( 1, sizeof(displayFlight) );
+	struct stat sb;
+
+	if ( flight == NULL )
+		return NULL;
+	flight->writable = 1;
+	// anyone who runs SetDisplay may have to take a turn
+	flight->fd = open( path, O_RDWR | O_CREAT, 0666 );
+	if ( flight->fd < 0 )
+	{
+		flight->writable = 0;
+		flight->fd = open( path, O_RDONLY );
+	}
+	if ( flight->fd < 0 )
+	{
+		free( flight );
+		return NULL;
+	}
+	// zeroes, for the first to lead to make a slot of; the same size whoever does it first
+	if ( fstat( flight->fd, &sb ) != 0 || ((size_t)sb.st_size < sizeof(flightSlot) &&
+			(!flight->writable || ftruncate( flight->fd, sizeof(flightSlot) ) != 0)) )
+	{
+		close( flight->fd );
+		free( flight );
+		return NULL;
+	}
+	flight->slot = mmap( NULL, sizeof(flightSlot), flight->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+			flight->fd, 0 );
+	if ( flight->slot == MAP_FAILED )
+	{
+		close( flight->fd );
+		free( flight );
+		return NULL;
+	}
+	return flight;
+}
+
+void flightClose( displayFlight *flight )
+{
+	if ( flight == NULL )
+		return;
+	if ( flight->leading )
+		flock( flight->fd, LOCK_UN );
+	munmap( flight->slot, sizeof(flightSlot) );
+	close( flight->fd );
+	free( flight );
+}
+
+static uint64_t flightMix( uint64_t hash, const void *data, size_t size )
+{
+	const uint8_t *bytes = data;
+	size_t ii;
+
+	for ( ii = 0; ii < size; ii++ )
+		hash = (hash ^ bytes[ii]) * 1099511628211ull;
+	return hash;
+}
+
+uint64_t flightKey( const char *backendSpec, const char *policyPath, displayMode wanted, int scanType,
+		int mirroringOnOff, int force )
+{
+	uint64_t hash = 14695981039346656037ull;    // FNV-1a
+	uint32_t fields[6];
+
+	fields[0] = (uint32_t)wanted.width;
+	fields[1] = (uint32_t)wanted.height;
+	fields[2] = (uint32_t)wanted.bitsPerPixel;
+	fields[3] = (uint32_t)scanType;
+	fields[4] = (uint32_t)mirroringOnOff;
+	fields[5] = (uint32_t)force;
+	hash = flightMix( hash, fields, sizeof(fields) );
+	hash = flightMix( hash, &wanted.refresh, sizeof(wanted.refresh) );
+	// the NUL keeps "a" "bc" from being "ab" "c"
+	hash = flightMix( hash, backendSpec ? backendSpec : "", backendSpec ? strlen( backendSpec ) + 1 : 1 );
+	hash = flightMix( hash, policyPath ? policyPath : "", policyPath ? strlen( policyPath ) + 1 : 1 );
+	return hash;
+}
+
+/*
+The slot as it is between writes.  Only the lock holder writes, and
+only for a moment, so this doesn't wait long; if it never finishes the
+slot is taken to be empty.
+*/
+static void readSlot( const displayFlight *flight, flightSlot *copy )
+{
+	const volatile flightSlot *slot = flight->slot;
+	uint64_t seq;
+	int tries;
+
+	for ( tries = 0; ; tries++ )
+	{
+		if ( tries == FLIGHT_READ_TRIES )
+		{
+			memset( copy, 0, sizeof(flightSlot) );
+			return;
+		}
+		seq = slot->seq;
+		__sync_synchronize();
+		if ( seq % 2 == 0 )
+		{
+			memcpy( copy, (const void *)slot, sizeof(flightSlot) );
+			__sync_synchronize();
+			if ( slot->seq == seq )
+				break;
+		}
+		sched_yield();
+	}
+	if ( copy->magic != DISPLAYFLIGHT_MAGIC || copy->version != DISPLAYFLIGHT_VERSION )
+		memset( copy, 0, sizeof(flightSlot) );
+}
+
+static void writeSlot( displayFlight *flight, const flightSlot *from )
+{
+	volatile flightSlot *slot = flight->slot;
+	uint64_t seq;
+
+	if ( !flight->writable )
+		return;
+	// a new file, or one of another version, is zeroes to begin with; seq can be
+	// left odd by a writer that died, so start from the next even one
+	seq = slot->magic == DISPLAYFLIGHT_MAGIC && slot->version == DISPLAYFLIGHT_VERSION ? (slot->seq + 1) & ~(uint64_t)1 : 0;
+	slot->seq = seq + 1;
+	__sync_synchronize();
+	memcpy( (void *)&slot->flight, &from->flight, sizeof(flightSlot) - offsetof(flightSlot, flight) );
+	slot->magic = DISPLAYFLIGHT_MAGIC;
+	slot->version = DISPLAYFLIGHT_VERSION;
+	__sync_synchronize();
+	slot->seq = seq + 2;
+}
+
+static void lead( displayFlight *flight, flightSlot *mine )
+{
+	flightSlot was;
+
+	readSlot( flight, &was );
+	flight->leading = 1;
+	mine->flight = was.flight + 1;
+	mine->state = FLIGHT_FLYING;
+	mine->pid = (uint32_t)getpid();
+	mine->started = flightTime();
+	mine->landed = 0;
+	writeSlot( flight, mine );
+}
+
+/*
+A whole run like mine that landed and set every display as planned.
+*/
+static int reusable( const flightSlot *slot, const flightSlot *mine )
+{
+	return slot->state == FLIGHT_LANDED && slot->key == mine->key && !slot->partial && slot->err == kDisplayNoErr &&
+			slot->mismatched == 0 && slot->unreadable == 0;
+}
+
+int flightBegin( displayFlight *flight, flightSlot *mine, int mayReuse, flightSlot *seen )
+{
+	memset( seen, 0, sizeof(flightSlot) );
+	if ( flight == NULL )
+		return FLIGHT_ALONE;
+
+	for ( ;; )
+	{
+		uint64_t waitedFor;
+
+		if ( flock( flight->fd, LOCK_EX | LOCK_NB ) == 0 )
+		{
+			lead( flight, mine );
+			return FLIGHT_LEAD;
+		}
+		if ( errno != EWOULDBLOCK && errno != EINTR )
+			return FLIGHT_ALONE;
+
+		readSlot( flight, seen );
+		if ( !mayReuse || seen->state != FLIGHT_FLYING || seen->key != mine->key || seen->partial || mine->partial )
+		{
+			flightSlot last;
+
+			// something else, or can't tell: our turn is after it
+			waitedFor = seen->flight;
+			while ( flock( flight->fd, LOCK_EX ) != 0 )
+			{
+				if ( errno != EINTR )
+					return FLIGHT_ALONE;
+			}
+			// one just like mine may have gone in between, and then the displays are as I want them
+			readSlot( flight, &last );
+			if ( mayReuse && !mine->partial && last.flight > waitedFor && reusable( &last, mine ) )
+			{
+				flock( flight->fd, LOCK_UN );
+				*seen = last;
+				return FLIGHT_REUSED;
+			}
+			lead( flight, mine );
+			return FLIGHT_LEAD;
+		}
+
+		// the same as mine: all who want it wait together, and see it land
+		waitedFor = seen->flight;
+		while ( flock( flight->fd, LOCK_SH ) != 0 )
+		{
+			if ( errno != EINTR )
+				return FLIGHT_ALONE;
+		}
+		readSlot( flight, seen );
+		flock( flight->fd, LOCK_UN );
+		if ( seen->flight == waitedFor && reusable( seen, mine ) )
+			return FLIGHT_REUSED;
+		// it failed, or died in flight: have a go ourselves
+	}
+}
+
+void flightLand( displayFlight *flight, flightSlot *mine )
+{
+	if ( flight == NULL || !flight->leading )
+		return;
+	mine->state = FLIGHT_LANDED;
+	mine->landed = flightTime();
+	writeSlot( flight, mine );
+	flight->leading = 0;
+	flock( flight->fd, LOCK_UN );
+}
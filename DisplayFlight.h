@@ -0,0 +1,112 @@
+/*
+DisplayFlight.h
+
+One SetDisplay at a time.  At login the LoginWindow job, a management
+agent and a user's script can all run SetDisplay at once, and each
+would list every display and commit a configuration of its own, the
+displays switching modes over and over.  With a flight file (SetDisplay
+-F) they take turns instead: the first to come along leads, and the
+others wait.  One that wants the same thing as the flight it waited on
+(the same mode, match, mirroring, policy and backend) takes that
+flight's result as its own once it lands and doesn't touch the displays
+at all; one that wants something else goes next, and is told whose
+flight it waited for, unless by its turn the last to land was one like
+its own.
+
+The turns are an flock() on the file, which the kernel lets go of when
+a process dies, so a SetDisplay that crashes mid-flight holds no one
+up; whoever was waiting on it leads instead, since its flight never
+landed.  What is in flight, and how the last flight went, is in the
+file itself, mapped shared: a flightSlot, only ever written by the
+process holding the lock, with seq odd while it is.
+
+Who can open the file for writing decides who can lead with their
+result shown to others; a process that can only read it still takes
+its turn.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef DISPLAYFLIGHT_H
+#define DISPLAYFLIGHT_H
+
+#include <stdint.h>
+
+#include "DisplayBackend.h"
+
+#define DISPLAYFLIGHT_MAGIC   0x5344464c        // 'SDFL'
+#define DISPLAYFLIGHT_VERSION 1
+
+#define FLIGHT_IDLE   0
+#define FLIGHT_FLYING 1
+#define FLIGHT_LANDED 2
+
+// flightBegin
+#define FLIGHT_LEAD   0                 // go ahead, and flightLand when done
+#define FLIGHT_REUSED 1                 // the same was just done, see seen
+#define FLIGHT_ALONE  2                 // no flight file to be had, go ahead uncoordinated
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t seq;               // odd while being written
+	uint64_t flight;            // flights begun, this one's number
+
+	uint32_t state;             // FLIGHT_...
+	uint32_t pid;
+	uint64_t key;               // flightKey of what it set out to do
+	uint32_t partial;           // only some displays (a -D correction): not for anyone else to reuse
+	uint32_t width;
+	uint32_t height;
+	uint32_t bitsPerPixel;
+	double refresh;
+	int32_t scanType;
+	int32_t mirroringOnOff;
+	uint64_t started;           // microseconds since 1970
+	uint64_t landed;
+
+	// how it went, from the displayPlanResult
+	uint32_t numDisplays;
+	uint32_t commits;
+	uint32_t configured;
+	uint32_t skipped;
+	uint32_t mismatched;
+	uint32_t unreadable;
+	int32_t err;
+} flightSlot;
+
+typedef struct displayFlight displayFlight;
+
+/*
+Opens (creating it if need be) the flight file at path.  NULL if it
+can't be opened at all.
+*/
+displayFlight *flightOpen( const char *path );
+void flightClose( displayFlight *flight );
+
+/*
+What a run sets out to do, for telling one flight from another.
+*/
+uint64_t flightKey( const char *backendSpec, const char *policyPath, displayMode wanted, int scanType,
+		int mirroringOnOff, int force );
+
+/*
+Waits for this process's turn.  mine has the key, partial and the
+target (width ... mirroringOnOff) filled in.  Returns FLIGHT_LEAD with
+the lock held and mine published as flying; seen is then the flight
+that had to be waited for (state FLIGHT_IDLE if none).  With mayReuse,
+returns FLIGHT_REUSED, holding nothing, when the flight waited for, or
+the last to land while waiting, was the same as mine, whole, and landed
+with no error; seen is that flight.
+*/
+int flightBegin( displayFlight *flight, flightSlot *mine, int mayReuse, flightSlot *seen );
+
+/*
+Publishes mine, its result filled in, as landed and lets the next
+process go.
+*/
+void flightLand( displayFlight *flight, flightSlot *mine );
+
+#endif
@@ -0,0 +1,279 @@
+/*
+DisplayLog.c
+
+See DisplayLog.h.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "DisplayLog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "ModeCatalog.h"
+
+#define LOG_WRITING UINT64_MAX   // a record's seq while it's being written
+
+struct displayLog
+{
+	void *map;
+	size_t mapSize;
+	logHeader *header;
+	logRecord *records;
+	uint32_t numRecords;
+};
+
+uint64_t logTime( void )
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return (uint64_t)tv.tv_sec * 1000000u + (uint64_t)tv.tv_usec;
+}
+
+/*
+A whole new log, written beside path and linked into place, so that
+no one maps a log whose header isn't there yet, and of two runs making
+it at once one simply finds the other's.
+*/
+static int createLog( const char *path, uint32_t numRecords )
+{
+	char tmpPath[1024];
+	logHeader header;
+	int fd, err = 0;
+
+	if ( snprintf( tmpPath, sizeof(tmpPath), "%s.%d", path, (int)getpid() ) >= (int)sizeof(tmpPath) )
+		return -1;
+	fd = open( tmpPath, O_WRONLY | O_CREAT | O_EXCL, 0644 );
+	if ( fd < 0 )
+		return -1;
+	memset( &header, 0, sizeof(header) );
+	header.magic = DISPLAYLOG_MAGIC;
+	header.version = DISPLAYLOG_VERSION;
+	header.recordSize = sizeof(logRecord);
+	header.numRecords = numRecords;
+	header.created = logTime();
+	if ( write( fd, &header, sizeof(header) ) != (ssize_t)sizeof(header) ||
+			ftruncate( fd, (off_t)(sizeof(header) + (size_t)numRecords * sizeof(logRecord)) ) != 0 )
+		err = -1;
+	if ( close( fd ) != 0 )
+		err = -1;
+	if ( err == 0 && link( tmpPath, path ) != 0 && errno != EEXIST )
+		err = -1;
+	unlink( tmpPath );
+	return err;
+}
+
+static displayLog *mapLog( int fd, int writable )
+{
+	displayLog *log;
+	struct stat sb;
+	logHeader *header;
+
+	if ( fstat( fd, &sb ) != 0 || (size_t)sb.st_size < sizeof(logHeader) )
+	{
+		close( fd );
+		return NULL;
+	}
+	log = calloc( 1, sizeof(displayLog) );
+	if ( log == NULL )
+	{
+		close( fd );
+		return NULL;
+	}
+	log->mapSize = (size_t)sb.st_size;
+	log->map = mmap( NULL, log->mapSize, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( log->map == MAP_FAILED )
+	{
+		free( log );
+		return NULL;
+	}
+
+	header = log->map;
+	if ( header->magic != DISPLAYLOG_MAGIC || header->version != DISPLAYLOG_VERSION ||
+			header->recordSize != sizeof(logRecord) || header->numRecords == 0 ||
+			header->numRecords > (log->mapSize - sizeof(logHeader)) / sizeof(logRecord) )
+	{
+		munmap( log->map, log->mapSize );
+		free( log );
+		return NULL;
+	}
+	log->header = header;
+	log->records = (logRecord *)(header + 1);
+	log->numRecords = header->numRecords;
+	return log;
+}
+
+displayLog *logOpen( const char *path, uint32_t numRecords )
+{
+	int fd = open( path, O_RDWR );
+
+	if ( fd < 0 && errno == ENOENT )
+	{
+		if ( createLog( path, numRecords ? numRecords : DISPLAYLOG_RECORDS ) != 0 )
+			return NULL;
+		fd = open( path, O_RDWR );
+	}
+	if ( fd < 0 )
+		return NULL;
+	return mapLog( fd, 1 );
+}
+
+displayLog *logOpenReading( const char *path )
+{
+	int fd = open( path, O_RDONLY );
+
+	if ( fd < 0 )
+		return NULL;
+	return mapLog( fd, 0 );
+}
+
+void logClose( displayLog *log )
+{
+	if ( log == NULL )
+		return;
+	munmap( log->map, log->mapSize );
+	free( log );
+}
+
+static int outcomeOf( const logDisplay *disp, int scanType )
+{
+	if ( disp->width == 0 )
+		return LOG_NONE;
+	if ( scanType == SCAN_HIGHEST )
+		return LOG_HIGHEST;
+	if ( scanType == SCAN_EXACT || (disp->width == disp->wantedWidth && disp->height == disp->wantedHeight &&
+			disp->bitsPerPixel == disp->wantedBitsPerPixel && (disp->wantedRefresh == 0 || disp->refresh == disp->wantedRefresh)) )
+		return LOG_EXACT;
+	return LOG_CLOSEST;
+}
+
+static uint16_t clampCount( unsigned long count )
+{
+	return count > UINT16_MAX ? UINT16_MAX : (uint16_t)count;
+}
+
+void logPlan( logRecord *record, const displayPlan *plan, const displayPlanResult *result )
+{
+	size_t ii;
+
+	record->numLogged = (uint16_t)(plan->count < DISPLAYLOG_DISPLAYS ? plan->count : DISPLAYLOG_DISPLAYS);
+	record->commits = clampCount( result->commits );
+	record->configured = clampCount( result->configured );
+	record->skipped = clampCount( result->skipped );
+	record->settled = clampCount( result->settled );
+	record->mismatched = clampCount( result->mismatched );
+	record->unreadable = clampCount( result->unreadable );
+	record->err = result->err;
+	for ( ii = 0; ii < record->numLogged; ii++ )
+	{
+		const displayPlanEntry *entry = &plan->entries[ii];
+		logDisplay *disp = &record->displays[ii];
+
+		memset( disp, 0, sizeof(logDisplay) );
+		disp->display = entry->display;
+		disp->wantedWidth = record->width;
+		disp->wantedHeight = record->height;
+		disp->wantedBitsPerPixel = record->bitsPerPixel;
+		disp->wantedRefresh = record->refresh;
+		if ( entry->modeIndex != kNoMode )
+		{
+			disp->width = (uint16_t)entry->mode.mode.width;
+			disp->height = (uint16_t)entry->mode.mode.height;
+			disp->bitsPerPixel = (uint8_t)entry->mode.mode.bitsPerPixel;
+			disp->refresh = (float)entry->mode.mode.refresh;
+		}
+		disp->outcome = (uint8_t)outcomeOf( disp, record->scanType );
+		// planEntryChanges, without needing DisplayPlan.c to read a log
+		disp->changed = result->commits > 0 && (entry->changeMode || entry->changeMirror) && entry->err == kDisplayNoErr;
+		disp->verify = (uint8_t)entry->verify;
+		disp->mirror = (uint8_t)entry->mirror;
+		disp->err = entry->err;
+		if ( entry->verify == PLAN_VERIFY_SETTLED || entry->verify == PLAN_VERIFY_MISMATCH )
+			disp->settleMicroseconds = (uint32_t)(entry->settleNanoseconds / 1000u);
+	}
+}
+
+void logWanted( logRecord *record, displayID display, int scanType, displayMode wanted )
+{
+	size_t ii;
+
+	for ( ii = 0; ii < record->numLogged; ii++ )
+	{
+		logDisplay *disp = &record->displays[ii];
+		if ( disp->display != display )
+			continue;
+		disp->wantedWidth = (uint16_t)wanted.width;
+		disp->wantedHeight = (uint16_t)wanted.height;
+		disp->wantedBitsPerPixel = (uint8_t)wanted.bitsPerPixel;
+		disp->wantedRefresh = (float)wanted.refresh;
+		disp->outcome = (uint8_t)outcomeOf( disp, scanType );
+	}
+}
+
+static uint64_t loadSeq( const logRecord *slot )
+{
+	uint64_t seq = *(volatile const uint64_t *)&slot->seq;
+	__sync_synchronize();
+	return seq;
+}
+
+void logAppend( displayLog *log, logRecord *record )
+{
+	logRecord *slot;
+	uint64_t seq, was;
+
+	for ( ;; )
+	{
+		seq = __sync_add_and_fetch( &log->header->next, 1 );
+		slot = &log->records[(seq - 1) % log->numRecords];
+		was = loadSeq( slot );
+		// readers skip it from here until seq is in
+		if ( was != LOG_WRITING && __sync_bool_compare_and_swap( &slot->seq, was, LOG_WRITING ) )
+			break;
+		// a writer a whole lap behind is still at it: leave this one out rather than wait
+	}
+	record->seq = seq;
+	memcpy( &slot->time, &record->time, sizeof(logRecord) - offsetof(logRecord, time) );
+	__sync_synchronize();
+	*(volatile uint64_t *)&slot->seq = seq;
+}
+
+const logHeader *logHeaderOf( const displayLog *log )
+{
+	return log->header;
+}
+
+size_t logRead( const displayLog *log, int (*visit)( void *ctx, const logRecord *record ), void *ctx )
+{
+	uint64_t next = *(volatile const uint64_t *)&log->header->next;
+	uint64_t seq = next > log->numRecords ? next - log->numRecords + 1 : 1;
+	logRecord record;
+	size_t visited = 0;
+
+	for ( ; seq <= next; seq++ )
+	{
+		const logRecord *slot = &log->records[(seq - 1) % log->numRecords];
+		if ( loadSeq( slot ) != seq )
+			continue;
+		memcpy( &record, slot, sizeof(logRecord) );
+		__sync_synchronize();
+		if ( loadSeq( slot ) != seq )
+			continue;
+		record.seq = seq;
+		visited++;
+		if ( visit( ctx, &record ) )
+			break;
+	}
+	return visited;
+}
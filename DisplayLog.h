@@ -0,0 +1,165 @@
+/*
+DisplayLog.h
+
+What SetDisplay did on a machine, run after run, kept where launchd
+can't throw it away: a fixed-size file of fixed-size records, mapped
+shared, that every run appends a record to (SetDisplay -L) and
+SetDisplayLog reads.  When it is full the oldest records are written
+over, so it never grows and never needs rotating.
+
+Appending takes no lock and makes no system call: a writer claims the
+next record with an atomic add on the header's counter and fills it in
+place, so runs that overlap (a login and a management agent) each get
+their own.  A record's seq is marked while it is being written and set
+last, and a reader takes a record only if seq was the one it expected
+before and after copying it, so a half-written or overwritten record
+is skipped rather than read.  A writer that finds its record still
+being written a whole lap of the log ago leaves that one out and takes
+the next rather than wait.  Nothing is synced; the kernel writes the
+pages back, and they survive SetDisplay crashing.
+
+The file is in the byte order of the machine that wrote it.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef DISPLAYLOG_H
+#define DISPLAYLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "DisplayBackend.h"
+#include "DisplayPlan.h"
+
+#define DISPLAYLOG_MAGIC   0x5344474c  // 'SDGL'
+#define DISPLAYLOG_VERSION 1
+#define DISPLAYLOG_RECORDS 2048         // a new file's, 1 MB
+#define DISPLAYLOG_DISPLAYS 12          // displays kept in a record, the rest are only counted
+
+// what was logged
+#define LOG_RUN        0                // SetDisplay run once, at login say
+#define LOG_CORRECTION 1                // SetDisplay -D setting displays that changed
+#define LOG_REUSED     2                // SetDisplay -F run that took the result of one just like it
+#define LOG_KINDS      3
+
+// how the display came by its mode, as SetDisplayFleet counts them
+#define LOG_EXACT     0                 // got the mode asked for
+#define LOG_CLOSEST   1                 // got the closest the display has
+#define LOG_HIGHEST   2                 // -z, or a rule's highest
+#define LOG_NONE      3                 // no mode matched, left alone
+#define LOG_OUTCOMES  4
+
+// where a run's time went, from SetDisplay's side of the session
+#define LOG_PHASE_OPEN     0            // opening the session (backend, cache)
+#define LOG_PHASE_DISPLAYS 1            // the online display list
+#define LOG_PHASE_MATCH    2            // identifying, listing and matching every display
+#define LOG_PHASE_PLAN     3
+#define LOG_PHASE_APPLY    4            // begin, configure, commit
+#define LOG_PHASE_VERIFY   5            // reading the displays back (planVerify)
+#define LOG_PHASE_TOTAL    6
+#define LOG_PHASES         7
+
+typedef struct
+{
+	uint32_t display;
+	uint16_t wantedWidth;       // after the policy
+	uint16_t wantedHeight;
+	float wantedRefresh;
+	uint16_t width;             // what was chosen
+	uint16_t height;
+	float refresh;
+	uint8_t wantedBitsPerPixel;
+	uint8_t bitsPerPixel;
+	uint8_t outcome;            // LOG_EXACT ...
+	uint8_t changed;            // in the commit, rather than already as chosen
+	uint8_t verify;             // PLAN_VERIFY_...
+	uint8_t mirror;             // MIRROR_...
+	uint16_t reserved;
+	int32_t err;                // from configuring it
+	uint32_t settleMicroseconds;        // commit to reading back as chosen (or to the deadline)
+} logDisplay;
+
+typedef struct
+{
+	uint64_t seq;               // 1 for the first record ever written
+	uint64_t time;              // microseconds since 1970
+	uint32_t pid;
+	uint16_t kind;              // LOG_RUN ...
+	uint8_t scanType;
+	uint8_t mirroringOnOff;
+	uint16_t width;             // asked for on the command line
+	uint16_t height;
+	float refresh;
+	uint8_t bitsPerPixel;
+	uint8_t setting;            // 0 when nothing was to be set (-p, -n, -a ...)
+	uint16_t numLogged;         // displays[] in use
+	uint32_t numDisplays;       // displays seen
+	uint32_t phaseMicroseconds[LOG_PHASES];
+	uint16_t commits;
+	uint16_t configured;
+	uint16_t skipped;
+	uint16_t settled;
+	uint16_t mismatched;
+	uint16_t unreadable;
+	int32_t err;                // the apply's, kDisplayNoErr if it went through
+	logDisplay displays[DISPLAYLOG_DISPLAYS];
+} logRecord;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t recordSize;        // sizeof(logRecord)
+	uint32_t numRecords;
+	uint64_t next;              // records ever claimed, the newest is next - 1 (mod numRecords)
+	uint64_t created;           // microseconds since 1970
+	uint8_t reserved[32];
+} logHeader;
+
+typedef struct displayLog displayLog;
+
+/*
+Maps the log at path for appending, creating it with numRecords
+records (0 for DISPLAYLOG_RECORDS) if there is none.  NULL if it
+can't be created, or if path is something other than a log of this
+version, which is left alone.
+*/
+displayLog *logOpen( const char *path, uint32_t numRecords );
+
+/*
+Maps the log at path read-only.
+*/
+displayLog *logOpenReading( const char *path );
+void logClose( displayLog *log );
+
+/*
+The current time for logRecord.time.
+*/
+uint64_t logTime( void );
+
+/*
+Fills in the record's displays from a plan once it has been applied
+(and verified): what each got and how, taking what was asked for to be
+the record's mode and scanType.  logWanted then puts in what a display
+asked for after the policy, where that's different.
+*/
+void logPlan( logRecord *record, const displayPlan *plan, const displayPlanResult *result );
+void logWanted( logRecord *record, displayID display, int scanType, displayMode wanted );
+
+/*
+Claims the next record, sets record->seq to it and copies record in.
+Safe from any number of threads and processes at once.
+*/
+void logAppend( displayLog *log, logRecord *record );
+
+/*
+The header, and the records from the oldest to the newest, each
+copied out and handed to visit, which returns nonzero to stop.  Records
+being written just then are skipped.  Returns how many were visited.
+*/
+const logHeader *logHeaderOf( const displayLog *log );
+size_t logRead( const displayLog *log, int (*visit)( void *ctx, const logRecord *record ), void *ctx );
+
+#endif
@@ -0,0 +1,303 @@
+/*
+DisplayPlan.c
+
+See DisplayPlan.h.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "DisplayPlan.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Clock.h"
+#include "ModeCatalog.h"
+
+void planInit( displayPlan *plan )
+{
+	memset( plan, 0, sizeof(displayPlan) );
+}
+
+void planFree( displayPlan *plan )
+{
+	free( plan->entries );
+	planInit( plan );
+}
+
+static int sameModeDesc( const displayModeDesc *a, const displayModeDesc *b )
+{
+	return a->mode.width == b->mode.width && a->mode.height == b->mode.height &&
+			a->mode.bitsPerPixel == b->mode.bitsPerPixel && a->mode.refresh == b->mode.refresh &&
+			a->ioModeID == b->ioModeID;
+}
+
+static displayPlanEntry *planNext( displayPlan *plan )
+{
+	if ( plan->count == plan->max )
+	{
+		size_t max = plan->max ? plan->max * 2 : 8;
+		displayPlanEntry *entries = realloc( plan->entries, max * sizeof(displayPlanEntry) );
+		if ( entries == NULL )
+			return NULL;
+		plan->entries = entries;
+		plan->max = max;
+	}
+	return &plan->entries[plan->count++];
+}
+
+displayPlanEntry *planAdd( displayPlan *plan, displayID display, long modeIndex, const displayModeDesc *mode,
+		int mirroringOnOff, displayID mainDisplay,
+		const displayModeDesc *current, long currentIndex, displayID currentMirrorOf )
+{
+	displayPlanEntry *entry = planNext( plan );
+
+	if ( entry == NULL )
+		return NULL;
+	memset( entry, 0, sizeof(displayPlanEntry) );
+	entry->display = display;
+	entry->modeIndex = modeIndex;
+	if ( mode != NULL )
+		entry->mode = *mode;
+	entry->mirror = MIRROR_UNCHANGED;
+	entry->mirrorOf = kNullDisplay;
+	if ( mirroringOnOff == MIRROR_OFF ) {
+		entry->mirror = MIRROR_OFF;
+	} else if ( mirroringOnOff == MIRROR_ON ) {
+		// the main display is what the others mirror, it stays as it is
+		if ( display != mainDisplay ) {
+			entry->mirror = MIRROR_ON;
+			entry->mirrorOf = mainDisplay;
+		}
+	}
+
+	entry->changeMode = entry->modeIndex != kNoMode;
+	entry->changeMirror = entry->mirror != MIRROR_UNCHANGED;
+	if ( current != NULL ) {
+		if ( entry->changeMode )
+			entry->changeMode = currentIndex >= 0 ? currentIndex != modeIndex : !sameModeDesc( current, &entry->mode );
+		if ( entry->mirror == MIRROR_OFF )
+			entry->changeMirror = currentMirrorOf != kNullDisplay;
+		else if ( entry->mirror == MIRROR_ON )
+			entry->changeMirror = currentMirrorOf != entry->mirrorOf;
+	}
+	return entry;
+}
+
+displayPlanEntry *planAppend( displayPlan *plan, const displayPlanEntry *entry )
+{
+	displayPlanEntry *copy = planNext( plan );
+
+	if ( copy != NULL )
+		*copy = *entry;
+	return copy;
+}
+
+void planDropLast( displayPlan *plan )
+{
+	if ( plan->count > 0 )
+		plan->count--;
+}
+
+int planEntryChanges( const displayPlanEntry *entry )
+{
+	return entry->changeMode || entry->changeMirror;
+}
+
+void planPrint( const displayPlan *plan )
+{
+	size_t ii;
+
+	printf( "------ Configuration plan ---------\n" );
+	for ( ii = 0; ii < plan->count; ii++ )
+	{
+		const displayPlanEntry *entry = &plan->entries[ii];
+		printf( "Display 0x%x: ", (unsigned int)entry->display );
+		if ( entry->modeIndex == kNoMode )
+			printf( "no matching mode, not changed" );
+		else
+			printf( "%zu %zu %zu %lg (mode %ld)", entry->mode.mode.width, entry->mode.mode.height,
+					entry->mode.mode.bitsPerPixel, entry->mode.mode.refresh, entry->modeIndex );
+		if ( entry->mirror == MIRROR_OFF )
+			printf( ", mirroring off" );
+		else if ( entry->mirror == MIRROR_ON )
+			printf( ", mirroring 0x%x", (unsigned int)entry->mirrorOf );
+		if ( !planEntryChanges( entry ) )
+			printf( ", already set" );
+		printf( "\n" );
+	}
+	printf( "-----------------------------------\n" );
+}
+
+displayErr planApply( displayBackend *backend, displayPlan *plan, int permanently, displayPlanResult *result )
+{
+	displayConfig *configRef;
+	uint64_t start = clockNanoseconds();
+	displayErr err;
+	size_t ii;
+
+	memset( result, 0, sizeof(displayPlanResult) );
+	for ( ii = 0; ii < plan->count; ii++ )
+	{
+		plan->entries[ii].err = kDisplayNoErr;
+		plan->entries[ii].verify = PLAN_VERIFY_NONE;
+		if ( !planEntryChanges( &plan->entries[ii] ) )
+			result->skipped++;
+	}
+	if ( result->skipped == plan->count )
+	{
+		result->applyNanoseconds = clockNanoseconds() - start;
+		return kDisplayNoErr;
+	}
+
+	err = backendBeginConfiguration( backend, &configRef );
+	if ( err != kDisplayNoErr )
+	{
+		result->err = err;
+		result->applyNanoseconds = clockNanoseconds() - start;
+		return err;
+	}
+
+	for ( ii = 0; ii < plan->count; ii++ )
+	{
+		displayPlanEntry *entry = &plan->entries[ii];
+		int touched = 0;
+
+		if ( entry->changeMode ) {
+			entry->err = backendConfigureMode( backend, configRef, entry->display, (size_t)entry->modeIndex );
+			touched = 1;
+		}
+		// a display whose mode can't be set is left out of the transaction, mirroring and all
+		if ( entry->err != kDisplayNoErr ) {
+			if ( result->err == kDisplayNoErr )
+				result->err = entry->err;
+			continue;
+		}
+		if ( entry->changeMirror && entry->mirror == MIRROR_OFF ) {
+			backendConfigureMirror( backend, configRef, entry->display, kNullDisplay );
+			touched = 1;
+		} else if ( entry->changeMirror && entry->mirror == MIRROR_ON ) {
+			backendConfigureMirror( backend, configRef, entry->display, entry->mirrorOf );
+			touched = 1;
+		}
+		if ( touched )
+			result->configured++;
+	}
+
+	err = backendCompleteConfiguration( backend, configRef, permanently );
+	if ( err == kDisplayNoErr ) {
+		result->commits++;
+		result->committedAt = clockNanoseconds();
+	} else if ( result->err == kDisplayNoErr )
+		result->err = err;
+	result->applyNanoseconds = clockNanoseconds() - start;
+	return result->err;
+}
+
+#define VERIFY_FIRST_POLL_US 1000
+#define VERIFY_MAX_POLL_US   20000
+
+static int verifyWanted( const displayPlanEntry *entry )
+{
+	return planEntryChanges( entry ) && entry->err == kDisplayNoErr;
+}
+
+/*
+Reads the display back, and says whether it is as planned.
+*/
+static int verifyEntry( displayBackend *backend, displayPlanEntry *entry )
+{
+	int modeOK = 1, mirrorOK = 1;
+
+	if ( backendCurrentMode( backend, entry->display, &entry->readBack, &entry->readBackIndex ) != kDisplayNoErr )
+	{
+		entry->verify = PLAN_VERIFY_UNREADABLE;
+		return 0;
+	}
+	entry->readBackMirrorOf = backendMirrorOf( backend, entry->display );
+	if ( entry->changeMode )
+		modeOK = entry->readBackIndex >= 0 ? entry->readBackIndex == entry->modeIndex :
+				sameModeDesc( &entry->readBack, &entry->mode );
+	if ( entry->changeMirror )
+		mirrorOK = entry->readBackMirrorOf == (entry->mirror == MIRROR_ON ? entry->mirrorOf : kNullDisplay);
+	entry->verify = modeOK && mirrorOK ? PLAN_VERIFY_SETTLED : PLAN_VERIFY_MISMATCH;
+	return entry->verify == PLAN_VERIFY_SETTLED;
+}
+
+static void verifySleep( long usec )
+{
+	struct timespec ts;
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while ( nanosleep( &ts, &ts ) == -1 && errno == EINTR )
+		;
+}
+
+displayErr planVerify( displayBackend *backend, displayPlan *plan, long timeoutMs, displayPlanResult *result )
+{
+	uint64_t start = clockNanoseconds();
+	uint64_t deadline = result->committedAt + (uint64_t)(timeoutMs > 0 ? timeoutMs : 0) * 1000000u;
+	long pollUs = VERIFY_FIRST_POLL_US;
+	size_t ii, waiting = 0;
+
+	result->settled = result->mismatched = result->unreadable = 0;
+	result->settleMaxNanoseconds = 0;
+	for ( ii = 0; ii < plan->count; ii++ )
+	{
+		plan->entries[ii].verify = PLAN_VERIFY_NONE;
+		plan->entries[ii].settleNanoseconds = 0;
+		if ( result->commits > 0 && verifyWanted( &plan->entries[ii] ) )
+			waiting++;
+	}
+
+	while ( waiting > 0 )
+	{
+		uint64_t now;
+
+		for ( ii = 0; ii < plan->count; ii++ )
+		{
+			displayPlanEntry *entry = &plan->entries[ii];
+			if ( result->commits == 0 || !verifyWanted( entry ) || entry->verify == PLAN_VERIFY_SETTLED ||
+					entry->verify == PLAN_VERIFY_UNREADABLE )
+				continue;
+			if ( verifyEntry( backend, entry ) )
+			{
+				entry->settleNanoseconds = clockNanoseconds() - result->committedAt;
+				result->settled++;
+				if ( entry->settleNanoseconds > result->settleMaxNanoseconds )
+					result->settleMaxNanoseconds = entry->settleNanoseconds;
+				waiting--;
+			}
+			else if ( entry->verify == PLAN_VERIFY_UNREADABLE )
+			{
+				result->unreadable++;
+				waiting--;
+			}
+		}
+		now = clockNanoseconds();
+		if ( waiting == 0 || now >= deadline )
+			break;
+		// a monitor coming up takes a good part of a second, no use asking it every millisecond
+		if ( (uint64_t)pollUs * 1000u > deadline - now )
+			pollUs = (long)((deadline - now) / 1000u) + 1;
+		verifySleep( pollUs );
+		pollUs = pollUs * 2 < VERIFY_MAX_POLL_US ? pollUs * 2 : VERIFY_MAX_POLL_US;
+	}
+
+	for ( ii = 0; ii < plan->count; ii++ )
+	{
+		displayPlanEntry *entry = &plan->entries[ii];
+		if ( entry->verify == PLAN_VERIFY_MISMATCH )
+		{
+			entry->settleNanoseconds = clockNanoseconds() - result->committedAt;
+			result->mismatched++;
+		}
+	}
+	result->verifyNanoseconds = clockNanoseconds() - start;
+	return result->mismatched > 0 || result->unreadable > 0 ? kDisplayErrFailure : kDisplayNoErr;
+}
@@ -0,0 +1,116 @@
+/*
+DisplayPlan.h
+
+What SetDisplay is going to do to every display, worked out before any
+of it is done, so that it can all be applied in one configuration
+transaction (one screen flash, one relayout) instead of one per display.
+
+A display that is already in the chosen mode, and already mirrored (or
+not) the way it should be, is left out of the transaction, and if that
+is every display there is no transaction at all.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef DISPLAYPLAN_H
+#define DISPLAYPLAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "DisplayBackend.h"
+
+#define MIRROR_UNCHANGED 0
+#define MIRROR_OFF       1
+#define MIRROR_ON        2      // mirror the main display, the -M/-m values
+
+// what planVerify found a changed display in
+#define PLAN_VERIFY_NONE       0        // not checked: not changed, not committed, or its configure failed
+#define PLAN_VERIFY_SETTLED    1        // reads back as planned
+#define PLAN_VERIFY_MISMATCH   2        // still something else at the deadline
+#define PLAN_VERIFY_UNREADABLE 3        // its current mode couldn't be read back
+
+typedef struct
+{
+	displayID display;
+	long modeIndex;             // kNoMode: no mode matched, mode left alone
+	displayModeDesc mode;
+	int mirror;
+	displayID mirrorOf;         // for MIRROR_ON, kNullDisplay for the main display itself
+	int changeMode;             // 0 when the display is already in the mode
+	int changeMirror;           // 0 when the mirroring already is as planned
+	displayErr err;             // from configuring this display
+	int verify;                 // PLAN_VERIFY_..., from planVerify
+	uint64_t settleNanoseconds; // from the commit until it read back as planned, or until the deadline
+	displayModeDesc readBack;   // what it was in when planVerify last looked
+	long readBackIndex;
+	displayID readBackMirrorOf;
+} displayPlanEntry;
+
+typedef struct
+{
+	displayPlanEntry *entries;
+	size_t count;
+	size_t max;
+} displayPlan;
+
+typedef struct
+{
+	unsigned long commits;      // configuration transactions completed
+	unsigned long configured;   // displays configured in them
+	unsigned long skipped;      // displays already as planned
+	uint64_t applyNanoseconds;
+	uint64_t committedAt;       // clockNanoseconds() when the commit returned, 0 without one
+	displayErr err;             // first error, or kDisplayNoErr
+
+	// from planVerify
+	unsigned long settled;      // displays that read back as planned
+	unsigned long mismatched;   // displays still in something else at the deadline
+	unsigned long unreadable;
+	uint64_t settleMaxNanoseconds;
+	uint64_t verifyNanoseconds;
+} displayPlanResult;
+
+void planInit( displayPlan *plan );
+void planFree( displayPlan *plan );
+
+/*
+Adds a display to the plan.  mirroringOnOff is the -m/-M setting;
+mainDisplay is what the display mirrors when mirroring is turned on.
+current, currentIndex and currentMirrorOf are the display's state now
+(currentIndex is -1 if the backend couldn't place the current mode in
+its list); pass a NULL current to have the display configured anyway.
+*/
+displayPlanEntry *planAdd( displayPlan *plan, displayID display, long modeIndex, const displayModeDesc *mode,
+		int mirroringOnOff, displayID mainDisplay,
+		const displayModeDesc *current, long currentIndex, displayID currentMirrorOf );
+
+/*
+Copies an entry planned elsewhere (in a plan of its own) onto the end.
+*/
+displayPlanEntry *planAppend( displayPlan *plan, const displayPlanEntry *entry );
+void planDropLast( displayPlan *plan );
+int planEntryChanges( const displayPlanEntry *entry );
+
+void planPrint( const displayPlan *plan );
+
+/*
+Applies the whole plan in a single begin/configure/commit, leaving out
+the displays that need no change.
+*/
+displayErr planApply( displayBackend *backend, displayPlan *plan, int permanently, displayPlanResult *result );
+
+/*
+After planApply: reads each display the commit changed back from the
+backend until its mode and mirroring are what was planned or timeoutMs
+have passed since the commit, and records in the entries and in result
+what each ended up in and how long that took.  A commit returning is no
+promise the display took the change (a KVM can drop it, a monitor can
+take its time coming up), so this is what says it did.  It polls rather
+than waits for events so the events stay for whoever is waiting on
+them.  Returns kDisplayErrFailure if any display is not as planned.
+*/
+displayErr planVerify( displayBackend *backend, displayPlan *plan, long timeoutMs, displayPlanResult *result );
+
+#endif
@@ -0,0 +1,659 @@
+/*
+DisplayPolicy.c
+
+See DisplayPolicy.h.
+
+The compiled file is a header, the displacement of each bucket of the
+perfect hash, the slots it hashes into (a rule's index, or
+POLICY_EMPTY) and the rules, each part 8-byte aligned:
+
+	rule of key K: bucket b = hash(K) % numBuckets,
+	               slot = hash(hash(K) ^ displacement[b] * PHI) % numSlots
+
+The displacements are found at compile time, biggest bucket first, so
+that every rule lands in a slot of its own.  A lookup is one hash, two
+reads and a compare with what the rule matches, so a display nothing
+matches can't be given someone else's rule.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "DisplayPolicy.h"
+#include "ModeCatalog.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ALIGN8(n) (((n) + 7) & ~(uint64_t)7)
+
+#define POLICY_EMPTY       0xffffffffu
+#define POLICY_BUCKET_SIZE 4            // rules per bucket, on average
+#define POLICY_MAX_DISPLACEMENT 65536   // then the seed is changed and it starts over
+#define POLICY_PHI         0x9e3779b97f4a7c15ull
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numRules;
+	uint32_t numBuckets;
+	uint32_t numSlots;
+	uint32_t reserved;
+	uint64_t seed;
+	uint64_t size;              // bytes, this header included
+} policyFileHeader;
+
+struct displayPolicy
+{
+	void *map;
+	size_t mapSize;
+	const policyFileHeader *header;
+	const uint32_t *displacements;
+	const uint32_t *slots;
+	const policyRule *rules;
+};
+
+static uint64_t policyMix( uint64_t x )
+{
+	// splitmix64's finalizer
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return x;
+}
+
+/*
+The key of a rule, or of what a display would need its rule to match:
+only the fields the kind of match looks at go into it.
+*/
+static uint64_t policyKey( int match, uint32_t heads, uint32_t vendor, uint32_t model, uint32_t serial, uint64_t edidHash )
+{
+	uint64_t key = policyMix( ((uint64_t)match << 32) | heads );
+
+	if ( match == POLICY_MATCH_EDID )
+		key = policyMix( key ^ edidHash );
+	if ( match <= POLICY_MATCH_VENDOR && match != POLICY_MATCH_EDID )
+		key = policyMix( key ^ vendor );
+	if ( match == POLICY_MATCH_SERIAL || match == POLICY_MATCH_MODEL )
+		key = policyMix( key ^ model );
+	if ( match == POLICY_MATCH_SERIAL )
+		key = policyMix( key ^ serial );
+	return key;
+}
+
+static uint32_t policyBucket( uint64_t hash, uint32_t numBuckets )
+{
+	return (uint32_t)((hash >> 32) % numBuckets);
+}
+
+static uint32_t policySlot( uint64_t hash, uint32_t displacement, uint32_t numSlots )
+{
+	return (uint32_t)(policyMix( hash ^ (displacement * POLICY_PHI) ) % numSlots);
+}
+
+/////////////////
+
+static void policyError( char *error, size_t errorSize, const char *format, ... )
+{
+	va_list args;
+
+	if ( error == NULL || errorSize == 0 )
+		return;
+	va_start( args, format );
+	vsnprintf( error, errorSize, format, args );
+	va_end( args );
+}
+
+static int parseNumber( const char *text, uint64_t *value )
+{
+	char *end;
+
+	errno = 0;
+	*value = strtoull( text, &end, 0 );
+	return errno == 0 && end != text && *end == '\0' ? 0 : -1;
+}
+
+/*
+One line of the text: 1 and the rule, 0 for a blank line or a comment,
+-1 with what is wrong in error.
+*/
+static int parseRule( char *text, uint32_t line, policyRule *rule, char *error, size_t errorSize )
+{
+	int haveVendor = 0, haveModel = 0, haveSerial = 0, haveEdid = 0, haveAny = 0;
+	int inAction = 0, numbers = 0;
+	uint32_t values[4 * POLICY_MAX_TARGETS];
+	char *hash = strchr( text, '#' );
+	char *word;
+	int ii;
+
+	if ( hash != NULL )
+		*hash = '\0';
+	for ( word = text; *word; word++ )
+	{
+		if ( *word == ',' )
+			*word = ' ';
+	}
+	memset( rule, 0, sizeof(policyRule) );
+	rule->line = line;
+	rule->scanType = SCAN_CLOSEST;
+
+	word = strtok( text, " \t\r\n" );
+	if ( word == NULL )
+		return 0;
+	for ( ; word != NULL; word = strtok( NULL, " \t\r\n" ) )
+	{
+		char *equals = strchr( word, '=' );
+		uint64_t value;
+
+		if ( !inAction && strcmp( word, "=" ) == 0 ) {
+			inAction = 1;
+		} else if ( !inAction && strcmp( word, "*" ) == 0 ) {
+			haveAny = 1;
+		} else if ( !inAction ) {
+			char *end = NULL;
+			if ( equals != NULL )
+			{
+				*equals = '\0';
+				// the EDID's hash is hex whether it says 0x or not
+				if ( strcmp( word, "edid" ) == 0 )
+					value = strtoull( equals + 1, &end, 16 );
+				else if ( parseNumber( equals + 1, &value ) == 0 )
+					end = "";
+			}
+			if ( end == NULL || end == equals + 1 || *end != '\0' )
+			{
+				policyError( error, errorSize, "line %u: %s isn't KEY=NUMBER", line, word );
+				return -1;
+			}
+			if ( strcmp( word, "vendor" ) == 0 && value <= UINT32_MAX ) {
+				rule->vendor = (uint32_t)value;
+				haveVendor = 1;
+			} else if ( strcmp( word, "model" ) == 0 && value <= UINT32_MAX ) {
+				rule->model = (uint32_t)value;
+				haveModel = 1;
+			} else if ( strcmp( word, "serial" ) == 0 && value <= UINT32_MAX ) {
+				rule->serial = (uint32_t)value;
+				haveSerial = 1;
+			} else if ( strcmp( word, "edid" ) == 0 ) {
+				rule->edidHash = value;
+				haveEdid = 1;
+			} else if ( strcmp( word, "heads" ) == 0 && value > 0 && value <= UINT32_MAX ) {
+				rule->heads = (uint32_t)value;
+			} else {
+				policyError( error, errorSize, "line %u: no such match as %s=%s", line, word, equals + 1 );
+				return -1;
+			}
+		} else if ( strcmp( word, "exact" ) == 0 ) {
+			rule->scanType = SCAN_EXACT;
+		} else if ( strcmp( word, "closest" ) == 0 ) {
+			rule->scanType = SCAN_CLOSEST;
+		} else if ( strcmp( word, "highest" ) == 0 ) {
+			rule->scanType = SCAN_HIGHEST;
+		} else if ( strcmp( word, "mirror" ) == 0 ) {
+			rule->mirroring = 2;
+		} else if ( strcmp( word, "nomirror" ) == 0 ) {
+			rule->mirroring = 1;
+		} else {
+			char *end;
+			double number = strtod( word, &end );
+			if ( *end != '\0' || number < 0 || number > 1e6 )
+			{
+				policyError( error, errorSize, "line %u: %s isn't a number", line, word );
+				return -1;
+			}
+			if ( numbers == 4 * POLICY_MAX_TARGETS )
+			{
+				policyError( error, errorSize, "line %u: no more than %d modes to a rule", line, POLICY_MAX_TARGETS );
+				return -1;
+			}
+			// the refresh is kept in mHz, the rest in whole numbers
+			values[numbers] = numbers % 4 == 3 ? (uint32_t)(number * 1000 + 0.5) : (uint32_t)number;
+			numbers++;
+		}
+	}
+
+	if ( !inAction )
+	{
+		policyError( error, errorSize, "line %u: no = between what the rule matches and what it sets", line );
+		return -1;
+	}
+	if ( numbers % 4 != 0 || (numbers == 0 && rule->scanType != SCAN_HIGHEST) )
+	{
+		policyError( error, errorSize, "line %u: modes are WIDTH HEIGHT BPP REFRESH", line );
+		return -1;
+	}
+	rule->numTargets = (uint8_t)(numbers / 4);
+	for ( ii = 0; ii < rule->numTargets; ii++ )
+	{
+		rule->targets[ii].width = values[4 * ii];
+		rule->targets[ii].height = values[4 * ii + 1];
+		rule->targets[ii].bitsPerPixel = values[4 * ii + 2];
+		rule->targets[ii].refresh = values[4 * ii + 3];
+	}
+
+	if ( haveEdid && (haveVendor || haveModel || haveSerial) ) {
+		policyError( error, errorSize, "line %u: a rule for an EDID can't have a vendor, model or serial too", line );
+		return -1;
+	} else if ( haveEdid ) {
+		rule->match = POLICY_MATCH_EDID;
+	} else if ( haveSerial && (!haveVendor || !haveModel) ) {
+		policyError( error, errorSize, "line %u: a serial needs the vendor and the model too", line );
+		return -1;
+	} else if ( haveSerial ) {
+		rule->match = POLICY_MATCH_SERIAL;
+	} else if ( haveModel && !haveVendor ) {
+		policyError( error, errorSize, "line %u: a model needs the vendor too", line );
+		return -1;
+	} else if ( haveModel ) {
+		rule->match = POLICY_MATCH_MODEL;
+	} else if ( haveVendor ) {
+		rule->match = POLICY_MATCH_VENDOR;
+	} else if ( haveAny || rule->heads != 0 ) {
+		rule->match = POLICY_MATCH_ANY;
+	} else {
+		policyError( error, errorSize, "line %u: a rule for everything says so with *", line );
+		return -1;
+	}
+	return 1;
+}
+
+typedef struct
+{
+	uint32_t bucket;
+	uint32_t size;
+} bucketOrder;
+
+static int biggestFirst( const void *a, const void *b )
+{
+	const bucketOrder *aa = a, *bb = b;
+
+	if ( aa->size != bb->size )
+		return aa->size > bb->size ? -1 : 1;
+	return aa->bucket < bb->bucket ? -1 : aa->bucket > bb->bucket;
+}
+
+/*
+The displacements that put every rule in a slot of its own, for one
+seed.  Returns 0, or -1 when some bucket can't be placed (or two keys
+are the same 64 bits), for the next seed to be tried.
+*/
+static int buildIndex( const policyRule *rules, uint32_t numRules, uint64_t seed, uint32_t numBuckets, uint32_t numSlots,
+		uint32_t *displacements, uint32_t *slots, uint32_t *members, uint32_t *starts, bucketOrder *order )
+{
+	uint32_t ii, jj, kk;
+
+	memset( displacements, 0, numBuckets * sizeof(uint32_t) );
+	for ( ii = 0; ii < numSlots; ii++ )
+		slots[ii] = POLICY_EMPTY;
+
+	// the rules of each bucket together, counting sort
+	memset( starts, 0, (numBuckets + 1) * sizeof(uint32_t) );
+	for ( ii = 0; ii < numRules; ii++ )
+		starts[policyBucket( policyMix( rules[ii].key ^ seed ), numBuckets ) + 1]++;
+	for ( ii = 0; ii < numBuckets; ii++ )
+	{
+		order[ii].bucket = ii;
+		order[ii].size = starts[ii + 1];
+		starts[ii + 1] += starts[ii];
+	}
+	for ( ii = 0; ii < numRules; ii++ )
+	{
+		uint32_t bucket = policyBucket( policyMix( rules[ii].key ^ seed ), numBuckets );
+		members[starts[bucket] + --order[bucket].size] = ii;
+	}
+	for ( ii = 0; ii < numBuckets; ii++ )
+		order[ii].size = starts[ii + 1] - starts[ii];
+	qsort( order, numBuckets, sizeof(bucketOrder), biggestFirst );
+
+	for ( ii = 0; ii < numBuckets && order[ii].size > 0; ii++ )
+	{
+		uint32_t bucket = order[ii].bucket;
+		const uint32_t *bucketRules = members + starts[bucket];
+		uint32_t displacement;
+
+		for ( displacement = 0; displacement < POLICY_MAX_DISPLACEMENT; displacement++ )
+		{
+			for ( jj = 0; jj < order[ii].size; jj++ )
+			{
+				uint32_t slot = policySlot( policyMix( rules[bucketRules[jj]].key ^ seed ), displacement, numSlots );
+				if ( slots[slot] != POLICY_EMPTY )
+					break;
+				slots[slot] = bucketRules[jj];
+			}
+			if ( jj == order[ii].size )
+				break;
+			// undo the ones that went in
+			for ( kk = 0; kk < jj; kk++ )
+				slots[policySlot( policyMix( rules[bucketRules[kk]].key ^ seed ), displacement, numSlots )] = POLICY_EMPTY;
+		}
+		if ( displacement == POLICY_MAX_DISPLACEMENT )
+			return -1;
+		displacements[bucket] = displacement;
+	}
+	return 0;
+}
+
+static int sameMatch( const policyRule *a, const policyRule *b )
+{
+	return a->match == b->match && a->heads == b->heads && a->vendor == b->vendor && a->model == b->model &&
+			a->serial == b->serial && a->edidHash == b->edidHash;
+}
+
+static int compareKeys( const void *a, const void *b )
+{
+	const policyRule *aa = *(const policyRule * const *)a, *bb = *(const policyRule * const *)b;
+
+	return aa->key < bb->key ? -1 : aa->key > bb->key;
+}
+
+static int writeAll( int fd, const void *buf, size_t len )
+{
+	const char *p = buf;
+
+	while ( len > 0 )
+	{
+		ssize_t n = write( fd, p, len );
+		if ( n <= 0 )
+			return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+static int writePolicy( const char *path, const policyFileHeader *header, const void *data, size_t size )
+{
+	char *tmpPath = malloc( strlen( path ) + 32 );
+	int fd, err = 0;
+
+	if ( tmpPath == NULL )
+		return -1;
+	sprintf( tmpPath, "%s.%ld", path, (long)getpid() );
+	fd = open( tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if ( fd < 0 )
+		err = -1;
+	if ( err == 0 )
+		err = writeAll( fd, header, sizeof(policyFileHeader) );
+	if ( err == 0 )
+		err = writeAll( fd, data, size );
+	if ( fd >= 0 && close( fd ) != 0 )
+		err = -1;
+	if ( err == 0 && rename( tmpPath, path ) != 0 )
+		err = -1;
+	if ( err != 0 && fd >= 0 )
+		unlink( tmpPath );
+	free( tmpPath );
+	return err;
+}
+
+long policyCompile( const char *sourcePath, const char *policyPath, char *error, size_t errorSize )
+{
+	FILE *source = fopen( sourcePath, "r" );
+	policyRule *rules = NULL;
+	const policyRule **sorted = NULL;
+	uint32_t numRules = 0, maxRules = 0, line = 0;
+	uint32_t numBuckets, numSlots, ii;
+	uint32_t *members = NULL, *starts = NULL;
+	bucketOrder *order = NULL;
+	policyFileHeader header;
+	uint8_t *data = NULL;
+	size_t tableSize, dataSize;
+	uint64_t seed;
+	char text[4096];
+	long result = -1;
+
+	if ( source == NULL )
+	{
+		policyError( error, errorSize, "can't read %s", sourcePath );
+		return -1;
+	}
+	while ( fgets( text, sizeof(text), source ) != NULL )
+	{
+		int parsed;
+
+		line++;
+		if ( strchr( text, '\n' ) == NULL && !feof( source ) )
+		{
+			policyError( error, errorSize, "line %u: too long", line );
+			goto done;
+		}
+		if ( numRules == maxRules )
+		{
+			uint32_t grown = maxRules ? maxRules * 2 : 64;
+			policyRule *more = realloc( rules, grown * sizeof(policyRule) );
+			if ( more == NULL )
+			{
+				policyError( error, errorSize, "out of memory" );
+				goto done;
+			}
+			rules = more;
+			maxRules = grown;
+		}
+		parsed = parseRule( text, line, &rules[numRules], error, errorSize );
+		if ( parsed < 0 )
+			goto done;
+		if ( parsed == 0 )
+			continue;
+		rules[numRules].key = policyKey( rules[numRules].match, rules[numRules].heads, rules[numRules].vendor,
+				rules[numRules].model, rules[numRules].serial, rules[numRules].edidHash );
+		numRules++;
+	}
+	if ( ferror( source ) )
+	{
+		policyError( error, errorSize, "can't read %s", sourcePath );
+		goto done;
+	}
+
+	// two rules for the same displays is a mistake in the text
+	sorted = malloc( (numRules ? numRules : 1) * sizeof(policyRule *) );
+	if ( sorted == NULL )
+	{
+		policyError( error, errorSize, "out of memory" );
+		goto done;
+	}
+	for ( ii = 0; ii < numRules; ii++ )
+		sorted[ii] = &rules[ii];
+	qsort( sorted, numRules, sizeof(policyRule *), compareKeys );
+	for ( ii = 1; ii < numRules; ii++ )
+	{
+		if ( sorted[ii]->key != sorted[ii - 1]->key )
+			continue;
+		if ( sameMatch( sorted[ii], sorted[ii - 1] ) )
+			policyError( error, errorSize, "lines %u and %u match the same displays",
+					sorted[ii - 1]->line < sorted[ii]->line ? sorted[ii - 1]->line : sorted[ii]->line,
+					sorted[ii - 1]->line < sorted[ii]->line ? sorted[ii]->line : sorted[ii - 1]->line );
+		else
+			policyError( error, errorSize, "lines %u and %u hash the same, change one", sorted[ii - 1]->line, sorted[ii]->line );
+		goto done;
+	}
+
+	numBuckets = numRules / POLICY_BUCKET_SIZE + 1;
+	numSlots = numRules + numRules / 4 + 1;
+	tableSize = ALIGN8( (numBuckets + numSlots) * sizeof(uint32_t) );
+	dataSize = tableSize + numRules * sizeof(policyRule);
+	data = calloc( 1, dataSize );
+	members = malloc( (numRules ? numRules : 1) * sizeof(uint32_t) );
+	starts = malloc( (numBuckets + 1) * sizeof(uint32_t) );
+	order = malloc( numBuckets * sizeof(bucketOrder) );
+	if ( data == NULL || members == NULL || starts == NULL || order == NULL )
+	{
+		policyError( error, errorSize, "out of memory" );
+		goto done;
+	}
+	for ( seed = POLICY_PHI, ii = 0; ii < 64; seed = policyMix( seed ), ii++ )
+	{
+		if ( buildIndex( rules, numRules, seed, numBuckets, numSlots, (uint32_t *)data,
+				(uint32_t *)data + numBuckets, members, starts, order ) == 0 )
+			break;
+	}
+	if ( ii == 64 )
+	{
+		policyError( error, errorSize, "can't build the index" );
+		goto done;
+	}
+	memcpy( data + tableSize, rules, numRules * sizeof(policyRule) );
+
+	memset( &header, 0, sizeof(header) );
+	header.magic = POLICY_MAGIC;
+	header.version = POLICY_VERSION;
+	header.numRules = numRules;
+	header.numBuckets = numBuckets;
+	header.numSlots = numSlots;
+	header.seed = seed;
+	header.size = sizeof(header) + dataSize;
+	if ( writePolicy( policyPath, &header, data, dataSize ) != 0 )
+	{
+		policyError( error, errorSize, "can't write %s", policyPath );
+		goto done;
+	}
+	result = numRules;
+
+done:
+	fclose( source );
+	free( rules );
+	free( sorted );
+	free( data );
+	free( members );
+	free( starts );
+	free( order );
+	return result;
+}
+
+/////////////////
+
+displayPolicy *policyOpen( const char *path )
+{
+	displayPolicy *policy;
+	const policyFileHeader *header;
+	struct stat sb;
+	uint64_t tableSize;
+	int fd;
+
+	fd = open( path, O_RDONLY );
+	if ( fd < 0 )
+		return NULL;
+	if ( fstat( fd, &sb ) != 0 || (size_t)sb.st_size < sizeof(policyFileHeader) )
+	{
+		close( fd );
+		return NULL;
+	}
+	policy = calloc( 1, sizeof(displayPolicy) );
+	if ( policy == NULL )
+	{
+		close( fd );
+		return NULL;
+	}
+	policy->map = mmap( NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( policy->map == MAP_FAILED )
+	{
+		free( policy );
+		return NULL;
+	}
+	policy->mapSize = (size_t)sb.st_size;
+
+	// nothing but the sizes is checked here, so opening takes the same
+	// time for any number of rules; lookups check what they read
+	header = policy->map;
+	tableSize = ALIGN8( ((uint64_t)header->numBuckets + header->numSlots) * sizeof(uint32_t) );
+	if ( header->magic != POLICY_MAGIC || header->version != POLICY_VERSION || header->size != policy->mapSize ||
+			header->numBuckets == 0 || header->numSlots == 0 ||
+			sizeof(policyFileHeader) + tableSize + (uint64_t)header->numRules * sizeof(policyRule) != header->size )
+	{
+		policyClose( policy );
+		return NULL;
+	}
+	policy->header = header;
+	policy->displacements = (const uint32_t *)(header + 1);
+	policy->slots = policy->displacements + header->numBuckets;
+	policy->rules = (const policyRule *)((const uint8_t *)(header + 1) + tableSize);
+	return policy;
+}
+
+void policyClose( displayPolicy *policy )
+{
+	if ( policy == NULL )
+		return;
+	munmap( policy->map, policy->mapSize );
+	free( policy );
+}
+
+uint32_t policyCount( const displayPolicy *policy )
+{
+	return policy->header->numRules;
+}
+
+const policyRule *policyRuleAt( const displayPolicy *policy, uint32_t index )
+{
+	return index < policy->header->numRules ? &policy->rules[index] : NULL;
+}
+
+static const policyRule *policyFind( const displayPolicy *policy, const policyRule *probe )
+{
+	const policyFileHeader *header = policy->header;
+	uint64_t hash = policyMix( probe->key ^ header->seed );
+	uint32_t displacement = policy->displacements[policyBucket( hash, header->numBuckets )];
+	uint32_t index = policy->slots[policySlot( hash, displacement, header->numSlots )];
+
+	if ( index >= header->numRules || policy->rules[index].key != probe->key || !sameMatch( &policy->rules[index], probe ) )
+		return NULL;
+	return &policy->rules[index];
+}
+
+const policyRule *policyResolve( const displayPolicy *policy, const displayIdentity *identity, uint32_t heads )
+{
+	int match, pass;
+
+	for ( match = 0; match < POLICY_MATCHES; match++ )
+	{
+		if ( match == POLICY_MATCH_EDID ? identity->edidHash == 0 :
+				match != POLICY_MATCH_ANY && identity->vendor == 0 && identity->model == 0 && identity->serial == 0 )
+			continue;
+		for ( pass = 0; pass < 2; pass++ )
+		{
+			policyRule probe;
+			const policyRule *rule;
+
+			if ( pass == 0 && heads == 0 )
+				continue;
+			// what a rule of this kind would have in it
+			memset( &probe, 0, sizeof(probe) );
+			probe.match = (uint8_t)match;
+			probe.heads = pass == 0 ? heads : 0;
+			if ( match == POLICY_MATCH_EDID )
+				probe.edidHash = identity->edidHash;
+			if ( match == POLICY_MATCH_SERIAL || match == POLICY_MATCH_MODEL || match == POLICY_MATCH_VENDOR )
+				probe.vendor = identity->vendor;
+			if ( match == POLICY_MATCH_SERIAL || match == POLICY_MATCH_MODEL )
+				probe.model = identity->model;
+			if ( match == POLICY_MATCH_SERIAL )
+				probe.serial = identity->serial;
+			probe.key = policyKey( match, probe.heads, probe.vendor, probe.model, probe.serial, probe.edidHash );
+			rule = policyFind( policy, &probe );
+			if ( rule != NULL )
+				return rule;
+		}
+	}
+	return NULL;
+}
+
+displayMode policyTargetMode( const policyTarget *target )
+{
+	displayMode mode;
+
+	mode.width = target->width;
+	mode.height = target->height;
+	mode.bitsPerPixel = target->bitsPerPixel;
+	mode.refresh = target->refresh / 1000.0;
+	return mode;
+}
@@ -0,0 +1,102 @@
+/*
+DisplayPolicy.h
+
+A fleet's display policy: which mode (and mirroring) each monitor, KVM
+or number of heads gets, in one file for every lab instead of a plist
+per lab with the mode in its arguments.  It is written as text, one
+rule per line:
+
+	# MATCH ... = [exact|closest|highest] [mirror|nomirror] WIDTH HEIGHT BPP REFRESH [, WIDTH HEIGHT BPP REFRESH ...]
+	vendor=0x10ac model=0xa0c4 = 2560 1440 32 60, 1920 1080 32 60
+	vendor=0x10ac model=0xa0c4 serial=842 = 1920 1200 32 60
+	edid=9f3c1a0b5e27d488 = mirror 1280 1024 32 60
+	vendor=0x4c2d heads=2 = mirror 1600 1200 32 0
+	* = 1600 1200 32 0
+
+vendor, model and serial (numbers, 0x for hex) are the monitor's, as
+identified by the backend; edid is the hash of its EDID, which is what
+tells one KVM's EDID from another's; heads=N only matches when N
+displays are online.  The modes are tried in order, the first the
+display has (width, height and depth) is set; when it has none of them
+the last one is matched the rule's way, closest if it doesn't say.
+mirror and nomirror are -M and -m.
+
+The text is compiled ahead of time (policyCompile, SetDisplayPolicy -o)
+into a file that is mapped and used in place: the rules, fixed size,
+behind a perfect hash (hash and displace) of what they match.  Finding
+a display's rule is at most ten probes, whatever the number of rules:
+the most specific rule wins (serial, then EDID, then model, then
+vendor, then *), one for this number of heads before one for any.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef DISPLAYPOLICY_H
+#define DISPLAYPOLICY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "DisplayBackend.h"
+
+#define POLICY_MAGIC       0x5344504f // 'SDPO'
+#define POLICY_VERSION     1
+#define POLICY_MAX_TARGETS 4
+
+// what a rule matches, most specific first
+#define POLICY_MATCH_SERIAL 0       // vendor, model and serial
+#define POLICY_MATCH_EDID   1
+#define POLICY_MATCH_MODEL  2       // vendor and model
+#define POLICY_MATCH_VENDOR 3
+#define POLICY_MATCH_ANY    4
+#define POLICY_MATCHES      5
+
+typedef struct
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t bitsPerPixel;
+	uint32_t refresh;           // mHz, 0 for any
+} policyTarget;
+
+typedef struct
+{
+	uint64_t key;               // the hash the index is built on
+	uint64_t edidHash;
+	uint32_t vendor, model, serial;
+	uint32_t heads;             // 0 for any
+	uint8_t match;              // POLICY_MATCH_...
+	uint8_t scanType;           // SCAN_CLOSEST unless the rule says
+	uint8_t mirroring;          // 0 as it is, 1 off, 2 on, as SetDisplay's mirroringOnOff
+	uint8_t numTargets;
+	uint32_t line;              // in the text it was compiled from
+	policyTarget targets[POLICY_MAX_TARGETS];
+} policyRule;
+
+typedef struct displayPolicy displayPolicy;
+
+/*
+Compiles the text in sourcePath into policyPath (a new file renamed
+over the old).  Returns the number of rules, or -1 with what is wrong,
+and on what line, in error.
+*/
+long policyCompile( const char *sourcePath, const char *policyPath, char *error, size_t errorSize );
+
+/*
+NULL if path isn't a compiled policy (or out of memory).
+*/
+displayPolicy *policyOpen( const char *path );
+void policyClose( displayPolicy *policy );
+uint32_t policyCount( const displayPolicy *policy );
+const policyRule *policyRuleAt( const displayPolicy *policy, uint32_t index );
+
+/*
+The rule for a display with identity when heads displays are online,
+NULL if none matches.  The rule points into the policy.
+*/
+const policyRule *policyResolve( const displayPolicy *policy, const displayIdentity *identity, uint32_t heads );
+
+displayMode policyTargetMode( const policyTarget *target );
+
+#endif
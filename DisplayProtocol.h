@@ -0,0 +1,106 @@
+/*
+DisplayProtocol.h
+
+What SetDisplay -S (DisplayServer.c) and SetDisplayClient.c say to each
+other over the server's Unix domain socket.
+
+Every message is a protocolHeader followed by size bytes of body.  A
+request gets exactly one reply, with the same op and tag, in the order
+the requests came in.  status is kDisplayNoErr or the displayErr that
+stopped the request; a failed request has no body.  Both ends are on
+the same machine, so everything is in host byte order.
+
+	PROTOCOL_DISPLAYS   no body ->
+	                    protocolCount, then protocolDisplay[count]
+	PROTOCOL_LIST       protocolListRequest ->
+	                    protocolCount, then protocolMode[count]
+	PROTOCOL_FIND       protocolFindRequest -> protocolMode (index
+	                    kNoMode when nothing matched)
+	PROTOCOL_APPLY      protocolApplyRequest -> protocolApplyReply
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef DISPLAYPROTOCOL_H
+#define DISPLAYPROTOCOL_H
+
+#include <stdint.h>
+
+#include "DisplayBackend.h"
+
+#define PROTOCOL_DEFAULT_SOCKET "/var/run/edu.utah.SetDisplay.sock"
+
+#define PROTOCOL_DISPLAYS 1
+#define PROTOCOL_LIST     2
+#define PROTOCOL_FIND     3
+#define PROTOCOL_APPLY    4
+
+#define PROTOCOL_MAX_REQUEST 256    // no request body is bigger, the server hangs up on ones that are
+
+typedef struct
+{
+	uint32_t size;              // of the body that follows
+	uint16_t op;
+	uint16_t status;
+	uint32_t tag;               // whatever the client likes, copied into the reply
+	uint32_t reserved;
+} protocolHeader;
+
+typedef struct
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t bitsPerPixel;
+	uint32_t ioModeID;
+	double refresh;
+	int32_t index;              // in the display's mode list
+	uint32_t usable;
+} protocolMode;
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t reserved;
+} protocolCount;
+
+typedef struct
+{
+	uint32_t display;
+	uint32_t mirrorOf;
+	displayIdentity identity;
+	protocolMode current;       // index -1 if it isn't in the mode list
+} protocolDisplay;
+
+typedef struct
+{
+	uint32_t display;
+	uint32_t reserved;
+} protocolListRequest;
+
+typedef struct
+{
+	uint32_t display;
+	uint32_t scanType;          // SCAN_EXACT, SCAN_CLOSEST or SCAN_HIGHEST
+	protocolMode mode;          // only the width, height, depth and refresh are looked at
+} protocolFindRequest;
+
+typedef struct
+{
+	uint32_t display;           // kNullDisplay for every display
+	uint32_t scanType;
+	uint32_t mirror;            // MIRROR_UNCHANGED, MIRROR_OFF or MIRROR_ON
+	uint32_t force;             // reconfigure even displays already in the mode
+	protocolMode mode;
+} protocolApplyRequest;
+
+typedef struct
+{
+	uint32_t commits;
+	uint32_t configured;
+	uint32_t skipped;
+	uint32_t unmatched;         // displays no mode matched
+	uint64_t applyNanoseconds;
+} protocolApplyReply;
+
+#endif
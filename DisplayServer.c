@@ -0,0 +1,569 @@
+/*
+DisplayServer.c
+
+See DisplayServer.h and DisplayProtocol.h.
+
+The displays are a libsetdisplay session's; all the server keeps of its
+own is the encoded mode list replies.
+
+One thread, poll() over the listening socket and every client.  Requests
+are read without blocking into a per-client buffer and answered as soon
+as a whole one is in.  Replies are queued per client and written out as
+fast as the client takes them; a client's next requests aren't read
+until it has taken every reply, so one that stops reading holds up only
+itself.  Between rounds the backend is asked, without waiting, whether
+anything happened to the displays.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "DisplayServer.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Clock.h"
+#include "DisplayProtocol.h"
+
+#define SERVER_MAX_CLIENTS  64
+#define SERVER_MAX_EVENTS   64
+#define SERVER_EVENT_POLL   100     // ms, how often the backend is asked about changes
+
+typedef struct
+{
+	displayID display;
+	unsigned long generation;   // of the catalog it was made from
+	void *body;
+	size_t size;
+} serverListReply;
+
+typedef struct
+{
+	int fd;
+	unsigned char in[sizeof(protocolHeader) + PROTOCOL_MAX_REQUEST];
+	size_t inLength;
+	unsigned char *out;         // replies not yet taken
+	size_t outLength;
+	size_t outSent;
+	size_t outSize;
+} serverClient;
+
+typedef struct
+{
+	setDisplaySession *session;
+	int verbose;
+	int listenFd;
+	int watchEvents;
+
+	serverListReply *listReplies;
+	size_t numListReplies;
+
+	serverClient clients[SERVER_MAX_CLIENTS];
+	size_t numClients;
+
+	unsigned long requests;
+	unsigned long events;
+} server;
+
+static volatile sig_atomic_t serverStop = 0;
+
+static void stopServer( int sig )
+{
+	serverStop = 1;
+}
+
+static void pollEvents( server *srv )
+{
+	displayEvent events[SERVER_MAX_EVENTS];
+	size_t numEvents, ii;
+
+	if ( !srv->watchEvents )
+		return;
+	// the session forgets whatever changed, it is read again when next asked for
+	if ( sessionWaitForEvents( srv->session, 0, events, SERVER_MAX_EVENTS, &numEvents ) != kDisplayNoErr )
+	{
+		// nothing more will come (or never could), what is known stays
+		srv->watchEvents = 0;
+		return;
+	}
+	srv->events += numEvents;
+	for ( ii = 0; ii < numEvents && srv->verbose == 1; ii++ )
+		printf( "Display 0x%x changed (0x%x)\n", (unsigned int)events[ii].display, (unsigned int)events[ii].flags );
+}
+
+/////////////////
+
+static void wireMode( protocolMode *wire, const displayModeDesc *desc, long index )
+{
+	memset( wire, 0, sizeof(protocolMode) );
+	wire->width = (uint32_t)desc->mode.width;
+	wire->height = (uint32_t)desc->mode.height;
+	wire->bitsPerPixel = (uint32_t)desc->mode.bitsPerPixel;
+	wire->ioModeID = desc->ioModeID;
+	wire->refresh = desc->mode.refresh;
+	wire->index = (int32_t)index;
+	wire->usable = desc->usable ? 1 : 0;
+}
+
+static displayMode wantedMode( const protocolMode *wire )
+{
+	displayMode mode;
+	mode.width = wire->width;
+	mode.height = wire->height;
+	mode.bitsPerPixel = wire->bitsPerPixel;
+	mode.refresh = wire->refresh;
+	return mode;
+}
+
+/*
+Sends as much of the client's queued replies as it will take without
+waiting.  Returns -1 when the client is gone.
+*/
+static int flushClient( serverClient *client )
+{
+	while ( client->outSent < client->outLength )
+	{
+		ssize_t n = send( client->fd, client->out + client->outSent, client->outLength - client->outSent, MSG_DONTWAIT );
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+			return 0;
+		if ( n <= 0 )
+			return -1;
+		client->outSent += (size_t)n;
+	}
+	client->outLength = 0;
+	client->outSent = 0;
+	return 0;
+}
+
+static int queueReply( serverClient *client, const void *buf, size_t len )
+{
+	if ( client->outLength + len > client->outSize )
+	{
+		size_t size = client->outSize ? client->outSize : 4096;
+		unsigned char *out;
+		while ( size < client->outLength + len )
+			size *= 2;
+		out = realloc( client->out, size );
+		if ( out == NULL )
+			return -1;
+		client->out = out;
+		client->outSize = size;
+	}
+	memcpy( client->out + client->outLength, buf, len );
+	client->outLength += len;
+	return 0;
+}
+
+static int sendReply( serverClient *client, const protocolHeader *request, displayErr status, const void *body, size_t size )
+{
+	protocolHeader reply;
+
+	memset( &reply, 0, sizeof(reply) );
+	reply.op = request->op;
+	reply.tag = request->tag;
+	reply.status = (uint16_t)status;
+	reply.size = status == kDisplayNoErr ? (uint32_t)size : 0;
+	if ( queueReply( client, &reply, sizeof(reply) ) != 0 )
+		return -1;
+	if ( reply.size > 0 && queueReply( client, body, size ) != 0 )
+		return -1;
+	return flushClient( client );
+}
+
+static int serveDisplays( server *srv, serverClient *client, const protocolHeader *request )
+{
+	const displayID *online;
+	uint32_t numDisplays, ii;
+	protocolCount *count;
+	protocolDisplay *displays;
+	displayErr err;
+	char *body;
+	int result;
+
+	err = sessionDisplays( srv->session, &online, &numDisplays );
+	if ( err != kDisplayNoErr )
+		return sendReply( client, request, err, NULL, 0 );
+	body = malloc( sizeof(protocolCount) + numDisplays * sizeof(protocolDisplay) );
+	if ( body == NULL )
+		return sendReply( client, request, kDisplayErrNoMemory, NULL, 0 );
+	count = (protocolCount *)body;
+	displays = (protocolDisplay *)(count + 1);
+	memset( count, 0, sizeof(protocolCount) );
+	for ( ii = 0; ii < numDisplays; ii++ )
+	{
+		protocolDisplay *wire = &displays[count->count];
+		setDisplayInfo info;
+		long index;
+		// online stays put, nothing here makes the session look for displays again
+		if ( sessionInfo( srv->session, online[ii], &info ) != kDisplayNoErr )
+			continue;
+		memset( wire, 0, sizeof(protocolDisplay) );
+		wire->display = info.display;
+		wire->mirrorOf = info.mirrorOf;
+		wire->identity = info.identity;
+		index = info.currentIndex;
+		if ( index < 0 )
+			index = catalogFindMode( sessionCatalog( srv->session, online[ii] ), &info.current );
+		wireMode( &wire->current, &info.current, index );
+		count->count++;
+	}
+	result = sendReply( client, request, kDisplayNoErr, body, sizeof(protocolCount) + count->count * sizeof(protocolDisplay) );
+	free( body );
+	return result;
+}
+
+/*
+The PROTOCOL_LIST body for the display's catalog, made the first time
+it is asked for.
+*/
+static serverListReply *listReply( server *srv, displayID display, const setDisplayInfo *info )
+{
+	const modeCatalog *catalog = sessionCatalog( srv->session, display );
+	serverListReply *reply = NULL;
+	protocolCount *count;
+	protocolMode *modes;
+	uint32_t ii;
+	size_t jj;
+
+	for ( jj = 0; jj < srv->numListReplies; jj++ )
+	{
+		if ( srv->listReplies[jj].display == display )
+		{
+			reply = &srv->listReplies[jj];
+			if ( reply->generation == info->generation )
+				return reply;
+			break;
+		}
+	}
+	if ( reply == NULL )
+	{
+		serverListReply *replies = realloc( srv->listReplies, (srv->numListReplies + 1) * sizeof(serverListReply) );
+		if ( replies == NULL )
+			return NULL;
+		srv->listReplies = replies;
+		reply = &srv->listReplies[srv->numListReplies++];
+		reply->display = display;
+		reply->body = NULL;
+	}
+	free( reply->body );
+	reply->size = sizeof(protocolCount) + (size_t)catalog->numModes * sizeof(protocolMode);
+	reply->body = malloc( reply->size );
+	if ( reply->body == NULL )
+	{
+		*reply = srv->listReplies[--srv->numListReplies];
+		return NULL;
+	}
+	reply->generation = info->generation;
+	count = reply->body;
+	memset( count, 0, sizeof(protocolCount) );
+	count->count = catalog->numModes;
+	modes = (protocolMode *)(count + 1);
+	for ( ii = 0; ii < catalog->numModes; ii++ )
+	{
+		displayModeDesc desc;
+		catalogModeDesc( catalog, ii, &desc );
+		wireMode( &modes[ii], &desc, ii );
+	}
+	return reply;
+}
+
+static int serveList( server *srv, serverClient *client, const protocolHeader *request, const void *body )
+{
+	const protocolListRequest *list = body;
+	serverListReply *reply;
+	setDisplayInfo info;
+	displayErr err;
+
+	if ( request->size != sizeof(protocolListRequest) )
+		return sendReply( client, request, kDisplayErrIllegalArg, NULL, 0 );
+	err = sessionInfo( srv->session, list->display, &info );
+	if ( err != kDisplayNoErr )
+		return sendReply( client, request, err, NULL, 0 );
+	reply = listReply( srv, list->display, &info );
+	if ( reply == NULL )
+		return sendReply( client, request, kDisplayErrNoMemory, NULL, 0 );
+	return sendReply( client, request, kDisplayNoErr, reply->body, reply->size );
+}
+
+static int serveFind( server *srv, serverClient *client, const protocolHeader *request, const void *body )
+{
+	const protocolFindRequest *find = body;
+	protocolMode reply;
+	setDisplayInfo info;
+	displayModeDesc desc;
+	displayErr err;
+	long index;
+
+	if ( request->size != sizeof(protocolFindRequest) || find->scanType > SCAN_HIGHEST )
+		return sendReply( client, request, kDisplayErrIllegalArg, NULL, 0 );
+	err = sessionInfo( srv->session, find->display, &info );
+	if ( err != kDisplayNoErr )
+		return sendReply( client, request, err, NULL, 0 );
+	index = sessionFind( srv->session, find->display, (int)find->scanType, wantedMode( &find->mode ), &desc );
+	wireMode( &reply, &desc, index );
+	return sendReply( client, request, kDisplayNoErr, &reply, sizeof(reply) );
+}
+
+static int serveApply( server *srv, serverClient *client, const protocolHeader *request, const void *body )
+{
+	const protocolApplyRequest *apply = body;
+	protocolApplyReply reply;
+	displayPlanResult result;
+	displayPlan plan;
+	const displayID *online;
+	displayID *displays;
+	uint32_t numDisplays, ii;
+	displayErr err;
+
+	if ( request->size != sizeof(protocolApplyRequest) || apply->scanType > SCAN_HIGHEST || apply->mirror > MIRROR_ON )
+		return sendReply( client, request, kDisplayErrIllegalArg, NULL, 0 );
+	err = sessionDisplays( srv->session, &online, &numDisplays );
+	if ( err != kDisplayNoErr )
+		return sendReply( client, request, err, NULL, 0 );
+	// planning can send the session looking for displays again, which takes online with it
+	displays = malloc( (numDisplays ? numDisplays : 1) * sizeof(displayID) );
+	if ( displays == NULL )
+		return sendReply( client, request, kDisplayErrNoMemory, NULL, 0 );
+	memcpy( displays, online, numDisplays * sizeof(displayID) );
+	for ( ii = 0; ii < numDisplays && apply->display != kNullDisplay; ii++ )
+	{
+		if ( displays[ii] == apply->display )
+			break;
+	}
+	if ( ii == numDisplays )
+	{
+		free( displays );
+		return sendReply( client, request, kDisplayErrIllegalArg, NULL, 0 );
+	}
+
+	memset( &reply, 0, sizeof(reply) );
+	planInit( &plan );
+	if ( apply->display != kNullDisplay )
+	{
+		displays[0] = apply->display;
+		numDisplays = 1;
+	}
+	sessionPlanDisplays( srv->session, &plan, displays, numDisplays, (int)apply->scanType, wantedMode( &apply->mode ),
+			(int)apply->mirror, apply->force ? SESSION_PLAN_FORCE : 0, NULL );
+	free( displays );
+	err = sessionApply( srv->session, &plan, 1, &result );
+	for ( ii = 0; ii < plan.count; ii++ )
+	{
+		if ( plan.entries[ii].modeIndex == kNoMode )
+			reply.unmatched++;
+	}
+	planFree( &plan );
+
+	reply.commits = (uint32_t)result.commits;
+	reply.configured = (uint32_t)result.configured;
+	reply.skipped = (uint32_t)result.skipped;
+	reply.applyNanoseconds = result.applyNanoseconds;
+	if ( srv->verbose == 1 )
+		printf( "Apply: %u configured, %u skipped, %.3f ms (%d)\n", reply.configured, reply.skipped,
+				reply.applyNanoseconds / 1e6, err );
+	return sendReply( client, request, err, &reply, sizeof(reply) );
+}
+
+static int serveRequest( server *srv, serverClient *client, const protocolHeader *request, const void *body )
+{
+	srv->requests++;
+	switch ( request->op )
+	{
+		case PROTOCOL_DISPLAYS:
+			return serveDisplays( srv, client, request );
+		case PROTOCOL_LIST:
+			return serveList( srv, client, request, body );
+		case PROTOCOL_FIND:
+			return serveFind( srv, client, request, body );
+		case PROTOCOL_APPLY:
+			return serveApply( srv, client, request, body );
+	}
+	return sendReply( client, request, kDisplayErrNotSupported, NULL, 0 );
+}
+
+/*
+Reads what the client has sent and answers every complete request in
+it.  Returns -1 when the client is gone or has to go.
+*/
+static int serveClient( server *srv, serverClient *client )
+{
+	for ( ;; )
+	{
+		ssize_t n;
+		// no more until it has taken what it was sent
+		if ( client->outLength > 0 )
+			return 0;
+		n = recv( client->fd, client->in + client->inLength, sizeof(client->in) - client->inLength, MSG_DONTWAIT );
+		if ( n == 0 )
+			return -1;
+		if ( n < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			if ( errno == EAGAIN || errno == EWOULDBLOCK )
+				return 0;
+			return -1;
+		}
+		client->inLength += (size_t)n;
+
+		while ( client->inLength >= sizeof(protocolHeader) )
+		{
+			protocolHeader request;
+			size_t frame;
+
+			memcpy( &request, client->in, sizeof(request) );
+			if ( request.size > PROTOCOL_MAX_REQUEST )
+				return -1;
+			frame = sizeof(protocolHeader) + request.size;
+			if ( client->inLength < frame )
+				break;
+			// the body is copied out so that it is aligned for the request structs
+			{
+				uint64_t body[PROTOCOL_MAX_REQUEST / sizeof(uint64_t)];
+				memcpy( body, client->in + sizeof(protocolHeader), request.size );
+				if ( serveRequest( srv, client, &request, body ) != 0 )
+					return -1;
+			}
+			memmove( client->in, client->in + frame, client->inLength - frame );
+			client->inLength -= frame;
+		}
+	}
+}
+
+static int listenOn( const char *socketPath )
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if ( strlen( socketPath ) >= sizeof(addr.sun_path) )
+	{
+		printf( "Socket path too long: %s\n", socketPath );
+		return -1;
+	}
+	memset( &addr, 0, sizeof(addr) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, socketPath );
+
+	fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( fd < 0 )
+		return -1;
+	unlink( socketPath );       // left over from a server that didn't get to clean up
+	if ( bind( fd, (struct sockaddr *)&addr, sizeof(addr) ) != 0 || listen( fd, SERVER_MAX_CLIENTS ) != 0 )
+	{
+		printf( "Cannot listen on %s\n", socketPath );
+		close( fd );
+		return -1;
+	}
+	return fd;
+}
+
+int serverRun( setDisplaySession *session, const char *socketPath, int verbose )
+{
+	const displayID *online;
+	uint32_t numDisplays = 0;
+	server *srv;
+	struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+	uint64_t started;
+	size_t ii;
+
+	srv = calloc( 1, sizeof(server) );
+	if ( srv == NULL )
+		return -1;
+	srv->session = session;
+	srv->verbose = verbose;
+	srv->watchEvents = 1;
+	srv->listenFd = listenOn( socketPath );
+	if ( srv->listenFd < 0 )
+	{
+		free( srv );
+		return -1;
+	}
+	signal( SIGPIPE, SIG_IGN );
+	signal( SIGINT, stopServer );
+	signal( SIGTERM, stopServer );
+
+	// warm up: every display's catalog and current mode, before the first request
+	sessionLoad( session );
+	if ( sessionDisplays( session, &online, &numDisplays ) != kDisplayNoErr )
+		numDisplays = 0;
+	sessionSaveCache( session );
+	if ( verbose == 1 )
+		printf( "Serving %u display(s) on %s\n", (unsigned int)numDisplays, socketPath );
+
+	started = clockNanoseconds();
+	while ( !serverStop )
+	{
+		fds[0].fd = srv->listenFd;
+		fds[0].events = POLLIN;
+		for ( ii = 0; ii < srv->numClients; ii++ )
+		{
+			fds[ii + 1].fd = srv->clients[ii].fd;
+			fds[ii + 1].events = srv->clients[ii].outLength > 0 ? POLLOUT : POLLIN;
+		}
+		if ( poll( fds, srv->numClients + 1, srv->watchEvents ? SERVER_EVENT_POLL : -1 ) < 0 && errno != EINTR )
+			break;
+
+		pollEvents( srv );
+
+		// backwards, so that a client that goes can be swapped with the last one
+		for ( ii = srv->numClients; ii > 0; ii-- )
+		{
+			serverClient *client = &srv->clients[ii - 1];
+			int gone = (fds[ii].revents & POLLOUT) && flushClient( client ) != 0;
+			if ( !gone && client->outLength == 0 && (fds[ii].revents & (POLLIN | POLLHUP | POLLERR)) )
+				gone = serveClient( srv, client ) != 0;
+			else if ( !gone && (fds[ii].revents & (POLLHUP | POLLERR)) )
+				gone = 1;
+			if ( gone )
+			{
+				close( client->fd );
+				free( client->out );
+				*client = srv->clients[--srv->numClients];
+			}
+		}
+		if ( fds[0].revents & POLLIN )
+		{
+			int fd = accept( srv->listenFd, NULL, NULL );
+			if ( fd >= 0 && srv->numClients == SERVER_MAX_CLIENTS )
+				close( fd );
+			else if ( fd >= 0 )
+			{
+				memset( &srv->clients[srv->numClients], 0, sizeof(serverClient) );
+				srv->clients[srv->numClients].fd = fd;
+				srv->numClients++;
+			}
+		}
+	}
+
+	if ( verbose == 1 )
+	{
+		setDisplayStats stats;
+		sessionStats( session, &stats );
+		printf( "%lu request(s) in %.3f s, %lu display event(s), current mode read from the backend %lu time(s)\n",
+				srv->requests, (clockNanoseconds() - started) / 1e9, srv->events, sessionBackend( session )->stats.currentMode );
+		printf( "%lu mode list(s) read, %lu catalog(s) made; %lu changed display(s) read again, %lu kept their catalog\n",
+				sessionBackend( session )->stats.copyModes, stats.catalogs, stats.rechecks, stats.kept );
+	}
+	for ( ii = 0; ii < srv->numClients; ii++ )
+	{
+		close( srv->clients[ii].fd );
+		free( srv->clients[ii].out );
+	}
+	close( srv->listenFd );
+	unlink( socketPath );
+	for ( ii = 0; ii < srv->numListReplies; ii++ )
+		free( srv->listReplies[ii].body );
+	free( srv->listReplies );
+	free( srv );
+	return 0;
+}
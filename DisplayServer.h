@@ -0,0 +1,28 @@
+/*
+DisplayServer.h
+
+SetDisplay -S: answers display, mode list, match and apply requests
+(DisplayProtocol.h) on a Unix domain socket, so that something polling
+the displays doesn't have to run SetDisplay and read its output every
+time.
+
+The server's session keeps every display's mode catalog and current
+mode in memory and only goes back to the backend for a display after
+the backend says it changed, or to apply a mode.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef DISPLAYSERVER_H
+#define DISPLAYSERVER_H
+
+#include "SetDisplayLib.h"
+
+/*
+Serves the session's displays on socketPath until SIGINT or SIGTERM.
+Returns 0, or -1 if the socket couldn't be set up.
+*/
+int serverRun( setDisplaySession *session, const char *socketPath, int verbose );
+
+#endif
@@ -0,0 +1,447 @@
+/*
+DisplayTiming.c
+
+See DisplayTiming.h.  The DMT table is VESA DMT 1.0 revision 13; the
+CVT formulas are those of the VESA CVT 1.2 spreadsheet, with no
+margins.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "DisplayTiming.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DMT_RB       0x80       // reduced blanking, in the table only
+#define DMT_INDEX    256        // a power of two, well over twice the table
+
+// everything the formulas round down is positive, so no libm
+#define FLOOR(x)     ((double)(long)(x))
+
+#define PH           TIMING_HSYNC_POSITIVE
+#define PV           TIMING_VSYNC_POSITIVE
+
+typedef struct
+{
+	uint8_t id;
+	uint8_t refresh;            // nominal, the field rate if interlaced
+	uint8_t flags;
+	uint32_t clock;             // kHz
+	uint16_t hActive, hSyncStart, hSyncEnd, hTotal;
+	uint16_t vActive, vSyncStart, vSyncEnd, vTotal;
+} dmtEntry;
+
+static const dmtEntry dmtTimings[] =
+{
+	{ 0x01, 85, PH, 31500, 640, 672, 736, 832, 350, 382, 385, 445 },
+	{ 0x02, 85, PV, 31500, 640, 672, 736, 832, 400, 401, 404, 445 },
+	{ 0x03, 85, PV, 35500, 720, 756, 828, 936, 400, 401, 404, 446 },
+	{ 0x04, 60, 0, 25175, 640, 656, 752, 800, 480, 490, 492, 525 },
+	{ 0x05, 72, 0, 31500, 640, 664, 704, 832, 480, 489, 492, 520 },
+	{ 0x06, 75, 0, 31500, 640, 656, 720, 840, 480, 481, 484, 500 },
+	{ 0x07, 85, 0, 36000, 640, 696, 752, 832, 480, 481, 484, 509 },
+	{ 0x08, 56, PH|PV, 36000, 800, 824, 896, 1024, 600, 601, 603, 625 },
+	{ 0x09, 60, PH|PV, 40000, 800, 840, 968, 1056, 600, 601, 605, 628 },
+	{ 0x0a, 72, PH|PV, 50000, 800, 856, 976, 1040, 600, 637, 643, 666 },
+	{ 0x0b, 75, PH|PV, 49500, 800, 816, 896, 1056, 600, 601, 604, 625 },
+	{ 0x0c, 85, PH|PV, 56250, 800, 832, 896, 1048, 600, 601, 604, 631 },
+	{ 0x0d, 120, PH|DMT_RB, 73250, 800, 848, 880, 960, 600, 603, 607, 636 },
+	{ 0x0e, 60, PH|PV, 33750, 848, 864, 976, 1088, 480, 486, 494, 517 },
+	{ 0x0f, 87, PH|PV|TIMING_INTERLACED, 44900, 1024, 1032, 1208, 1264, 768, 768, 776, 817 },
+	{ 0x10, 60, 0, 65000, 1024, 1048, 1184, 1344, 768, 771, 777, 806 },
+	{ 0x11, 70, 0, 75000, 1024, 1048, 1184, 1328, 768, 771, 777, 806 },
+	{ 0x12, 75, PH|PV, 78750, 1024, 1040, 1136, 1312, 768, 769, 772, 800 },
+	{ 0x13, 85, PH|PV, 94500, 1024, 1072, 1168, 1376, 768, 769, 772, 808 },
+	{ 0x14, 120, PH|DMT_RB, 115500, 1024, 1072, 1104, 1184, 768, 771, 775, 813 },
+	{ 0x15, 75, PH|PV, 108000, 1152, 1216, 1344, 1600, 864, 865, 868, 900 },
+	{ 0x55, 60, PH|PV, 74250, 1280, 1390, 1430, 1650, 720, 725, 730, 750 },
+	{ 0x16, 60, PH|DMT_RB, 68250, 1280, 1328, 1360, 1440, 768, 771, 778, 790 },
+	{ 0x17, 60, PV, 79500, 1280, 1344, 1472, 1664, 768, 771, 778, 798 },
+	{ 0x18, 75, PV, 102250, 1280, 1360, 1488, 1696, 768, 771, 778, 805 },
+	{ 0x19, 85, PV, 117500, 1280, 1360, 1496, 1712, 768, 771, 778, 809 },
+	{ 0x1a, 120, PH|DMT_RB, 140250, 1280, 1328, 1360, 1440, 768, 771, 778, 813 },
+	{ 0x1b, 60, PH|DMT_RB, 71000, 1280, 1328, 1360, 1440, 800, 803, 809, 823 },
+	{ 0x1c, 60, PV, 83500, 1280, 1352, 1480, 1680, 800, 803, 809, 831 },
+	{ 0x1d, 75, PV, 106500, 1280, 1360, 1488, 1696, 800, 803, 809, 838 },
+	{ 0x1e, 85, PV, 122500, 1280, 1360, 1496, 1712, 800, 803, 809, 843 },
+	{ 0x1f, 120, PH|DMT_RB, 146250, 1280, 1328, 1360, 1440, 800, 803, 809, 847 },
+	{ 0x20, 60, PH|PV, 108000, 1280, 1376, 1488, 1800, 960, 961, 964, 1000 },
+	{ 0x21, 85, PH|PV, 148500, 1280, 1344, 1504, 1728, 960, 961, 964, 1011 },
+	{ 0x22, 120, PH|DMT_RB, 175500, 1280, 1328, 1360, 1440, 960, 963, 967, 1017 },
+	{ 0x23, 60, PH|PV, 108000, 1280, 1328, 1440, 1688, 1024, 1025, 1028, 1066 },
+	{ 0x24, 75, PH|PV, 135000, 1280, 1296, 1440, 1688, 1024, 1025, 1028, 1066 },
+	{ 0x25, 85, PH|PV, 157500, 1280, 1344, 1504, 1728, 1024, 1025, 1028, 1072 },
+	{ 0x26, 120, PH|DMT_RB, 187250, 1280, 1328, 1360, 1440, 1024, 1027, 1034, 1084 },
+	{ 0x27, 60, PH|PV, 85500, 1360, 1424, 1536, 1792, 768, 771, 777, 795 },
+	{ 0x28, 120, PH|DMT_RB, 148250, 1360, 1408, 1440, 1520, 768, 771, 776, 813 },
+	{ 0x51, 60, PH|PV, 85500, 1366, 1436, 1579, 1792, 768, 771, 774, 798 },
+	{ 0x56, 60, PH|PV|DMT_RB, 72000, 1366, 1380, 1436, 1500, 768, 769, 772, 800 },
+	{ 0x29, 60, PH|DMT_RB, 101000, 1400, 1448, 1480, 1560, 1050, 1053, 1057, 1080 },
+	{ 0x2a, 60, PV, 121750, 1400, 1488, 1632, 1864, 1050, 1053, 1057, 1089 },
+	{ 0x2b, 75, PV, 156000, 1400, 1504, 1648, 1896, 1050, 1053, 1057, 1099 },
+	{ 0x2c, 85, PV, 179500, 1400, 1504, 1656, 1912, 1050, 1053, 1057, 1105 },
+	{ 0x2d, 120, PH|DMT_RB, 208000, 1400, 1448, 1480, 1560, 1050, 1053, 1057, 1112 },
+	{ 0x2e, 60, PH|DMT_RB, 88750, 1440, 1488, 1520, 1600, 900, 903, 909, 926 },
+	{ 0x2f, 60, PV, 106500, 1440, 1520, 1672, 1904, 900, 903, 909, 934 },
+	{ 0x30, 75, PV, 136750, 1440, 1536, 1688, 1936, 900, 903, 909, 942 },
+	{ 0x31, 85, PV, 157000, 1440, 1544, 1696, 1952, 900, 903, 909, 948 },
+	{ 0x32, 120, PH|DMT_RB, 182750, 1440, 1488, 1520, 1600, 900, 903, 909, 953 },
+	{ 0x53, 60, PH|PV|DMT_RB, 108000, 1600, 1624, 1704, 1800, 900, 901, 904, 1000 },
+	{ 0x33, 60, PH|PV, 162000, 1600, 1664, 1856, 2160, 1200, 1201, 1204, 1250 },
+	{ 0x34, 65, PH|PV, 175500, 1600, 1664, 1856, 2160, 1200, 1201, 1204, 1250 },
+	{ 0x35, 70, PH|PV, 189000, 1600, 1664, 1856, 2160, 1200, 1201, 1204, 1250 },
+	{ 0x36, 75, PH|PV, 202500, 1600, 1664, 1856, 2160, 1200, 1201, 1204, 1250 },
+	{ 0x37, 85, PH|PV, 229500, 1600, 1664, 1856, 2160, 1200, 1201, 1204, 1250 },
+	{ 0x38, 120, PH|DMT_RB, 268250, 1600, 1648, 1680, 1760, 1200, 1203, 1207, 1271 },
+	{ 0x39, 60, PH|DMT_RB, 119000, 1680, 1728, 1760, 1840, 1050, 1053, 1059, 1080 },
+	{ 0x3a, 60, PV, 146250, 1680, 1784, 1960, 2240, 1050, 1053, 1059, 1089 },
+	{ 0x3b, 75, PV, 187000, 1680, 1800, 1976, 2272, 1050, 1053, 1059, 1099 },
+	{ 0x3c, 85, PV, 214750, 1680, 1808, 1984, 2288, 1050, 1053, 1059, 1105 },
+	{ 0x3d, 120, PH|DMT_RB, 245500, 1680, 1728, 1760, 1840, 1050, 1053, 1059, 1112 },
+	{ 0x3e, 60, PV, 204750, 1792, 1920, 2120, 2448, 1344, 1345, 1348, 1394 },
+	{ 0x3f, 75, PV, 261000, 1792, 1888, 2104, 2456, 1344, 1345, 1348, 1417 },
+	{ 0x40, 120, PH|DMT_RB, 333250, 1792, 1840, 1872, 1952, 1344, 1347, 1351, 1423 },
+	{ 0x41, 60, PV, 218250, 1856, 1952, 2176, 2528, 1392, 1393, 1396, 1439 },
+	{ 0x42, 75, PV, 288000, 1856, 1984, 2208, 2560, 1392, 1393, 1396, 1500 },
+	{ 0x43, 120, PH|DMT_RB, 356500, 1856, 1904, 1936, 2016, 1392, 1395, 1399, 1474 },
+	{ 0x52, 60, PH|PV, 148500, 1920, 2008, 2052, 2200, 1080, 1084, 1089, 1125 },
+	{ 0x44, 60, PH|DMT_RB, 154000, 1920, 1968, 2000, 2080, 1200, 1203, 1209, 1235 },
+	{ 0x45, 60, PV, 193250, 1920, 2056, 2256, 2592, 1200, 1203, 1209, 1245 },
+	{ 0x46, 75, PV, 245250, 1920, 2056, 2264, 2608, 1200, 1203, 1209, 1255 },
+	{ 0x47, 85, PV, 281250, 1920, 2064, 2272, 2624, 1200, 1203, 1209, 1262 },
+	{ 0x48, 120, PH|DMT_RB, 317000, 1920, 1968, 2000, 2080, 1200, 1203, 1209, 1271 },
+	{ 0x49, 60, PV, 234000, 1920, 2048, 2256, 2600, 1440, 1441, 1444, 1500 },
+	{ 0x4a, 75, PV, 297000, 1920, 2064, 2288, 2640, 1440, 1441, 1444, 1500 },
+	{ 0x4b, 120, PH|DMT_RB, 380500, 1920, 1968, 2000, 2080, 1440, 1443, 1447, 1525 },
+	{ 0x54, 60, PH|PV|DMT_RB, 162000, 2048, 2074, 2154, 2250, 1152, 1153, 1156, 1200 },
+	{ 0x4c, 60, PH|DMT_RB, 268500, 2560, 2608, 2640, 2720, 1600, 1603, 1609, 1646 },
+	{ 0x4d, 60, PV, 348500, 2560, 2752, 3032, 3504, 1600, 1603, 1609, 1658 },
+	{ 0x4e, 75, PV, 443250, 2560, 2768, 3048, 3536, 1600, 1603, 1609, 1672 },
+	{ 0x4f, 85, PV, 505250, 2560, 2768, 3048, 3536, 1600, 1603, 1609, 1682 },
+	{ 0x50, 120, PH|DMT_RB, 552750, 2560, 2608, 2640, 2720, 1600, 1603, 1609, 1694 },
+	{ 0x57, 60, PH|DMT_RB, 556744, 4096, 4104, 4136, 4176, 2160, 2208, 2216, 2222 },
+};
+
+#define DMT_COUNT (sizeof(dmtTimings) / sizeof(dmtTimings[0]))
+
+/*
+An open addressed index into dmtTimings by width, height, refresh and
+reduced blanking: entry + 1, 0 for an empty slot.  Built once, on the
+first lookup.
+*/
+static uint8_t dmtIndex[DMT_INDEX];
+static pthread_once_t dmtIndexOnce = PTHREAD_ONCE_INIT;
+
+static unsigned int dmtHash( unsigned int width, unsigned int height, unsigned int refresh, int reduced )
+{
+	uint32_t key = (uint32_t)width * 2654435761u ^ (uint32_t)height * 40503u ^ refresh * 97u ^ (reduced ? 0x5bd1e995u : 0);
+	return (key ^ key >> 16) & (DMT_INDEX - 1);
+}
+
+static void buildDmtIndex( void )
+{
+	size_t ii;
+
+	for ( ii = 0; ii < DMT_COUNT; ii++ )
+	{
+		const dmtEntry *dmt = &dmtTimings[ii];
+		unsigned int slot = dmtHash( dmt->hActive, dmt->vActive, dmt->refresh, (dmt->flags & DMT_RB) != 0 );
+		while ( dmtIndex[slot] != 0 )
+			slot = (slot + 1) & (DMT_INDEX - 1);
+		dmtIndex[slot] = (uint8_t)(ii + 1);
+	}
+}
+
+static const dmtEntry *findDMT( unsigned int width, unsigned int height, unsigned int refresh, int reduced )
+{
+	unsigned int slot = dmtHash( width, height, refresh, reduced );
+
+	pthread_once( &dmtIndexOnce, buildDmtIndex );
+	for ( ; dmtIndex[slot] != 0; slot = (slot + 1) & (DMT_INDEX - 1) )
+	{
+		const dmtEntry *dmt = &dmtTimings[dmtIndex[slot] - 1];
+		if ( dmt->hActive == width && dmt->vActive == height && dmt->refresh == refresh &&
+				((dmt->flags & DMT_RB) != 0) == (reduced != 0) )
+			return dmt;
+	}
+	return NULL;
+}
+
+/*
+Fills in the rates from the clock and the totals.
+*/
+static void timingRates( displayTiming *timing )
+{
+	double frames = (double)timing->pixelClock * 1000 / ((double)timing->hTotal * timing->vTotal);
+
+	timing->hRate = (double)timing->pixelClock / timing->hTotal;
+	timing->refresh = (timing->flags & TIMING_INTERLACED) ? frames * 2 : frames;
+}
+
+int timingDMT( size_t width, size_t height, double refresh, int reducedBlanking, displayTiming *timing )
+{
+	const dmtEntry *dmt;
+	unsigned int rate = (unsigned int)(refresh + 0.5);
+
+	if ( width > 65535 || height > 65535 || refresh <= 0 || refresh > 255 )
+		return -1;
+	dmt = findDMT( (unsigned int)width, (unsigned int)height, rate, reducedBlanking );
+	if ( dmt == NULL )
+		dmt = findDMT( (unsigned int)width, (unsigned int)height, rate, !reducedBlanking );
+	if ( dmt == NULL )
+		return -1;
+
+	memset( timing, 0, sizeof(displayTiming) );
+	timing->pixelClock = dmt->clock;
+	timing->hActive = dmt->hActive;
+	timing->hFrontPorch = dmt->hSyncStart - dmt->hActive;
+	timing->hSync = dmt->hSyncEnd - dmt->hSyncStart;
+	timing->hBackPorch = dmt->hTotal - dmt->hSyncEnd;
+	timing->hTotal = dmt->hTotal;
+	timing->vActive = dmt->vActive;
+	timing->vFrontPorch = dmt->vSyncStart - dmt->vActive;
+	timing->vSync = dmt->vSyncEnd - dmt->vSyncStart;
+	timing->vBackPorch = dmt->vTotal - dmt->vSyncEnd;
+	timing->vTotal = dmt->vTotal;
+	timing->flags = dmt->flags & ~DMT_RB;
+	timing->source = TIMING_DMT;
+	timing->dmtID = dmt->id;
+	timingRates( timing );
+	return 0;
+}
+
+/*
+CVT's vertical sync width says what the aspect ratio is.
+*/
+static unsigned int cvtSyncWidth( size_t width, size_t height )
+{
+	if ( height * 4 / 3 == width )
+		return 4;
+	if ( height * 16 / 9 == width || (height * 16 / 9 + 8) / 8 * 8 == width )
+		return 5;
+	if ( height * 16 / 10 == width )
+		return 6;
+	if ( height * 5 / 4 == width || height * 15 / 9 == width )
+		return 7;
+	return 10;
+}
+
+int timingCVT( size_t width, size_t height, double refresh, int source, int interlaced, displayTiming *timing )
+{
+	// CVT 1.2: cell granularity, minimum vertical porches, the blanking formula's C' and M'
+	const double cellGran = 8, minVPorch = 3, minVBackPorch = 6, minVSyncBP = 550;
+	const double cPrime = 30, mPrime = 300;
+	double hPixels, vLines, fieldRate, hPeriod, totalPixels, clock;
+	double interlace = interlaced ? 0.5 : 0;
+	unsigned int vSync, vBlank;
+
+	if ( width < 64 || height < 64 || width > 16384 || height > 16384 || !(refresh >= 10 && refresh <= 500) )
+		return -1;
+	if ( source == TIMING_CVT_RB && refresh != 60 * FLOOR( refresh / 60 ) )
+		return -1;
+	if ( interlaced && source != TIMING_CVT )
+		return -1;
+
+	memset( timing, 0, sizeof(displayTiming) );
+	hPixels = source == TIMING_CVT_RB2 ? (double)width : FLOOR( width / cellGran ) * cellGran;
+	vLines = interlaced ? FLOOR( height / 2.0 ) : (double)height;
+	fieldRate = interlaced ? refresh * 2 : refresh;
+	vSync = source == TIMING_CVT_RB2 ? 8 : cvtSyncWidth( width, height );
+
+	if ( source == TIMING_CVT )
+	{
+		double vSyncBP, dutyCycle, hBlank;
+
+		hPeriod = (1e6 / fieldRate - minVSyncBP) / (vLines + minVPorch + interlace);
+		if ( hPeriod <= 0 )
+			return -1;
+		vSyncBP = FLOOR( minVSyncBP / hPeriod ) + 1;
+		if ( vSyncBP < vSync + minVBackPorch )
+			vSyncBP = vSync + minVBackPorch;
+		vBlank = (unsigned int)(vSyncBP + minVPorch);
+		dutyCycle = cPrime - mPrime * hPeriod / 1000;
+		if ( dutyCycle < 20 )
+			dutyCycle = 20;
+		hBlank = FLOOR( hPixels * dutyCycle / (100 - dutyCycle) / (2 * cellGran) ) * 2 * cellGran;
+		totalPixels = hPixels + hBlank;
+		clock = 250 * FLOOR( totalPixels / hPeriod * 1000 / 250 );      // kHz, in 0.25 MHz steps
+		timing->hSync = (uint16_t)(FLOOR( 0.08 * totalPixels / cellGran ) * cellGran);
+		timing->hBackPorch = (uint16_t)(hBlank / 2);
+		timing->hFrontPorch = (uint16_t)(hBlank - timing->hSync - timing->hBackPorch);
+		timing->vFrontPorch = (uint16_t)minVPorch;
+		timing->vBackPorch = (uint16_t)(vSyncBP - vSync);
+		timing->flags = TIMING_VSYNC_POSITIVE;
+	} else {
+		// reduced blanking: a fixed horizontal blank, enough lines for 460 us of vertical blank
+		const double minVBlank = 460;
+		double hBlank = source == TIMING_CVT_RB2 ? 80 : 160;
+		unsigned int minVbi = source == TIMING_CVT_RB2 ? 1 + vSync + 6 : 3 + vSync + 6;
+		double totalLines;
+
+		hPeriod = (1e6 / fieldRate - minVBlank) / vLines;
+		if ( hPeriod <= 0 )
+			return -1;
+		vBlank = (unsigned int)FLOOR( minVBlank / hPeriod ) + 1;
+		if ( vBlank < minVbi )
+			vBlank = minVbi;
+		totalLines = vLines + vBlank;
+		totalPixels = hPixels + hBlank;
+		if ( source == TIMING_CVT_RB2 )
+			clock = FLOOR( fieldRate * totalLines * totalPixels / 1000 );                    // 1 kHz steps
+		else
+			clock = 250 * FLOOR( fieldRate * totalLines * totalPixels / 1000 / 250 );        // 0.25 MHz steps
+		timing->hSync = 32;
+		timing->hFrontPorch = source == TIMING_CVT_RB2 ? 8 : 48;
+		timing->hBackPorch = (uint16_t)(hBlank - timing->hSync - timing->hFrontPorch);
+		if ( source == TIMING_CVT_RB2 )
+		{
+			timing->vBackPorch = 6;
+			timing->vFrontPorch = (uint16_t)(vBlank - vSync - 6);
+		} else {
+			timing->vFrontPorch = 3;
+			timing->vBackPorch = (uint16_t)(vBlank - vSync - 3);
+		}
+		timing->flags = TIMING_HSYNC_POSITIVE;
+	}
+	if ( clock <= 0 || totalPixels > 65535 )
+		return -1;
+
+	timing->pixelClock = (uint32_t)clock;
+	timing->hActive = (uint16_t)hPixels;
+	timing->hTotal = (uint16_t)totalPixels;
+	timing->vSync = (uint16_t)vSync;
+	if ( interlaced )
+	{
+		// two fields, each vBlank and a half lines of blanking
+		timing->vActive = (uint16_t)(vLines * 2);
+		timing->vTotal = (uint16_t)(vLines * 2 + vBlank * 2 + 1);
+		timing->flags |= TIMING_INTERLACED;
+	} else {
+		timing->vActive = (uint16_t)vLines;
+		timing->vTotal = (uint16_t)(vLines + vBlank);
+	}
+	timing->source = (uint8_t)source;
+	timingRates( timing );
+	return 0;
+}
+
+int timingCheck( const displayTiming *timing, const timingLimits *limits )
+{
+	if ( limits == NULL )
+		return TIMING_OK;
+	if ( limits->maxPixelClock != 0 && timing->pixelClock > limits->maxPixelClock )
+		return TIMING_CLOCK_TOO_HIGH;
+	if ( (limits->minHRate != 0 && timing->hRate < limits->minHRate - 0.5) ||
+			(limits->maxHRate != 0 && timing->hRate > limits->maxHRate + 0.5) )
+		return TIMING_HRATE_OUT;
+	if ( (limits->minVRate != 0 && timing->refresh < limits->minVRate - 0.5) ||
+			(limits->maxVRate != 0 && timing->refresh > limits->maxVRate + 0.5) )
+		return TIMING_VRATE_OUT;
+	return TIMING_OK;
+}
+
+int timingFor( size_t width, size_t height, double refresh, const timingLimits *limits, displayTiming *timing )
+{
+	if ( timingDMT( width, height, refresh, 1, timing ) != 0 &&
+			timingCVT( width, height, refresh, refresh == 60 * FLOOR( refresh / 60 ) ? TIMING_CVT_RB : TIMING_CVT_RB2, 0, timing ) != 0 &&
+			timingCVT( width, height, refresh, TIMING_CVT, 0, timing ) != 0 )
+		return -1;
+	return timingCheck( timing, limits );
+}
+
+const char *timingCheckName( int check )
+{
+	switch ( check )
+	{
+		case TIMING_OK:
+			return "within limits";
+		case TIMING_CLOCK_TOO_HIGH:
+			return "pixel clock too high";
+		case TIMING_HRATE_OUT:
+			return "line rate out of range";
+		case TIMING_VRATE_OUT:
+			return "refresh rate out of range";
+	}
+	return "no timing";
+}
+
+const char *timingSourceName( int source )
+{
+	static const char *names[] = { "DMT", "CVT", "CVT-RB", "CVT-RB2" };
+	return (unsigned int)source < sizeof(names) / sizeof(names[0]) ? names[source] : "?";
+}
+
+void timingCatalogLimits( const modeCatalog *catalog, timingLimits *limits )
+{
+	displayModeDesc desc;
+	displayTiming timing;
+	uint32_t ii;
+
+	memset( limits, 0, sizeof(timingLimits) );
+	if ( catalog == NULL )
+		return;
+	for ( ii = 0; ii < catalog->numModes; ii++ )
+	{
+		catalogModeDesc( catalog, ii, &desc );
+		// built-in panels say 0
+		if ( timingFor( desc.mode.width, desc.mode.height, desc.mode.refresh > 0 ? desc.mode.refresh : 60, NULL, &timing ) < 0 )
+			continue;
+		if ( timing.pixelClock > limits->maxPixelClock )
+			limits->maxPixelClock = timing.pixelClock;
+		if ( limits->minHRate == 0 || timing.hRate < limits->minHRate )
+			limits->minHRate = timing.hRate;
+		if ( timing.hRate > limits->maxHRate )
+			limits->maxHRate = timing.hRate;
+		if ( limits->minVRate == 0 || timing.refresh < limits->minVRate )
+			limits->minVRate = timing.refresh;
+		if ( timing.refresh > limits->maxVRate )
+			limits->maxVRate = timing.refresh;
+	}
+}
+
+/////////////////
+
+static const struct
+{
+	unsigned int width, height;
+	const char *name;
+} aspectNames[] =
+{
+	{ 4, 3, "4:3" }, { 5, 4, "5:4" }, { 16, 9, "16:9" }, { 16, 10, "16:10" }, { 3, 2, "3:2" },
+	{ 64, 27, "21:9" }, { 43, 18, "21:9" }, { 32, 9, "32:9" }, { 17, 9, "17:9" }, { 1, 1, "1:1" },
+};
+
+int timingSameAspect( size_t width1, size_t height1, size_t width2, size_t height2 )
+{
+	double a, b;
+
+	if ( height1 == 0 || height2 == 0 )
+		return width1 == width2 && height1 == height2;
+	a = (double)width1 / height1;
+	b = (double)width2 / height2;
+	return a - b <= 0.02 * b && b - a <= 0.02 * b;
+}
+
+const char *timingAspectName( size_t width, size_t height, char *buf, size_t size )
+{
+	size_t ii, a = width, b = height;
+
+	for ( ii = 0; ii < sizeof(aspectNames) / sizeof(aspectNames[0]); ii++ )
+	{
+		if ( timingSameAspect( width, height, aspectNames[ii].width, aspectNames[ii].height ) )
+			return aspectNames[ii].name;
+	}
+	while ( b != 0 )
+	{
+		size_t t = a % b;
+		a = b;
+		b = t;
+	}
+	if ( a == 0 )
+		a = 1;
+	snprintf( buf, size, "%zu:%zu", width / a, height / a );
+	return buf;
+}
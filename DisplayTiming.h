@@ -0,0 +1,108 @@
+/*
+DisplayTiming.h
+
+Video timings for a width, height and refresh rate: the VESA DMT
+timing if there is one (a table compiled in, looked up through an
+index into it, so a lookup is a few compares), otherwise one worked out
+with the VESA CVT formulas, with reduced blanking (the way digital
+displays are driven) or without (CRTs and VGA KVMs).  Nothing is
+allocated, so this can run on the way to setting the displays at login.
+
+What it is for: when the mode asked for isn't in a display's list, say
+what the mode would have taken and whether that is more than the
+display has shown it can do (timingCatalogLimits), instead of
+quietly settling for the closest mode.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef DISPLAYTIMING_H
+#define DISPLAYTIMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "DisplayBackend.h"
+#include "ModeCatalog.h"
+
+// where a timing came from
+#define TIMING_DMT      0
+#define TIMING_CVT      1
+#define TIMING_CVT_RB   2       // reduced blanking, CVT 1.1
+#define TIMING_CVT_RB2  3       // reduced blanking v2, CVT 1.2, any refresh rate
+
+// flags
+#define TIMING_INTERLACED      0x1
+#define TIMING_HSYNC_POSITIVE  0x2
+#define TIMING_VSYNC_POSITIVE  0x4
+
+// timingCheck
+#define TIMING_OK              0
+#define TIMING_CLOCK_TOO_HIGH  1    // more pixels a second than the limit
+#define TIMING_HRATE_OUT       2    // line rate outside the limits
+#define TIMING_VRATE_OUT       3    // refresh rate outside the limits
+
+typedef struct
+{
+	uint32_t pixelClock;        // kHz
+	uint16_t hActive, hFrontPorch, hSync, hBackPorch, hTotal;
+	uint16_t vActive, vFrontPorch, vSync, vBackPorch, vTotal;  // lines of a frame (porches and sync of a field)
+	uint8_t flags;
+	uint8_t source;             // TIMING_DMT ...
+	uint8_t dmtID;              // for TIMING_DMT
+	double refresh;             // Hz, what the timing really comes to (the field rate if interlaced)
+	double hRate;               // kHz
+} displayTiming;
+
+/*
+What a display can take.  0 means not known, and isn't checked.
+*/
+typedef struct
+{
+	uint32_t maxPixelClock;     // kHz
+	double minHRate, maxHRate;  // kHz
+	double minVRate, maxVRate;  // Hz
+} timingLimits;
+
+/*
+The DMT timing for the mode, the reduced blanking one first if
+reducedBlanking and there are both.  refresh is rounded to the Hz.
+Returns 0, or -1 if DMT has none.
+*/
+int timingDMT( size_t width, size_t height, double refresh, int reducedBlanking, displayTiming *timing );
+
+/*
+The CVT timing, source TIMING_CVT, TIMING_CVT_RB (refresh a multiple
+of 60 Hz only, as the standard says) or TIMING_CVT_RB2.  Returns 0, or
+-1 if the numbers are out of what CVT covers.
+*/
+int timingCVT( size_t width, size_t height, double refresh, int source, int interlaced, displayTiming *timing );
+
+/*
+The timing a display would be driven at: DMT if there is one, otherwise
+CVT reduced blanking (v1 at multiples of 60 Hz, v2 at anything else),
+otherwise CVT.  Returns -1 if none of them can do it, otherwise what
+timingCheck makes of it against limits (which may be NULL).
+*/
+int timingFor( size_t width, size_t height, double refresh, const timingLimits *limits, displayTiming *timing );
+
+int timingCheck( const displayTiming *timing, const timingLimits *limits );
+const char *timingCheckName( int check );
+const char *timingSourceName( int source );
+
+/*
+The limits a display has shown it can take: the fastest pixel clock and
+line rate and the lowest and highest refresh of the timings of the
+modes in its catalog.
+*/
+void timingCatalogLimits( const modeCatalog *catalog, timingLimits *limits );
+
+/*
+The aspect ratio's usual name ("16:9", also for 1366x768), or width:height
+reduced.  buf needs 24 bytes.  timingSameAspect allows 2% either way.
+*/
+const char *timingAspectName( size_t width, size_t height, char *buf, size_t size );
+int timingSameAspect( size_t width1, size_t height1, size_t width2, size_t height2 );
+
+#endif
@@ -0,0 +1,261 @@
+/*
+DisplayTrace.c
+
+See DisplayTrace.h.
+
+Spans go into one growing array under a mutex; a trace left on in a
+resident SetDisplay stops recording at TRACE_MAX_SPANS and counts what
+it dropped instead.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "DisplayTrace.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Clock.h"
+
+#define TRACE_MAX_SPANS (1 << 20)
+
+typedef struct
+{
+	uint64_t start;
+	uint64_t end;
+	displayID display;
+	tracePhase phase;
+} traceSpan;
+
+struct displayTrace
+{
+	pthread_mutex_t lock;
+	uint64_t created;
+	traceSpan *spans;
+	size_t numSpans;
+	size_t maxSpans;
+	unsigned long dropped;
+};
+
+// what a phase adds up to for one display
+typedef struct
+{
+	displayID display;
+	uint64_t first;
+	uint64_t last;
+	uint64_t total[TRACE_PHASES];
+	unsigned long calls[TRACE_PHASES];
+} traceRow;
+
+static const char *phaseNames[TRACE_PHASES] =
+{
+	"displays", "identify", "current", "mirror", "edid", "list", "cache", "catalog", "match",
+	"begin", "configure", "commit", "cancel"
+};
+
+displayTrace *traceCreate( void )
+{
+	displayTrace *trace = calloc( 1, sizeof(displayTrace) );
+
+	if ( trace == NULL )
+		return NULL;
+	pthread_mutex_init( &trace->lock, NULL );
+	trace->created = clockNanoseconds();
+	return trace;
+}
+
+void traceDestroy( displayTrace *trace )
+{
+	if ( trace == NULL )
+		return;
+	pthread_mutex_destroy( &trace->lock );
+	free( trace->spans );
+	free( trace );
+}
+
+uint64_t traceStart( const displayTrace *trace )
+{
+	return trace != NULL ? clockNanoseconds() : 0;
+}
+
+void traceEnd( displayTrace *trace, tracePhase phase, displayID display, uint64_t started )
+{
+	uint64_t now;
+	traceSpan *span;
+
+	if ( trace == NULL )
+		return;
+	now = clockNanoseconds();
+	pthread_mutex_lock( &trace->lock );
+	if ( trace->numSpans == trace->maxSpans )
+	{
+		size_t maxSpans = trace->maxSpans ? trace->maxSpans * 2 : 256;
+		traceSpan *spans = maxSpans <= TRACE_MAX_SPANS ? realloc( trace->spans, maxSpans * sizeof(traceSpan) ) : NULL;
+		if ( spans == NULL )
+		{
+			trace->dropped++;
+			pthread_mutex_unlock( &trace->lock );
+			return;
+		}
+		trace->spans = spans;
+		trace->maxSpans = maxSpans;
+	}
+	span = &trace->spans[trace->numSpans++];
+	span->start = started;
+	span->end = now;
+	span->display = display;
+	span->phase = phase;
+	pthread_mutex_unlock( &trace->lock );
+}
+
+const char *tracePhaseName( tracePhase phase )
+{
+	return (unsigned int)phase < TRACE_PHASES ? phaseNames[phase] : "?";
+}
+
+/*
+One row per display, in the order they first show up, the session's
+own (kNullDisplay) first.  Call with the lock held.
+*/
+static traceRow *traceRows( displayTrace *trace, size_t *numRows )
+{
+	traceRow *rows = calloc( 1, sizeof(traceRow) );
+	size_t count = 1, ii, jj;
+
+	*numRows = 0;
+	if ( rows == NULL )
+		return NULL;
+	rows[0].display = kNullDisplay;
+	for ( ii = 0; ii < trace->numSpans; ii++ )
+	{
+		const traceSpan *span = &trace->spans[ii];
+		traceRow *row;
+
+		for ( jj = 0; jj < count; jj++ )
+		{
+			if ( rows[jj].display == span->display )
+				break;
+		}
+		if ( jj == count )
+		{
+			traceRow *grown = realloc( rows, (count + 1) * sizeof(traceRow) );
+			if ( grown == NULL )
+				continue;
+			rows = grown;
+			memset( &rows[count], 0, sizeof(traceRow) );
+			rows[count++].display = span->display;
+		}
+		row = &rows[jj];
+		if ( row->first == 0 || span->start < row->first )
+			row->first = span->start;
+		if ( span->end > row->last )
+			row->last = span->end;
+		row->total[span->phase] += span->end - span->start;
+		row->calls[span->phase]++;
+	}
+	*numRows = count;
+	return rows;
+}
+
+static void printRow( FILE *out, const char *label, const traceRow *row, const int *shown )
+{
+	int phase;
+
+	fprintf( out, "%-12s", label );
+	for ( phase = 0; phase < TRACE_PHASES; phase++ )
+	{
+		if ( shown[phase] )
+			fprintf( out, " %9.3f", row->total[phase] / 1e6 );
+	}
+	fprintf( out, " %9.3f\n", row->last > row->first ? (row->last - row->first) / 1e6 : 0.0 );
+}
+
+void tracePrintSummary( displayTrace *trace, FILE *out )
+{
+	traceRow *rows, all;
+	size_t numRows, ii;
+	int shown[TRACE_PHASES];
+	int phase;
+
+	pthread_mutex_lock( &trace->lock );
+	rows = traceRows( trace, &numRows );
+	pthread_mutex_unlock( &trace->lock );
+	if ( rows == NULL )
+		return;
+
+	memset( &all, 0, sizeof(all) );
+	for ( ii = 0; ii < numRows; ii++ )
+	{
+		if ( rows[ii].first != 0 && (all.first == 0 || rows[ii].first < all.first) )
+			all.first = rows[ii].first;
+		if ( rows[ii].last > all.last )
+			all.last = rows[ii].last;
+		for ( phase = 0; phase < TRACE_PHASES; phase++ )
+		{
+			all.total[phase] += rows[ii].total[phase];
+			all.calls[phase] += rows[ii].calls[phase];
+		}
+	}
+
+	fprintf( out, "%-12s", "ms" );
+	for ( phase = 0; phase < TRACE_PHASES; phase++ )
+	{
+		shown[phase] = all.calls[phase] != 0;
+		if ( shown[phase] )
+			fprintf( out, " %9s", phaseNames[phase] );
+	}
+	fprintf( out, " %9s\n", "wall" );
+	for ( ii = 0; ii < numRows; ii++ )
+	{
+		char label[16];
+		if ( rows[ii].display == kNullDisplay && rows[ii].last == 0 )
+			continue;
+		if ( rows[ii].display == kNullDisplay )
+			snprintf( label, sizeof(label), "session" );
+		else
+			snprintf( label, sizeof(label), "0x%x", (unsigned int)rows[ii].display );
+		printRow( out, label, &rows[ii], shown );
+	}
+	printRow( out, "all", &all, shown );
+	if ( trace->dropped != 0 )
+		fprintf( out, "(%lu span(s) not recorded)\n", trace->dropped );
+	free( rows );
+}
+
+int traceWriteChrome( displayTrace *trace, const char *path )
+{
+	FILE *out = fopen( path, "w" );
+	traceRow *rows;
+	size_t numRows, ii;
+	const char *sep = ",\n";
+
+	if ( out == NULL )
+		return -1;
+	pthread_mutex_lock( &trace->lock );
+	fprintf( out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+	fprintf( out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"SetDisplay\"}}" );
+	rows = traceRows( trace, &numRows );
+	for ( ii = 0; rows != NULL && ii < numRows; ii++ )
+	{
+		if ( rows[ii].display == kNullDisplay )
+			fprintf( out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"session\"}}", sep );
+		else
+			fprintf( out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"display 0x%x\"}}",
+					sep, (unsigned int)rows[ii].display, (unsigned int)rows[ii].display );
+	}
+	free( rows );
+	for ( ii = 0; ii < trace->numSpans; ii++ )
+	{
+		const traceSpan *span = &trace->spans[ii];
+		fprintf( out, "%s{\"name\":\"%s\",\"cat\":\"display\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				sep, phaseNames[span->phase], (unsigned int)span->display,
+				(span->start - trace->created) / 1e3, (span->end - span->start) / 1e3 );
+	}
+	fprintf( out, "\n]}\n" );
+	pthread_mutex_unlock( &trace->lock );
+	if ( fclose( out ) != 0 )
+		return -1;
+	return 0;
+}
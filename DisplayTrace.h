@@ -0,0 +1,70 @@
+/*
+DisplayTrace.h
+
+Where the time goes: every backend call, and the catalog building and
+matching in between, recorded per display as a span on the monotonic
+clock.  Hang a trace on a backend (and a session, sessionSetTrace) and
+at the end print a table of the phases per display or write the spans
+out as a Chrome trace-event file (chrome://tracing, Perfetto), one row
+per display.
+
+Recording takes a lock, so workers can record into the same trace.
+Without a trace nothing is timed.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef DISPLAYTRACE_H
+#define DISPLAYTRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "DisplayBackend.h"
+
+typedef enum
+{
+	TRACE_DISPLAYS,             // the online display list
+	TRACE_IDENTIFY,
+	TRACE_CURRENT,              // current mode
+	TRACE_MIRROR,               // what the display mirrors
+	TRACE_EDID,                 // reading the monitor's EDID
+	TRACE_LIST,                 // the backend's mode list
+	TRACE_CACHE,                // looking the monitor up in the mode cache
+	TRACE_CATALOG,              // building the catalog from a mode list
+	TRACE_MATCH,
+	TRACE_BEGIN,                // begin configuration
+	TRACE_CONFIGURE,            // mode and mirroring, per display
+	TRACE_COMMIT,               // complete configuration, waits for the displays on a Mac
+	TRACE_CANCEL,
+	TRACE_PHASES
+} tracePhase;
+
+typedef struct displayTrace displayTrace;
+
+displayTrace *traceCreate( void );
+void traceDestroy( displayTrace *trace );
+
+/*
+traceStart is the clock if there is a trace (0 if trace is NULL);
+traceEnd records the phase for the display (kNullDisplay for what
+isn't one display's) from then to now.
+*/
+uint64_t traceStart( const displayTrace *trace );
+void traceEnd( displayTrace *trace, tracePhase phase, displayID display, uint64_t started );
+
+const char *tracePhaseName( tracePhase phase );
+
+/*
+A line per display with the time spent in each phase, and the whole.
+*/
+void tracePrintSummary( displayTrace *trace, FILE *out );
+
+/*
+The spans as Chrome trace-event JSON.  Returns 0, or -1 if path
+couldn't be written.
+*/
+int traceWriteChrome( displayTrace *trace, const char *path );
+
+#endif
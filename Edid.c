@@ -0,0 +1,541 @@
+/*
+Edid.c
+
+See Edid.h.  The layouts are those of VESA E-EDID 1.4, CTA-861-G and
+DisplayID 1.3 / 2.0.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "Edid.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EDID_DESCRIPTORS    54      // the four 18 byte descriptors of the base block
+#define EDID_DESCRIPTOR     18
+
+#define CTA_EXTENSION       0x02
+#define DISPLAYID_EXTENSION 0x70
+
+typedef struct
+{
+	uint16_t width;
+	uint16_t height;
+	uint8_t refresh;
+} edidTiming;
+
+// established timings I and II, bytes 35 to 37, most significant bit first
+static const edidTiming establishedTimings[17] =
+{
+	{ 720, 400, 70 }, { 720, 400, 88 }, { 640, 480, 60 }, { 640, 480, 67 },
+	{ 640, 480, 72 }, { 640, 480, 75 }, { 800, 600, 56 }, { 800, 600, 60 },
+	{ 800, 600, 72 }, { 800, 600, 75 }, { 832, 624, 75 }, { 1024, 768, 87 },
+	{ 1024, 768, 60 }, { 1024, 768, 70 }, { 1024, 768, 75 }, { 1280, 1024, 75 },
+	{ 1152, 870, 75 },
+};
+
+// established timings III (descriptor 0xF7), bytes 6 to 11, most significant bit first
+static const edidTiming establishedTimings3[44] =
+{
+	{ 640, 350, 85 }, { 640, 400, 85 }, { 720, 400, 85 }, { 640, 480, 85 },
+	{ 848, 480, 60 }, { 800, 600, 85 }, { 1024, 768, 85 }, { 1152, 864, 75 },
+	{ 1280, 768, 60 }, { 1280, 768, 60 }, { 1280, 768, 75 }, { 1280, 768, 85 },
+	{ 1280, 960, 60 }, { 1280, 960, 85 }, { 1280, 1024, 60 }, { 1280, 1024, 85 },
+	{ 1360, 768, 60 }, { 1440, 900, 60 }, { 1440, 900, 60 }, { 1440, 900, 75 },
+	{ 1440, 900, 85 }, { 1400, 1050, 60 }, { 1400, 1050, 60 }, { 1400, 1050, 75 },
+	{ 1400, 1050, 85 }, { 1680, 1050, 60 }, { 1680, 1050, 60 }, { 1680, 1050, 75 },
+	{ 1680, 1050, 85 }, { 1600, 1200, 60 }, { 1600, 1200, 65 }, { 1600, 1200, 70 },
+	{ 1600, 1200, 75 }, { 1600, 1200, 85 }, { 1792, 1344, 60 }, { 1792, 1344, 75 },
+	{ 1856, 1392, 60 }, { 1856, 1392, 75 }, { 1920, 1200, 60 }, { 1920, 1200, 60 },
+	{ 1920, 1200, 75 }, { 1920, 1200, 85 }, { 1920, 1440, 60 }, { 1920, 1440, 75 },
+};
+
+/*
+CTA-861 video identification codes 1 to 107, the picture as the
+display shows it (pixel repetition taken out), at the nominal rate.
+Codes that aren't listed are skipped.
+*/
+static const edidTiming ctaTimings[108] =
+{
+	{ 0, 0, 0 },
+	{ 640, 480, 60 }, { 720, 480, 60 }, { 720, 480, 60 }, { 1280, 720, 60 },           // 1
+	{ 1920, 1080, 60 }, { 720, 480, 60 }, { 720, 480, 60 }, { 720, 240, 60 },          // 5
+	{ 720, 240, 60 }, { 720, 480, 60 }, { 720, 480, 60 }, { 720, 240, 60 },            // 9
+	{ 720, 240, 60 }, { 720, 480, 60 }, { 720, 480, 60 }, { 1920, 1080, 60 },          // 13
+	{ 720, 576, 50 }, { 720, 576, 50 }, { 1280, 720, 50 }, { 1920, 1080, 50 },         // 17
+	{ 720, 576, 50 }, { 720, 576, 50 }, { 720, 288, 50 }, { 720, 288, 50 },            // 21
+	{ 720, 576, 50 }, { 720, 576, 50 }, { 720, 288, 50 }, { 720, 288, 50 },            // 25
+	{ 720, 576, 50 }, { 720, 576, 50 }, { 1920, 1080, 50 }, { 1920, 1080, 24 },        // 29
+	{ 1920, 1080, 25 }, { 1920, 1080, 30 }, { 720, 480, 60 }, { 720, 480, 60 },        // 33
+	{ 720, 576, 50 }, { 720, 576, 50 }, { 1920, 1080, 50 }, { 1920, 1080, 100 },       // 37
+	{ 1280, 720, 100 }, { 720, 576, 100 }, { 720, 576, 100 }, { 720, 576, 100 },       // 41
+	{ 720, 576, 100 }, { 1920, 1080, 120 }, { 1280, 720, 120 }, { 720, 480, 120 },     // 45
+	{ 720, 480, 120 }, { 720, 480, 120 }, { 720, 480, 120 }, { 720, 576, 200 },        // 49
+	{ 720, 576, 200 }, { 720, 576, 200 }, { 720, 576, 200 }, { 720, 480, 240 },        // 53
+	{ 720, 480, 240 }, { 720, 480, 240 }, { 720, 480, 240 }, { 1280, 720, 24 },        // 57
+	{ 1280, 720, 25 }, { 1280, 720, 30 }, { 1920, 1080, 120 }, { 1920, 1080, 100 },    // 61
+	{ 1280, 720, 24 }, { 1280, 720, 25 }, { 1280, 720, 30 }, { 1280, 720, 50 },        // 65, 64:27 from here
+	{ 1280, 720, 60 }, { 1280, 720, 100 }, { 1280, 720, 120 }, { 1920, 1080, 24 },     // 69
+	{ 1920, 1080, 25 }, { 1920, 1080, 30 }, { 1920, 1080, 50 }, { 1920, 1080, 60 },    // 73
+	{ 1920, 1080, 100 }, { 1920, 1080, 120 }, { 1680, 720, 24 }, { 1680, 720, 25 },    // 77
+	{ 1680, 720, 30 }, { 1680, 720, 50 }, { 1680, 720, 60 }, { 1680, 720, 100 },       // 81
+	{ 1680, 720, 120 }, { 2560, 1080, 24 }, { 2560, 1080, 25 }, { 2560, 1080, 30 },    // 85
+	{ 2560, 1080, 50 }, { 2560, 1080, 60 }, { 2560, 1080, 100 }, { 2560, 1080, 120 },  // 89
+	{ 3840, 2160, 24 }, { 3840, 2160, 25 }, { 3840, 2160, 30 }, { 3840, 2160, 50 },    // 93
+	{ 3840, 2160, 60 }, { 4096, 2160, 24 }, { 4096, 2160, 25 }, { 4096, 2160, 30 },    // 97
+	{ 4096, 2160, 50 }, { 4096, 2160, 60 }, { 3840, 2160, 24 }, { 3840, 2160, 25 },    // 101
+	{ 3840, 2160, 30 }, { 3840, 2160, 50 }, { 3840, 2160, 60 },                        // 105
+};
+
+static const uint8_t edidHeader[8] = { 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00 };
+
+/*
+Where the modes go while a parse runs.
+*/
+typedef struct
+{
+	displayModeDesc *modes;
+	size_t count;
+	size_t max;
+} modeSink;
+
+static unsigned int le16( const uint8_t *p )
+{
+	return p[0] | (unsigned int)p[1] << 8;
+}
+
+static unsigned int le24( const uint8_t *p )
+{
+	return p[0] | (unsigned int)p[1] << 8 | (unsigned int)p[2] << 16;
+}
+
+static int blockChecksumOK( const uint8_t *block )
+{
+	uint8_t sum = 0;
+	int ii;
+
+	for ( ii = 0; ii < EDID_BLOCK; ii++ )
+		sum += block[ii];
+	return sum == 0;
+}
+
+static void addMode( modeSink *sink, unsigned int width, unsigned int height, double refresh )
+{
+	displayModeDesc *desc;
+	size_t ii;
+
+	// !(refresh <= EDID_MAX_REFRESH) is true of NaN too
+	if ( width == 0 || height == 0 || refresh <= 0 || !(refresh <= EDID_MAX_REFRESH) || sink->count == sink->max )
+		return;
+	for ( ii = 0; ii < sink->count; ii++ )
+	{
+		const displayMode *mode = &sink->modes[ii].mode;
+		if ( mode->width == width && mode->height == height && mode->refresh == refresh )
+			return;
+	}
+	desc = &sink->modes[sink->count++];
+	memset( desc, 0, sizeof(displayModeDesc) );
+	desc->mode.width = width;
+	desc->mode.height = height;
+	desc->mode.bitsPerPixel = 32;
+	desc->mode.refresh = refresh;
+	desc->usable = 1;
+}
+
+/*
+The vertical rate of a timing, to the hundredth (59.94, not 59.9400599).
+An interlaced timing's vertical numbers are a field's, so this is the
+field rate, the one interlaced modes go by.
+*/
+static double timingRefresh( double pixelClock, unsigned int hTotal, unsigned int vTotal )
+{
+	double refresh;
+
+	if ( hTotal == 0 || vTotal == 0 )
+		return 0;
+	refresh = pixelClock / ((double)hTotal * vTotal);
+	// a clock of millions over a total of one would overflow the long; addMode leaves it out anyway
+	if ( !(refresh <= EDID_MAX_REFRESH) )
+		return 0;
+	return (double)(long)(refresh * 100 + 0.5) / 100;
+}
+
+/*
+An 18 byte detailed timing descriptor.  Returns 0 if it isn't one.
+*/
+static int detailedTiming( const uint8_t *d, displayMode *mode )
+{
+	unsigned int clock = le16( d );
+	unsigned int hActive = d[2] | (unsigned int)(d[4] & 0xf0) << 4;
+	unsigned int hBlank = d[3] | (unsigned int)(d[4] & 0x0f) << 8;
+	unsigned int vActive = d[5] | (unsigned int)(d[7] & 0xf0) << 4;
+	unsigned int vBlank = d[6] | (unsigned int)(d[7] & 0x0f) << 8;
+	int interlaced = (d[17] & 0x80) != 0;
+
+	if ( clock == 0 || hActive == 0 || vActive == 0 )
+		return 0;
+	mode->width = hActive;
+	mode->height = interlaced ? vActive * 2 : vActive;
+	mode->bitsPerPixel = 32;
+	mode->refresh = timingRefresh( clock * 10000.0, hActive + hBlank, vActive + vBlank );
+	return mode->refresh > 0;
+}
+
+static void standardTiming( modeSink *sink, const uint8_t *t, int version, int revision )
+{
+	unsigned int width, height;
+
+	if ( (t[0] == 0x01 && t[1] == 0x01) || t[0] == 0x00 )
+		return;
+	width = (t[0] + 31) * 8;
+	switch ( t[1] >> 6 )
+	{
+		case 0:
+			// 16:10 since EDID 1.3, 1:1 before
+			height = (version > 1 || revision >= 3) ? width * 10 / 16 : width;
+			break;
+		case 1:
+			height = width * 3 / 4;
+			break;
+		case 2:
+			height = width * 4 / 5;
+			break;
+		default:
+			height = width * 9 / 16;
+			break;
+	}
+	addMode( sink, width, height, (t[1] & 0x3f) + 60 );
+}
+
+static void timingBits( modeSink *sink, const uint8_t *bits, size_t numBytes, const edidTiming *table, size_t tableSize )
+{
+	size_t bit;
+
+	for ( bit = 0; bit < numBytes * 8 && bit < tableSize; bit++ )
+	{
+		if ( bits[bit / 8] & (0x80 >> (bit % 8)) )
+			addMode( sink, table[bit].width, table[bit].height, table[bit].refresh );
+	}
+}
+
+static void ctaVideoCodes( modeSink *sink, const uint8_t *codes, size_t count )
+{
+	size_t ii;
+
+	for ( ii = 0; ii < count; ii++ )
+	{
+		unsigned int vic = codes[ii];
+		// 129 to 192 are 1 to 64 marked native
+		if ( vic >= 129 && vic <= 192 )
+			vic &= 0x7f;
+		if ( vic < sizeof(ctaTimings) / sizeof(ctaTimings[0]) )
+			addMode( sink, ctaTimings[vic].width, ctaTimings[vic].height, ctaTimings[vic].refresh );
+	}
+}
+
+static void ctaBlock( modeSink *sink, const uint8_t *block )
+{
+	unsigned int dtdStart = block[2];
+	unsigned int pos;
+	displayMode mode;
+
+	if ( dtdStart != 0 && (dtdStart < 4 || dtdStart > EDID_BLOCK - 1) )
+		return;
+	// data block collection (revision 3 on), bytes 4 to dtdStart
+	for ( pos = 4; block[1] >= 3 && pos < dtdStart; )
+	{
+		unsigned int tag = block[pos] >> 5;
+		unsigned int length = block[pos] & 0x1f;
+		const uint8_t *payload = block + pos + 1;
+
+		if ( pos + 1 + length > dtdStart )
+			break;
+		if ( tag == 2 )
+			ctaVideoCodes( sink, payload, length );
+		else if ( tag == 7 && length >= 1 && payload[0] == 0x0e )
+			ctaVideoCodes( sink, payload + 1, length - 1 );     // YCbCr 4:2:0 video data block
+		pos += 1 + length;
+	}
+	if ( dtdStart == 0 )
+		return;
+	for ( pos = dtdStart; pos + EDID_DESCRIPTOR <= EDID_BLOCK - 1; pos += EDID_DESCRIPTOR )
+	{
+		if ( !detailedTiming( block + pos, &mode ) )
+			break;
+		addMode( sink, (unsigned int)mode.width, (unsigned int)mode.height, mode.refresh );
+	}
+}
+
+/*
+Type I (DisplayID 1.x, 10 kHz units) and Type VII (2.0, 1 kHz units)
+timings share the 20 byte layout.
+*/
+static void displayIdTimings( modeSink *sink, const uint8_t *payload, size_t length, double clockUnit )
+{
+	size_t pos;
+
+	for ( pos = 0; pos + 20 <= length; pos += 20 )
+	{
+		const uint8_t *t = payload + pos;
+		double clock = (le24( t ) + 1.0) * clockUnit;
+		int interlaced = (t[3] & 0x10) != 0;
+		unsigned int hActive = le16( t + 4 ) + 1;
+		unsigned int hBlank = le16( t + 6 ) + 1;
+		unsigned int vActive = le16( t + 12 ) + 1;
+		unsigned int vBlank = le16( t + 14 ) + 1;
+
+		addMode( sink, hActive, interlaced ? vActive * 2 : vActive,
+				timingRefresh( clock, hActive + hBlank, vActive + vBlank ) );
+	}
+}
+
+static void displayIdBlock( modeSink *sink, const uint8_t *block )
+{
+	// the DisplayID section starts after the extension tag
+	const uint8_t *section = block + 1;
+	size_t end = 4 + (size_t)section[1];
+	size_t pos;
+
+	if ( end > EDID_BLOCK - 2 )
+		end = EDID_BLOCK - 2;
+	for ( pos = 4; pos + 3 <= end; )
+	{
+		unsigned int tag = section[pos];
+		size_t length = section[pos + 2];
+		const uint8_t *payload = section + pos + 3;
+
+		if ( pos + 3 + length > end )
+			break;
+		if ( tag == 0x03 )
+			displayIdTimings( sink, payload, length, 10000.0 );
+		else if ( tag == 0x22 )
+			displayIdTimings( sink, payload, length, 1000.0 );
+		pos += 3 + length;
+	}
+}
+
+static void baseBlock( modeSink *sink, const uint8_t *block )
+{
+	int version = block[18], revision = block[19];
+	int ii;
+
+	for ( ii = 0; ii < 4; ii++ )
+	{
+		const uint8_t *d = block + EDID_DESCRIPTORS + ii * EDID_DESCRIPTOR;
+		displayMode mode;
+
+		if ( detailedTiming( d, &mode ) )
+			addMode( sink, (unsigned int)mode.width, (unsigned int)mode.height, mode.refresh );
+	}
+	timingBits( sink, block + 35, 3, establishedTimings, sizeof(establishedTimings) / sizeof(establishedTimings[0]) );
+	for ( ii = 0; ii < 8; ii++ )
+		standardTiming( sink, block + 38 + ii * 2, version, revision );
+	for ( ii = 0; ii < 4; ii++ )
+	{
+		const uint8_t *d = block + EDID_DESCRIPTORS + ii * EDID_DESCRIPTOR;
+		int jj;
+
+		if ( d[0] != 0 || d[1] != 0 )
+			continue;
+		if ( d[3] == 0xfa )
+		{
+			for ( jj = 0; jj < 6; jj++ )
+				standardTiming( sink, d + 5 + jj * 2, version, revision );
+		} else if ( d[3] == 0xf7 ) {
+			timingBits( sink, d + 6, 6, establishedTimings3, sizeof(establishedTimings3) / sizeof(establishedTimings3[0]) );
+		}
+	}
+}
+
+/////////////////
+
+int edidParse( const uint8_t *edid, size_t size, edidInfo *info )
+{
+	unsigned int pnp;
+	size_t block;
+	int ii;
+
+	memset( info, 0, sizeof(edidInfo) );
+	if ( size < EDID_BLOCK || memcmp( edid, edidHeader, sizeof(edidHeader) ) != 0 )
+		return -1;
+
+	pnp = (unsigned int)edid[8] << 8 | edid[9];
+	info->vendor[0] = (char)('@' + ((pnp >> 10) & 0x1f));
+	info->vendor[1] = (char)('@' + ((pnp >> 5) & 0x1f));
+	info->vendor[2] = (char)('@' + (pnp & 0x1f));
+	info->product = (uint16_t)le16( edid + 10 );
+	info->serial = le16( edid + 12 ) | (uint32_t)le16( edid + 14 ) << 16;
+	info->year = edid[17] ? 1990 + edid[17] : 0;
+	info->version = edid[18];
+	info->revision = edid[19];
+	info->extensions = edid[126];
+	info->blocks = (int)(size / EDID_BLOCK);
+	if ( info->blocks > 1 + info->extensions )
+		info->blocks = 1 + info->extensions;
+	for ( block = 0; block < (size_t)info->blocks; block++ )
+	{
+		if ( !blockChecksumOK( edid + block * EDID_BLOCK ) )
+			info->badChecksums++;
+	}
+
+	info->hasPreferred = detailedTiming( edid + EDID_DESCRIPTORS, &info->preferred );
+	for ( ii = 0; ii < 4; ii++ )
+	{
+		const uint8_t *d = edid + EDID_DESCRIPTORS + ii * EDID_DESCRIPTOR;
+		if ( d[0] != 0 || d[1] != 0 )
+			continue;
+		if ( d[3] == 0xfc )
+		{
+			int jj;
+			for ( jj = 0; jj < 13 && d[5 + jj] != 0x0a; jj++ )
+				info->name[jj] = isprint( d[5 + jj] ) ? (char)d[5 + jj] : '?';
+			info->name[jj] = '\0';
+		} else if ( d[3] == 0xfd ) {
+			// the offsets in byte 4 add 255 to a maximum (or minimum) rate
+			info->hasRange = 1;
+			info->minVRate = d[5] + ((d[4] & 0x03) == 0x03 ? 255 : 0);
+			info->maxVRate = d[6] + ((d[4] & 0x02) ? 255 : 0);
+			info->minHRate = d[7] + ((d[4] & 0x0c) == 0x0c ? 255 : 0);
+			info->maxHRate = d[8] + ((d[4] & 0x08) ? 255 : 0);
+			info->maxPixelClock = d[9] * 10;
+		}
+	}
+	return 0;
+}
+
+size_t edidModes( const uint8_t *edid, size_t size, displayModeDesc *modes, size_t maxModes )
+{
+	modeSink sink;
+	size_t numBlocks, block;
+
+	if ( size < EDID_BLOCK || memcmp( edid, edidHeader, sizeof(edidHeader) ) != 0 )
+		return 0;
+	sink.modes = modes;
+	sink.count = 0;
+	sink.max = maxModes;
+
+	baseBlock( &sink, edid );
+	numBlocks = size / EDID_BLOCK;
+	if ( numBlocks > 1 + (size_t)edid[126] )
+		numBlocks = 1 + (size_t)edid[126];
+	for ( block = 1; block < numBlocks; block++ )
+	{
+		const uint8_t *ext = edid + block * EDID_BLOCK;
+		if ( ext[0] == CTA_EXTENSION )
+			ctaBlock( &sink, ext );
+		else if ( ext[0] == DISPLAYID_EXTENSION )
+			displayIdBlock( &sink, ext );
+	}
+	return sink.count;
+}
+
+modeCatalog *edidCatalog( const uint8_t *edid, size_t size )
+{
+	displayModeDesc *modes = malloc( EDID_MAX_MODES * sizeof(displayModeDesc) );
+	modeCatalog *catalog = NULL;
+	size_t count;
+
+	if ( modes == NULL )
+		return NULL;
+	count = edidModes( edid, size, modes, EDID_MAX_MODES );
+	if ( count > 0 )
+		catalog = catalogCreate( modes, count );
+	free( modes );
+	return catalog;
+}
+
+void edidIdentity( const uint8_t *edid, size_t size, displayIdentity *identity )
+{
+	uint64_t hash = 14695981039346656037ull;    // FNV-1a
+	size_t ii;
+
+	memset( identity, 0, sizeof(displayIdentity) );
+	if ( size < EDID_BLOCK || memcmp( edid, edidHeader, sizeof(edidHeader) ) != 0 )
+		return;
+	identity->vendor = (uint32_t)edid[8] << 8 | edid[9];
+	identity->model = le16( edid + 10 );
+	identity->serial = le16( edid + 12 ) | (uint32_t)le16( edid + 14 ) << 16;
+	for ( ii = 0; ii < size; ii++ )
+		hash = (hash ^ edid[ii]) * 1099511628211ull;
+	identity->edidHash = hash;
+}
+
+/*
+Hex digits to bytes, in place (there are never more bytes than
+digits).  Returns the number of bytes, 0 if anything but hex digits,
+white space, commas and "0x" prefixes turned up.
+*/
+static size_t unhex( uint8_t *text, size_t size )
+{
+	size_t in, out = 0;
+	int half = -1;
+
+	for ( in = 0; in < size; in++ )
+	{
+		int c = text[in], digit;
+
+		if ( isspace( c ) || c == ',' || c == '<' || c == '>' )
+			continue;
+		if ( c == '0' && in + 1 < size && (text[in + 1] == 'x' || text[in + 1] == 'X') && half < 0 )
+		{
+			in++;
+			continue;
+		}
+		if ( !isxdigit( c ) )
+			return 0;
+		digit = isdigit( c ) ? c - '0' : tolower( c ) - 'a' + 10;
+		if ( half < 0 )
+		{
+			half = digit;
+		} else {
+			text[out++] = (uint8_t)(half << 4 | digit);
+			half = -1;
+		}
+	}
+	return out;
+}
+
+int edidLoad( const char *path, uint8_t **edid, size_t *size )
+{
+	FILE *file = fopen( path, "rb" );
+	uint8_t *bytes = NULL;
+	size_t length = 0, max = 0;
+
+	*edid = NULL;
+	*size = 0;
+	if ( file == NULL )
+		return -1;
+	for ( ;; )
+	{
+		size_t got;
+		if ( length == max )
+		{
+			uint8_t *grown;
+			max = max ? max * 2 : 1024;
+			grown = realloc( bytes, max );
+			if ( grown == NULL )
+				break;
+			bytes = grown;
+		}
+		got = fread( bytes + length, 1, max - length, file );
+		if ( got == 0 )
+			break;
+		length += got;
+	}
+	fclose( file );
+
+	if ( bytes != NULL && (length < sizeof(edidHeader) || memcmp( bytes, edidHeader, sizeof(edidHeader) ) != 0) )
+		length = unhex( bytes, length );
+	if ( bytes == NULL || length < EDID_BLOCK || memcmp( bytes, edidHeader, sizeof(edidHeader) ) != 0 )
+	{
+		free( bytes );
+		return -1;
+	}
+	*edid = bytes;
+	*size = length;
+	return 0;
+}
@@ -0,0 +1,88 @@
+/*
+Edid.h
+
+The modes a monitor says it can do, read straight out of its EDID: the
+base block's detailed timings, established timings (I, II and III) and
+standard timings, and the video data blocks and detailed timings of
+CTA-861 extensions and the Type I and Type VII timings of DisplayID
+extensions.
+
+This is for the displays SetDisplay exists for: a monitor that was off
+at boot or is behind a KVM, where the window server lists no modes for
+it.  The EDID, from the display if it can still be read or from a file
+saved while the monitor was there, stands in for the missing list.
+
+Nothing is copied or allocated while parsing; the bytes are read where
+they are, every read checked against size, so a truncated or garbled
+EDID gives fewer modes, never a bad read.  Blocks with a bad checksum
+are still read (KVMs are not careful about them), and counted.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef EDID_H
+#define EDID_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "DisplayBackend.h"
+#include "ModeCatalog.h"
+
+#define EDID_BLOCK      128
+#define EDID_MAX_MODES  512
+#define EDID_MAX_REFRESH 1000.0 // Hz; a faster timing is a mangled one, and left out
+
+typedef struct
+{
+	char vendor[4];             // PNP ID, e.g. "DEL"
+	uint16_t product;
+	uint32_t serial;
+	int year;                   // of manufacture, 0 if not given
+	int version;
+	int revision;
+	int extensions;             // extension blocks the base block says follow
+	int blocks;                 // blocks actually there
+	int badChecksums;
+	char name[14];              // from the display name descriptor, "" if none
+	int hasPreferred;
+	displayMode preferred;      // the first detailed timing
+	int hasRange;               // the range limits below are from the monitor
+	int minVRate, maxVRate;     // Hz
+	int minHRate, maxHRate;     // kHz
+	int maxPixelClock;          // MHz
+} edidInfo;
+
+/*
+0 if edid starts with a valid EDID base block header, -1 otherwise.
+*/
+int edidParse( const uint8_t *edid, size_t size, edidInfo *info );
+
+/*
+Every distinct mode in the EDID, the preferred one first, up to
+maxModes of them (EDID_MAX_MODES is more than an EDID can describe).
+Returns how many were stored.  The modes are 32 bits per pixel, usable,
+and have no ioModeID.
+*/
+size_t edidModes( const uint8_t *edid, size_t size, displayModeDesc *modes, size_t maxModes );
+
+/*
+The catalog of edidModes, NULL if there are none (or no memory).
+*/
+modeCatalog *edidCatalog( const uint8_t *edid, size_t size );
+
+/*
+vendor, model and serial the way the window server reports them, and
+a hash of the bytes.
+*/
+void edidIdentity( const uint8_t *edid, size_t size, displayIdentity *identity );
+
+/*
+Reads an EDID saved in path, either raw or as hex digits (what ioreg
+and most EDID tools print; white space and a leading "0x" are skipped).
+The bytes are malloc'd.  Returns 0, or -1 if there is no EDID in it.
+*/
+int edidLoad( const char *path, uint8_t **edid, size_t *size );
+
+#endif
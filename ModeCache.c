@@ -0,0 +1,297 @@
+/*
+ModeCache.c
+
+See ModeCache.h.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "ModeCache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ALIGN8(n) (((n) + 7) & ~(uint64_t)7)
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numEntries;
+	uint32_t reserved;
+	uint64_t size;
+} cacheFileHeader;
+
+typedef struct
+{
+	displayIdentity identity;
+	uint64_t offset;            // of the catalog block, from the start of the file
+	uint64_t size;
+} cacheFileEntry;
+
+typedef struct
+{
+	displayIdentity identity;
+	void *block;
+	size_t size;
+} cacheStored;
+
+struct modeCache
+{
+	char *path;
+	void *map;
+	size_t mapSize;
+	const cacheFileEntry *entries;
+	uint32_t numEntries;
+
+	cacheStored *stored;
+	size_t numStored;
+	size_t maxStored;
+};
+
+static int sameIdentity( const displayIdentity *a, const displayIdentity *b )
+{
+	return a->vendor == b->vendor && a->model == b->model && a->serial == b->serial && a->edidHash == b->edidHash;
+}
+
+static void mapCacheFile( modeCache *cache )
+{
+	const cacheFileHeader *header;
+	struct stat sb;
+	uint32_t ii;
+	int fd;
+
+	fd = open( cache->path, O_RDONLY );
+	if ( fd < 0 )
+		return;
+	if ( fstat( fd, &sb ) != 0 || (size_t)sb.st_size < sizeof(cacheFileHeader) )
+	{
+		close( fd );
+		return;
+	}
+	cache->map = mmap( NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( cache->map == MAP_FAILED )
+	{
+		cache->map = NULL;
+		return;
+	}
+	cache->mapSize = (size_t)sb.st_size;
+
+	header = cache->map;
+	if ( header->magic != MODECACHE_MAGIC || header->version != MODECACHE_VERSION || header->size != cache->mapSize ||
+			header->numEntries > (cache->mapSize - sizeof(cacheFileHeader)) / sizeof(cacheFileEntry) )
+		return;
+	cache->entries = (const cacheFileEntry *)(header + 1);
+	for ( ii = 0; ii < header->numEntries; ii++ )
+	{
+		const cacheFileEntry *entry = &cache->entries[ii];
+		if ( entry->offset % 8 != 0 || entry->offset > cache->mapSize || entry->size > cache->mapSize - entry->offset )
+		{
+			cache->entries = NULL;
+			return;
+		}
+	}
+	cache->numEntries = header->numEntries;
+}
+
+modeCache *cacheOpen( const char *path )
+{
+	modeCache *cache = calloc( 1, sizeof(modeCache) );
+
+	if ( cache == NULL )
+		return NULL;
+	cache->path = strdup( path );
+	if ( cache->path == NULL )
+	{
+		free( cache );
+		return NULL;
+	}
+	mapCacheFile( cache );
+	return cache;
+}
+
+void cacheClose( modeCache *cache )
+{
+	size_t ii;
+
+	if ( cache == NULL )
+		return;
+	for ( ii = 0; ii < cache->numStored; ii++ )
+		free( cache->stored[ii].block );
+	free( cache->stored );
+	if ( cache->map != NULL )
+		munmap( cache->map, cache->mapSize );
+	free( cache->path );
+	free( cache );
+}
+
+modeCatalog *cacheLookup( modeCache *cache, const displayIdentity *identity )
+{
+	uint32_t ii;
+
+	if ( !identityIsKnown( identity ) )
+		return NULL;
+	for ( ii = 0; ii < cache->numEntries; ii++ )
+	{
+		const cacheFileEntry *entry = &cache->entries[ii];
+		if ( sameIdentity( &entry->identity, identity ) )
+			return catalogAttach( (const char *)cache->map + entry->offset, (size_t)entry->size );
+	}
+	return NULL;
+}
+
+int cacheStore( modeCache *cache, const displayIdentity *identity, const modeCatalog *catalog )
+{
+	cacheStored *slot = NULL;
+	size_t size = (size_t)catalog->header->size;
+	void *block;
+	size_t ii;
+
+	if ( !identityIsKnown( identity ) )
+		return 0;
+	block = malloc( size );
+	if ( block == NULL )
+		return -1;
+	memcpy( block, catalog->header, size );
+
+	for ( ii = 0; ii < cache->numStored; ii++ )
+	{
+		if ( sameIdentity( &cache->stored[ii].identity, identity ) )
+		{
+			slot = &cache->stored[ii];
+			free( slot->block );
+			break;
+		}
+	}
+	if ( slot == NULL )
+	{
+		if ( cache->numStored == cache->maxStored )
+		{
+			size_t maxStored = cache->maxStored ? cache->maxStored * 2 : 4;
+			cacheStored *stored = realloc( cache->stored, maxStored * sizeof(cacheStored) );
+			if ( stored == NULL )
+			{
+				free( block );
+				return -1;
+			}
+			cache->stored = stored;
+			cache->maxStored = maxStored;
+		}
+		slot = &cache->stored[cache->numStored++];
+		slot->identity = *identity;
+	}
+	slot->block = block;
+	slot->size = size;
+	return 0;
+}
+
+static int writeAll( int fd, const void *buf, size_t len )
+{
+	const char *p = buf;
+
+	while ( len > 0 )
+	{
+		ssize_t n = write( fd, p, len );
+		if ( n <= 0 )
+			return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+int cacheWrite( modeCache *cache )
+{
+	static const char zeros[8] = { 0 };
+	cacheFileHeader header;
+	cacheFileEntry *entries;
+	const void **blocks;
+	char *tmpPath;
+	uint32_t numEntries = 0;
+	uint64_t offset;
+	uint32_t ii, jj;
+	int fd, err = 0;
+
+	if ( cache->numStored == 0 )
+		return 0;
+
+	entries = calloc( cache->numStored + cache->numEntries, sizeof(cacheFileEntry) );
+	blocks = calloc( cache->numStored + cache->numEntries, sizeof(void *) );
+	tmpPath = malloc( strlen( cache->path ) + 32 );
+	if ( entries == NULL || blocks == NULL || tmpPath == NULL )
+	{
+		free( entries );
+		free( blocks );
+		free( tmpPath );
+		return -1;
+	}
+
+	// what was stored this run, then whatever else the old file had
+	for ( ii = 0; ii < cache->numStored; ii++ )
+	{
+		entries[numEntries].identity = cache->stored[ii].identity;
+		entries[numEntries].size = cache->stored[ii].size;
+		blocks[numEntries++] = cache->stored[ii].block;
+	}
+	for ( ii = 0; ii < cache->numEntries; ii++ )
+	{
+		for ( jj = 0; jj < cache->numStored; jj++ )
+		{
+			if ( sameIdentity( &cache->entries[ii].identity, &cache->stored[jj].identity ) )
+				break;
+		}
+		if ( jj < cache->numStored )
+			continue;
+		entries[numEntries] = cache->entries[ii];
+		blocks[numEntries++] = (const char *)cache->map + cache->entries[ii].offset;
+	}
+
+	offset = ALIGN8( sizeof(cacheFileHeader) + numEntries * sizeof(cacheFileEntry) );
+	for ( ii = 0; ii < numEntries; ii++ )
+	{
+		entries[ii].offset = offset;
+		offset = ALIGN8( offset + entries[ii].size );
+	}
+	memset( &header, 0, sizeof(header) );
+	header.magic = MODECACHE_MAGIC;
+	header.version = MODECACHE_VERSION;
+	header.numEntries = numEntries;
+	header.size = offset;
+
+	sprintf( tmpPath, "%s.%ld", cache->path, (long)getpid() );
+	fd = open( tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if ( fd < 0 )
+		err = -1;
+	if ( err == 0 )
+		err = writeAll( fd, &header, sizeof(header) );
+	if ( err == 0 )
+		err = writeAll( fd, entries, numEntries * sizeof(cacheFileEntry) );
+	offset = sizeof(cacheFileHeader) + numEntries * sizeof(cacheFileEntry);
+	for ( ii = 0; ii < numEntries && err == 0; ii++ )
+	{
+		err = writeAll( fd, zeros, (size_t)(entries[ii].offset - offset) );
+		if ( err == 0 )
+			err = writeAll( fd, blocks[ii], (size_t)entries[ii].size );
+		offset = entries[ii].offset + entries[ii].size;
+	}
+	if ( err == 0 )
+		err = writeAll( fd, zeros, (size_t)(header.size - offset) );
+	if ( fd >= 0 && close( fd ) != 0 )
+		err = -1;
+	if ( err == 0 && rename( tmpPath, cache->path ) != 0 )
+		err = -1;
+	if ( err != 0 && fd >= 0 )
+		unlink( tmpPath );
+
+	free( entries );
+	free( blocks );
+	free( tmpPath );
+	return err;
+}
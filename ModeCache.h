@@ -0,0 +1,59 @@
+/*
+ModeCache.h
+
+An on-disk cache of mode catalogs, keyed by display identity, so that
+a machine that boots to the same monitors (or the same KVM) it had
+yesterday doesn't have to ask the window server for every mode of every
+display before it can work out which one it wants.
+
+The file is a small index followed by the catalogs themselves, each
+exactly as ModeCatalog keeps it in memory.  It is mapped read-only and
+the catalogs are used in place.  Updates go to a new file that is
+renamed over the old one, so a reader never sees half a file.
+
+A cached catalog is only as good as the monitor it was made from.
+Callers check it against the live display (the current mode has to be
+in it) before matching with it, and against the real mode list before
+applying anything picked from it.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef MODECACHE_H
+#define MODECACHE_H
+
+#include "DisplayBackend.h"
+#include "ModeCatalog.h"
+
+#define MODECACHE_MAGIC   0x53444341 // 'SDCA'
+#define MODECACHE_VERSION 1
+
+typedef struct modeCache modeCache;
+
+/*
+Opening never fails because of the file: a missing, short or foreign
+file is just an empty cache.  NULL means out of memory.
+*/
+modeCache *cacheOpen( const char *path );
+void cacheClose( modeCache *cache );
+
+/*
+The returned catalog points into the cache and is good until
+cacheClose.  Destroy it with catalogDestroy as usual.
+*/
+modeCatalog *cacheLookup( modeCache *cache, const displayIdentity *identity );
+
+/*
+Remembers a catalog for the next cacheWrite.  The catalog is copied.
+Displays the backend can't identify are not cached.
+*/
+int cacheStore( modeCache *cache, const displayIdentity *identity, const modeCatalog *catalog );
+
+/*
+Writes the cache back if anything was stored since it was opened.
+Returns 0 on success (or when there was nothing to write).
+*/
+int cacheWrite( modeCache *cache );
+
+#endif
@@ -0,0 +1,1476 @@
+/*
+ModeCatalog.c
+
+See ModeCatalog.h.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "ModeCatalog.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Targets and resolutions below this never overflow the int arithmetic
+// the closest match has always been done in, so the tree gives the same
+// answer as the scan.  Anything bigger goes through catalogScan.
+#define INDEX_LIMIT (1 << 28)
+
+// More resolutions than this at the same distance and we just scan.
+#define MAX_TIES 64
+
+// Mirror sets up to this size are worked out without allocating.
+#define COMMON_CURSORS 64
+
+// Batches against up to this many modes go through them rather than the tree.
+#define BATCH_SCAN_MODES 32
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+typedef struct
+{
+	size_t refresh, width, height, bpp, ioModeID;
+	size_t resWidth, resHeight, resFirst, resModes;
+	size_t exactWidth, exactHeight, exactBpp, exactFirst;
+	size_t usable;
+	size_t size;
+} catalogLayout;
+
+// Past this many modes, resolutions or keys the layout's size_t arithmetic could wrap (with a 32 bit size_t).
+#define LAYOUT_MAX_COUNT (SIZE_MAX / 256)
+
+/*
+Where each array of a catalog of these counts goes.  Returns -1 if the
+counts are too big for the block to be addressed at all (they may be a
+cache file's).
+*/
+static int layoutCatalog( catalogLayout *layout, uint32_t numModes, uint32_t numResolutions, uint32_t numExactKeys )
+{
+	size_t off = ALIGN8( sizeof(modeCatalogHeader) );
+
+	if ( numModes > LAYOUT_MAX_COUNT || numResolutions > LAYOUT_MAX_COUNT || numExactKeys > LAYOUT_MAX_COUNT )
+		return -1;
+
+	layout->refresh = off;      off += ALIGN8( numModes * sizeof(double) );
+	layout->width = off;        off += ALIGN8( numModes * sizeof(int32_t) );
+	layout->height = off;       off += ALIGN8( numModes * sizeof(int32_t) );
+	layout->bpp = off;          off += ALIGN8( numModes * sizeof(int32_t) );
+	layout->ioModeID = off;     off += ALIGN8( numModes * sizeof(uint32_t) );
+	layout->resWidth = off;     off += ALIGN8( numResolutions * sizeof(int32_t) );
+	layout->resHeight = off;    off += ALIGN8( numResolutions * sizeof(int32_t) );
+	layout->resFirst = off;     off += ALIGN8( ((size_t)numResolutions + 1) * sizeof(uint32_t) );
+	layout->resModes = off;     off += ALIGN8( numModes * sizeof(uint32_t) );
+	layout->exactWidth = off;   off += ALIGN8( numExactKeys * sizeof(int32_t) );
+	layout->exactHeight = off;  off += ALIGN8( numExactKeys * sizeof(int32_t) );
+	layout->exactBpp = off;     off += ALIGN8( numExactKeys * sizeof(int32_t) );
+	layout->exactFirst = off;   off += ALIGN8( numExactKeys * sizeof(uint32_t) );
+	layout->usable = off;       off += ALIGN8( numModes * sizeof(uint8_t) );
+	layout->size = off;
+	return 0;
+}
+
+static void pointCatalog( modeCatalog *catalog, const void *block )
+{
+	const char *base = block;
+	const modeCatalogHeader *header = block;
+	catalogLayout layout;
+
+	layoutCatalog( &layout, header->numModes, header->numResolutions, header->numExactKeys );
+	catalog->header = header;
+	catalog->numModes = header->numModes;
+	catalog->numResolutions = header->numResolutions;
+	catalog->numExactKeys = header->numExactKeys;
+	catalog->refresh = (const double *)(base + layout.refresh);
+	catalog->width = (const int32_t *)(base + layout.width);
+	catalog->height = (const int32_t *)(base + layout.height);
+	catalog->bpp = (const int32_t *)(base + layout.bpp);
+	catalog->ioModeID = (const uint32_t *)(base + layout.ioModeID);
+	catalog->resWidth = (const int32_t *)(base + layout.resWidth);
+	catalog->resHeight = (const int32_t *)(base + layout.resHeight);
+	catalog->resFirst = (const uint32_t *)(base + layout.resFirst);
+	catalog->resModes = (const uint32_t *)(base + layout.resModes);
+	catalog->exactWidth = (const int32_t *)(base + layout.exactWidth);
+	catalog->exactHeight = (const int32_t *)(base + layout.exactHeight);
+	catalog->exactBpp = (const int32_t *)(base + layout.exactBpp);
+	catalog->exactFirst = (const uint32_t *)(base + layout.exactFirst);
+	catalog->usable = (const uint8_t *)(base + layout.usable);
+}
+
+/////////////////
+
+/*
+The closest match, one mode at a time, exactly as modeForDisplay has
+always done it: the distances are ints, a mode with the same width and
+height distance as the best so far only wins if its depth and refresh
+are no further off, and otherwise the later of two equally distant
+modes wins.
+*/
+typedef struct
+{
+	int d_width;
+	int d_height;
+	int d_bpp;
+	int d_refresh;
+	long match;
+} closestState;
+
+static void closestBegin( closestState *state )
+{
+	state->d_width = INT_MAX/2;
+	state->d_height = INT_MAX/2;
+	state->d_bpp = INT_MAX;
+	state->d_refresh = INT_MAX;
+	state->match = kNoMode;
+}
+
+/*
+abs() of the difference as an int, negated wrapping: a difference of
+INT_MIN stays INT_MIN (what abs() gave it, though abs() overflows).
+*/
+static int delta( int32_t value, size_t target )
+{
+	uint32_t diff = (uint32_t)value - (uint32_t)target;
+
+	return (int)diff < 0 ? (int)(0u - diff) : (int)diff;
+}
+
+/*
+The refresh difference in whole hertz, truncated; one too big for an
+int, or NaN, is INT_MAX, as far off as can be.
+*/
+static int refreshDelta( double refresh, double target )
+{
+	double diff = refresh - target;
+
+	if ( diff < 0 )
+		diff = -diff;
+	return diff < INT_MAX ? (int)diff : INT_MAX;
+}
+
+static int wrappingSum( int a, int b )
+{
+	return (int)((uint32_t)a + (uint32_t)b);
+}
+
+static void closestStep( closestState *state, const modeCatalog *catalog, uint32_t pos, const displayMode *findMode )
+{
+	int dw = delta( catalog->width[pos], findMode->width );
+	int dh = delta( catalog->height[pos], findMode->height );
+	int db = delta( catalog->bpp[pos], findMode->bitsPerPixel );
+	int dr = refreshDelta( catalog->refresh[pos], findMode->refresh );
+
+	if ( dw == state->d_width && dh == state->d_height ) {
+		if ( db <= state->d_bpp && dr <= state->d_refresh ) {
+			state->d_bpp = db;
+			state->d_refresh = dr;
+			state->match = pos;
+		}
+	} else if ( wrappingSum( dw, dh ) <= wrappingSum( state->d_width, state->d_height ) ) {
+		state->d_width = dw;
+		state->d_height = dh;
+		state->d_bpp = db;
+		state->d_refresh = dr;
+		state->match = pos;
+	}
+}
+
+static void highestTarget( displayMode *findMode )
+{
+	findMode->width = INT_MAX;
+	findMode->height = INT_MAX;
+	findMode->bitsPerPixel = INT_MAX;
+	findMode->refresh = INT_MAX;
+}
+
+long catalogScan( const modeCatalog *catalog, int scanType, displayMode findMode )
+{
+	closestState state;
+	uint32_t pos;
+
+	if ( scanType == SCAN_EXACT ) {
+		for ( pos = 0; pos < catalog->numModes; pos++ )
+		{
+			if ( (size_t)catalog->width[pos] == findMode.width && (size_t)catalog->height[pos] == findMode.height &&
+					(size_t)catalog->bpp[pos] == findMode.bitsPerPixel )
+				return pos;
+		}
+		return kNoMode;
+	}
+
+	if ( scanType == SCAN_HIGHEST )
+		highestTarget( &findMode );
+	closestBegin( &state );
+	for ( pos = 0; pos < catalog->numModes; pos++ )
+		closestStep( &state, catalog, pos, &findMode );
+	return state.match;
+}
+
+/////////////////
+
+static int compareExact( const modeCatalog *catalog, uint32_t key, int32_t w, int32_t h, int32_t b )
+{
+	return catalog->exactWidth[key] != w ? (catalog->exactWidth[key] < w ? -1 : 1) :
+			catalog->exactHeight[key] != h ? (catalog->exactHeight[key] < h ? -1 : 1) :
+			catalog->exactBpp[key] != b ? (catalog->exactBpp[key] < b ? -1 : 1) : 0;
+}
+
+static long findExact( const modeCatalog *catalog, const displayMode *findMode )
+{
+	uint32_t lo = 0, hi = catalog->numExactKeys;
+	int32_t w, h, b;
+
+	if ( findMode->width > INT32_MAX || findMode->height > INT32_MAX || findMode->bitsPerPixel > INT32_MAX )
+		return kNoMode;
+	w = (int32_t)findMode->width;
+	h = (int32_t)findMode->height;
+	b = (int32_t)findMode->bitsPerPixel;
+	while ( lo < hi )
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		int cmp = compareExact( catalog, mid, w, h, b );
+		if ( cmp == 0 )
+			return catalog->exactFirst[mid];
+		if ( cmp < 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return kNoMode;
+}
+
+typedef struct
+{
+	int64_t best;
+	uint32_t ties[MAX_TIES];
+	int numTies;
+	int overflow;
+} nearestQuery;
+
+static void nearestResolutions( const modeCatalog *catalog, uint32_t lo, uint32_t hi, int axis, int64_t tw, int64_t th, nearestQuery *query )
+{
+	while ( lo < hi )
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		int64_t w = catalog->resWidth[mid];
+		int64_t h = catalog->resHeight[mid];
+		int64_t dist = (w > tw ? w - tw : tw - w) + (h > th ? h - th : th - h);
+		int64_t split = axis ? th - h : tw - w;
+
+		if ( dist < query->best ) {
+			query->best = dist;
+			query->numTies = 0;
+			query->overflow = 0;
+		}
+		if ( dist == query->best ) {
+			if ( query->numTies < MAX_TIES )
+				query->ties[query->numTies++] = mid;
+			else
+				query->overflow = 1;
+		}
+
+		// near side first, then the far side only if something over
+		// there could be at least as close
+		if ( split < 0 ) {
+			nearestResolutions( catalog, lo, mid, !axis, tw, th, query );
+			if ( -split > query->best )
+				return;
+			lo = mid + 1;
+		} else {
+			nearestResolutions( catalog, mid + 1, hi, !axis, tw, th, query );
+			if ( split > query->best )
+				return;
+			hi = mid;
+		}
+		axis = !axis;
+	}
+}
+
+static long findClosest( const modeCatalog *catalog, const displayMode *findMode )
+{
+	nearestQuery query;
+	uint32_t cursor[MAX_TIES];
+	closestState state;
+	int ii;
+
+	if ( findMode->width >= INDEX_LIMIT || findMode->height >= INDEX_LIMIT || !(catalog->header->flags & MODECATALOG_INDEXABLE) )
+		return catalogScan( catalog, SCAN_CLOSEST, *findMode );
+
+	query.best = INT64_MAX;
+	query.numTies = 0;
+	query.overflow = 0;
+	nearestResolutions( catalog, 0, catalog->numResolutions, 0, (int64_t)findMode->width, (int64_t)findMode->height, &query );
+	if ( query.overflow )
+		return catalogScan( catalog, SCAN_CLOSEST, *findMode );
+
+	// Only the modes at the closest distance can end up chosen, but
+	// which of them does depends on the order they were listed in, so
+	// walk them in that order.
+	for ( ii = 0; ii < query.numTies; ii++ )
+		cursor[ii] = catalog->resFirst[query.ties[ii]];
+	closestBegin( &state );
+	for ( ;; )
+	{
+		int next = -1;
+		uint32_t pos = 0;
+		for ( ii = 0; ii < query.numTies; ii++ )
+		{
+			if ( cursor[ii] < catalog->resFirst[query.ties[ii] + 1] &&
+					(next < 0 || catalog->resModes[cursor[ii]] < pos) ) {
+				next = ii;
+				pos = catalog->resModes[cursor[ii]];
+			}
+		}
+		if ( next < 0 )
+			break;
+		cursor[next]++;
+		closestStep( &state, catalog, pos, findMode );
+	}
+	return state.match;
+}
+
+long catalogFind( const modeCatalog *catalog, int scanType, displayMode findMode )
+{
+	if ( catalog->numModes == 0 )
+		return kNoMode;
+	switch ( scanType )
+	{
+		case SCAN_EXACT:
+			return findExact( catalog, &findMode );
+		case SCAN_CLOSEST:
+			return findClosest( catalog, &findMode );
+		case SCAN_HIGHEST:
+			return catalog->header->highest;
+	}
+	return kNoMode;
+}
+
+/*
+The first of the catalog's keys from on that isn't below (w, h, b),
+galloping out from from before the binary search, so that walking a
+short list of keys through a long catalog is about the short list's
+length and not the catalog's.
+*/
+static uint32_t exactLowerBound( const modeCatalog *catalog, uint32_t from, int32_t w, int32_t h, int32_t b )
+{
+	uint32_t lo = from, hi = from, step = 1;
+
+	while ( hi < catalog->numExactKeys && compareExact( catalog, hi, w, h, b ) < 0 )
+	{
+		lo = hi + 1;
+		hi = from + step;
+		step *= 2;
+	}
+	if ( hi > catalog->numExactKeys )
+		hi = catalog->numExactKeys;
+	while ( lo < hi )
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if ( compareExact( catalog, mid, w, h, b ) < 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int64_t distance64( int32_t value, int64_t target )
+{
+	return value > target ? value - target : target - value;
+}
+
+static int64_t clampTarget( size_t value )
+{
+	return value > INT32_MAX ? INT32_MAX : (int64_t)value;
+}
+
+/*
+Whether every catalog but the first has a mode of this width, height
+and depth.
+*/
+static int inAllOthers( const modeCatalog *const *catalogs, size_t count, int32_t w, int32_t h, int32_t b )
+{
+	size_t cc;
+
+	for ( cc = 1; cc < count; cc++ )
+	{
+		uint32_t key = exactLowerBound( catalogs[cc], 0, w, h, b );
+		if ( key == catalogs[cc]->numExactKeys || compareExact( catalogs[cc], key, w, h, b ) != 0 )
+			return 0;
+	}
+	return 1;
+}
+
+/*
+closestStep over the first catalog's modes that all the others have,
+one by one, for the targets and catalogs the merge below can't take.
+*/
+static long commonScan( const modeCatalog *const *catalogs, size_t count, const displayMode *findMode )
+{
+	const modeCatalog *first = catalogs[0];
+	closestState state;
+	uint32_t pos;
+
+	closestBegin( &state );
+	for ( pos = 0; pos < first->numModes; pos++ )
+	{
+		if ( inAllOthers( catalogs, count, first->width[pos], first->height[pos], first->bpp[pos] ) )
+			closestStep( &state, first, pos, findMode );
+	}
+	return state.match;
+}
+
+/*
+closestStep over the first catalog's modes of the keys given (of
+smallest), in the order they were listed, as findClosest walks its
+ties.  kNoMode with *overflow set if there are more resolutions than
+it keeps track of.
+*/
+static long commonTies( const modeCatalog *first, const modeCatalog *smallest, const uint32_t *keys, int numKeys,
+		const displayMode *findMode, int *overflow )
+{
+	uint32_t res[MAX_TIES], cursor[MAX_TIES];
+	closestState state;
+	int numRes = 0, ii, kk;
+
+	*overflow = 0;
+	for ( kk = 0; kk < numKeys; kk++ )
+	{
+		nearestQuery query;
+		query.best = INT64_MAX;
+		query.numTies = 0;
+		query.overflow = 0;
+		nearestResolutions( first, 0, first->numResolutions, 0, smallest->exactWidth[keys[kk]],
+				smallest->exactHeight[keys[kk]], &query );
+		if ( query.best != 0 || query.numTies != 1 )
+			continue;
+		for ( ii = 0; ii < numRes && res[ii] != query.ties[0]; ii++ )
+			;
+		if ( ii < numRes )
+			continue;
+		if ( numRes == MAX_TIES )
+		{
+			*overflow = 1;
+			return kNoMode;
+		}
+		res[numRes] = query.ties[0];
+		cursor[numRes++] = first->resFirst[query.ties[0]];
+	}
+
+	closestBegin( &state );
+	for ( ;; )
+	{
+		int next = -1;
+		uint32_t pos = 0;
+		for ( ii = 0; ii < numRes; ii++ )
+		{
+			if ( cursor[ii] < first->resFirst[res[ii] + 1] && (next < 0 || first->resModes[cursor[ii]] < pos) ) {
+				next = ii;
+				pos = first->resModes[cursor[ii]];
+			}
+		}
+		if ( next < 0 )
+			break;
+		cursor[next]++;
+		// of the resolution, but maybe of a depth not all of them have
+		for ( kk = 0; kk < numKeys; kk++ )
+		{
+			if ( smallest->exactWidth[keys[kk]] == first->width[pos] && smallest->exactHeight[keys[kk]] == first->height[pos] &&
+					smallest->exactBpp[keys[kk]] == first->bpp[pos] )
+				break;
+		}
+		if ( kk < numKeys )
+			closestStep( &state, first, pos, findMode );
+	}
+	return state.match;
+}
+
+/*
+The catalog's mode of this width, height and depth that closestStep
+would take: the refresh closest to the one wanted, the later of two as
+close.
+*/
+static long closestRefresh( const modeCatalog *catalog, int32_t w, int32_t h, int32_t b, const displayMode *findMode )
+{
+	uint32_t key = exactLowerBound( catalog, 0, w, h, b );
+	closestState state;
+	uint32_t ii, end = catalog->numModes;
+	const uint32_t *positions = NULL;
+
+	if ( key == catalog->numExactKeys || compareExact( catalog, key, w, h, b ) != 0 )
+		return kNoMode;
+	ii = catalog->exactFirst[key];
+	// the modes of the resolution, if the tree can say which they are
+	if ( catalog->header->flags & MODECATALOG_INDEXABLE )
+	{
+		nearestQuery query;
+		query.best = INT64_MAX;
+		query.numTies = 0;
+		query.overflow = 0;
+		nearestResolutions( catalog, 0, catalog->numResolutions, 0, w, h, &query );
+		if ( query.best == 0 && query.numTies == 1 )
+		{
+			positions = catalog->resModes;
+			ii = catalog->resFirst[query.ties[0]];
+			end = catalog->resFirst[query.ties[0] + 1];
+		}
+	}
+	closestBegin( &state );
+	for ( ; ii < end; ii++ )
+	{
+		uint32_t pos = positions != NULL ? positions[ii] : ii;
+		if ( catalog->width[pos] == w && catalog->height[pos] == h && catalog->bpp[pos] == b )
+			closestStep( &state, catalog, pos, findMode );
+	}
+	return state.match;
+}
+
+long catalogFindCommon( const modeCatalog *const *catalogs, size_t count, int scanType, displayMode findMode, long *positions )
+{
+	const modeCatalog *smallest, *first;
+	uint32_t cursorSpace[COMMON_CURSORS], *cursors = cursorSpace;
+	uint32_t key, ties[MAX_TIES];
+	int64_t tw, th, bestDistance = INT64_MAX;
+	int numTies = 0, overflow = 0;
+	long match;
+	size_t cc;
+
+	if ( count == 0 )
+		return kNoMode;
+	smallest = first = catalogs[0];
+	for ( cc = 0; cc < count; cc++ )
+	{
+		if ( catalogs[cc]->numModes == 0 )
+			return kNoMode;
+		if ( catalogs[cc]->numExactKeys < smallest->numExactKeys )
+			smallest = catalogs[cc];
+	}
+
+	if ( scanType == SCAN_EXACT )
+	{
+		for ( cc = 0; cc < count; cc++ )
+		{
+			positions[cc] = findExact( catalogs[cc], &findMode );
+			if ( positions[cc] == kNoMode )
+				return kNoMode;
+		}
+		return 0;
+	}
+	if ( scanType == SCAN_HIGHEST )
+		highestTarget( &findMode );
+	else if ( scanType != SCAN_CLOSEST )
+		return kNoMode;
+
+	// closestStep, as catalogFind, over the modes of the first catalog
+	// (the main display's) that every other one has too: the width plus
+	// height distance decides, and only the ones at the closest of it
+	// need going through in the order they were listed
+	if ( (scanType == SCAN_CLOSEST && (findMode.width >= INDEX_LIMIT || findMode.height >= INDEX_LIMIT)) ||
+			!(first->header->flags & MODECATALOG_INDEXABLE) )
+		match = commonScan( catalogs, count, &findMode );
+	else
+	{
+		if ( count > COMMON_CURSORS )
+		{
+			cursors = malloc( count * sizeof(uint32_t) );
+			if ( cursors == NULL )
+				return kNoMode;
+		}
+		memset( cursors, 0, count * sizeof(uint32_t) );
+
+		// Merge the smallest catalog's keys against the others', but
+		// only as far as it takes: a key further off than the closest
+		// common one so far isn't looked for at all.
+		tw = clampTarget( findMode.width );
+		th = clampTarget( findMode.height );
+		for ( key = 0; key < smallest->numExactKeys; key++ )
+		{
+			int32_t w = smallest->exactWidth[key], h = smallest->exactHeight[key], b = smallest->exactBpp[key];
+			int64_t distance = distance64( w, tw ) + distance64( h, th );
+
+			if ( distance > bestDistance )
+			{
+				// sorted by width, so nothing further on is any closer
+				if ( w - tw > bestDistance )
+					break;
+				continue;
+			}
+			for ( cc = 0; cc < count; cc++ )
+			{
+				const modeCatalog *catalog = catalogs[cc];
+				if ( catalog == smallest )
+					continue;
+				cursors[cc] = exactLowerBound( catalog, cursors[cc], w, h, b );
+				if ( cursors[cc] == catalog->numExactKeys || compareExact( catalog, cursors[cc], w, h, b ) != 0 )
+					break;
+			}
+			if ( cc < count )
+				continue;
+			if ( distance < bestDistance )
+			{
+				bestDistance = distance;
+				numTies = 0;
+			}
+			if ( numTies == MAX_TIES )
+			{
+				overflow = 1;
+				break;
+			}
+			ties[numTies++] = key;
+		}
+		if ( cursors != cursorSpace )
+			free( cursors );
+		match = overflow ? kNoMode : commonTies( first, smallest, ties, numTies, &findMode, &overflow );
+		if ( overflow )
+			match = commonScan( catalogs, count, &findMode );
+	}
+	if ( match == kNoMode )
+		return kNoMode;
+
+	positions[0] = match;
+	for ( cc = 1; cc < count; cc++ )
+	{
+		positions[cc] = closestRefresh( catalogs[cc], first->width[match], first->height[match], first->bpp[match], &findMode );
+		if ( positions[cc] == kNoMode )
+			return kNoMode;
+	}
+	return 0;
+}
+
+/*
+Batches.  closestStep only ever moves to a mode whose width plus
+height distance is the smallest so far or the same as it, so running
+it over just the modes at the smallest distance, in the order they
+were listed, ends on the same mode as running it over all of them.
+The kernels find that distance for a few targets at a time in one pass
+over the widths and heights (SIMD where the CPU has it, the same int
+arithmetic closestStep does), then walk the modes at it through
+closestStep.
+*/
+
+#define BATCH_TARGETS 4
+#define BATCH_FOUND   64
+
+// the modes at a target's nearest distance, in order; a count past
+// BATCH_FOUND means there were more than were kept
+typedef struct
+{
+	uint32_t count;
+	uint32_t pos[BATCH_FOUND];
+} batchFound;
+
+typedef struct
+{
+	void (*nearest)( const modeCatalog *catalog, const uint32_t *tw, const uint32_t *th, int count, int32_t *best );
+	void (*collect)( const modeCatalog *catalog, const uint32_t *tw, const uint32_t *th, int count, const int32_t *best,
+			batchFound *found );
+} batchKernel;
+
+static int batchSum( const modeCatalog *catalog, uint32_t pos, uint32_t tw, uint32_t th )
+{
+	return wrappingSum( delta( catalog->width[pos], tw ), delta( catalog->height[pos], th ) );
+}
+
+static void addFound( batchFound *found, uint32_t pos )
+{
+	if ( found->count < BATCH_FOUND )
+		found->pos[found->count] = pos;
+	found->count++;
+}
+
+// the modes from pos on, into what best and found already have
+static void nearestFrom( const modeCatalog *catalog, uint32_t pos, const uint32_t *tw, const uint32_t *th, int count, int32_t *best )
+{
+	int tt;
+
+	for ( ; pos < catalog->numModes; pos++ )
+	{
+		for ( tt = 0; tt < count; tt++ )
+		{
+			int sum = batchSum( catalog, pos, tw[tt], th[tt] );
+			if ( sum < best[tt] )
+				best[tt] = sum;
+		}
+	}
+}
+
+static void collectFrom( const modeCatalog *catalog, uint32_t pos, const uint32_t *tw, const uint32_t *th, int count,
+		const int32_t *best, batchFound *found )
+{
+	int tt;
+
+	for ( ; pos < catalog->numModes; pos++ )
+	{
+		for ( tt = 0; tt < count; tt++ )
+		{
+			if ( batchSum( catalog, pos, tw[tt], th[tt] ) == best[tt] )
+				addFound( &found[tt], pos );
+		}
+	}
+}
+
+static void nearestScalar( const modeCatalog *catalog, const uint32_t *tw, const uint32_t *th, int count, int32_t *best )
+{
+	int tt;
+
+	for ( tt = 0; tt < count; tt++ )
+		best[tt] = INT_MAX;
+	nearestFrom( catalog, 0, tw, th, count, best );
+}
+
+static void collectScalar( const modeCatalog *catalog, const uint32_t *tw, const uint32_t *th, int count, const int32_t *best,
+		batchFound *found )
+{
+	collectFrom( catalog, 0, tw, th, count, best, found );
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+
+#define BATCH_X86 1
+
+__attribute__((target("sse4.1")))
+static void nearestSse41( const modeCatalog *catalog, const uint32_t *tw, const uint32_t *th, int count, int32_t *best )
+{
+	__m128i vw[BATCH_TARGETS], vh[BATCH_TARGETS], vbest[BATCH_TARGETS];
+	uint32_t pos, end = catalog->numModes & ~3u;
+	int tt, lane;
+
+	for ( tt = 0; tt < count; tt++ )
+	{
+		vw[tt] = _mm_set1_epi32( (int)tw[tt] );
+		vh[tt] = _mm_set1_epi32( (int)th[tt] );
+		vbest[tt] = _mm_set1_epi32( INT_MAX );
+	}
+	for ( pos = 0; pos < end; pos += 4 )
+	{
+		__m128i w = _mm_loadu_si128( (const __m128i *)(catalog->width + pos) );
+		__m128i h = _mm_loadu_si128( (const __m128i *)(catalog->height + pos) );
+		for ( tt = 0; tt < count; tt++ )
+		{
+			__m128i sum = _mm_add_epi32( _mm_abs_epi32( _mm_sub_epi32( w, vw[tt] ) ), _mm_abs_epi32( _mm_sub_epi32( h, vh[tt] ) ) );
+			vbest[tt] = _mm_min_epi32( vbest[tt], sum );
+		}
+	}
+	for ( tt = 0; tt < count; tt++ )
+	{
+		int32_t lanes[4];
+		_mm_storeu_si128( (__m128i *)lanes, vbest[tt] );
+		best[tt] = INT_MAX;
+		for ( lane = 0; lane < 4; lane++ )
+			best[tt] = lanes[lane] < best[tt] ? lanes[lane] : best[tt];
+	}
+	nearestFrom( catalog, end, tw, th, count, best );
+}
+
+__attribute__((target("sse4.1")))
+static void collectSse41( const modeCatalog *catalog, const uint32_t *tw, const uint32_t *th, int count, const int32_t *best,
+		batchFound *found )
+{
+	__m128i vw[BATCH_TARGETS], vh[BATCH_TARGETS], vbest[BATCH_TARGETS];
+	uint32_t pos, end = catalog->numModes & ~3u;
+	int tt;
+
+	for ( tt = 0; tt < count; tt++ )
+	{
+		vw[tt] = _mm_set1_epi32( (int)tw[tt] );
+		vh[tt] = _mm_set1_epi32( (int)th[tt] );
+		vbest[tt] = _mm_set1_epi32( best[tt] );
+	}
+	for ( pos = 0; pos < end; pos += 4 )
+	{
+		__m128i w = _mm_loadu_si128( (const __m128i *)(catalog->width + pos) );
+		__m128i h = _mm_loadu_si128( (const __m128i *)(catalog->height + pos) );
+		for ( tt = 0; tt < count; tt++ )
+		{
+			__m128i sum = _mm_add_epi32( _mm_abs_epi32( _mm_sub_epi32( w, vw[tt] ) ), _mm_abs_epi32( _mm_sub_epi32( h, vh[tt] ) ) );
+			unsigned int mask = (unsigned int)_mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( sum, vbest[tt] ) ) );
+			for ( ; mask != 0; mask &= mask - 1 )
+				addFound( &found[tt], pos + (uint32_t)__builtin_ctz( mask ) );
+		}
+	}
+	collectFrom( catalog, end, tw, th, count, best, found );
+}
+
+__attribute__((target("avx2")))
+static void nearestAvx2( const modeCatalog *catalog, const uint32_t *tw, const uint32_t *th, int count, int32_t *best )
+{
+	__m256i vw[BATCH_TARGETS], vh[BATCH_TARGETS], vbest[BATCH_TARGETS];
+	uint32_t pos, end = catalog->numModes & ~7u;
+	int tt, lane;
+
+	for ( tt = 0; tt < count; tt++ )
+	{
+		vw[tt] = _mm256_set1_epi32( (int)tw[tt] );
+		vh[tt] = _mm256_set1_epi32( (int)th[tt] );
+		vbest[tt] = _mm256_set1_epi32( INT_MAX );
+	}
+	for ( pos = 0; pos < end; pos += 8 )
+	{
+		__m256i w = _mm256_loadu_si256( (const __m256i *)(catalog->width + pos) );
+		__m256i h = _mm256_loadu_si256( (const __m256i *)(catalog->height + pos) );
+		for ( tt = 0; tt < count; tt++ )
+		{
+			__m256i sum = _mm256_add_epi32( _mm256_abs_epi32( _mm256_sub_epi32( w, vw[tt] ) ),
+					_mm256_abs_epi32( _mm256_sub_epi32( h, vh[tt] ) ) );
+			vbest[tt] = _mm256_min_epi32( vbest[tt], sum );
+		}
+	}
+	for ( tt = 0; tt < count; tt++ )
+	{
+		int32_t lanes[8];
+		_mm256_storeu_si256( (__m256i *)lanes, vbest[tt] );
+		best[tt] = INT_MAX;
+		for ( lane = 0; lane < 8; lane++ )
+			best[tt] = lanes[lane] < best[tt] ? lanes[lane] : best[tt];
+	}
+	nearestFrom( catalog, end, tw, th, count, best );
+}
+
+__attribute__((target("avx2")))
+static void collectAvx2( const modeCatalog *catalog, const uint32_t *tw, const uint32_t *th, int count, const int32_t *best,
+		batchFound *found )
+{
+	__m256i vw[BATCH_TARGETS], vh[BATCH_TARGETS], vbest[BATCH_TARGETS];
+	uint32_t pos, end = catalog->numModes & ~7u;
+	int tt;
+
+	for ( tt = 0; tt < count; tt++ )
+	{
+		vw[tt] = _mm256_set1_epi32( (int)tw[tt] );
+		vh[tt] = _mm256_set1_epi32( (int)th[tt] );
+		vbest[tt] = _mm256_set1_epi32( best[tt] );
+	}
+	for ( pos = 0; pos < end; pos += 8 )
+	{
+		__m256i w = _mm256_loadu_si256( (const __m256i *)(catalog->width + pos) );
+		__m256i h = _mm256_loadu_si256( (const __m256i *)(catalog->height + pos) );
+		for ( tt = 0; tt < count; tt++ )
+		{
+			__m256i sum = _mm256_add_epi32( _mm256_abs_epi32( _mm256_sub_epi32( w, vw[tt] ) ),
+					_mm256_abs_epi32( _mm256_sub_epi32( h, vh[tt] ) ) );
+			unsigned int mask = (unsigned int)_mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( sum, vbest[tt] ) ) );
+			for ( ; mask != 0; mask &= mask - 1 )
+				addFound( &found[tt], pos + (uint32_t)__builtin_ctz( mask ) );
+		}
+	}
+	collectFrom( catalog, end, tw, th, count, best, found );
+}
+
+#else
+
+#define BATCH_X86 0
+
+#endif
+
+static const batchKernel batchKernels[] =
+{
+	{ nearestScalar, collectScalar },
+#if BATCH_X86
+	{ nearestSse41, collectSse41 },
+	{ nearestAvx2, collectAvx2 },
+#endif
+};
+
+static int bestKernel( void )
+{
+	int kernel;
+
+	for ( kernel = CATALOG_KERNEL_AVX2; kernel > CATALOG_KERNEL_SCALAR; kernel-- )
+	{
+		if ( catalogKernelAvailable( kernel ) )
+			break;
+	}
+	return kernel;
+}
+
+int catalogKernelAvailable( int kernel )
+{
+	switch ( kernel )
+	{
+		case CATALOG_KERNEL_SCALAR:
+			return 1;
+#if BATCH_X86
+		case CATALOG_KERNEL_SSE41:
+			return __builtin_cpu_supports( "sse4.1" ) ? 1 : 0;
+		case CATALOG_KERNEL_AVX2:
+			return __builtin_cpu_supports( "avx2" ) ? 1 : 0;
+#endif
+	}
+	return 0;
+}
+
+const char *catalogKernelName( int kernel )
+{
+	static const char *names[] = { "scalar", "sse4.1", "avx2" };
+
+	if ( kernel == CATALOG_KERNEL_BEST )
+		kernel = bestKernel();
+	return kernel >= 0 && kernel <= CATALOG_KERNEL_AVX2 ? names[kernel] : "?";
+}
+
+void catalogScanBatch( const modeCatalog *catalog, int scanType, const displayMode *targets, size_t count, long *matches,
+		int kernel )
+{
+	const batchKernel *kernels;
+	size_t first;
+
+	if ( kernel == CATALOG_KERNEL_BEST )
+		kernel = bestKernel();
+	if ( !catalogKernelAvailable( kernel ) )
+		kernel = CATALOG_KERNEL_SCALAR;
+	kernels = &batchKernels[kernel];
+
+	for ( first = 0; first < count; first += BATCH_TARGETS )
+	{
+		displayMode block[BATCH_TARGETS];
+		uint32_t tw[BATCH_TARGETS], th[BATCH_TARGETS];
+		int32_t best[BATCH_TARGETS];
+		batchFound found[BATCH_TARGETS];
+		int numTargets = count - first < BATCH_TARGETS ? (int)(count - first) : BATCH_TARGETS;
+		int tt;
+
+		if ( scanType != SCAN_CLOSEST && scanType != SCAN_HIGHEST )
+		{
+			// exact is a lookup in the sorted keys, however many there are
+			for ( tt = 0; tt < numTargets; tt++ )
+				matches[first + tt] = scanType == SCAN_EXACT && catalog->numModes > 0 ? findExact( catalog, &targets[first + tt] ) : kNoMode;
+			continue;
+		}
+		for ( tt = 0; tt < numTargets; tt++ )
+		{
+			block[tt] = targets[first + tt];
+			if ( scanType == SCAN_HIGHEST )
+				highestTarget( &block[tt] );
+			tw[tt] = (uint32_t)block[tt].width;
+			th[tt] = (uint32_t)block[tt].height;
+			found[tt].count = 0;
+		}
+		kernels->nearest( catalog, tw, th, numTargets, best );
+		kernels->collect( catalog, tw, th, numTargets, best, found );
+		for ( tt = 0; tt < numTargets; tt++ )
+		{
+			closestState state;
+			uint32_t ii, pos;
+
+			closestBegin( &state );
+			for ( ii = 0; ii < found[tt].count && ii < BATCH_FOUND; ii++ )
+				closestStep( &state, catalog, found[tt].pos[ii], &block[tt] );
+			// more of them than were kept, the rest the slow way (pos[] is only all filled in then)
+			if ( found[tt].count > BATCH_FOUND )
+			{
+				for ( pos = found[tt].pos[BATCH_FOUND - 1] + 1; pos < catalog->numModes; pos++ )
+				{
+					if ( batchSum( catalog, pos, tw[tt], th[tt] ) == best[tt] )
+						closestStep( &state, catalog, pos, &block[tt] );
+				}
+			}
+			matches[first + tt] = state.match;
+		}
+	}
+}
+
+void catalogFindBatch( const modeCatalog *catalog, int scanType, const displayMode *targets, size_t count, long *matches )
+{
+	size_t ii;
+
+	// a short list is quicker to go through than the tree
+	if ( scanType == SCAN_CLOSEST && (catalog->numModes <= BATCH_SCAN_MODES ||
+			!(catalog->header->flags & MODECATALOG_INDEXABLE)) )
+	{
+		catalogScanBatch( catalog, scanType, targets, count, matches, CATALOG_KERNEL_BEST );
+		return;
+	}
+	for ( ii = 0; ii < count; ii++ )
+		matches[ii] = catalogFind( catalog, scanType, targets[ii] );
+}
+
+/////////////////
+
+void catalogModeDesc( const modeCatalog *catalog, long position, displayModeDesc *desc )
+{
+	desc->mode.width = catalog->width[position];
+	desc->mode.height = catalog->height[position];
+	desc->mode.bitsPerPixel = catalog->bpp[position];
+	desc->mode.refresh = catalog->refresh[position];
+	desc->ioModeID = catalog->ioModeID[position];
+	desc->usable = catalog->usable[position];
+}
+
+static int sameMode( const modeCatalog *catalog, uint32_t pos, const displayModeDesc *desc )
+{
+	return (size_t)catalog->width[pos] == desc->mode.width && (size_t)catalog->height[pos] == desc->mode.height &&
+			(size_t)catalog->bpp[pos] == desc->mode.bitsPerPixel && catalog->refresh[pos] == desc->mode.refresh &&
+			catalog->ioModeID[pos] == desc->ioModeID && catalog->usable[pos] == (desc->usable ? 1 : 0);
+}
+
+long catalogFindMode( const modeCatalog *catalog, const displayModeDesc *desc )
+{
+	nearestQuery query;
+	uint32_t ii, res;
+
+	if ( findExact( catalog, &desc->mode ) == kNoMode )
+		return kNoMode;
+	if ( !(catalog->header->flags & MODECATALOG_INDEXABLE) ) {
+		for ( ii = 0; ii < catalog->numModes; ii++ )
+		{
+			if ( sameMode( catalog, ii, desc ) )
+				return ii;
+		}
+		return kNoMode;
+	}
+
+	// the width x height is in the tree at distance 0, and only once
+	query.best = INT64_MAX;
+	query.numTies = 0;
+	query.overflow = 0;
+	nearestResolutions( catalog, 0, catalog->numResolutions, 0, (int64_t)desc->mode.width, (int64_t)desc->mode.height, &query );
+	if ( query.numTies == 0 || query.best != 0 )
+		return kNoMode;
+	res = query.ties[0];
+	for ( ii = catalog->resFirst[res]; ii < catalog->resFirst[res + 1]; ii++ )
+	{
+		if ( sameMode( catalog, catalog->resModes[ii], desc ) )
+			return catalog->resModes[ii];
+	}
+	return kNoMode;
+}
+
+int catalogMatchesModes( const modeCatalog *catalog, const displayModeDesc *modes, size_t count )
+{
+	size_t ii;
+
+	if ( count != catalog->numModes )
+		return 0;
+	for ( ii = 0; ii < count; ii++ )
+	{
+		if ( !sameMode( catalog, (uint32_t)ii, &modes[ii] ) )
+			return 0;
+	}
+	return 1;
+}
+
+/////////////////
+
+typedef struct
+{
+	int32_t width;
+	int32_t height;
+	int32_t bpp;
+	uint32_t pos;
+} sortEntry;
+
+static int entryBefore( const sortEntry *x, const sortEntry *y )
+{
+	if ( x->width != y->width )
+		return x->width < y->width;
+	if ( x->height != y->height )
+		return x->height < y->height;
+	if ( x->bpp != y->bpp )
+		return x->bpp < y->bpp;
+	return x->pos < y->pos;
+}
+
+/*
+Sorts the entries by resolution, depth and position, scratch having
+room for as many.  qsort's comparisons through a function pointer were
+most of what making a catalog took (a fleet simulation makes one for
+every display of every machine, SetDisplayFleet.c); this is runs of
+16 put in order in place and then merged, with the comparison inlined.
+*/
+static void sortEntries( sortEntry *entries, sortEntry *scratch, uint32_t count )
+{
+	sortEntry *from = entries, *to = scratch, *swap;
+	uint32_t ii, jj, width;
+
+	for ( ii = 0; ii < count; ii += 16 )
+	{
+		uint32_t end = count - ii < 16 ? count : ii + 16;
+		for ( jj = ii + 1; jj < end; jj++ )
+		{
+			sortEntry entry = entries[jj];
+			uint32_t kk = jj;
+			for ( ; kk > ii && entryBefore( &entry, &entries[kk - 1] ); kk-- )
+				entries[kk] = entries[kk - 1];
+			entries[kk] = entry;
+		}
+	}
+	for ( width = 16; width < count; width *= 2 )
+	{
+		for ( ii = 0; ii < count; ii += 2 * width )
+		{
+			uint32_t left = ii, mid = count - ii < width ? count : ii + width;
+			uint32_t right = mid, end = count - mid < width ? count : mid + width;
+			for ( jj = ii; jj < end; jj++ )
+				to[jj] = right >= end || (left < mid && !entryBefore( &from[right], &from[left] )) ? from[left++] : from[right++];
+		}
+		swap = from;
+		from = to;
+		to = swap;
+	}
+	if ( from != entries )
+		memcpy( entries, from, count * sizeof(sortEntry) );
+}
+
+typedef struct
+{
+	int32_t width;
+	int32_t height;
+	uint32_t first;             // into the sorted entries
+	uint32_t count;
+} resolutionEntry;
+
+static int compareWidth( const void *a, const void *b )
+{
+	const resolutionEntry *x = a, *y = b;
+	return x->width != y->width ? (x->width < y->width ? -1 : 1) : (x->height > y->height) - (x->height < y->height);
+}
+
+static int compareHeight( const void *a, const void *b )
+{
+	const resolutionEntry *x = a, *y = b;
+	return x->height != y->height ? (x->height < y->height ? -1 : 1) : (x->width > y->width) - (x->width < y->width);
+}
+
+static void buildTree( resolutionEntry *res, uint32_t lo, uint32_t hi, int axis )
+{
+	uint32_t mid;
+
+	if ( hi - lo < 2 )
+		return;
+	qsort( res + lo, hi - lo, sizeof(resolutionEntry), axis ? compareHeight : compareWidth );
+	mid = lo + (hi - lo) / 2;
+	buildTree( res, lo, mid, !axis );
+	buildTree( res, mid + 1, hi, !axis );
+}
+
+static int32_t clampDimension( size_t value )
+{
+	return value > INT32_MAX ? INT32_MAX : (int32_t)value;
+}
+
+static int compareModePositions( const void *a, const void *b )
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+A resolution's positions in list order; there are seldom more than a
+dozen, which qsort takes longer to get going for than to sort.
+*/
+static void sortPositions( uint32_t *positions, uint32_t count )
+{
+	uint32_t ii, jj;
+
+	if ( count > 32 )
+	{
+		qsort( positions, count, sizeof(uint32_t), compareModePositions );
+		return;
+	}
+	for ( ii = 1; ii < count; ii++ )
+	{
+		uint32_t pos = positions[ii];
+		for ( jj = ii; jj > 0 && positions[jj - 1] > pos; jj-- )
+			positions[jj] = positions[jj - 1];
+		positions[jj] = pos;
+	}
+}
+
+/////////////////
+
+/*
+Chunks are used from the front, newest first in the list; one that
+can't take an allocation is left as it is and a bigger one goes in
+front of it.  A reset with more than one chunk frees them all and
+makes one as big as they held, so the next round takes one.
+*/
+#define ARENA_FIRST_CHUNK 16384
+#define ARENA_HEADER      ALIGN8(sizeof(arenaChunk))
+
+typedef struct arenaChunk
+{
+	struct arenaChunk *next;
+	size_t size;                // bytes after the header
+	size_t used;
+} arenaChunk;
+
+struct catalogArena
+{
+	arenaChunk *chunks;
+	size_t used;                // in all the chunks, since the last reset
+};
+
+static arenaChunk *chunkCreate( size_t size, arenaChunk *next )
+{
+	arenaChunk *chunk = malloc( ARENA_HEADER + size );
+
+	if ( chunk == NULL )
+		return NULL;
+	chunk->next = next;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+static void freeChunks( arenaChunk *chunk )
+{
+	while ( chunk != NULL )
+	{
+		arenaChunk *next = chunk->next;
+		free( chunk );
+		chunk = next;
+	}
+}
+
+catalogArena *arenaCreate( void )
+{
+	return calloc( 1, sizeof(catalogArena) );
+}
+
+void arenaReset( catalogArena *arena )
+{
+	arenaChunk *chunk = arena->chunks;
+
+	if ( chunk != NULL && chunk->next != NULL )
+	{
+		size_t size = chunk->size;
+		while ( size < arena->used )
+			size *= 2;
+		freeChunks( chunk );
+		arena->chunks = chunkCreate( size, NULL );
+	}
+	else if ( chunk != NULL )
+		chunk->used = 0;
+	arena->used = 0;
+}
+
+void arenaDestroy( catalogArena *arena )
+{
+	if ( arena == NULL )
+		return;
+	freeChunks( arena->chunks );
+	free( arena );
+}
+
+static void *arenaAlloc( catalogArena *arena, size_t size )
+{
+	arenaChunk *chunk = arena->chunks;
+	void *p;
+
+	size = ALIGN8( size );
+	if ( chunk == NULL || chunk->size - chunk->used < size )
+	{
+		size_t chunkSize = chunk != NULL ? chunk->size * 2 : ARENA_FIRST_CHUNK;
+		while ( chunkSize < size )
+			chunkSize *= 2;
+		chunk = chunkCreate( chunkSize, chunk );
+		if ( chunk == NULL )
+			return NULL;
+		arena->chunks = chunk;
+	}
+	p = (char *)chunk + ARENA_HEADER + chunk->used;
+	chunk->used += size;
+	arena->used += size;
+	return p;
+}
+
+/*
+What catalogCreate needs, from the arena when there is one and from
+malloc when not; only the latter are given back with releaseBlock.
+*/
+static void *allocBlock( catalogArena *arena, size_t size )
+{
+	return arena != NULL ? arenaAlloc( arena, size ) : malloc( size );
+}
+
+static void *allocZeroed( catalogArena *arena, size_t size )
+{
+	void *p;
+
+	if ( arena == NULL )
+		return calloc( 1, size );
+	p = arenaAlloc( arena, size );
+	if ( p != NULL )
+		memset( p, 0, size );
+	return p;
+}
+
+static void releaseBlock( catalogArena *arena, void *p )
+{
+	if ( arena == NULL )
+		free( p );
+}
+
+modeCatalog *catalogCreate( const displayModeDesc *modes, size_t count )
+{
+	return catalogCreateIn( NULL, modes, count );
+}
+
+modeCatalog *catalogCreateIn( catalogArena *arena, const displayModeDesc *modes, size_t count )
+{
+	modeCatalog *catalog;
+	modeCatalogHeader *header;
+	catalogLayout layout;
+	sortEntry *entries;
+	resolutionEntry *res;
+	uint32_t numModes = (uint32_t)count;
+	uint32_t numResolutions = 0, numExactKeys = 0;
+	uint32_t ii, jj, out;
+	char *base;
+	int indexable = 1;
+	displayMode highest = { 0, 0, 0, 0 };
+
+	entries = allocBlock( arena, (numModes ? numModes : 1) * 2 * sizeof(sortEntry) );
+	res = allocBlock( arena, (numModes ? numModes : 1) * sizeof(resolutionEntry) );
+	catalog = allocZeroed( arena, sizeof(modeCatalog) );
+	if ( entries == NULL || res == NULL || catalog == NULL )
+		goto fail;
+
+	for ( ii = 0; ii < numModes; ii++ )
+	{
+		entries[ii].width = clampDimension( modes[ii].mode.width );
+		entries[ii].height = clampDimension( modes[ii].mode.height );
+		entries[ii].bpp = clampDimension( modes[ii].mode.bitsPerPixel );
+		entries[ii].pos = ii;
+		if ( modes[ii].mode.width >= INDEX_LIMIT || modes[ii].mode.height >= INDEX_LIMIT )
+			indexable = 0;
+	}
+	sortEntries( entries, entries + numModes, numModes );
+
+	for ( ii = 0; ii < numModes; ii++ )
+	{
+		if ( ii == 0 || entries[ii].width != entries[ii - 1].width || entries[ii].height != entries[ii - 1].height ) {
+			res[numResolutions].width = entries[ii].width;
+			res[numResolutions].height = entries[ii].height;
+			res[numResolutions].first = ii;
+			res[numResolutions].count = 0;
+			numResolutions++;
+		}
+		res[numResolutions - 1].count++;
+		if ( res[numResolutions - 1].count == 1 || entries[ii].bpp != entries[ii - 1].bpp )
+			numExactKeys++;
+	}
+	buildTree( res, 0, numResolutions, 0 );
+
+	if ( layoutCatalog( &layout, numModes, numResolutions, numExactKeys ) != 0 )
+		goto fail;
+	base = allocZeroed( arena, layout.size );
+	if ( base == NULL )
+		goto fail;
+	header = (modeCatalogHeader *)base;
+	header->magic = MODECATALOG_MAGIC;
+	header->version = MODECATALOG_VERSION;
+	header->size = layout.size;
+	header->numModes = numModes;
+	header->numResolutions = numResolutions;
+	header->numExactKeys = numExactKeys;
+	header->flags = indexable ? MODECATALOG_INDEXABLE : 0;
+
+	for ( ii = 0; ii < numModes; ii++ )
+	{
+		((double *)(base + layout.refresh))[ii] = modes[ii].mode.refresh;
+		((int32_t *)(base + layout.width))[ii] = clampDimension( modes[ii].mode.width );
+		((int32_t *)(base + layout.height))[ii] = clampDimension( modes[ii].mode.height );
+		((int32_t *)(base + layout.bpp))[ii] = clampDimension( modes[ii].mode.bitsPerPixel );
+		((uint32_t *)(base + layout.ioModeID))[ii] = modes[ii].ioModeID;
+		((uint8_t *)(base + layout.usable))[ii] = modes[ii].usable ? 1 : 0;
+	}
+
+	out = 0;
+	for ( ii = 0; ii < numResolutions; ii++ )
+	{
+		uint32_t *resModes = (uint32_t *)(base + layout.resModes);
+		((int32_t *)(base + layout.resWidth))[ii] = res[ii].width;
+		((int32_t *)(base + layout.resHeight))[ii] = res[ii].height;
+		((uint32_t *)(base + layout.resFirst))[ii] = out;
+		for ( jj = 0; jj < res[ii].count; jj++ )
+			resModes[out + jj] = entries[res[ii].first + jj].pos;
+		// grouped by depth in the sort, the replay wants list order
+		sortPositions( resModes + out, res[ii].count );
+		out += res[ii].count;
+	}
+	((uint32_t *)(base + layout.resFirst))[numResolutions] = out;
+
+	out = 0;
+	for ( ii = 0; ii < numModes; ii++ )
+	{
+		if ( ii > 0 && entries[ii].width == entries[ii - 1].width && entries[ii].height == entries[ii - 1].height &&
+				entries[ii].bpp == entries[ii - 1].bpp )
+			continue;
+		((int32_t *)(base + layout.exactWidth))[out] = entries[ii].width;
+		((int32_t *)(base + layout.exactHeight))[out] = entries[ii].height;
+		((int32_t *)(base + layout.exactBpp))[out] = entries[ii].bpp;
+		((uint32_t *)(base + layout.exactFirst))[out] = entries[ii].pos;
+		out++;
+	}
+
+	catalog->storage = arena == NULL ? base : NULL;
+	catalog->inArena = arena != NULL;
+	pointCatalog( catalog, base );
+	header->highest = (int32_t)catalogScan( catalog, SCAN_HIGHEST, highest );
+	releaseBlock( arena, entries );
+	releaseBlock( arena, res );
+	return catalog;
+
+fail:
+	releaseBlock( arena, entries );
+	releaseBlock( arena, res );
+	releaseBlock( arena, catalog );
+	return NULL;
+}
+
+modeCatalog *catalogAttach( const void *block, size_t size )
+{
+	const modeCatalogHeader *header = block;
+	catalogLayout layout;
+	modeCatalog *catalog;
+	uint32_t ii;
+
+	if ( size < sizeof(modeCatalogHeader) || header->magic != MODECATALOG_MAGIC || header->version != MODECATALOG_VERSION )
+		return NULL;
+	if ( layoutCatalog( &layout, header->numModes, header->numResolutions, header->numExactKeys ) != 0 ||
+			header->size != layout.size || layout.size > size )
+		return NULL;
+
+	catalog = calloc( 1, sizeof(modeCatalog) );
+	if ( catalog == NULL )
+		return NULL;
+	pointCatalog( catalog, block );
+
+	// the block may have come off disk, don't trust its indexes
+	// highest is a position, or kNoMode for an empty catalog
+	if ( header->highest < kNoMode || header->highest >= (int32_t)header->numModes ||
+			catalog->resFirst[header->numResolutions] != header->numModes )
+		goto bad;
+	for ( ii = 0; ii < header->numResolutions; ii++ )
+	{
+		if ( catalog->resFirst[ii] > catalog->resFirst[ii + 1] )
+			goto bad;
+	}
+	for ( ii = 0; ii < header->numModes; ii++ )
+	{
+		if ( catalog->resModes[ii] >= header->numModes )
+			goto bad;
+	}
+	for ( ii = 0; ii < header->numExactKeys; ii++ )
+	{
+		if ( catalog->exactFirst[ii] >= header->numModes )
+			goto bad;
+	}
+	return catalog;
+
+bad:
+	free( catalog );
+	return NULL;
+}
+
+void catalogDestroy( modeCatalog *catalog )
+{
+	if ( catalog == NULL || catalog->inArena )
+		return;
+	free( catalog->storage );
+	free( catalog );
+}
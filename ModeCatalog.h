@@ -0,0 +1,158 @@
+/*
+ModeCatalog.h
+
+A display's mode list, extracted once into flat arrays and indexed so
+that exact, closest and highest lookups don't have to scan every mode.
+
+The catalog keeps every mode in the order the backend listed it; a
+mode's position in the catalog is its index in the backend's list, so
+it can be handed straight to backendConfigureMode.  On top of that it
+keeps the distinct resolutions in a 2-d tree (for closest), the
+distinct width x height x depth keys sorted (for exact), and the
+answer to "highest" worked out ahead of time.
+
+Lookups give the same answer the old linear scan in modeForDisplay
+did, ties and all.  catalogScan is that linear scan, kept as the
+reference and as the fallback for targets the index can't take.
+
+The whole catalog lives in one block of memory with no pointers in it,
+so it can be written to disk and used again straight from a mapping.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef MODECATALOG_H
+#define MODECATALOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "DisplayBackend.h"
+
+#define SCAN_EXACT   0
+#define SCAN_CLOSEST 1
+#define SCAN_HIGHEST 2
+
+#define kNoMode      (-1L)
+
+#define MODECATALOG_MAGIC   0x53444d43 // 'SDMC'
+#define MODECATALOG_VERSION 1
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;              // bytes, this header included
+	uint32_t numModes;
+	uint32_t numResolutions;
+	uint32_t numExactKeys;
+	int32_t highest;            // catalog position, or -1
+	uint32_t flags;
+	uint32_t reserved;
+} modeCatalogHeader;
+
+#define MODECATALOG_INDEXABLE 0x1   // every resolution fits the 2-d tree
+
+typedef struct
+{
+	const modeCatalogHeader *header;
+	uint32_t numModes;
+	uint32_t numResolutions;
+	uint32_t numExactKeys;
+
+	// every mode, in backend order
+	const double *refresh;
+	const int32_t *width;
+	const int32_t *height;
+	const int32_t *bpp;
+	const uint32_t *ioModeID;
+	const uint8_t *usable;
+
+	// distinct resolutions, laid out as an implicit 2-d tree
+	const int32_t *resWidth;
+	const int32_t *resHeight;
+	const uint32_t *resFirst;   // [numResolutions + 1], into resModes
+	const uint32_t *resModes;   // mode positions grouped by resolution, ascending
+
+	// distinct width x height x depth, sorted, with the first mode that has it
+	const int32_t *exactWidth;
+	const int32_t *exactHeight;
+	const int32_t *exactBpp;
+	const uint32_t *exactFirst;
+
+	void *storage;              // freed by catalogDestroy when not NULL
+	int inArena;                // the arena it was made in frees it
+} modeCatalog;
+
+modeCatalog *catalogCreate( const displayModeDesc *modes, size_t count );
+modeCatalog *catalogAttach( const void *block, size_t size );
+void catalogDestroy( modeCatalog *catalog );
+
+/*
+An arena to make catalogs in, for something that makes them over and
+over (the session, for a display whose modes keep changing).  The
+catalog, the room its building takes and the catalog's struct all come
+out of the arena, catalogDestroy leaves them alone, and arenaReset
+gives back everything made in it at once.  The memory is kept for the
+next catalog: once an arena has grown to the biggest catalog made in
+it, making another allocates nothing.  An arena is for one thread at a
+time.
+*/
+typedef struct catalogArena catalogArena;
+
+catalogArena *arenaCreate( void );
+void arenaReset( catalogArena *arena );
+void arenaDestroy( catalogArena *arena );
+modeCatalog *catalogCreateIn( catalogArena *arena, const displayModeDesc *modes, size_t count );
+
+/*
+Returns the catalog position of the matching mode, or kNoMode.
+*/
+long catalogFind( const modeCatalog *catalog, int scanType, displayMode findMode );
+long catalogScan( const modeCatalog *catalog, int scanType, displayMode findMode );
+
+/*
+For a mirror set: the mode that all count catalogs have (the same
+width, height and depth) that scanType picks for findMode, by the same
+distances and ties as catalogFind, going through the first catalog's
+modes in the order they were listed; so for one catalog it is
+catalogFind's answer.  Each of the other catalogs then gets the mode of
+that width, height and depth catalogFind would take of them.  It walks
+the smallest catalog's sorted keys and looks for the ones that could
+win in the others' (galloping, so each catalog is passed over once).
+Fills in positions[count] and returns 0, or kNoMode when there is no
+mode they all have (or no memory).
+*/
+long catalogFindCommon( const modeCatalog *const *catalogs, size_t count, int scanType, displayMode findMode, long *positions );
+
+/*
+catalogFind and catalogScan for count targets at once: matches[i] is
+what they give for targets[i].  catalogScanBatch goes through every
+mode for closest and highest, a few targets per pass, with the kernel
+asked for: CATALOG_KERNEL_BEST is the fastest the CPU has, and one it
+doesn't have is taken as scalar.  catalogFindBatch picks whichever of
+that and the tree is quicker for the catalog.
+*/
+#define CATALOG_KERNEL_BEST   (-1)
+#define CATALOG_KERNEL_SCALAR 0
+#define CATALOG_KERNEL_SSE41  1
+#define CATALOG_KERNEL_AVX2   2
+
+void catalogFindBatch( const modeCatalog *catalog, int scanType, const displayMode *targets, size_t count, long *matches );
+void catalogScanBatch( const modeCatalog *catalog, int scanType, const displayMode *targets, size_t count, long *matches,
+		int kernel );
+int catalogKernelAvailable( int kernel );
+const char *catalogKernelName( int kernel );
+
+void catalogModeDesc( const modeCatalog *catalog, long position, displayModeDesc *desc );
+
+/*
+catalogFindMode gives the first position holding a mode with exactly
+these attributes, or kNoMode.  catalogMatchesModes is 1 when the
+catalog was built from an identical mode list.
+*/
+long catalogFindMode( const modeCatalog *catalog, const displayModeDesc *desc );
+int catalogMatchesModes( const modeCatalog *catalog, const displayModeDesc *modes, size_t count );
+
+#endif
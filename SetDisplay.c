@@ -1,5 +1,10 @@
 /*
-gcc -arch i386 -O3 -o SetDisplay SetDisplay.c -framework Cocoa
+gcc -arch i386 -O3 -o SetDisplay SetDisplay.c DisplayBackend.c DisplayBackendCG.c DisplayBackendDRM.c DisplayBackendReplay.c DisplayBackendSim.c DisplayBackendXRandR.c DisplayFlight.c DisplayLog.c DisplayPlan.c DisplayPolicy.c DisplayServer.c DisplayTiming.c DisplayTrace.c Edid.c ModeCache.c ModeCatalog.c SetDisplayLib.c WorkerPool.c -framework Cocoa -framework IOKit
+
+Anywhere else (the kernel's DRM connectors on Linux, see DisplayBackendDRM.c, and simulated displays, see DisplayBackendSim.c):
+gcc -O3 -o SetDisplay SetDisplay.c DisplayBackend.c DisplayBackendCG.c DisplayBackendDRM.c DisplayBackendReplay.c DisplayBackendSim.c DisplayBackendXRandR.c DisplayFlight.c DisplayLog.c DisplayPlan.c DisplayPolicy.c DisplayServer.c DisplayTiming.c DisplayTrace.c Edid.c ModeCache.c ModeCatalog.c SetDisplayLib.c WorkerPool.c -lpthread
+
+With X11 RandR as well (see DisplayBackendXRandR.c), add -DHAVE_XRANDR and -lXrandr -lX11.
 
 SetDisplay.c
 
@@ -47,50 +52,35 @@ manager says is possible.  So be careful!!!
 
 */
 
-#include <ApplicationServices/ApplicationServices.h>
-#include <CoreFoundation/CoreFoundation.h>
-#include <IOKit/IOKitLib.h>
+
+#include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-#define MAX_DISPLAYS 32
+#include "Clock.h"
+#include "DisplayFlight.h"
+#include "DisplayLog.h"
+#include "DisplayServer.h"
+#include "SetDisplayLib.h"
 
-typedef struct
-{
-	size_t width;
-	size_t height;
-	size_t bitsPerPixel;
-	double refresh;
-} displayMode;
+#define MAX_EVENTS 64
+#define VERIFY_TIMEOUT_MS 2000
 
 displayMode myModeStruct;
 
-size_t displayBitsPerPixel( CGDisplayModeRef mode )
-{
-	size_t depth = 0;
-	
-	CFStringRef pixEnc = CGDisplayModeCopyPixelEncoding(mode);
-	if(CFStringCompare(pixEnc, CFSTR(IO32BitDirectPixels), kCFCompareCaseInsensitive) == kCFCompareEqualTo)
-		depth = 32;
-	else if(CFStringCompare(pixEnc, CFSTR(IO16BitDirectPixels), kCFCompareCaseInsensitive) == kCFCompareEqualTo)
-		depth = 16;
-	else if(CFStringCompare(pixEnc, CFSTR(IO8BitIndexedPixels), kCFCompareCaseInsensitive) == kCFCompareEqualTo)
-		depth = 8;
-	
-	return depth;
-}
-
-static void printShortDispDesc( CGDisplayModeRef modeRef, int showOnlyAqua )
+static void printShortDispDesc( const displayModeDesc *desc, int showOnlyAqua )
 {
 	int aqua;
-	if ( CGDisplayModeGetIODisplayModeID(modeRef) )
+	if ( desc->usable )
 		aqua = 1;
 	else
 		aqua = 0;
-	size_t width = CGDisplayModeGetWidth(modeRef);
-	size_t height = CGDisplayModeGetHeight(modeRef);
-	size_t bpp = displayBitsPerPixel(modeRef);
-	double refreshrate = CGDisplayModeGetRefreshRate(modeRef);
+	size_t width = desc->mode.width;
+	size_t height = desc->mode.height;
+	size_t bpp = desc->mode.bitsPerPixel;
+	double refreshrate = desc->mode.refresh;
 	if ( showOnlyAqua == 1 ) {
 		if ( aqua == 1 )
 			printf( "%zu %zu %zu %lg Usable\n", width, height, bpp, refreshrate );
@@ -101,126 +91,538 @@ static void printShortDispDesc( CGDisplayModeRef modeRef, int showOnlyAqua )
 
 /////////////////
 
-static void allModesForDisplay( CGDirectDisplayID display, int verbose)
+static void allModesForDisplay( const modeCatalog *catalog, int verbose)
 {
-	CFIndex index, count;
-	CFArrayRef dictModes;
-	CGDisplayModeRef modeRef;
-	dictModes = CGDisplayCopyAllDisplayModes (display, NULL);
-	count = CFArrayGetCount (dictModes);
+	uint32_t index;
+	displayModeDesc desc;
 	printf( "------ All modes for display ------\n" );
-	for (index = 0; index < count; index++)
+	for (index = 0; index < catalog->numModes; index++)
 	{
-		modeRef = (CGDisplayModeRef)CFArrayGetValueAtIndex( dictModes, index );
-		printShortDispDesc( modeRef, verbose );
+		catalogModeDesc( catalog, index, &desc );
+		printShortDispDesc( &desc, verbose );
 	}
 	printf( "-----------------------------------\n" );
 }
 
-CGDisplayModeRef modeForDisplay( CGDirectDisplayID display, int scanType, displayMode findMode )
+static void printMatch( const displayModeDesc *matching )
+{
+	printf( "%zu %zu %zu %lg\n", matching->mode.width, matching->mode.height, matching->mode.bitsPerPixel, matching->mode.refresh );
+}
+
+long modeForDisplay( setDisplaySession *session, displayID display, int scanType, displayMode findMode )
+{
+	displayModeDesc matching;
+	long matchingModeIndex = sessionFind( session, display, scanType, findMode, &matching );
+	printMatch( &matching );
+	return matchingModeIndex;
+}
+
+/*
+Plans every display and, for any whose mode list turned out not to be
+the one the cache had, says so and what matched this time.
+*/
+static void planDisplays( setDisplaySession *session, displayPlan *plan, const displayID *displays, uint32_t numDisplays,
+		int scanType, int mirroringOnOff, int flags )
 {
-	CGDisplayModeRef matchingModeRef;
-	displayMode matchingModeStruct;
-	matchingModeStruct.width = 0;
-	matchingModeStruct.height = 0;
-	matchingModeStruct.bitsPerPixel = 0;
-	matchingModeStruct.refresh = 0;
-	int d_width = INT_MAX/2;
-	int d_height = INT_MAX/2;
-	int d_bpp = INT_MAX;
-	int d_refresh = INT_MAX;
-	CFIndex index, count;
-	CFArrayRef dictModes;
-	CGDisplayModeRef modeRef;
-	dictModes = CGDisplayCopyAllDisplayModes (display, NULL);
-	count = CFArrayGetCount (dictModes);
-	for (index = 0; index < count; index++)
+	int *relisted = calloc( numDisplays ? numDisplays : 1, sizeof(int) );
+	size_t ii, jj;
+	sessionPlanDisplays( session, plan, displays, numDisplays, scanType, myModeStruct, mirroringOnOff, flags, relisted );
+	for ( ii = 0; relisted != NULL && ii < numDisplays; ii++ )
 	{
-		modeRef = (CGDisplayModeRef)CFArrayGetValueAtIndex( dictModes, index );
-		size_t width = CGDisplayModeGetWidth(modeRef);
-		size_t height = CGDisplayModeGetHeight(modeRef);
-		size_t bpp = displayBitsPerPixel(modeRef);
-		double refreshrate = CGDisplayModeGetRefreshRate(modeRef);
-		if ( scanType == 0 ) {
-			// Exact
-			if ( width == findMode.width && height == findMode.height && bpp == findMode.bitsPerPixel /* && refreshrate == findMode.refresh */ ) {
-				matchingModeStruct.width = width;
-				matchingModeStruct.height = height;
-				matchingModeStruct.bitsPerPixel = bpp;
-				matchingModeStruct.refresh = refreshrate;
-				matchingModeRef = modeRef;
-				index = count; // EXIT LOOP
-			}
-		} else if ( scanType == 1 ) {
-			// Closest
-			int dw = abs(width - findMode.width);
-			int dh = abs(height - findMode.height);
-			int db = abs(bpp - findMode.bitsPerPixel);
-			int dr = abs(refreshrate - findMode.refresh);
-
-//			printf( "%zu %zu %zu %lg\n", matchingModeStruct.width, matchingModeStruct.height, matchingModeStruct.bitsPerPixel, matchingModeStruct.refresh );
-
-			if ( dw == d_width && dh == d_height ) {
-				if ( db <= d_bpp && dr <= d_refresh ) {
-					matchingModeStruct.bitsPerPixel = bpp;
-					matchingModeStruct.refresh = refreshrate;
-					d_width = dw;
-					d_height = dh;
-					d_bpp = db;
-					d_refresh = dr;
-					matchingModeRef = modeRef;
-				}
-			} else if ( dw + dh <= d_width + d_height ) {
-				matchingModeStruct.width = width;
-				matchingModeStruct.height = height;
-				matchingModeStruct.bitsPerPixel = bpp;
-				matchingModeStruct.refresh = refreshrate;
-				d_width = dw;
-				d_height = dh;
-				d_bpp = db;
-				d_refresh = dr;
-				matchingModeRef = modeRef;
-			}
+		if ( !relisted[ii] )
+			continue;
+		for ( jj = 0; jj < plan->count; jj++ )
+		{
+			if ( plan->entries[jj].display != displays[ii] )
+				continue;
+			printf( "----- Mode list changed, again -----\n" );
+			printMatch( &plan->entries[jj].mode );
+			printf( "-----------------------------------\n" );
+		}
+	}
+	free( relisted );
+}
+
+/*
+The closest mode isn't the one asked for.  Says so when it isn't even
+the same shape, and with -v what the mode asked for would have taken.
+*/
+static void explainClosest( setDisplaySession *session, const displayPlanEntry *entry, displayMode wanted, int verbose )
+{
+	const displayMode *got = &entry->mode.mode;
+	displayTiming timing;
+	timingLimits limits;
+	char wantedAspect[24], gotAspect[24];
+	int check;
+
+	if ( wanted.width == 0 || wanted.height == 0 || (got->width == wanted.width && got->height == wanted.height) )
+		return;
+	if ( !timingSameAspect( got->width, got->height, wanted.width, wanted.height ) )
+		printf( "Display 0x%x has no %zu x %zu mode, %zu x %zu is %s, not %s\n", (unsigned int)entry->display,
+				wanted.width, wanted.height, got->width, got->height,
+				timingAspectName( got->width, got->height, gotAspect, sizeof(gotAspect) ),
+				timingAspectName( wanted.width, wanted.height, wantedAspect, sizeof(wantedAspect) ) );
+	if ( verbose != 1 )
+		return;
+	check = sessionTiming( session, entry->display, wanted, &timing, &limits );
+	if ( check < 0 )
+		return;
+	printf( "%zu x %zu would be %s %.2f MHz, %.2f kHz, %.2f Hz: %s (the display's modes go up to %.2f MHz, %.2f kHz)\n",
+			wanted.width, wanted.height, timingSourceName( timing.source ), timing.pixelClock / 1000.0,
+			timing.hRate, timing.refresh, timingCheckName( check ), limits.maxPixelClock / 1000.0, limits.maxHRate );
+}
+
+/*
+What went wrong in sessionApply.  A display whose configure failed was
+left out of the commit and is as it was; the others were still
+committed, if the commit went through.
+*/
+static void reportApply( setDisplaySession *session, const displayPlan *plan, const displayPlanResult *result )
+{
+	size_t ii;
+	for ( ii = 0; ii < plan->count; ii++ )
+	{
+		const displayPlanEntry *entry = &plan->entries[ii];
+		if ( entry->err != kDisplayNoErr )
+			printf( "Cannot set display 0x%x to %zu %zu %zu %lg (%d), left as it was\n", (unsigned int)entry->display,
+					entry->mode.mode.width, entry->mode.mode.height, entry->mode.mode.bitsPerPixel,
+					entry->mode.mode.refresh, entry->err );
+	}
+	if ( result->commits == 0 && result->err == kDisplayErrNotSupported )
+		printf( "The %s backend can't set modes\n", sessionBackend( session )->name );
+	else if ( result->commits == 0 && result->err != kDisplayNoErr )
+		printf( "Cannot complete display configuration (%d), nothing was changed\n", result->err );
+}
+
+static void printState( const displayModeDesc *mode, int showMirror, displayID mirrorOf )
+{
+	printf( "%zu %zu %zu %lg", mode->mode.width, mode->mode.height, mode->mode.bitsPerPixel, mode->mode.refresh );
+	if ( showMirror && mirrorOf != kNullDisplay )
+		printf( " mirroring 0x%x", (unsigned int)mirrorOf );
+	else if ( showMirror )
+		printf( " not mirrored" );
+}
+
+/*
+What sessionVerify found: every display that didn't read back as
+planned, and with -v how long each that did took to.
+*/
+static void reportVerify( const displayPlan *plan, int verbose )
+{
+	size_t ii;
+	for ( ii = 0; ii < plan->count; ii++ )
+	{
+		const displayPlanEntry *entry = &plan->entries[ii];
+		if ( entry->verify == PLAN_VERIFY_UNREADABLE ) {
+			printf( "Cannot read display 0x%x back after the commit\n", (unsigned int)entry->display );
+		} else if ( entry->verify == PLAN_VERIFY_MISMATCH ) {
+			printf( "Display 0x%x is ", (unsigned int)entry->display );
+			printState( &entry->readBack, entry->changeMirror, entry->readBackMirrorOf );
+			printf( " %.3f ms after the commit, not ", entry->settleNanoseconds / 1e6 );
+			printState( &entry->mode, entry->changeMirror, entry->mirror == MIRROR_ON ? entry->mirrorOf : kNullDisplay );
+			printf( " as planned\n" );
+		} else if ( entry->verify == PLAN_VERIFY_SETTLED && verbose == 1 ) {
+			printf( "Display 0x%x read back as planned %.3f ms after the commit\n", (unsigned int)entry->display,
+					entry->settleNanoseconds / 1e6 );
+		}
+	}
+}
+
+static void applyPlan( setDisplaySession *session, displayPlan *plan, int scanType, long verifyMs, int verbose,
+		displayPlanResult *resultOut )
+{
+	displayPlanResult result;
+	size_t ii;
+	for ( ii = 0; ii < plan->count; ii++ )
+	{
+		const displayPlanEntry *entry = &plan->entries[ii];
+		displayMode wanted = myModeStruct;
+		int entryScanType = scanType, mirroringOnOff = 0;
+		sessionPolicy( session, entry->display, &entryScanType, &wanted, &mirroringOnOff );
+		if ( entry->modeIndex != kNoMode && entryScanType == SCAN_CLOSEST )
+			explainClosest( session, entry, wanted, verbose );
+		if ( entry->modeIndex == kNoMode )
+			printf( "No matching mode for display 0x%x, not changed\n", (unsigned int)entry->display );
+		else if ( !planEntryChanges( entry ) )
+			printf( "Display 0x%x is already %zu %zu %zu %lg, not changed\n", (unsigned int)entry->display,
+					entry->mode.mode.width, entry->mode.mode.height, entry->mode.mode.bitsPerPixel, entry->mode.mode.refresh );
+	}
+	if ( sessionApply( session, plan, 1, &result ) != kDisplayNoErr )
+		reportApply( session, plan, &result );
+	if ( verbose == 1 )
+		printf( "%lu display(s) configured in %lu commit(s), %lu skipped, %.3f ms\n", result.configured, result.commits,
+				result.skipped, result.applyNanoseconds / 1e6 );
+	if ( verifyMs > 0 && result.commits > 0 )
+	{
+		sessionVerify( session, plan, verifyMs, &result );
+		reportVerify( plan, verbose );
+		if ( verbose == 1 )
+			printf( "%lu display(s) read back as planned, the last %.3f ms after the commit; %lu not as planned, "
+					"%lu unreadable\n", result.settled, result.settleMaxNanoseconds / 1e6, result.mismatched, result.unreadable );
+	}
+	*resultOut = result;
+}
+
+/////////////////
+
+static void flightStart( flightSlot *mine, uint64_t key, int partial, int scanType, int mirroringOnOff )
+{
+	memset( mine, 0, sizeof(flightSlot) );
+	mine->key = key;
+	mine->partial = (uint32_t)partial;
+	mine->width = (uint32_t)myModeStruct.width;
+	mine->height = (uint32_t)myModeStruct.height;
+	mine->bitsPerPixel = (uint32_t)myModeStruct.bitsPerPixel;
+	mine->refresh = myModeStruct.refresh;
+	mine->scanType = scanType;
+	mine->mirroringOnOff = mirroringOnOff;
+}
+
+static void flightDone( displayFlight *flight, flightSlot *mine, uint32_t numDisplays, const displayPlanResult *result )
+{
+	mine->numDisplays = numDisplays;
+	mine->commits = (uint32_t)result->commits;
+	mine->configured = (uint32_t)result->configured;
+	mine->skipped = (uint32_t)result->skipped;
+	mine->mismatched = (uint32_t)result->mismatched;
+	mine->unreadable = (uint32_t)result->unreadable;
+	mine->err = result->err;
+	flightLand( flight, mine );
+}
+
+/*
+Says whose flight this one had to wait for, when it had to.
+*/
+static void reportWait( const flightSlot *seen, uint64_t waited )
+{
+	if ( seen->state != FLIGHT_FLYING || seen->pid == 0 )
+		return;
+	printf( "Waited %.3f ms for SetDisplay (pid %u) %s %u %u %u %lg to finish\n", waited / 1e6, (unsigned int)seen->pid,
+			seen->partial ? "putting back" : "setting", (unsigned int)seen->width, (unsigned int)seen->height,
+			(unsigned int)seen->bitsPerPixel, seen->refresh );
+}
+
+static void logStart( logRecord *record, int kind, int scanType, int mirroringOnOff, int setting )
+{
+	memset( record, 0, sizeof(logRecord) );
+	record->time = logTime();
+	record->pid = (uint32_t)getpid();
+	record->kind = (uint16_t)kind;
+	record->scanType = (uint8_t)scanType;
+	record->mirroringOnOff = (uint8_t)mirroringOnOff;
+	record->width = (uint16_t)myModeStruct.width;
+	record->height = (uint16_t)myModeStruct.height;
+	record->bitsPerPixel = (uint8_t)myModeStruct.bitsPerPixel;
+	record->refresh = (float)myModeStruct.refresh;
+	record->setting = (uint8_t)setting;
+}
+
+static uint32_t logMicroseconds( uint64_t nanoseconds )
+{
+	return nanoseconds / 1000u > UINT32_MAX ? UINT32_MAX : (uint32_t)(nanoseconds / 1000u);
+}
+
+/*
+Puts what the plan did in the record, each display with the mode it
+asked for after the policy, and appends it.
+*/
+static void logDone( displayLog *log, logRecord *record, setDisplaySession *session, const displayPlan *plan,
+		const displayPlanResult *result )
+{
+	size_t ii;
+	if ( log == NULL )
+		return;
+	logPlan( record, plan, result );
+	for ( ii = 0; ii < plan->count && ii < DISPLAYLOG_DISPLAYS; ii++ )
+	{
+		displayMode wanted = myModeStruct;
+		int scanType = record->scanType, mirroringOnOff = record->mirroringOnOff;
+		if ( sessionPolicy( session, plan->entries[ii].display, &scanType, &wanted, &mirroringOnOff ) != NULL )
+			logWanted( record, plan->entries[ii].display, scanType, wanted );
+	}
+	record->phaseMicroseconds[LOG_PHASE_APPLY] = logMicroseconds( result->applyNanoseconds );
+	record->phaseMicroseconds[LOG_PHASE_VERIFY] = logMicroseconds( result->verifyNanoseconds );
+	logAppend( log, record );
+}
+
+static uint16_t logCount( uint32_t count )
+{
+	return count > UINT16_MAX ? UINT16_MAX : (uint16_t)count;
+}
+
+/*
+A run that took the result of the flight it waited for (-F) is logged
+with that result, and the wait as its time.
+*/
+static void logReused( const char *logPath, logRecord *record, const flightSlot *seen, uint64_t waited )
+{
+	displayLog *log;
+
+	if ( logPath == NULL )
+		return;
+	log = logOpen( logPath, 0 );
+	if ( log == NULL )
+	{
+		printf( "Cannot log to %s\n", logPath );
+		return;
+	}
+	record->kind = LOG_REUSED;
+	record->numDisplays = seen->numDisplays;
+	record->commits = logCount( seen->commits );
+	record->configured = logCount( seen->configured );
+	record->skipped = logCount( seen->skipped );
+	record->mismatched = logCount( seen->mismatched );
+	record->unreadable = logCount( seen->unreadable );
+	record->err = seen->err;
+	record->phaseMicroseconds[LOG_PHASE_TOTAL] = logMicroseconds( waited );
+	logAppend( log, record );
+	logClose( log );
+}
+
+/*
+A run that gives up before setting anything still lands its flight, so
+that the ones waiting on it go ahead, and is logged with the error.
+*/
+static void runFailed( displayFlight *flight, flightSlot *mine, const char *logPath, logRecord *record, displayErr err,
+		uint32_t numDisplays )
+{
+	displayPlanResult result;
+	displayLog *log;
+
+	memset( &result, 0, sizeof(result) );
+	result.err = err;
+	flightDone( flight, mine, numDisplays, &result );
+	flightClose( flight );
+	if ( logPath != NULL && (log = logOpen( logPath, 0 )) != NULL )
+	{
+		record->err = err;
+		logAppend( log, record );
+		logClose( log );
+	}
+}
+
+/////////////////
+
+static volatile sig_atomic_t daemonStop = 0;
+
+static void stopDaemon( int sig )
+{
+	daemonStop = 1;
+}
+
+static void noteChanged( displayID **changed, uint32_t *numChanged, const displayEvent *events, size_t numEvents )
+{
+	size_t ii;
+	uint32_t jj;
+	for ( ii = 0; ii < numEvents; ii++ )
+	{
+		displayID *grown;
+		for ( jj = 0; jj < *numChanged; jj++ )
+		{
+			if ( (*changed)[jj] == events[ii].display )
+				break;
 		}
+		if ( jj < *numChanged )
+			continue;
+		grown = realloc( *changed, (*numChanged + 1) * sizeof(displayID) );
+		if ( grown == NULL )
+			continue;
+		*changed = grown;
+		(*changed)[(*numChanged)++] = events[ii].display;
 	}
-	printf( "%zu %zu %zu %lg\n", matchingModeStruct.width, matchingModeStruct.height, matchingModeStruct.bitsPerPixel, matchingModeStruct.refresh );
-	return matchingModeRef;
 }
 
-static void setdisplay( CGDirectDisplayID display, CGDisplayModeRef modeRef, int mirroringOnOff, int verbose )
+/*
+Stays running and puts displays back in the chosen mode whenever they
+are plugged in, switched back to by a KVM, or otherwise changed.  Events
+come in bursts, so after the first one it waits until there has been
+nothing new for debounceMs (but never longer than four times that)
+before looking, and then only at the displays the events were about.
+*/
+static void runDaemon( setDisplaySession *session, int scanType, int mirroringOnOff, int planFlags,
+		long debounceMs, long verifyMs, displayFlight *flight, uint64_t key, displayLog *log, int verbose )
 {
-	CGError err;
-	CGDisplayConfigRef configRef;
-	boolean_t exactMatch;
-	CGBeginDisplayConfiguration(&configRef);
-
-	err = CGConfigureDisplayWithDisplayMode( configRef, display, modeRef, NULL );
-
-	if ( mirroringOnOff == 1 ) {
-		CGConfigureDisplayMirrorOfDisplay(configRef, display, kCGNullDirectDisplay);
-	} else if ( mirroringOnOff == 2 ) {
-		CGDirectDisplayID mainDisplay = CGMainDisplayID();
-		if ( display != mainDisplay ) {
-			CGConfigureDisplayMirrorOfDisplay(configRef, display, mainDisplay);
+	unsigned long cycles = 0, corrected = 0, corrections = 0, listsBefore;
+	unsigned long settled = 0, mismatched = 0, unreadable = 0;
+	setDisplayStats stats;
+	uint64_t latencyTotal = 0, latencyMax = 0, settleTotal = 0, settleMax = 0;
+	int moreEvents = 1;
+
+	signal( SIGINT, stopDaemon );
+	signal( SIGTERM, stopDaemon );
+	if ( verbose == 1 )
+		printf( "Waiting for display changes\n" );
+
+	while ( !daemonStop && moreEvents )
+	{
+		displayEvent events[MAX_EVENTS];
+		displayID *changed = NULL;
+		uint32_t numChanged = 0;
+		size_t numEvents, ii;
+		uint64_t first, now, quietUntil, giveUpAt;
+		displayPlan plan;
+		displayPlanResult result;
+		logRecord record;
+		flightSlot mine, seen;
+		uint64_t planned;
+		displayErr err;
+
+		err = sessionWaitForEvents( session, 1000, events, MAX_EVENTS, &numEvents );
+		if ( err == kDisplayErrNoMoreEvents )
+			break;
+		if ( err != kDisplayNoErr )
+		{
+			printf( "Cannot wait for display events (%d)\n", err );
+			break;
+		}
+		if ( numEvents == 0 )
+			continue;
+
+		first = events[0].timestamp;
+		for ( ii = 1; ii < numEvents; ii++ )
+		{
+			if ( events[ii].timestamp < first )
+				first = events[ii].timestamp;
+		}
+		noteChanged( &changed, &numChanged, events, numEvents );
+
+		now = clockNanoseconds();
+		quietUntil = now + (uint64_t)debounceMs * 1000000u;
+		giveUpAt = first + (uint64_t)debounceMs * 4000000u;
+		while ( !daemonStop )
+		{
+			uint64_t deadline = quietUntil < giveUpAt ? quietUntil : giveUpAt;
+			now = clockNanoseconds();
+			if ( now >= deadline )
+				break;
+			err = sessionWaitForEvents( session, (long)((deadline - now + 999999) / 1000000), events, MAX_EVENTS, &numEvents );
+			if ( err != kDisplayNoErr )
+			{
+				moreEvents = 0;
+				break;
+			}
+			if ( numEvents > 0 )
+			{
+				noteChanged( &changed, &numChanged, events, numEvents );
+				quietUntil = clockNanoseconds() + (uint64_t)debounceMs * 1000000u;
+			}
+		}
+
+		cycles++;
+		// only the displays that changed, so no one else can take it for theirs
+		flightStart( &mine, key, 1, scanType, mirroringOnOff );
+		now = clockNanoseconds();
+		flightBegin( flight, &mine, 0, &seen );
+		reportWait( &seen, clockNanoseconds() - now );
+		listsBefore = sessionBackend( session )->stats.copyModes;
+		logStart( &record, LOG_CORRECTION, scanType, mirroringOnOff, 1 );
+		record.numDisplays = numChanged;
+		now = clockNanoseconds();
+		planInit( &plan );
+		// a display that went away again just isn't planned
+		sessionPlanDisplays( session, &plan, changed, numChanged, scanType, myModeStruct, mirroringOnOff, planFlags, NULL );
+		free( changed );
+		planned = clockNanoseconds();
+		record.phaseMicroseconds[LOG_PHASE_PLAN] = logMicroseconds( planned - now );
+		err = sessionApply( session, &plan, 1, &result );
+		now = clockNanoseconds();
+		if ( err != kDisplayNoErr )
+			reportApply( session, &plan, &result );
+		if ( verifyMs > 0 && result.commits > 0 )
+		{
+			sessionVerify( session, &plan, verifyMs, &result );
+			reportVerify( &plan, verbose );
+			for ( ii = 0; ii < plan.count; ii++ )
+			{
+				if ( plan.entries[ii].verify == PLAN_VERIFY_SETTLED )
+					settleTotal += plan.entries[ii].settleNanoseconds;
+			}
+			settled += result.settled;
+			mismatched += result.mismatched;
+			unreadable += result.unreadable;
+			if ( result.settleMaxNanoseconds > settleMax )
+				settleMax = result.settleMaxNanoseconds;
 		}
+		flightDone( flight, &mine, numChanged, &result );
+		if ( result.configured > 0 )
+		{
+			uint64_t latency = now - first;
+			corrected++;
+			corrections += result.configured;
+			latencyTotal += latency;
+			if ( latency > latencyMax )
+				latencyMax = latency;
+			if ( verbose == 1 )
+				printf( "%u display(s) changed, %lu corrected %.3f ms after the first event, %lu mode list(s) read\n",
+						numChanged, result.configured, latency / 1e6, sessionBackend( session )->stats.copyModes - listsBefore );
+		} else if ( verbose == 1 ) {
+			printf( "%u display(s) changed, all already as wanted, %lu mode list(s) read\n", numChanged,
+					sessionBackend( session )->stats.copyModes - listsBefore );
+		}
+		// from the first event, which is what a KVM switch costs whoever is sitting there
+		record.phaseMicroseconds[LOG_PHASE_TOTAL] = logMicroseconds( clockNanoseconds() - first );
+		logDone( log, &record, session, &plan, &result );
+		planFree( &plan );
+		sessionSaveCache( session );
 	}
 
-	CGCompleteDisplayConfiguration( configRef, kCGConfigurePermanently );
-	if ( err != CGDisplayNoErr )
+	printf( "%lu event burst(s), %lu needed correcting (%lu display(s))", cycles, corrected, corrections );
+	if ( corrected > 0 )
+		printf( ", event to corrected mode: avg %.3f ms, max %.3f ms", latencyTotal / 1e6 / corrected, latencyMax / 1e6 );
+	printf( "\n" );
+	if ( settled + mismatched + unreadable > 0 )
 	{
-		printf( "Oops!  Mode switch failed?!?? (%d)\n", err );
+		printf( "%lu display(s) read back as planned", settled );
+		if ( settled > 0 )
+			printf( ", commit to settled: avg %.3f ms, max %.3f ms", settleTotal / 1e6 / settled, settleMax / 1e6 );
+		printf( "; %lu not as planned, %lu unreadable\n", mismatched, unreadable );
 	}
+	sessionStats( session, &stats );
+	printf( "%lu mode list(s) read, %lu catalog(s) made; %lu changed display(s) read again, %lu kept their catalog; "
+			"%lu match(es), %lu the same as last time\n", sessionBackend( session )->stats.copyModes, stats.catalogs,
+			stats.rechecks, stats.kept, stats.matches, stats.matchesKept );
+}
+
+/*
+-t and -T, once everything has been done.
+*/
+static void reportTimes( displayTrace *trace, const char *tracePath, int shouldPrintTimes )
+{
+	if ( trace == NULL )
+		return;
+	if ( shouldPrintTimes == 1 )
+		tracePrintSummary( trace, stdout );
+	if ( tracePath != NULL && traceWriteChrome( trace, tracePath ) != 0 )
+		printf( "Cannot write %s\n", tracePath );
+	traceDestroy( trace );
 }
 
 static void usage()
 {
-	printf( "SetDisplay [-acvxyz] [-w WIDTH] [-h HEIGHT] [-b BPP] [-r REFRESH] | [WIDTH HEIGHT BPP REFRESH]\n" );
+	printf( "SetDisplay [-acDfnptvxz] [-B BACKEND] [-C CACHEFILE] [-E EDIDFILE] [-F FLIGHTFILE] [-j WORKERS] [-L LOGFILE] [-P POLICY] [-R RECORDING] [-S SOCKET] [-T TRACEFILE] [-V MS] [-W MS] [-w WIDTH] [-h HEIGHT] [-b BPP] [-r REFRESH] | [WIDTH HEIGHT BPP REFRESH]\n" );
 	printf( " -a Show all possible matches (resolution not changed)\n" );
+	printf( " -B Display backend, NAME[:KEY=VALUE,...], one of:\n" );
+	backendUsage();
+	printf( " -C Keep the mode lists of known monitors in CACHEFILE\n" );
 	printf( " -c Show closest match\n" );
+	printf( " -D Keep running and set the resolution again whenever a display changes (not with -a, -n or -p)\n" );
+	printf( " -E Take the modes of a display that has none from the EDID saved in EDIDFILE\n" );
+	printf( " -F Take turns with other SetDisplays given the same FLIGHTFILE; one wanting what the one before it just did leaves the displays alone\n" );
+	printf( " -f Reconfigure displays even if they are already in the chosen mode\n" );
+	printf( " -j Work on at most WORKERS displays at once, default all of them\n" );
+	printf( " -L Add what was done to LOGFILE, a ring of the last 2048 runs (read it with SetDisplayLog)\n" );
 	printf( " -M Mirroring on\n" );
 	printf( " -m Mirroring off\n" );
 	printf( " -n Do not change the resolution\n" );
+	printf( " -P Set the displays a rule in POLICY (compiled with SetDisplayPolicy) matches the rule's way\n" );
+	printf( " -p Print what would be changed (resolution not changed)\n" );
+	printf( " -R Record the displays, and how long each call to the backend took, into RECORDING (play it back with -B replay:file=RECORDING)\n" );
+	printf( " -S Answer requests on SOCKET instead (see SetDisplayClient)\n" );
+	printf( " -T Write how long each step took for each display to TRACEFILE (Chrome trace-event JSON)\n" );
+	printf( " -t Print how long each step took for each display\n" );
+	printf( " -V How long to wait for the displays changed to read back as planned, default 2000 ms, 0 not to check\n" );
 	printf( " -v Verbose\n" );
+	printf( " -W How long display events have to settle before -D looks at them, default 250 ms\n" );
 	printf( " -x Show exact match\n" );
 	printf( " -z Show highest possible resolution\n" );
 	printf( " No args default to 1024 768 32 75\n" );
@@ -230,10 +632,30 @@ static void usage()
 
 int main(int argc, char **argv)
 {
-	CGDirectDisplayID displays[MAX_DISPLAYS];
-	CGDisplayCount numDisplays;
-	CGDisplayCount ii;
-	CGDisplayErr err;
+	const displayID *online;
+	displayID *displays;
+	uint32_t numDisplays;
+	uint32_t ii;
+	displayErr err;
+	setDisplaySession *session;
+	const char *backendSpec = NULL;
+	const char *cachePath = NULL;
+	const char *edidPath = NULL;
+	const char *logPath = NULL;
+	displayLog *log = NULL;
+	const char *flightPath = NULL;
+	displayFlight *flight = NULL;
+	flightSlot mine, seen;
+	uint64_t key;
+	logRecord record;
+	displayPlanResult result;
+	uint64_t started = clockNanoseconds(), phaseStart;
+	const char *policyPath = NULL;
+	const char *recordPath = NULL;
+	displayPolicy *policy = NULL;
+	const char *socketPath = NULL;
+	const char *tracePath = NULL;
+	displayTrace *trace = NULL;
 	int cc;
 	int verbose = 0;
 	int shouldFindHighest = 0;
@@ -242,6 +664,16 @@ int main(int argc, char **argv)
 	int shouldFindClosest = 1;
 	int mirroringOnOff = 0;
 	int shouldSetDisplay = 1;
+	int shouldPrintPlan = 0;
+	int shouldForce = 0;
+	int shouldStayResident = 0;
+	int shouldPrintTimes = 0;
+	long debounceMs = 250;
+	long verifyMs = VERIFY_TIMEOUT_MS;
+	int workers = 0;
+	int scanType;
+	int planFlags;
+	displayPlan plan;
 
 	opterr = 0;
 
@@ -250,7 +682,7 @@ int main(int argc, char **argv)
 	myModeStruct.bitsPerPixel = 32;
 	myModeStruct.refresh = 75;
 
-	while ((cc = getopt (argc, argv, "ab:ch:Mmnr:vw:xz")) != -1) {
+	while ((cc = getopt (argc, argv, "aB:b:C:cDE:F:fh:j:L:MmnP:pR:r:S:T:tV:vW:w:xz")) != -1) {
 		//printf ("Options %c\n", cc);
 		switch (cc)
 			{
@@ -258,30 +690,79 @@ int main(int argc, char **argv)
 				shouldShowAll = 1;
 				shouldSetDisplay = 0;
 				break;
+			case 'B':
+				backendSpec = optarg;
+				break;
 			case 'b':
 				myModeStruct.bitsPerPixel = atoi(optarg);
 				break;
+			case 'C':
+				cachePath = optarg;
+				break;
 			case 'c':
 				shouldFindClosest = 1;
 				break;
+			case 'D':
+				shouldStayResident = 1;
+				break;
+			case 'E':
+				edidPath = optarg;
+				break;
+			case 'F':
+				flightPath = optarg;
+				break;
+			case 'f':
+				shouldForce = 1;
+				break;
 			case 'h':
 				myModeStruct.height = atoi(optarg);
 				break;
+			case 'j':
+				workers = atoi(optarg);
+				break;
 			case 'm':
 				mirroringOnOff = 1;
 				break;
+			case 'L':
+				logPath = optarg;
+				break;
 			case 'M':
 				mirroringOnOff = 2;
 				break;
 			case 'n':
 				shouldSetDisplay = 0;
 				break;
+			case 'P':
+				policyPath = optarg;
+				break;
+			case 'p':
+				shouldPrintPlan = 1;
+				shouldSetDisplay = 0;
+				break;
+			case 'R':
+				recordPath = optarg;
+				break;
 			case 'r':
 				myModeStruct.refresh = atoi(optarg);
 				break;
+			case 'S':
+				socketPath = optarg;
+				break;
+			case 'T':
+				tracePath = optarg;
+				break;
+			case 't':
+				shouldPrintTimes = 1;
+				break;
+			case 'V':
+				verifyMs = atol(optarg);
+				break;
 			case 'v':
 				verbose = 1;
 				break;
+			case 'W':
+				debounceMs = atol(optarg);
+				break;
 			case 'w':
 				myModeStruct.width = atoi(optarg);
 				break;
@@ -312,71 +793,214 @@ int main(int argc, char **argv)
 			usage();
 		}
 	}
+	// -D is there to set the displays, over and over: a run that mustn't would set them all the same
+	if ( shouldStayResident == 1 && shouldSetDisplay == 0 )
+	{
+		printf( "-D sets the displays, it can't be given with -a, -n or -p\n" );
+		usage();
+	}
 
 	if ( verbose == 1 )
 		printf( "Width: %zu Height: %zu BitsPerPixel: %zu Refresh rate: %lg\n", myModeStruct.width, myModeStruct.height, myModeStruct.bitsPerPixel, myModeStruct.refresh );
 
-	//err = CGGetActiveDisplayList(MAX_DISPLAYS, displays, &numDisplays); // active only
-	err = CGGetOnlineDisplayList(MAX_DISPLAYS, displays, &numDisplays); // active, mirrored, or sleeping
-	if ( err != CGDisplayNoErr )
+	scanType = shouldFindExact ? SCAN_EXACT : shouldFindHighest ? SCAN_HIGHEST : SCAN_CLOSEST;
+	logStart( &record, LOG_RUN, scanType, mirroringOnOff, shouldSetDisplay );
+	memset( &result, 0, sizeof(result) );
+
+	// before the displays are even listed: a run that finds it all just done needn't list them
+	key = flightKey( backendSpec, policyPath, myModeStruct, scanType, mirroringOnOff, shouldForce );
+	flightStart( &mine, key, 0, scanType, mirroringOnOff );
+	if ( flightPath != NULL && socketPath == NULL && (shouldSetDisplay == 1 || shouldStayResident == 1) )
+	{
+		flight = flightOpen( flightPath );
+		if ( flight == NULL )
+			printf( "Cannot open %s, not waiting for other SetDisplays\n", flightPath );
+		phaseStart = clockNanoseconds();
+		if ( flightBegin( flight, &mine, shouldStayResident == 0, &seen ) == FLIGHT_REUSED )
+		{
+			printf( "SetDisplay (pid %u) just set %u %u %u %lg, %u display(s) configured in %u commit(s) "
+					"%.3f ms ago; not set again\n", (unsigned int)seen.pid, (unsigned int)seen.width,
+					(unsigned int)seen.height, (unsigned int)seen.bitsPerPixel, seen.refresh,
+					(unsigned int)seen.configured, (unsigned int)seen.commits,
+					(logTime() - seen.landed) / 1e3 );
+			logReused( logPath, &record, &seen, clockNanoseconds() - phaseStart );
+			flightClose( flight );
+			exit( 0 );
+		}
+		reportWait( &seen, clockNanoseconds() - phaseStart );
+		// the wait is the other SetDisplay's time, not ours
+		started = clockNanoseconds();
+	}
+
+	session = sessionOpen( backendSpec, cachePath );
+	if ( session == NULL )
+	{
+		runFailed( flight, &mine, logPath, &record, kDisplayErrFailure, 0 );
+		exit( 1 );
+	}
+
+	if ( recordPath != NULL && (err = sessionRecord( session, recordPath )) != kDisplayNoErr )
+	{
+		runFailed( flight, &mine, logPath, &record, err, 0 );
+		sessionClose( session );
+		exit( 1 );
+	}
+	sessionSetWorkers( session, workers );
+	if ( edidPath != NULL && sessionSetEdidFile( session, edidPath ) != 0 )
+	{
+		printf( "No EDID in %s\n", edidPath );
+		runFailed( flight, &mine, logPath, &record, kDisplayErrIllegalArg, 0 );
+		sessionClose( session );
+		exit( 1 );
+	}
+	if ( policyPath != NULL )
+	{
+		policy = policyOpen( policyPath );
+		if ( policy == NULL )
+		{
+			printf( "%s isn't a compiled policy (see SetDisplayPolicy)\n", policyPath );
+			runFailed( flight, &mine, logPath, &record, kDisplayErrIllegalArg, 0 );
+			sessionClose( session );
+			exit( 1 );
+		}
+		sessionSetPolicy( session, policy );
+	}
+	if ( tracePath != NULL || shouldPrintTimes == 1 )
+	{
+		trace = traceCreate();
+		sessionSetTrace( session, trace );
+	}
+
+	if ( socketPath != NULL )
+	{
+		err = serverRun( session, socketPath, verbose );
+		sessionSaveCache( session );
+		sessionClose( session );
+		policyClose( policy );
+		reportTimes( trace, tracePath, shouldPrintTimes );
+		exit( err == 0 ? 0 : 1 );
+	}
+
+	phaseStart = clockNanoseconds();
+	record.phaseMicroseconds[LOG_PHASE_OPEN] = logMicroseconds( phaseStart - started );
+	err = sessionDisplays( session, &online, &numDisplays );
+	if ( err != kDisplayNoErr )
 	{
 		printf("Cannot get displays (%d)\n", err);
+		runFailed( flight, &mine, logPath, &record, err, 0 );
+		sessionClose( session );
 		exit( 1 );
 	}
+	// the session's array doesn't outlive the displays changing
+	displays = malloc( (numDisplays ? numDisplays : 1) * sizeof(displayID) );
+	if ( displays == NULL )
+	{
+		runFailed( flight, &mine, logPath, &record, kDisplayErrNoMemory, numDisplays );
+		sessionClose( session );
+		exit( 1 );
+	}
+	memcpy( displays, online, numDisplays * sizeof(displayID) );
 
 	if ( verbose == 1 )
 		printf( "%d online display(s) found\n", (int)numDisplays );
-
-	CGDisplayModeRef modeRef;
+	record.numDisplays = numDisplays;
+	record.phaseMicroseconds[LOG_PHASE_DISPLAYS] = logMicroseconds( clockNanoseconds() - phaseStart );
+	phaseStart = clockNanoseconds();
+
+	planFlags = shouldForce ? SESSION_PLAN_FORCE : 0;
+	planInit( &plan );
+	// errors show up display by display below
+	sessionLoad( session );
 	for (ii = 0; ii < numDisplays; ii++)
 	{
-		CGDisplayModeRef originalMode;
+		setDisplayInfo info;
+		const policyRule *rule;
+		displayMode findMode = myModeStruct;
+		int findScanType = scanType, findMirroring = mirroringOnOff;
 		if ( verbose == 1 && ! shouldShowAll )
 			printf( "------------------------------------\n");
-		originalMode = CGDisplayCopyDisplayMode( displays[ii] );
-		if ( originalMode == NULL )
+		err = sessionInfo( session, displays[ii], &info );
+		if ( err != kDisplayNoErr )
 		{
 			printf( "Display 0x%x is invalid\n", (unsigned int)displays[ii]);
+			runFailed( flight, &mine, logPath, &record, err, numDisplays );
+			sessionClose( session );
 			return 1;
 		}
 		if ( verbose == 1 )
 			printf( "Display 0x%x\n", (unsigned int)displays[ii]);
+		if ( verbose == 1 && info.staleCache )
+			printf( "Cached modes for display 0x%x are stale\n", (unsigned int)displays[ii] );
+		if ( verbose == 1 && info.fromCache )
+			printf( "Using cached modes for display 0x%x\n", (unsigned int)displays[ii] );
+		if ( verbose == 1 && info.fromEdid )
+			printf( "Modes for display 0x%x made up from its EDID\n", (unsigned int)displays[ii] );
+		rule = sessionPolicy( session, displays[ii], &findScanType, &findMode, &findMirroring );
+		if ( verbose == 1 && rule != NULL )
+			printf( "Display 0x%x goes by line %u of the policy\n", (unsigned int)displays[ii], (unsigned int)rule->line );
 
 		if ( shouldShowAll == 1 ) {
 
-			allModesForDisplay( displays[ii], verbose );
+			allModesForDisplay( sessionCatalog( session, displays[ii] ), verbose );
 
 		} else {
 
-			if ( shouldFindExact == 1 ) {
+			if ( findScanType == SCAN_EXACT ) {
 
 				printf( "------ Exact mode for display -----\n" );
-				modeRef = modeForDisplay( displays[ii], 0, myModeStruct );
+				modeForDisplay( session, displays[ii], findScanType, findMode );
 				printf( "-----------------------------------\n" );
 
-			} else if ( shouldFindHighest == 1 ) {
+			} else if ( findScanType == SCAN_HIGHEST ) {
 
 				printf( "----- Highest mode for display ----\n" );
-				myModeStruct.width = INT_MAX;
-				myModeStruct.height = INT_MAX;
-				myModeStruct.bitsPerPixel = INT_MAX;
-				myModeStruct.refresh = INT_MAX;
-				modeRef = modeForDisplay( displays[ii], 1, myModeStruct );
+				modeForDisplay( session, displays[ii], findScanType, findMode );
 				printf( "-----------------------------------\n" );
 
-			} else if ( shouldFindClosest == 1 ) {
+			} else if ( shouldFindClosest == 1 || rule != NULL ) {
 
 				printf( "----- Closest mode for display ----\n" );
-				modeRef = modeForDisplay( displays[ii], 1, myModeStruct );
+				modeForDisplay( session, displays[ii], findScanType, findMode );
 				printf( "-----------------------------------\n" );
 
 			}
 
-			if ( shouldSetDisplay == 1 )
-				setdisplay( displays[ii], modeRef, mirroringOnOff, verbose );
-
 		}
 
 	}
+	record.phaseMicroseconds[LOG_PHASE_MATCH] = logMicroseconds( clockNanoseconds() - phaseStart );
+	phaseStart = clockNanoseconds();
+	if ( shouldShowAll == 0 && shouldSetDisplay == 1 )
+		planDisplays( session, &plan, displays, numDisplays, scanType, mirroringOnOff, planFlags );
+	else if ( shouldShowAll == 0 && shouldPrintPlan == 1 )
+		planDisplays( session, &plan, displays, numDisplays, scanType, mirroringOnOff, planFlags | SESSION_PLAN_FROM_CACHE );
+	free( displays );
+	record.phaseMicroseconds[LOG_PHASE_PLAN] = logMicroseconds( clockNanoseconds() - phaseStart );
+	if ( shouldPrintPlan == 1 )
+		planPrint( &plan );
+	if ( shouldSetDisplay == 1 )
+		applyPlan( session, &plan, scanType, verifyMs, verbose, &result );
+	flightDone( flight, &mine, numDisplays, &result );
+	// only now, so the log costs the displays nothing
+	record.phaseMicroseconds[LOG_PHASE_TOTAL] = logMicroseconds( clockNanoseconds() - started );
+	if ( logPath != NULL )
+	{
+		log = logOpen( logPath, 0 );
+		if ( log == NULL )
+			printf( "Cannot log to %s\n", logPath );
+		logDone( log, &record, session, &plan, &result );
+	}
+	planFree( &plan );
+
+	if ( shouldStayResident == 1 )
+		runDaemon( session, scanType, mirroringOnOff, planFlags, debounceMs, verifyMs, flight, key, log, verbose );
+
+	if ( sessionSaveCache( session ) != 0 && verbose == 1 )
+		printf( "Cannot write %s\n", cachePath );
+	sessionClose( session );
+	policyClose( policy );
+	logClose( log );
+	flightClose( flight );
+	reportTimes( trace, tracePath, shouldPrintTimes );
 	exit(0);
 }
@@ -0,0 +1,2291 @@
+/*
+gcc -O3 -o SetDisplayBench SetDisplayBench.c DisplayBackend.c DisplayBackendCG.c DisplayBackendDRM.c DisplayBackendReplay.c DisplayBackendSim.c DisplayBackendXRandR.c DisplayFlight.c DisplayLog.c DisplayPlan.c DisplayPolicy.c DisplayTiming.c DisplayTrace.c Edid.c ModeCache.c ModeCatalog.c SetDisplayLib.c WorkerPool.c -lpthread -ldl
+
+(on a Mac leave out -ldl and add -framework Cocoa -framework IOKit; for
+the xrandr benchmark add -DHAVE_XRANDR and -lXrandr -lX11.)
+
+SetDisplayBench.c
+
+Benchmarks for SetDisplay against simulated displays (see
+DisplayBackendSim.c), to have numbers to hold a new matcher or a new
+way of getting the mode lists against:
+
+ match  Matching (-x exact, -c closest, -z highest) through the
+        session, for mode lists of 10 to 100000 modes: ns and
+        allocations per query, the linear catalogScan alongside as the
+        reference, and how many answers the two disagree on (should be
+        0).  Also what building the catalog takes.
+ batch  Closest and highest for many targets at once (what policy and
+        what-if tooling do) against 10 to 100000 modes: ns per target
+        for catalogScan and catalogFind one at a time, for
+        catalogScanBatch with each SIMD kernel the CPU has, and for
+        catalogFindBatch, and how many answers differ from catalogScan's
+        (should be 0).
+ mirror Finding the mode a mirror set (-M) all have, for 2 to 64
+        displays of 100 to 100000 modes each: ns and allocations per
+        set, the lookup of every mode of one display in all the others
+        as the reference, and how many answers the two disagree on.  A
+        set of one display has to give what catalogFind gives it.  It
+        fails if anything differs.
+ main   SetDisplay itself, run as a program the way it is run at
+        login, for 1 to 128 displays and 10 to 100000 modes: wall time
+        to set the displays, to find the exact and the highest mode,
+        and to list every mode (-a).  Needs the SetDisplay binary, -s.
+ timing The timing (DisplayTiming.h) of a DMT mode, of a mode DMT
+        doesn't have, and of each kind of CVT: ns and allocations per
+        timing (there should be none).
+ policy Compiling a policy (DisplayPolicy.h) of 10 to 100000 rules,
+        opening it and finding a display's rule: the time to the first
+        answer, as at login, and ns and allocations per display after
+        that, for a display with a rule of its own and for one that
+        falls through to the rule for everything (there should be no
+        allocations, and the times shouldn't grow with the rules).
+        Then whether a rule naming a monitor by its EDID alone (edid=)
+        matches a simulated display with that EDID (it fails if not).
+ walls  Finding, loading, planning and applying 1, 2, 4 ... 256
+        displays, one after the other (-j 1) and all at once.  With the
+        displays worked on in parallel the total should stay about the
+        same, since the time goes into waiting on the backend.
+ hotplug
+        1 to 16 heads set, one of them unplugged and plugged back, and
+        all of them set again (what SetDisplay -S does when asked to):
+        ms, mode lists read and catalogs made both times, how many heads
+        kept their catalogs and how many matches were the last one's.
+        The second time should read one mode list however many heads
+        there are.
+ drm    The Linux backend (DisplayBackendDRM.c) against generated
+        copies of /sys/class/drm with 2 to 128 connectors: us for the
+        first pass over them, for a pass when nothing changed (what
+        polling for hotplugs costs) and after a monitor was swapped,
+        and ms to load a session.  Then checks that a connector with
+        no EDID has its modes read again when they change.  Linux only.
+ xrandr The X11 backend (DisplayBackendXRandR.c) against the X server
+        in $DISPLAY, an Xvfb with RandR for instance: ms to load the
+        outputs, and to set them all to their highest modes and back
+        (one server grab each).  Needs -DHAVE_XRANDR -lXrandr -lX11,
+        and is left out of all of them without $DISPLAY.
+ replay Recordings (DisplayBackendReplay.c) played back as they were
+        recorded and as fast as they go: ms to load, apply and in all,
+        and whether both gave the same answers (the plan's digest is
+        shown, to hold against later builds).  The recordings named
+        with -R, or without any, simulated displays recorded first.
+ log    The log SetDisplay -L keeps (DisplayLog.h): us to create it and
+        to open it again (what a run pays), ns and allocations per
+        record appended (there should be none), and several processes
+        appending to a small log at once, round and round it: ns per
+        record, and whether a reader found every record it should and
+        none of them torn (it fails if not).
+ flight Many SetDisplays at once taking turns with a flight file
+        (DisplayFlight.h), each its own process with its own simulated
+        displays that take 20 ms to commit: all of them wanting the
+        same mode, and two modes between them.  ms from the first
+        starting to the last done, against one alone, how many set the
+        displays and how many took another's result, and whether any
+        two set them at the same time or one took the result of a
+        different mode (it fails if so).
+ steady A session kept open the way SetDisplay -D keeps one, its
+        simulated displays planned, set, relisted and asked over and
+        over (-n cycles): us and allocations per cycle, and the blocks
+        and bytes still allocated, which must not grow once it's warmed
+        up (it fails if they do).  A million cycles by default.
+
+Allocations are counted by wrapping malloc, calloc and realloc for the
+whole program (and posix_memalign, which the worker pool uses); build
+with -DBENCH_NO_ALLOC_COUNT where that doesn't work and they are shown
+as "-".
+
+USAGE:
+SetDisplayBench [-d MAXDISPLAYS] [-l LISTUS] [-c CURRENTUS] [-n CYCLES] [-R RECORDING ...] [-r RUNS] [-s SETDISPLAY]
+                [match|batch|mirror|main|timing|policy|walls|hotplug|drm|xrandr|replay|log|flight|steady ...]
+
+ -d Go up to MAXDISPLAYS displays (walls), doubling from 1, default 256
+ -l What listing a display's modes takes (walls, hotplug), default 2000 us
+ -c What reading a display's current mode takes (walls, hotplug), default 200 us
+ -n Cycles to run once warmed up (steady), default 1000000
+ -R Play back RECORDING (replay), made with SetDisplay -R; can be given many times
+ -r Runs per line, the fastest is shown, default 3
+ -s The SetDisplay to run (main), default ./SetDisplay
+ With no benchmark named all of them are run.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef BENCH_NO_ALLOC_COUNT
+#include <dlfcn.h>
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#define blockSize malloc_size
+#else
+#include <malloc.h>
+#define blockSize malloc_usable_size
+#endif
+#endif
+
+#include "Clock.h"
+#include "DisplayFlight.h"
+#include "DisplayLog.h"
+#include "Edid.h"
+#include "SetDisplayLib.h"
+
+#define BENCH_QUERIES      4096
+#define BENCH_MIN_NS       50000000u    // keep a measurement going at least this long
+#define BENCH_SCAN_QUERIES 256          // the linear scan gets fewer, it's the slow one
+
+typedef struct
+{
+	uint64_t load;
+	uint64_t plan;
+	uint64_t apply;
+	uint64_t total;
+} benchTimes;
+
+static displayMode wanted = { 1920, 1080, 32, 60 };
+
+/////////////////
+
+#ifndef BENCH_NO_ALLOC_COUNT
+
+/*
+Every allocation in the program, SetDisplay's code included, comes
+through here, and what is still out is kept count of.  dlsym can itself allocate before the real functions are
+known, so the first few bytes come out of a static block that is never
+freed.
+*/
+static void *(*realMalloc)( size_t );
+static void *(*realCalloc)( size_t, size_t );
+static void *(*realRealloc)( void *, size_t );
+static void (*realFree)( void * );
+static int (*realPosixMemalign)( void **, size_t, size_t );
+static unsigned long allocCount;
+static long liveBlocks;         // allocated and not yet freed
+static long liveBytes;          // what the allocator says those hold
+static char bootstrap[8192];
+static size_t bootstrapUsed;
+
+static void resolveAllocator( void )
+{
+	static int resolving;
+
+	if ( resolving )
+		return;
+	resolving = 1;
+	realMalloc = (void *(*)( size_t ))dlsym( RTLD_NEXT, "malloc" );
+	realCalloc = (void *(*)( size_t, size_t ))dlsym( RTLD_NEXT, "calloc" );
+	realRealloc = (void *(*)( void *, size_t ))dlsym( RTLD_NEXT, "realloc" );
+	realFree = (void (*)( void * ))dlsym( RTLD_NEXT, "free" );
+	realPosixMemalign = (int (*)( void **, size_t, size_t ))dlsym( RTLD_NEXT, "posix_memalign" );
+	resolving = 0;
+}
+
+static void *bootstrapAlloc( size_t size )
+{
+	void *p;
+
+	size = (size + 15) & ~(size_t)15;
+	if ( size > sizeof(bootstrap) - bootstrapUsed )
+		return NULL;
+	p = bootstrap + bootstrapUsed;
+	bootstrapUsed += size;
+	return p;
+}
+
+static int inBootstrap( const void *p )
+{
+	return (const char *)p >= bootstrap && (const char *)p < bootstrap + sizeof(bootstrap);
+}
+
+static void countLive( long blocks, long bytes )
+{
+	__sync_fetch_and_add( &liveBlocks, blocks );
+	__sync_fetch_and_add( &liveBytes, bytes );
+}
+
+static void countAllocation( void *p )
+{
+	__sync_fetch_and_add( &allocCount, 1 );
+	if ( p != NULL )
+		countLive( 1, (long)blockSize( p ) );
+}
+
+void *malloc( size_t size )
+{
+	void *p;
+
+	if ( realMalloc == NULL )
+		resolveAllocator();
+	if ( realMalloc == NULL )
+		return bootstrapAlloc( size );
+	p = realMalloc( size );
+	countAllocation( p );
+	return p;
+}
+
+void *calloc( size_t count, size_t size )
+{
+	void *p;
+
+	if ( realCalloc == NULL )
+		resolveAllocator();
+	if ( realCalloc == NULL )
+		return bootstrapAlloc( count * size );     // static, so already zero
+	p = realCalloc( count, size );
+	countAllocation( p );
+	return p;
+}
+
+void *realloc( void *p, size_t size )
+{
+	void *moved;
+	size_t held;
+
+	if ( inBootstrap( p ) )
+	{
+		size_t left = (size_t)(bootstrap + sizeof(bootstrap) - (char *)p);
+		moved = malloc( size );
+		if ( moved != NULL )
+			memcpy( moved, p, size < left ? size : left );
+		return moved;
+	}
+	if ( realRealloc == NULL )
+		resolveAllocator();
+	if ( realRealloc == NULL )
+		return NULL;
+	held = p != NULL ? blockSize( p ) : 0;
+	moved = realRealloc( p, size );
+	__sync_fetch_and_add( &allocCount, 1 );
+	if ( moved != NULL )
+		countLive( p == NULL ? 1 : 0, (long)blockSize( moved ) - (long)held );
+	else if ( p != NULL && size == 0 )
+		countLive( -1, -(long)held );
+	return moved;
+}
+
+int posix_memalign( void **p, size_t alignment, size_t size )
+{
+	int err;
+
+	if ( realPosixMemalign == NULL )
+		resolveAllocator();
+	if ( realPosixMemalign == NULL )
+		return ENOMEM;
+	err = realPosixMemalign( p, alignment, size );
+	if ( err == 0 )
+		countAllocation( *p );
+	return err;
+}
+
+void free( void *p )
+{
+	if ( p == NULL || inBootstrap( p ) )
+		return;
+	if ( realFree == NULL )
+		resolveAllocator();
+	if ( realFree != NULL )
+	{
+		countLive( -1, -(long)blockSize( p ) );
+		realFree( p );
+	}
+}
+
+static unsigned long allocations( void )
+{
+	return allocCount;
+}
+
+/*
+Blocks and bytes allocated and not yet freed.
+*/
+static void outstanding( long *blocks, long *bytes )
+{
+	*blocks = liveBlocks;
+	*bytes = liveBytes;
+}
+
+#define ALLOC_COUNTING 1
+
+#else
+
+static unsigned long allocations( void )
+{
+	return 0;
+}
+
+static void outstanding( long *blocks, long *bytes )
+{
+	*blocks = 0;
+	*bytes = 0;
+}
+
+#define ALLOC_COUNTING 0
+
+#endif
+
+static void printAllocs( double count )
+{
+	if ( ALLOC_COUNTING )
+		printf( " %9.2f", count );
+	else
+		printf( " %9s", "-" );
+}
+
+/////////////////
+
+static uint32_t benchRandom( uint32_t *state )
+{
+	*state = *state * 1664525u + 1013904223u;
+	return *state >> 8;
+}
+
+/*
+Half the queries ask for a mode the display has (at a refresh it may
+not), half for a made-up resolution, so closest has to work for both.
+*/
+static void makeQueries( const modeCatalog *catalog, displayMode *queries, size_t count )
+{
+	static const double rates[] = { 0, 50, 59.94, 60, 75, 85, 120, 144 };
+	uint32_t state = 12345;
+	size_t ii;
+
+	for ( ii = 0; ii < count; ii++ )
+	{
+		displayMode *query = &queries[ii];
+		if ( (ii & 1) == 0 && catalog->numModes > 0 )
+		{
+			displayModeDesc desc;
+			catalogModeDesc( catalog, benchRandom( &state ) % catalog->numModes, &desc );
+			*query = desc.mode;
+		} else {
+			query->width = 320 + benchRandom( &state ) % 4800;
+			query->height = 200 + benchRandom( &state ) % 2800;
+			query->bitsPerPixel = (benchRandom( &state ) & 1) ? 32 : 16;
+		}
+		query->refresh = rates[benchRandom( &state ) % (sizeof(rates) / sizeof(rates[0]))];
+	}
+}
+
+typedef struct
+{
+	double findNs;
+	double scanNs;
+	double allocsPerQuery;
+	unsigned long mismatches;
+} matchResult;
+
+static void benchScanType( setDisplaySession *session, displayID display, const modeCatalog *catalog,
+		const displayMode *queries, int scanType, matchResult *result )
+{
+	uint64_t started, elapsed;
+	unsigned long allocs, done = 0;
+	size_t ii;
+
+	// sessionFind the way SetDisplay does, until it has run long enough
+	allocs = allocations();
+	started = clockNanoseconds();
+	do {
+		for ( ii = 0; ii < BENCH_QUERIES; ii++ )
+			sessionFind( session, display, scanType, queries[ii], NULL );
+		done += BENCH_QUERIES;
+		elapsed = clockNanoseconds() - started;
+	} while ( elapsed < BENCH_MIN_NS );
+	result->findNs = (double)elapsed / done;
+	result->allocsPerQuery = (double)(allocations() - allocs) / done;
+
+	// the linear reference, checking the answers on the way (the
+	// catalogFind that is checked against it is small next to it)
+	result->mismatches = 0;
+	done = 0;
+	started = clockNanoseconds();
+	do {
+		for ( ii = 0; ii < BENCH_SCAN_QUERIES; ii++ )
+		{
+			if ( catalogScan( catalog, scanType, queries[ii] ) != catalogFind( catalog, scanType, queries[ii] ) )
+				result->mismatches++;
+		}
+		done += BENCH_SCAN_QUERIES;
+		elapsed = clockNanoseconds() - started;
+	} while ( elapsed < BENCH_MIN_NS );
+	result->scanNs = (double)elapsed / done;
+	result->mismatches = result->mismatches * BENCH_SCAN_QUERIES / done;
+}
+
+static int benchMatch( void )
+{
+	static const long modeCounts[] = { 10, 100, 1000, 10000, 100000 };
+	static const char *scanNames[] = { "exact", "closest", "highest" };
+	displayMode *queries = malloc( BENCH_QUERIES * sizeof(displayMode) );
+	size_t mm;
+	int scanType;
+
+	if ( queries == NULL )
+		return -1;
+	printf( "match: ns per query through sessionFind, the linear catalogScan as reference\n" );
+	printf( "%8s %10s %9s", "modes", "build us", "allocs" );
+	for ( scanType = SCAN_EXACT; scanType <= SCAN_HIGHEST; scanType++ )
+		printf( " | %-7s %9s %9s", scanNames[scanType], "scan", "allocs/q" );
+	printf( " | %s\n", "differ" );
+
+	for ( mm = 0; mm < sizeof(modeCounts) / sizeof(modeCounts[0]); mm++ )
+	{
+		char spec[128];
+		setDisplaySession *session;
+		const displayID *displays;
+		uint32_t numDisplays;
+		const modeCatalog *catalog;
+		uint64_t started, built;
+		unsigned long allocs, mismatches = 0;
+
+		snprintf( spec, sizeof(spec), "sim:displays=1,modes=%ld,shuffle=1", modeCounts[mm] );
+		session = sessionOpen( spec, NULL );
+		if ( session == NULL || sessionDisplays( session, &displays, &numDisplays ) != kDisplayNoErr || numDisplays == 0 )
+		{
+			sessionClose( session );
+			free( queries );
+			return -1;
+		}
+		allocs = allocations();
+		started = clockNanoseconds();
+		sessionLoad( session );
+		built = clockNanoseconds() - started;
+		allocs = allocations() - allocs;
+		catalog = sessionCatalog( session, displays[0] );
+		if ( catalog == NULL )
+		{
+			sessionClose( session );
+			free( queries );
+			return -1;
+		}
+		makeQueries( catalog, queries, BENCH_QUERIES );
+
+		printf( "%8ld %10.1f", modeCounts[mm], built / 1e3 );
+		if ( ALLOC_COUNTING )
+			printf( " %9lu", allocs );
+		else
+			printf( " %9s", "-" );
+		for ( scanType = SCAN_EXACT; scanType <= SCAN_HIGHEST; scanType++ )
+		{
+			matchResult result;
+			benchScanType( session, displays[0], catalog, queries, scanType, &result );
+			printf( " | %7.1f %9.1f", result.findNs, result.scanNs );
+			printAllocs( result.allocsPerQuery );
+			mismatches += result.mismatches;
+		}
+		printf( " | %lu\n", mismatches );
+		fflush( stdout );
+		sessionClose( session );
+	}
+	free( queries );
+	return 0;
+}
+
+/////////////////
+
+/*
+How long fn takes for the first numTargets queries, per target, run
+again until it has taken long enough.
+*/
+typedef struct
+{
+	const modeCatalog *catalog;
+	int scanType;
+	const displayMode *queries;
+	size_t numTargets;
+	long *matches;
+	int kernel;                 // -2 one at a time with catalogScan, -3 with catalogFind, -4 catalogFindBatch
+} batchRun;
+
+#define BATCH_ONE_SCAN  (-2)
+#define BATCH_ONE_FIND  (-3)
+#define BATCH_FIND      (-4)
+
+static double batchNs( batchRun *run )
+{
+	uint64_t started = clockNanoseconds(), elapsed;
+	unsigned long done = 0;
+	size_t ii;
+
+	do {
+		if ( run->kernel == BATCH_ONE_SCAN ) {
+			for ( ii = 0; ii < run->numTargets; ii++ )
+				run->matches[ii] = catalogScan( run->catalog, run->scanType, run->queries[ii] );
+		} else if ( run->kernel == BATCH_ONE_FIND ) {
+			for ( ii = 0; ii < run->numTargets; ii++ )
+				run->matches[ii] = catalogFind( run->catalog, run->scanType, run->queries[ii] );
+		} else if ( run->kernel == BATCH_FIND ) {
+			catalogFindBatch( run->catalog, run->scanType, run->queries, run->numTargets, run->matches );
+		} else {
+			catalogScanBatch( run->catalog, run->scanType, run->queries, run->numTargets, run->matches, run->kernel );
+		}
+		done += run->numTargets;
+		elapsed = clockNanoseconds() - started;
+	} while ( elapsed < BENCH_MIN_NS );
+	return (double)elapsed / done;
+}
+
+static int benchBatch( void )
+{
+	static const long modeCounts[] = { 10, 100, 1000, 10000, 100000 };
+	static const int runs[] = { BATCH_ONE_SCAN, CATALOG_KERNEL_SCALAR, CATALOG_KERNEL_SSE41, CATALOG_KERNEL_AVX2,
+			BATCH_ONE_FIND, BATCH_FIND };
+	static const char *runNames[] = { "scan", "scalar", "sse4.1", "avx2", "find", "batch" };
+	static const char *scanNames[] = { "exact", "closest", "highest" };
+	displayMode *queries = malloc( BENCH_QUERIES * sizeof(displayMode) );
+	long *reference = malloc( BENCH_QUERIES * sizeof(long) );
+	long *matches = malloc( BENCH_QUERIES * sizeof(long) );
+	size_t mm, rr;
+	int scanType;
+
+	if ( queries == NULL || reference == NULL || matches == NULL )
+	{
+		free( queries );
+		free( reference );
+		free( matches );
+		return -1;
+	}
+	printf( "batch: ns per target, catalogScan and catalogFind one at a time, catalogScanBatch with each kernel\n" );
+	printf( "       and catalogFindBatch (%s here); differ counts answers not the same as catalogScan's\n",
+			catalogKernelName( CATALOG_KERNEL_BEST ) );
+	printf( "%8s %7s %8s", "modes", "scan", "targets" );
+	for ( rr = 0; rr < sizeof(runs) / sizeof(runs[0]); rr++ )
+		printf( " %10s", runNames[rr] );
+	printf( " %7s\n", "differ" );
+
+	for ( mm = 0; mm < sizeof(modeCounts) / sizeof(modeCounts[0]); mm++ )
+	{
+		char spec[128];
+		setDisplaySession *session;
+		const displayID *displays;
+		uint32_t numDisplays;
+		const modeCatalog *catalog;
+
+		snprintf( spec, sizeof(spec), "sim:displays=1,modes=%ld,shuffle=1", modeCounts[mm] );
+		session = sessionOpen( spec, NULL );
+		if ( session == NULL || sessionDisplays( session, &displays, &numDisplays ) != kDisplayNoErr || numDisplays == 0 ||
+				sessionLoad( session ) != kDisplayNoErr || (catalog = sessionCatalog( session, displays[0] )) == NULL )
+		{
+			sessionClose( session );
+			free( queries );
+			free( reference );
+			free( matches );
+			return -1;
+		}
+		makeQueries( catalog, queries, BENCH_QUERIES );
+
+		for ( scanType = SCAN_CLOSEST; scanType <= SCAN_HIGHEST; scanType++ )
+		{
+			batchRun run;
+			unsigned long mismatches = 0;
+			size_t ii;
+
+			// the scans go through every mode, so fewer targets the more there are
+			run.catalog = catalog;
+			run.scanType = scanType;
+			run.queries = queries;
+			run.numTargets = 20000000 / (size_t)modeCounts[mm];
+			if ( run.numTargets > BENCH_QUERIES )
+				run.numTargets = BENCH_QUERIES;
+			if ( run.numTargets < 64 )
+				run.numTargets = 64;
+			for ( ii = 0; ii < run.numTargets; ii++ )
+				reference[ii] = catalogScan( catalog, scanType, queries[ii] );
+
+			printf( "%8ld %7s %8zu", modeCounts[mm], scanNames[scanType], run.numTargets );
+			for ( rr = 0; rr < sizeof(runs) / sizeof(runs[0]); rr++ )
+			{
+				run.kernel = runs[rr];
+				run.matches = matches;
+				if ( run.kernel >= 0 && !catalogKernelAvailable( run.kernel ) )
+				{
+					printf( " %10s", "-" );
+					continue;
+				}
+				printf( " %10.1f", batchNs( &run ) );
+				for ( ii = 0; ii < run.numTargets; ii++ )
+					mismatches += matches[ii] != reference[ii];
+			}
+			printf( " %7lu\n", mismatches );
+			fflush( stdout );
+		}
+		sessionClose( session );
+	}
+	free( queries );
+	free( reference );
+	free( matches );
+	return 0;
+}
+
+/////////////////
+
+/*
+catalogFindCommon the slow way, as the reference: catalogScan over the
+modes of the first catalog that all the others have, each looked up in
+them, then catalogScan over the others' modes of the one it found.
+*/
+static int inAll( const modeCatalog *const *catalogs, size_t count, const displayMode *key )
+{
+	size_t cc;
+
+	for ( cc = 1; cc < count; cc++ )
+	{
+		if ( catalogFind( catalogs[cc], SCAN_EXACT, *key ) == kNoMode )
+			return 0;
+	}
+	return 1;
+}
+
+static long naiveCommon( const modeCatalog *const *catalogs, size_t count, int scanType, displayMode findMode, long *positions )
+{
+	const modeCatalog *first = catalogs[0];
+	displayModeDesc *modes;
+	modeCatalog *common;
+	long *commonPositions;
+	uint32_t pos, numCommon = 0;
+	long found;
+	size_t cc;
+
+	modes = malloc( (first->numModes ? first->numModes : 1) * sizeof(displayModeDesc) );
+	commonPositions = malloc( (first->numModes ? first->numModes : 1) * sizeof(long) );
+	if ( modes == NULL || commonPositions == NULL )
+	{
+		free( modes );
+		free( commonPositions );
+		return kNoMode;
+	}
+	for ( pos = 0; pos < first->numModes; pos++ )
+	{
+		catalogModeDesc( first, pos, &modes[numCommon] );
+		if ( inAll( catalogs, count, &modes[numCommon].mode ) )
+			commonPositions[numCommon++] = pos;
+	}
+	common = numCommon > 0 ? catalogCreate( modes, numCommon ) : NULL;
+	found = common != NULL ? catalogScan( common, scanType, findMode ) : kNoMode;
+	catalogDestroy( common );
+	free( modes );
+	if ( found == kNoMode )
+	{
+		free( commonPositions );
+		return kNoMode;
+	}
+	positions[0] = commonPositions[found];
+	free( commonPositions );
+
+	for ( cc = 1; cc < count; cc++ )
+	{
+		const modeCatalog *catalog = catalogs[cc];
+		displayModeDesc *same = malloc( catalog->numModes * sizeof(displayModeDesc) );
+		long *samePositions = malloc( catalog->numModes * sizeof(long) );
+		uint32_t numSame = 0;
+
+		positions[cc] = kNoMode;
+		for ( pos = 0; same != NULL && samePositions != NULL && pos < catalog->numModes; pos++ )
+		{
+			if ( catalog->width[pos] != first->width[positions[0]] || catalog->height[pos] != first->height[positions[0]] ||
+					catalog->bpp[pos] != first->bpp[positions[0]] )
+				continue;
+			catalogModeDesc( catalog, pos, &same[numSame] );
+			samePositions[numSame++] = pos;
+		}
+		if ( numSame > 0 )
+		{
+			modeCatalog *sameCatalog = catalogCreate( same, numSame );
+			found = sameCatalog != NULL ? catalogScan( sameCatalog, scanType, findMode ) : kNoMode;
+			if ( found != kNoMode )
+				positions[cc] = samePositions[found];
+			catalogDestroy( sameCatalog );
+		}
+		free( same );
+		free( samePositions );
+	}
+	return 0;
+}
+
+static int benchMirror( void )
+{
+	static const long modeCounts[] = { 100, 1000, 10000, 100000 };
+	static const size_t ways[] = { 2, 4, 16, 64 };
+	static const char *scanNames[] = { "exact", "closest", "highest" };
+	displayMode *queries = malloc( BENCH_QUERIES * sizeof(displayMode) );
+	const modeCatalog *catalogs[64];
+	long positions[64], reference[64];
+	size_t mm, ww;
+	int scanType, failed = 0;
+
+	if ( queries == NULL )
+		return -1;
+	printf( "mirror: ns per common mode for a mirror set, the naive lookup of every mode as reference\n" );
+	printf( "%8s %5s", "modes", "ways" );
+	for ( scanType = SCAN_EXACT; scanType <= SCAN_HIGHEST; scanType++ )
+		printf( " | %-9s %11s %9s", scanNames[scanType], "naive", "allocs/q" );
+	printf( " | %s\n", "differ" );
+
+	for ( mm = 0; mm < sizeof(modeCounts) / sizeof(modeCounts[0]); mm++ )
+	{
+		char spec[128];
+		setDisplaySession *session;
+		const displayID *displays;
+		uint32_t numDisplays, ii;
+
+		// 16 different displays, the bigger sets have each more than once
+		snprintf( spec, sizeof(spec), "sim:displays=16,modes=%ld,shuffle=1", modeCounts[mm] );
+		session = sessionOpen( spec, NULL );
+		if ( session == NULL || sessionDisplays( session, &displays, &numDisplays ) != kDisplayNoErr || numDisplays == 0 ||
+				sessionLoad( session ) != kDisplayNoErr )
+		{
+			sessionClose( session );
+			free( queries );
+			return -1;
+		}
+		for ( ii = 0; ii < 64; ii++ )
+			catalogs[ii] = sessionCatalog( session, displays[ii % numDisplays] );
+		makeQueries( catalogs[0], queries, BENCH_QUERIES );
+
+		// a mirror set of one is that display on its own
+		{
+			unsigned long single = 0;
+			for ( scanType = SCAN_EXACT; scanType <= SCAN_HIGHEST; scanType++ )
+			{
+				for ( ii = 0; ii < BENCH_QUERIES; ii++ )
+				{
+					long found = catalogFindCommon( catalogs, 1, scanType, queries[ii], positions );
+					if ( (found == kNoMode ? kNoMode : positions[0]) != catalogFind( catalogs[0], scanType, queries[ii] ) )
+						single++;
+				}
+			}
+			printf( "%8ld %5d | %lu of %d differ from catalogFind\n", modeCounts[mm], 1, single, 3 * BENCH_QUERIES );
+			if ( single > 0 )
+				failed = 1;
+		}
+
+		for ( ww = 0; ww < sizeof(ways) / sizeof(ways[0]); ww++ )
+		{
+			unsigned long mismatches = 0;
+
+			printf( "%8ld %5zu", modeCounts[mm], ways[ww] );
+			for ( scanType = SCAN_EXACT; scanType <= SCAN_HIGHEST; scanType++ )
+			{
+				uint64_t started, elapsed;
+				unsigned long allocs, solved = 0, done = 0, checked = 0;
+				double ns;
+
+				allocs = allocations();
+				started = clockNanoseconds();
+				do {
+					for ( ii = 0; ii < BENCH_QUERIES; ii++ )
+						catalogFindCommon( catalogs, ways[ww], scanType, queries[ii], positions );
+					solved += BENCH_QUERIES;
+					elapsed = clockNanoseconds() - started;
+				} while ( elapsed < BENCH_MIN_NS );
+				ns = (double)elapsed / solved;
+				allocs = allocations() - allocs;
+
+				// the reference is slow, it checks what it gets through
+				started = clockNanoseconds();
+				do {
+					long found = catalogFindCommon( catalogs, ways[ww], scanType, queries[checked], positions );
+					size_t cc;
+
+					if ( naiveCommon( catalogs, ways[ww], scanType, queries[checked], reference ) != found )
+						mismatches++;
+					for ( cc = 0; found != kNoMode && cc < ways[ww]; cc++ )
+					{
+						if ( positions[cc] != reference[cc] )
+						{
+							mismatches++;
+							break;
+						}
+					}
+					checked = (checked + 1) % BENCH_QUERIES;
+					done++;
+					elapsed = clockNanoseconds() - started;
+				} while ( elapsed < BENCH_MIN_NS && done < BENCH_SCAN_QUERIES );
+				printf( " | %9.1f %11.1f", ns, (double)elapsed / done );
+				printAllocs( (double)allocs / solved );
+			}
+			printf( " | %lu\n", mismatches );
+			fflush( stdout );
+			if ( mismatches > 0 )
+				failed = 1;
+		}
+		sessionClose( session );
+	}
+	free( queries );
+	if ( failed )
+		printf( "mirror: FAILED\n" );
+	return failed ? -1 : 0;
+}
+
+static int benchTiming( void )
+{
+	static const struct
+	{
+		const char *name;
+		size_t width, height;
+		double refresh;
+		int source;             // -1 for timingFor
+	} cases[] =
+	{
+		{ "timingFor, DMT", 1920, 1080, 60, -1 },
+		{ "timingFor, not DMT", 3440, 1440, 100, -1 },
+		{ "timingDMT, missing", 3440, 1440, 100, TIMING_DMT },
+		{ "CVT", 2560, 1440, 75, TIMING_CVT },
+		{ "CVT-RB", 2560, 1440, 60, TIMING_CVT_RB },
+		{ "CVT-RB2", 2560, 1440, 75, TIMING_CVT_RB2 },
+	};
+	size_t cc;
+
+	printf( "timing: ns per timing\n" );
+	printf( "%-20s %10s %9s\n", "", "ns", "allocs" );
+	for ( cc = 0; cc < sizeof(cases) / sizeof(cases[0]); cc++ )
+	{
+		displayTiming timing;
+		volatile size_t width = cases[cc].width;       // read every time, so nothing is hoisted out
+		volatile uint32_t sink = 0;
+		unsigned long allocs = allocations(), done = 0;
+		uint64_t started = clockNanoseconds(), elapsed;
+
+		do {
+			int ii;
+			for ( ii = 0; ii < BENCH_QUERIES; ii++ )
+			{
+				if ( cases[cc].source < 0 )
+					timingFor( width, cases[cc].height, cases[cc].refresh, NULL, &timing );
+				else if ( cases[cc].source == TIMING_DMT )
+					timingDMT( width, cases[cc].height, cases[cc].refresh, 1, &timing );
+				else
+					timingCVT( width, cases[cc].height, cases[cc].refresh, cases[cc].source, 0, &timing );
+				sink += timing.pixelClock;
+			}
+			done += BENCH_QUERIES;
+			elapsed = clockNanoseconds() - started;
+		} while ( elapsed < BENCH_MIN_NS );
+		(void)sink;
+		printf( "%-20s %10.1f", cases[cc].name, (double)elapsed / done );
+		printAllocs( (double)(allocations() - allocs) / done );
+		printf( "\n" );
+	}
+	return 0;
+}
+
+/////////////////
+
+/*
+A monitor's EDID, different for every serial: the established 640x480,
+800x600 and 1024x768 and a 1920x1080 60 Hz detailed timing.
+*/
+static void makeEdid( uint8_t *edid, uint32_t serial )
+{
+	static const uint8_t header[8] = { 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00 };
+	static const uint8_t detailed[18] = { 0x02, 0x3a, 0x80, 0x18, 0x71, 0x38, 0x2d, 0x40, 0x58, 0x2c, 0x45, 0x00,
+	                                      0x00, 0x00, 0x00, 0x00, 0x00, 0x1e };
+	uint8_t sum = 0;
+	int ii;
+
+	memset( edid, 0, 128 );
+	memcpy( edid, header, sizeof(header) );
+	edid[8] = 0x4c; edid[9] = 0x42;         // "SDB"
+	edid[10] = 0x01;
+	memcpy( &edid[12], &serial, 4 );
+	edid[17] = 24;
+	edid[18] = 1; edid[19] = 4;
+	edid[35] = 0x21; edid[36] = 0x08;
+	for ( ii = 38; ii < 54; ii++ )
+		edid[ii] = 0x01;
+	memcpy( &edid[54], detailed, sizeof(detailed) );
+	for ( ii = 1; ii < 4; ii++ )
+		edid[54 + ii * 18 + 3] = 0x10;      // dummy descriptors
+	for ( ii = 0; ii < 127; ii++ )
+		sum += edid[ii];
+	edid[127] = (uint8_t)(0x100 - sum);
+}
+
+/*
+A policy of numRules rules, one for a serial each (vendor i, model i,
+serial i) and one for everything, compiled into path.
+*/
+static long makePolicy( const char *path, long numRules )
+{
+	char sourcePath[1100], error[256];
+	FILE *source;
+	long ii, compiled;
+
+	snprintf( sourcePath, sizeof(sourcePath), "%s.txt", path );
+	source = fopen( sourcePath, "w" );
+	if ( source == NULL )
+		return -1;
+	for ( ii = 1; ii < numRules; ii++ )
+		fprintf( source, "vendor=%ld model=%ld serial=%ld = 1920 1080 32 60, 1600 1200 32 0\n", ii, ii, ii );
+	fprintf( source, "* = 1600 1200 32 0\n" );
+	fclose( source );
+	compiled = policyCompile( sourcePath, path, error, sizeof(error) );
+	if ( compiled < 0 )
+		printf( "policy: %s\n", error );
+	unlink( sourcePath );
+	return compiled;
+}
+
+/*
+A rule that names a monitor by nothing but its EDID has to match a
+display that has that EDID, whatever else the backend says about it
+(the simulated displays, like Core Graphics, don't hash their EDIDs).
+*/
+static int edidRule( void )
+{
+	char edidPath[64], sourcePath[64], path[64], error[256];
+	uint8_t edid[128];
+	displayIdentity identity;
+	char spec[128];
+	setDisplaySession *session = NULL;
+	displayPolicy *policy = NULL;
+	const policyRule *rule = NULL;
+	const displayID *online;
+	uint32_t numDisplays = 0;
+	displayMode wanted;
+	int scanType, mirroringOnOff, matched;
+	FILE *file;
+
+	snprintf( edidPath, sizeof(edidPath), "/tmp/SetDisplayBench.%ld.edid", (long)getpid() );
+	snprintf( sourcePath, sizeof(sourcePath), "/tmp/SetDisplayBench.%ld.txt", (long)getpid() );
+	snprintf( path, sizeof(path), "/tmp/SetDisplayBench.%ld.sdpo", (long)getpid() );
+	makeEdid( edid, 4242 );
+	edidIdentity( edid, sizeof(edid), &identity );
+	file = fopen( edidPath, "w" );
+	if ( file != NULL )
+	{
+		fwrite( edid, 1, sizeof(edid), file );
+		fclose( file );
+	}
+	file = fopen( sourcePath, "w" );
+	if ( file != NULL )
+	{
+		fprintf( file, "edid=0x%016llx = 1280 1024 32 60\n* = 1600 1200 32 0\n", (unsigned long long)identity.edidHash );
+		fclose( file );
+	}
+	snprintf( spec, sizeof(spec), "sim:displays=2,edid=%s", edidPath );
+	if ( policyCompile( sourcePath, path, error, sizeof(error) ) > 0 && (policy = policyOpen( path )) != NULL &&
+			(session = sessionOpen( spec, NULL )) != NULL )
+	{
+		sessionSetPolicy( session, policy );
+		if ( sessionDisplays( session, &online, &numDisplays ) == kDisplayNoErr && numDisplays > 0 )
+			rule = sessionPolicy( session, online[0], &scanType, &wanted, &mirroringOnOff );
+	}
+	matched = rule != NULL && rule->line == 1 && wanted.width == 1280;
+	printf( "%-8s edid= rule %s\n", "", matched ? "matched" : "NOT matched" );
+	sessionClose( session );
+	policyClose( policy );
+	unlink( edidPath );
+	unlink( sourcePath );
+	unlink( path );
+	return matched ? 0 : -1;
+}
+
+static int benchPolicy( void )
+{
+	static const long sizes[] = { 10, 1000, 100000 };
+	size_t ss;
+
+	printf( "policy: ms to compile, us to open and resolve one display (what -P adds at login),\n" );
+	printf( "        ns per display resolved by its serial and by falling through to *\n" );
+	printf( "%8s %10s %10s %10s %10s %9s\n", "rules", "compile", "open", "serial", "*", "allocs" );
+	for ( ss = 0; ss < sizeof(sizes) / sizeof(sizes[0]); ss++ )
+	{
+		char path[64];
+		displayPolicy *policy;
+		displayIdentity identity;
+		uint64_t started, compiled, opened;
+		double ns[2];
+		unsigned long allocs = 0, done = 0;
+		int pass;
+
+		snprintf( path, sizeof(path), "/tmp/SetDisplayBench.%ld.sdpo", (long)getpid() );
+		started = clockNanoseconds();
+		if ( makePolicy( path, sizes[ss] ) != sizes[ss] )
+			return -1;
+		compiled = clockNanoseconds();
+		policy = policyOpen( path );
+		memset( &identity, 0, sizeof(identity) );
+		identity.vendor = identity.model = identity.serial = (uint32_t)(sizes[ss] / 2);
+		if ( policy == NULL || policyResolve( policy, &identity, 1 ) == NULL )
+		{
+			printf( "%8ld failed\n", sizes[ss] );
+			policyClose( policy );
+			unlink( path );
+			return -1;
+		}
+		opened = clockNanoseconds();
+
+		for ( pass = 0; pass < 2; pass++ )
+		{
+			volatile uint32_t sink = 0;
+			uint64_t passStarted = clockNanoseconds(), elapsed;
+			unsigned long passDone = 0, passAllocs = allocations();
+
+			do {
+				uint32_t ii;
+				for ( ii = 0; ii < BENCH_QUERIES; ii++ )
+				{
+					// the second pass asks about monitors no rule names
+					uint32_t which = 1 + ii % (uint32_t)(sizes[ss] - 1);
+					identity.vendor = identity.model = which;
+					identity.serial = pass == 0 ? which : which + 1;
+					sink += policyResolve( policy, &identity, 1 )->line;
+				}
+				passDone += BENCH_QUERIES;
+				elapsed = clockNanoseconds() - passStarted;
+			} while ( elapsed < BENCH_MIN_NS );
+			(void)sink;
+			ns[pass] = (double)elapsed / passDone;
+			allocs += allocations() - passAllocs;
+			done += passDone;
+		}
+		printf( "%8ld %10.3f %10.3f %10.1f %10.1f", sizes[ss], (compiled - started) / 1e6, (opened - compiled) / 1e3, ns[0], ns[1] );
+		printAllocs( (double)allocs / done );
+		printf( "\n" );
+		policyClose( policy );
+		unlink( path );
+	}
+	return edidRule();
+}
+
+/////////////////
+
+#ifdef __linux__
+
+static const char *benchDrmModes =
+	"1920x1080\n1920x1080\n1920x1080\n1920x1080i\n1680x1050\n1600x900\n1280x1024\n1280x1024\n"
+	"1440x900\n1280x800\n1280x720\n1280x720\n1024x768\n1024x768\n800x600\n800x600\n720x480\n640x480\n";
+
+static int writeFile( const char *dir, const char *name, const void *data, size_t size )
+{
+	char path[1024];
+	int fd, ok;
+
+	snprintf( path, sizeof(path), "%s/%s", dir, name );
+	fd = open( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if ( fd < 0 )
+		return -1;
+	ok = write( fd, data, size ) == (ssize_t)size;
+	close( fd );
+	return ok ? 0 : -1;
+}
+
+/*
+A copy of /sys/class/drm with numConnectors connectors, every other one
+connected.  Returns 0, or -1 if it couldn't be written.
+*/
+static int makeDrmFixture( const char *root, int numConnectors )
+{
+	int ii;
+
+	for ( ii = 0; ii < numConnectors; ii++ )
+	{
+		char dir[1024], id[16];
+		uint8_t edid[128];
+
+		snprintf( dir, sizeof(dir), "%s/card0-DP-%d", root, ii + 1 );
+		snprintf( id, sizeof(id), "%d\n", 50 + ii );
+		makeEdid( edid, (uint32_t)ii + 1 );
+		if ( mkdir( dir, 0755 ) != 0 || writeFile( dir, "connector_id", id, strlen( id ) ) != 0 ||
+				writeFile( dir, "status", ii % 2 ? "disconnected\n" : "connected\n", ii % 2 ? 13 : 10 ) != 0 ||
+				writeFile( dir, "edid", edid, ii % 2 ? 0 : sizeof(edid) ) != 0 ||
+				writeFile( dir, "modes", benchDrmModes, ii % 2 ? 0 : strlen( benchDrmModes ) ) != 0 )
+			return -1;
+	}
+	return 0;
+}
+
+static void removeDrmFixture( const char *root, int numConnectors )
+{
+	static const char *attributes[] = { "connector_id", "status", "edid", "modes" };
+	char path[1024];
+	int ii, aa;
+
+	for ( ii = 0; ii < numConnectors; ii++ )
+	{
+		for ( aa = 0; aa < 4; aa++ )
+		{
+			snprintf( path, sizeof(path), "%s/card0-DP-%d/%s", root, ii + 1, attributes[aa] );
+			unlink( path );
+		}
+		snprintf( path, sizeof(path), "%s/card0-DP-%d", root, ii + 1 );
+		rmdir( path );
+	}
+	rmdir( root );
+}
+
+/*
+A connector with no EDID (a KVM, a dock) can't be told to be the same
+monitor as before: when its modes change, the backend has to see it.
+*/
+static int drmNoEdid( void )
+{
+	char root[] = "/tmp/SetDisplayBench.XXXXXX";
+	char spec[64], dir[1024];
+	displayBackend *backend = NULL;
+	displayModeDesc *modes;
+	displayID display;
+	size_t before = 0, after = 0;
+	uint32_t count;
+
+	if ( mkdtemp( root ) == NULL )
+		return -1;
+	snprintf( spec, sizeof(spec), "drm:root=%s", root );
+	snprintf( dir, sizeof(dir), "%s/card0-DP-1", root );
+	if ( makeDrmFixture( root, 1 ) == 0 && writeFile( dir, "edid", "", 0 ) == 0 &&
+			(backend = backendCreate( spec )) != NULL &&
+			backendGetOnlineDisplays( backend, 1, &display, &count ) == kDisplayNoErr && count == 1 &&
+			backendCopyModes( backend, display, &modes, &before ) == kDisplayNoErr )
+	{
+		free( modes );
+		writeFile( dir, "modes", "1024x768\n", 9 );
+		// with no list to fill, a pass over the connectors
+		if ( backendGetOnlineDisplays( backend, 0, NULL, &count ) != kDisplayNoErr ||
+				backendCopyModes( backend, display, &modes, &after ) != kDisplayNoErr )
+			after = 0;
+		else
+			free( modes );
+	}
+	backendDestroy( backend );
+	removeDrmFixture( root, 1 );
+	printf( "no EDID: %zu mode(s), %zu after they changed\n", before, after );
+	return before > 1 && after == 1 ? 0 : -1;
+}
+
+/*
+The drm backend (DisplayBackendDRM.c) against generated copies of
+/sys/class/drm: what the first pass over the connectors takes, a pass
+when nothing changed (what polling for hotplugs costs), a pass after a
+monitor was swapped on one connector, and loading a session.
+*/
+static int benchDrm( void )
+{
+	static const int connectorCounts[] = { 2, 8, 32, 128 };
+	size_t cc;
+
+	printf( "drm: a pass over copies of /sys/class/drm, half the connectors connected\n" );
+	printf( "%10s %10s %10s %9s %10s %10s\n", "connectors", "first us", "same us", "allocs", "swapped us", "load ms" );
+	for ( cc = 0; cc < sizeof(connectorCounts) / sizeof(connectorCounts[0]); cc++ )
+	{
+		char root[] = "/tmp/SetDisplayBench.XXXXXX";
+		char spec[64], dir[1024];
+		int numConnectors = connectorCounts[cc];
+		displayBackend *backend;
+		setDisplaySession *session;
+		uint64_t started, first, same = 0, swapped = 0, load;
+		unsigned long allocs, done = 0, swaps = 0;
+		uint32_t count;
+
+		if ( mkdtemp( root ) == NULL )
+			return -1;
+		if ( makeDrmFixture( root, numConnectors ) != 0 )
+		{
+			removeDrmFixture( root, numConnectors );
+			return -1;
+		}
+		snprintf( spec, sizeof(spec), "drm:root=%s", root );
+		snprintf( dir, sizeof(dir), "%s/card0-DP-1", root );
+
+		started = clockNanoseconds();
+		backend = backendCreate( spec );
+		first = clockNanoseconds() - started;
+		if ( backend == NULL )
+		{
+			removeDrmFixture( root, numConnectors );
+			return -1;
+		}
+
+		allocs = allocations();
+		started = clockNanoseconds();
+		do {
+			backendGetOnlineDisplays( backend, 0, NULL, &count );
+			done++;
+			same = clockNanoseconds() - started;
+		} while ( same < BENCH_MIN_NS );
+		allocs = allocations() - allocs;
+
+		do {
+			uint8_t edid[128];
+			makeEdid( edid, 1000 + (uint32_t)swaps );
+			writeFile( dir, "edid", edid, sizeof(edid) );
+			started = clockNanoseconds();
+			backendGetOnlineDisplays( backend, 0, NULL, &count );
+			swapped += clockNanoseconds() - started;
+			swaps++;
+		} while ( swapped < BENCH_MIN_NS / 4 );
+		backendDestroy( backend );
+
+		started = clockNanoseconds();
+		session = sessionOpen( spec, NULL );
+		if ( session == NULL || sessionLoad( session ) != kDisplayNoErr )
+		{
+			sessionClose( session );
+			removeDrmFixture( root, numConnectors );
+			return -1;
+		}
+		load = clockNanoseconds() - started;
+		sessionClose( session );
+		removeDrmFixture( root, numConnectors );
+
+		printf( "%10d %10.1f %10.1f", numConnectors, first / 1e3, (double)same / done / 1e3 );
+		printAllocs( (double)allocs / done );
+		printf( " %10.1f %10.3f\n", (double)swapped / swaps / 1e3, load / 1e6 );
+		fflush( stdout );
+	}
+	return drmNoEdid();
+}
+
+#else
+
+static int benchDrm( void )
+{
+	printf( "drm: Linux only\n" );
+	return 0;
+}
+
+#endif
+
+/////////////////
+
+#ifdef HAVE_XRANDR
+
+/*
+The xrandr backend (DisplayBackendXRandR.c) against the X server in
+$DISPLAY, best an Xvfb of its own (see the README), since every output
+is set to its highest mode and back: listing and loading the outputs,
+and each of the two configurations, which are one server grab each.
+*/
+static int benchXRandR( int runs )
+{
+	benchTimes best[2];
+	uint64_t bestLoad = 0;
+	uint32_t numDisplays = 0;
+	int ii, way;
+
+	printf( "xrandr: the X server in $DISPLAY, fastest of %d run(s), times in ms\n", runs );
+	for ( ii = 0; ii < runs; ii++ )
+	{
+		setDisplaySession *session = sessionOpen( "xrandr", NULL );
+		const displayID *online;
+		displayID *displays;
+		displayModeDesc *was;
+		uint64_t started, loaded;
+		uint32_t dd;
+
+		if ( session == NULL )
+			return -1;
+		started = clockNanoseconds();
+		if ( sessionDisplays( session, &online, &numDisplays ) != kDisplayNoErr || sessionLoad( session ) != kDisplayNoErr )
+		{
+			sessionClose( session );
+			return -1;
+		}
+		loaded = clockNanoseconds() - started;
+		if ( ii == 0 || loaded < bestLoad )
+			bestLoad = loaded;
+
+		displays = malloc( (numDisplays ? numDisplays : 1) * sizeof(displayID) );
+		was = malloc( (numDisplays ? numDisplays : 1) * sizeof(displayModeDesc) );
+		if ( displays == NULL || was == NULL )
+		{
+			free( displays );
+			free( was );
+			sessionClose( session );
+			return -1;
+		}
+		memcpy( displays, online, numDisplays * sizeof(displayID) );
+		for ( dd = 0; dd < numDisplays; dd++ )
+		{
+			setDisplayInfo info;
+			memset( &was[dd], 0, sizeof(displayModeDesc) );
+			if ( sessionInfo( session, displays[dd], &info ) == kDisplayNoErr )
+				was[dd] = info.current;
+		}
+
+		// to the highest mode, then back to what each was in
+		for ( way = 0; way < 2; way++ )
+		{
+			displayPlan plan;
+			displayPlanResult result;
+			benchTimes times;
+			displayErr err;
+
+			planInit( &plan );
+			started = clockNanoseconds();
+			if ( way == 0 )
+				sessionPlanDisplays( session, &plan, displays, numDisplays, SCAN_HIGHEST, wanted, 0, SESSION_PLAN_FORCE, NULL );
+			for ( dd = 0; way == 1 && dd < numDisplays; dd++ )
+			{
+				if ( was[dd].mode.width != 0 )
+					sessionPlan( session, &plan, displays[dd], SCAN_EXACT, was[dd].mode, 0, SESSION_PLAN_FORCE, NULL );
+			}
+			times.plan = clockNanoseconds() - started;
+			err = sessionApply( session, &plan, 0, &result );
+			times.apply = clockNanoseconds() - started - times.plan;
+			planFree( &plan );
+			if ( err != kDisplayNoErr )
+			{
+				printf( "xrandr: setting the outputs failed (%d)\n", err );
+				free( displays );
+				free( was );
+				sessionClose( session );
+				return -1;
+			}
+			if ( ii == 0 || times.apply < best[way].apply )
+				best[way] = times;
+		}
+		free( displays );
+		free( was );
+		sessionClose( session );
+	}
+	printf( "%8s | %9s | %9s %9s | %9s %9s\n", "outputs", "load", "plan", "highest", "plan", "back" );
+	printf( "%8u | %9.3f | %9.3f %9.3f | %9.3f %9.3f\n", numDisplays, bestLoad / 1e6,
+			best[0].plan / 1e6, best[0].apply / 1e6, best[1].plan / 1e6, best[1].apply / 1e6 );
+	return 0;
+}
+
+#else
+
+static int benchXRandR( int runs )
+{
+	printf( "xrandr: build with -DHAVE_XRANDR\n" );
+	return 0;
+}
+
+#endif
+
+/////////////////
+
+/*
+Runs SetDisplay with its output thrown away and returns how long it
+took, or 0 if it couldn't be run or failed.
+*/
+static uint64_t runProgram( const char *path, char *const argv[] )
+{
+	uint64_t started = clockNanoseconds();
+	int status;
+	pid_t pid;
+
+	fflush( stdout );
+	pid = fork();
+	if ( pid < 0 )
+		return 0;
+	if ( pid == 0 )
+	{
+		int devNull = open( "/dev/null", O_WRONLY );
+		if ( devNull >= 0 )
+		{
+			dup2( devNull, 1 );
+			dup2( devNull, 2 );
+		}
+		execv( path, argv );
+		_exit( 127 );
+	}
+	if ( waitpid( pid, &status, 0 ) != pid || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+		return 0;
+	return clockNanoseconds() - started;
+}
+
+static int benchMain( const char *setDisplay, int runs )
+{
+	static const long shapes[][2] =
+	{
+		// displays, modes
+		{ 1, 10 }, { 1, 1000 }, { 1, 100000 },
+		{ 8, 1000 }, { 32, 1000 }, { 128, 1000 }, { 128, 10000 },
+	};
+	static const char *flags[] = { "-f", "-xn", "-zn", "-a" };
+	static const char *names[] = { "set -f", "exact", "highest", "list -a" };
+	size_t ss, ff;
+	int run;
+
+	if ( access( setDisplay, X_OK ) != 0 )
+	{
+		printf( "main: cannot run %s (see -s)\n", setDisplay );
+		return -1;
+	}
+	printf( "main: %s end to end, ms, fastest of %d run(s)\n", setDisplay, runs );
+	printf( "%8s %8s", "displays", "modes" );
+	for ( ff = 0; ff < sizeof(flags) / sizeof(flags[0]); ff++ )
+		printf( " %10s", names[ff] );
+	printf( "\n" );
+
+	for ( ss = 0; ss < sizeof(shapes) / sizeof(shapes[0]); ss++ )
+	{
+		char spec[128];
+
+		snprintf( spec, sizeof(spec), "sim:displays=%ld,modes=%ld,shuffle=1", shapes[ss][0], shapes[ss][1] );
+		printf( "%8ld %8ld", shapes[ss][0], shapes[ss][1] );
+		for ( ff = 0; ff < sizeof(flags) / sizeof(flags[0]); ff++ )
+		{
+			char *argv[] = { (char *)setDisplay, "-B", spec, (char *)flags[ff], "1920", "1080", "32", "60", NULL };
+			uint64_t best = 0;
+			for ( run = 0; run < runs; run++ )
+			{
+				uint64_t took = runProgram( setDisplay, argv );
+				if ( took == 0 )
+				{
+					printf( " %10s\n", "failed" );
+					return -1;
+				}
+				if ( best == 0 || took < best )
+					best = took;
+			}
+			printf( " %10.3f", best / 1e6 );
+		}
+		printf( "\n" );
+	}
+	return 0;
+}
+
+/////////////////
+
+/*
+What a plan comes to, to tell whether two runs gave the same answers.
+*/
+static uint64_t planDigest( const displayPlan *plan )
+{
+	uint64_t hash = 14695981039346656037ull;  // FNV-1a
+	size_t ii;
+
+	for ( ii = 0; ii < plan->count; ii++ )
+	{
+		const displayPlanEntry *entry = &plan->entries[ii];
+		uint64_t fields[6] = { entry->display, (uint64_t)entry->modeIndex, entry->mode.mode.width,
+				entry->mode.mode.height, entry->mode.mode.bitsPerPixel, (uint64_t)(entry->mode.mode.refresh * 1000) };
+		size_t jj;
+		for ( jj = 0; jj < sizeof(fields); jj++ )
+			hash = (hash ^ ((const uint8_t *)fields)[jj]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+/*
+One go from a fresh session: the displays, their state, a plan for all
+of them (forced, so every display is configured) and applying it.
+With recordPath the session is recorded there; digest, when not NULL,
+gets the plan's planDigest.
+*/
+static int runOnce( const char *spec, int workers, const char *recordPath, benchTimes *times, uint64_t *digest )
+{
+	setDisplaySession *session = sessionOpen( spec, NULL );
+	const displayID *online;
+	displayID *displays;
+	uint32_t numDisplays;
+	displayPlan plan;
+	displayPlanResult result;
+	uint64_t started, loaded, planned, applied;
+	displayErr err;
+
+	if ( session == NULL )
+		return -1;
+	if ( recordPath != NULL && sessionRecord( session, recordPath ) != kDisplayNoErr )
+	{
+		sessionClose( session );
+		return -1;
+	}
+	sessionSetWorkers( session, workers );
+
+	started = clockNanoseconds();
+	err = sessionDisplays( session, &online, &numDisplays );
+	if ( err == kDisplayNoErr )
+		err = sessionLoad( session );
+	loaded = clockNanoseconds();
+	if ( err != kDisplayNoErr )
+	{
+		sessionClose( session );
+		return -1;
+	}
+
+	displays = malloc( (numDisplays ? numDisplays : 1) * sizeof(displayID) );
+	if ( displays == NULL )
+	{
+		sessionClose( session );
+		return -1;
+	}
+	memcpy( displays, online, numDisplays * sizeof(displayID) );
+	planInit( &plan );
+	sessionPlanDisplays( session, &plan, displays, numDisplays, SCAN_CLOSEST, wanted, 0, SESSION_PLAN_FORCE, NULL );
+	planned = clockNanoseconds();
+	err = sessionApply( session, &plan, 0, &result );
+	applied = clockNanoseconds();
+	if ( digest != NULL )
+		*digest = planDigest( &plan );
+	planFree( &plan );
+	free( displays );
+	sessionClose( session );
+
+	times->load = loaded - started;
+	times->plan = planned - loaded;
+	times->apply = applied - planned;
+	times->total = applied - started;
+	return err == kDisplayNoErr ? 0 : -1;
+}
+
+static int fastest( const char *spec, int workers, int runs, benchTimes *best, uint64_t *digest )
+{
+	benchTimes times;
+	int ii;
+
+	for ( ii = 0; ii < runs; ii++ )
+	{
+		if ( runOnce( spec, workers, NULL, &times, digest ) != 0 )
+			return -1;
+		if ( ii == 0 || times.total < best->total )
+			*best = times;
+	}
+	return 0;
+}
+
+static int benchWalls( long maxDisplays, long listLatency, long currentLatency, int runs )
+{
+	long numDisplays;
+
+	printf( "walls: listing %ld us, current mode %ld us, fastest of %d run(s), times in ms\n", listLatency, currentLatency, runs );
+	printf( "%8s | %9s %9s %9s %9s | %9s %9s %9s %9s | %7s\n", "displays",
+			"load", "plan", "apply", "total", "load", "plan", "apply", "total", "speedup" );
+	printf( "%8s | %-39s | %-39s |\n", "", "one after the other (-j 1)", "in parallel" );
+	for ( numDisplays = 1; numDisplays <= maxDisplays; numDisplays *= 2 )
+	{
+		char spec[128];
+		benchTimes serial, parallel;
+
+		snprintf( spec, sizeof(spec), "sim:displays=%ld,list=%ld,cur=%ld", numDisplays, listLatency, currentLatency );
+		if ( fastest( spec, 1, runs, &serial, NULL ) != 0 || fastest( spec, 0, runs, &parallel, NULL ) != 0 )
+		{
+			printf( "%8ld | failed\n", numDisplays );
+			return -1;
+		}
+		printf( "%8ld | %9.3f %9.3f %9.3f %9.3f | %9.3f %9.3f %9.3f %9.3f | %6.1fx\n", numDisplays,
+				serial.load / 1e6, serial.plan / 1e6, serial.apply / 1e6, serial.total / 1e6,
+				parallel.load / 1e6, parallel.plan / 1e6, parallel.apply / 1e6, parallel.total / 1e6,
+				(double)serial.total / (parallel.total ? parallel.total : 1) );
+		fflush( stdout );
+	}
+	return 0;
+}
+
+/////////////////
+
+#define HOTPLUG_MAX_DISPLAYS 16
+
+/*
+Loads, plans and applies every display, as SetDisplay -S does when
+asked to set them all: ms, and the mode lists and catalogs that took.
+*/
+static int setAll( setDisplaySession *session, uint64_t *ns, unsigned long *lists, unsigned long *catalogs )
+{
+	const displayID *online;
+	displayID displays[HOTPLUG_MAX_DISPLAYS];
+	uint32_t numDisplays;
+	unsigned long listsBefore = sessionBackend( session )->stats.copyModes;
+	setDisplayStats before, after;
+	displayPlan plan;
+	displayPlanResult result;
+	uint64_t started;
+	displayErr err;
+
+	sessionStats( session, &before );
+	started = clockNanoseconds();
+	err = sessionDisplays( session, &online, &numDisplays );
+	if ( err == kDisplayNoErr && numDisplays > HOTPLUG_MAX_DISPLAYS )
+		err = kDisplayErrFailure;
+	if ( err == kDisplayNoErr )
+		err = sessionLoad( session );
+	if ( err != kDisplayNoErr )
+		return -1;
+	memcpy( displays, online, numDisplays * sizeof(displayID) );
+	planInit( &plan );
+	err = sessionPlanDisplays( session, &plan, displays, numDisplays, SCAN_CLOSEST, wanted, 0, 0, NULL );
+	if ( err == kDisplayNoErr )
+		err = sessionApply( session, &plan, 0, &result );
+	planFree( &plan );
+	*ns = clockNanoseconds() - started;
+	sessionStats( session, &after );
+	*lists = sessionBackend( session )->stats.copyModes - listsBefore;
+	*catalogs = after.catalogs - before.catalogs;
+	return err == kDisplayNoErr ? 0 : -1;
+}
+
+/*
+One of several heads unplugged and plugged back (the simulated KVM
+switch puts it back in its first mode), then all of them set again.
+The heads that weren't touched keep their catalogs, so that should
+cost one head's mode list, not one for every head.
+*/
+static int benchHotplug( long listLatency, long currentLatency )
+{
+	int numDisplays;
+
+	printf( "hotplug: one head replugged, then all set again (-j 1); listing %ld us, current mode %ld us\n", listLatency, currentLatency );
+	printf( "%8s | %9s %6s %8s | %9s %6s %8s %6s %9s\n", "displays", "first ms", "lists", "catalogs",
+			"again ms", "lists", "catalogs", "kept", "matches" );
+	for ( numDisplays = 1; numDisplays <= HOTPLUG_MAX_DISPLAYS; numDisplays *= 2 )
+	{
+		char spec[160];
+		setDisplaySession *session;
+		setDisplayStats stats;
+		displayEvent events[16];
+		size_t numEvents;
+		uint64_t firstNs, againNs;
+		unsigned long firstLists, firstCatalogs, againLists, againCatalogs;
+		int failed, replugged = 0;
+
+		// the one hotplug is due a millisecond in, which the first pass is longer than; it puts
+		// the display in its first mode, not the one it started in
+		snprintf( spec, sizeof(spec), "sim:displays=%d,list=%ld,cur=%ld,current=1024x768,hotplug=1,hotplugs=1,burst=1", numDisplays,
+				listLatency, currentLatency );
+		session = sessionOpen( spec, NULL );
+		if ( session == NULL )
+			return -1;
+		sessionSetWorkers( session, 1 );    // the work done, not how much of it overlaps
+		failed = setAll( session, &firstNs, &firstLists, &firstCatalogs );
+		// what the first pass set comes back as events too, the hotplug is the one that adds
+		while ( !failed && !replugged )
+		{
+			size_t ii;
+			if ( sessionWaitForEvents( session, 10, events, 16, &numEvents ) != kDisplayNoErr )
+				failed = -1;
+			for ( ii = 0; !failed && ii < numEvents; ii++ )
+				replugged |= (events[ii].flags & DISPLAY_EVENT_ADDED) != 0;
+		}
+		if ( !failed )
+			failed = setAll( session, &againNs, &againLists, &againCatalogs );
+		sessionStats( session, &stats );
+		sessionClose( session );
+		if ( failed )
+		{
+			printf( "%8d | failed\n", numDisplays );
+			return -1;
+		}
+		printf( "%8d | %9.3f %6lu %8lu | %9.3f %6lu %8lu %6lu %4lu/%-4lu\n", numDisplays, firstNs / 1e6, firstLists,
+				firstCatalogs, againNs / 1e6, againLists, againCatalogs, stats.kept, stats.matchesKept,
+				stats.matches + stats.matchesKept );
+		fflush( stdout );
+	}
+	return 0;
+}
+
+/////////////////
+
+/*
+A recording played back twice, waiting as long as each call took when
+it was recorded and not waiting at all, and the plans compared: both
+have to come to the same answers, and to the answers the displays gave
+when that can be known.  Without recordings (-R) some simulated
+displays are recorded first, and what they took is shown too.
+*/
+static int replayOne( const char *name, const char *path, const benchTimes *recorded, const uint64_t *recordedDigest, int runs )
+{
+	char spec[1100];
+	benchTimes timed, untimed;
+	uint64_t timedDigest = 0, untimedDigest = 0;
+	int same;
+
+	snprintf( spec, sizeof(spec), "replay:file=%s", path );
+	if ( fastest( spec, 0, runs, &timed, &timedDigest ) != 0 )
+	{
+		printf( "%-24s failed\n", name );
+		return -1;
+	}
+	snprintf( spec, sizeof(spec), "replay:file=%s,timing=0", path );
+	if ( fastest( spec, 0, runs, &untimed, &untimedDigest ) != 0 )
+	{
+		printf( "%-24s failed\n", name );
+		return -1;
+	}
+	same = timedDigest == untimedDigest && (recordedDigest == NULL || *recordedDigest == timedDigest);
+	if ( recorded != NULL )
+		printf( "%-24s %9.3f", name, recorded->total / 1e6 );
+	else
+		printf( "%-24s %9s", name, "-" );
+	printf( " | %9.3f %9.3f %9.3f | %9.3f | %-9s %016llx\n", timed.load / 1e6, timed.apply / 1e6, timed.total / 1e6,
+			untimed.total / 1e6, same ? "same" : "DIFFERENT", (unsigned long long)timedDigest );
+	fflush( stdout );
+	return same ? 0 : -1;
+}
+
+static int benchReplay( char **recordings, int numRecordings, int runs )
+{
+	static const int simDisplays[] = { 1, 4, 16, 64 };
+	int failed = 0;
+	int ii;
+
+	printf( "replay: fastest of %d run(s), times in ms\n", runs );
+	printf( "%-24s %9s | %9s %9s %9s | %9s | %s\n", "recording", "recorded", "load", "apply", "total", "timing=0", "answers" );
+	for ( ii = 0; ii < numRecordings; ii++ )
+	{
+		const char *name = strrchr( recordings[ii], '/' );
+		failed |= replayOne( name ? name + 1 : recordings[ii], recordings[ii], NULL, NULL, runs ) != 0;
+	}
+	for ( ii = 0; numRecordings == 0 && ii < (int)(sizeof(simDisplays) / sizeof(simDisplays[0])); ii++ )
+	{
+		char spec[128], path[64], name[32];
+		benchTimes recorded;
+		uint64_t digest;
+
+		snprintf( spec, sizeof(spec), "sim:displays=%d,modes=500,shuffle=1,list=2000,cur=200,commit=5000", simDisplays[ii] );
+		snprintf( path, sizeof(path), "/tmp/SetDisplayBench.%ld.sdrc", (long)getpid() );
+		snprintf( name, sizeof(name), "sim, %d display(s)", simDisplays[ii] );
+		if ( runOnce( spec, 0, path, &recorded, &digest ) != 0 )
+		{
+			printf( "%-24s can't record %s\n", name, path );
+			failed = 1;
+			continue;
+		}
+		failed |= replayOne( name, path, &recorded, &digest, runs ) != 0;
+		unlink( path );
+	}
+	return failed ? -1 : 0;
+}
+
+/////////////////
+
+/////////////////
+
+/*
+SetDisplay left running (-D, -S) holds one session open while the
+displays are planned, set and changed under it, for as long as the Mac
+is up.  Each cycle here plans the displays to one of two modes and
+applies that, collects the events it sends (so each display is read
+again, and relisted to be checked against its catalog, on the next
+cycle) and asks for a mode.  Once warmed up what is allocated mustn't grow: more blocks or
+bytes out at the end than after the warmup is a leak, and fails.
+*/
+#define STEADY_WARMUP   1000
+#define STEADY_DISPLAYS 4
+
+static displayErr steadyCycle( setDisplaySession *session, const displayID *displays, uint32_t numDisplays, long cycle )
+{
+	static const displayMode targets[2] = { { 1920, 1080, 32, 60 }, { 1280, 1024, 32, 75 } };
+	displayPlan plan;
+	displayPlanResult result;
+	displayEvent events[16];
+	size_t numEvents;
+	displayErr err;
+
+	planInit( &plan );
+	err = sessionPlanDisplays( session, &plan, displays, numDisplays, SCAN_CLOSEST, targets[cycle & 1], 0, 0, NULL );
+	if ( err == kDisplayNoErr )
+		err = sessionApply( session, &plan, 0, &result );
+	planFree( &plan );
+	while ( err == kDisplayNoErr && sessionWaitForEvents( session, 0, events, 16, &numEvents ) == kDisplayNoErr && numEvents > 0 )
+		;
+	if ( err == kDisplayNoErr && sessionFind( session, displays[cycle % numDisplays], SCAN_HIGHEST, targets[0], NULL ) == kNoMode )
+		err = kDisplayErrFailure;
+	return err;
+}
+
+static void printSteady( long cycle, uint64_t ns, unsigned long allocs, long blocks, long bytes, long mostBytes, long warmBytes )
+{
+	printf( "%9ld %9.2f", cycle, ns / 1e3 / (cycle - STEADY_WARMUP) );
+	printAllocs( (double)allocs / (cycle - STEADY_WARMUP) );
+	if ( ALLOC_COUNTING )
+		printf( " %9ld %11ld %11ld %+9ld\n", blocks, bytes, mostBytes, bytes - warmBytes );
+	else
+		printf( " %9s %11s %11s %9s\n", "-", "-", "-", "-" );
+}
+
+#define LOG_WRITERS 4
+#define LOG_APPENDS 200000              // each
+#define LOG_SMALL   256                 // records, so the writers go round many times
+
+static void fillRecord( logRecord *record, uint32_t writer, uint32_t count )
+{
+	int ii;
+
+	memset( record, 0, sizeof(logRecord) );
+	record->time = logTime();
+	record->pid = writer;
+	record->numLogged = DISPLAYLOG_DISPLAYS;
+	for ( ii = 0; ii < DISPLAYLOG_DISPLAYS; ii++ )
+	{
+		record->displays[ii].display = writer;
+		record->displays[ii].settleMicroseconds = count;
+	}
+}
+
+typedef struct
+{
+	size_t records;
+	size_t torn;
+	uint64_t lastSeq;
+	size_t outOfOrder;
+} logCheck;
+
+static int checkRecord( void *ctx, const logRecord *record )
+{
+	logCheck *check = ctx;
+	int ii;
+
+	check->records++;
+	if ( record->seq <= check->lastSeq )
+		check->outOfOrder++;
+	check->lastSeq = record->seq;
+	for ( ii = 0; ii < DISPLAYLOG_DISPLAYS; ii++ )
+	{
+		if ( record->displays[ii].display != record->pid ||
+				record->displays[ii].settleMicroseconds != record->displays[0].settleMicroseconds )
+		{
+			check->torn++;
+			break;
+		}
+	}
+	return 0;
+}
+
+static int benchLog( void )
+{
+	char path[128];
+	displayLog *log;
+	logRecord record;
+	logCheck check;
+	unsigned long allocs, done = 0;
+	uint64_t started, elapsed;
+	pid_t writers[LOG_WRITERS];
+	int ii, status, failed = 0;
+
+	snprintf( path, sizeof(path), "/tmp/SetDisplayBench.%ld.sdlg", (long)getpid() );
+	unlink( path );
+	printf( "log: a %u-record log, %zu bytes a record\n", DISPLAYLOG_RECORDS, sizeof(logRecord) );
+
+	started = clockNanoseconds();
+	log = logOpen( path, 0 );
+	elapsed = clockNanoseconds() - started;
+	if ( log == NULL )
+	{
+		printf( "Cannot create %s\n", path );
+		return 1;
+	}
+	logClose( log );
+	printf( "%-28s %10.1f us\n", "create", elapsed / 1e3 );
+
+	started = clockNanoseconds();
+	do {
+		log = logOpen( path, 0 );
+		logClose( log );
+		done++;
+		elapsed = clockNanoseconds() - started;
+	} while ( elapsed < BENCH_MIN_NS );
+	printf( "%-28s %10.1f us\n", "open and close", elapsed / 1e3 / done );
+
+	log = logOpen( path, 0 );
+	fillRecord( &record, 1, 0 );
+	allocs = allocations();
+	done = 0;
+	started = clockNanoseconds();
+	do {
+		for ( ii = 0; ii < BENCH_QUERIES; ii++ )
+			logAppend( log, &record );
+		done += BENCH_QUERIES;
+		elapsed = clockNanoseconds() - started;
+	} while ( elapsed < BENCH_MIN_NS );
+	printf( "%-28s %10.1f ns", "append", (double)elapsed / done );
+	printAllocs( (double)(allocations() - allocs) / done );
+	printf( "\n" );
+	logClose( log );
+	unlink( path );
+
+	// every writer its own process, as at login
+	log = logOpen( path, LOG_SMALL );
+	if ( log == NULL )
+		return 1;
+	started = clockNanoseconds();
+	for ( ii = 0; ii < LOG_WRITERS; ii++ )
+	{
+		writers[ii] = fork();
+		if ( writers[ii] == 0 )
+		{
+			uint32_t count;
+			for ( count = 0; count < LOG_APPENDS; count++ )
+			{
+				fillRecord( &record, (uint32_t)ii + 1, count );
+				logAppend( log, &record );
+			}
+			_exit( 0 );
+		}
+	}
+	// reading all the while, the way SetDisplayLog can
+	memset( &check, 0, sizeof(check) );
+	for ( ii = 0; ii < LOG_WRITERS; ii++ )
+	{
+		while ( waitpid( writers[ii], &status, WNOHANG ) == 0 )
+		{
+			logCheck during;
+			memset( &during, 0, sizeof(during) );
+			logRead( log, checkRecord, &during );
+			check.torn += during.torn;
+			check.outOfOrder += during.outOfOrder;
+		}
+		if ( writers[ii] < 0 || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+			failed = 1;
+	}
+	elapsed = clockNanoseconds() - started;
+	{
+		logCheck after;
+		memset( &after, 0, sizeof(after) );
+		logRead( log, checkRecord, &after );
+		check.torn += after.torn;
+		check.outOfOrder += after.outOfOrder;
+		check.records = after.records;
+	}
+	printf( "%-28s %10.1f ns, %d writers of %u records, %llu claimed, %zu read back of %u, %zu torn, "
+			"%zu out of order\n", "append, processes at once", (double)elapsed / (LOG_WRITERS * LOG_APPENDS), LOG_WRITERS, LOG_APPENDS,
+			(unsigned long long)logHeaderOf( log )->next, check.records, LOG_SMALL, check.torn, check.outOfOrder );
+	// a writer can leave out a record another is still writing a lap behind, and take another
+	if ( logHeaderOf( log )->next < (uint64_t)LOG_WRITERS * LOG_APPENDS || check.records + LOG_WRITERS < LOG_SMALL ||
+			check.torn > 0 || check.outOfOrder > 0 )
+		failed = 1;
+	logClose( log );
+	unlink( path );
+	if ( failed )
+		printf( "log: FAILED\n" );
+	return failed;
+}
+
+/////////////////
+
+#define FLIGHT_PROCESSES 16
+#define FLIGHT_SPEC      "sim:displays=2,commit=20000"
+
+typedef struct
+{
+	volatile int go;
+	struct
+	{
+		int outcome;                // flightBegin's
+		uint64_t key;
+		uint64_t reusedKey;
+		uint64_t started;           // setting the displays, when it led
+		uint64_t finished;
+	} runs[FLIGHT_PROCESSES];
+} flightShared;
+
+static int flightSet( displayMode mode )
+{
+	setDisplaySession *session = sessionOpen( FLIGHT_SPEC, NULL );
+	const displayID *online;
+	displayID *displays;
+	uint32_t numDisplays;
+	displayPlan plan;
+	displayPlanResult result;
+	displayErr err;
+
+	if ( session == NULL )
+		return -1;
+	err = sessionDisplays( session, &online, &numDisplays );
+	displays = err == kDisplayNoErr ? malloc( (numDisplays ? numDisplays : 1) * sizeof(displayID) ) : NULL;
+	if ( displays == NULL )
+	{
+		sessionClose( session );
+		return -1;
+	}
+	memcpy( displays, online, numDisplays * sizeof(displayID) );
+	planInit( &plan );
+	sessionPlanDisplays( session, &plan, displays, numDisplays, SCAN_CLOSEST, mode, 0, SESSION_PLAN_FORCE, NULL );
+	err = sessionApply( session, &plan, 0, &result );
+	planFree( &plan );
+	free( displays );
+	sessionClose( session );
+	return err == kDisplayNoErr ? 0 : -1;
+}
+
+/*
+One SetDisplay: waits for its turn, then sets the displays or takes the
+result of the one it waited for.
+*/
+static int flightOne( const char *path, flightShared *shared, int me, displayMode mode )
+{
+	displayFlight *flight = flightOpen( path );
+	flightSlot mine, seen;
+	int err = 0;
+
+	if ( flight == NULL )
+		return -1;
+	memset( &mine, 0, sizeof(mine) );
+	mine.key = flightKey( FLIGHT_SPEC, NULL, mode, SCAN_CLOSEST, MIRROR_UNCHANGED, 0 );
+	mine.width = (uint32_t)mode.width;
+	mine.height = (uint32_t)mode.height;
+	mine.bitsPerPixel = (uint32_t)mode.bitsPerPixel;
+	mine.refresh = mode.refresh;
+	shared->runs[me].key = mine.key;
+	while ( !shared->go )
+		;
+	shared->runs[me].outcome = flightBegin( flight, &mine, 1, &seen );
+	if ( shared->runs[me].outcome == FLIGHT_REUSED )
+		shared->runs[me].reusedKey = seen.key;
+	else
+	{
+		shared->runs[me].started = clockNanoseconds();
+		err = flightSet( mode );
+		mine.err = err ? kDisplayErrFailure : kDisplayNoErr;
+		shared->runs[me].finished = clockNanoseconds();
+		flightLand( flight, &mine );
+	}
+	flightClose( flight );
+	return err;
+}
+
+static int flightRound( const char *path, flightShared *shared, int numModes, uint64_t alone )
+{
+	static const displayMode modes[2] = { { 1600, 1200, 32, 0 }, { 1024, 768, 32, 0 } };
+	pid_t processes[FLIGHT_PROCESSES];
+	uint64_t started, elapsed;
+	int ii, jj, status, led = 0, reused = 0, overlapping = 0, wrong = 0, failed = 0;
+
+	unlink( path );
+	memset( shared, 0, sizeof(flightShared) );
+	for ( ii = 0; ii < FLIGHT_PROCESSES; ii++ )
+	{
+		processes[ii] = fork();
+		if ( processes[ii] == 0 )
+			_exit( flightOne( path, shared, ii, modes[ii % numModes] ) == 0 ? 0 : 1 );
+	}
+	// all of them forked and waiting, as at login
+	usleep( 100000 );
+	started = clockNanoseconds();
+	shared->go = 1;
+	for ( ii = 0; ii < FLIGHT_PROCESSES; ii++ )
+	{
+		if ( processes[ii] < 0 || waitpid( processes[ii], &status, 0 ) != processes[ii] || !WIFEXITED( status ) ||
+				WEXITSTATUS( status ) != 0 )
+			failed = 1;
+	}
+	elapsed = clockNanoseconds() - started;
+
+	for ( ii = 0; ii < FLIGHT_PROCESSES; ii++ )
+	{
+		if ( shared->runs[ii].outcome == FLIGHT_REUSED )
+		{
+			reused++;
+			if ( shared->runs[ii].reusedKey != shared->runs[ii].key )
+				wrong++;
+			continue;
+		}
+		led++;
+		for ( jj = 0; jj < ii; jj++ )
+		{
+			if ( shared->runs[jj].outcome != FLIGHT_REUSED && shared->runs[ii].started < shared->runs[jj].finished &&
+					shared->runs[jj].started < shared->runs[ii].finished )
+				overlapping++;
+		}
+	}
+	printf( "%-16s %2d processes %8.1f ms (one alone %.1f ms), %2d set the displays, %2d took another's result, "
+			"%d at the same time, %d a different mode's\n", numModes == 1 ? "same mode" : "two modes", FLIGHT_PROCESSES,
+			elapsed / 1e6, alone / 1e6, led, reused, overlapping, wrong );
+	unlink( path );
+	return failed || overlapping > 0 || wrong > 0 || led + reused != FLIGHT_PROCESSES ? -1 : 0;
+}
+
+static int benchFlight( void )
+{
+	char path[128];
+	flightShared *shared;
+	uint64_t alone;
+	int failed = 0;
+
+	snprintf( path, sizeof(path), "/tmp/SetDisplayBench.%ld.flight", (long)getpid() );
+	shared = mmap( NULL, sizeof(flightShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0 );
+	if ( shared == MAP_FAILED )
+		return 1;
+	printf( "flight: %s\n", FLIGHT_SPEC );
+	alone = clockNanoseconds();
+	failed |= flightSet( wanted ) != 0;
+	alone = clockNanoseconds() - alone;
+	failed |= flightRound( path, shared, 1, alone ) != 0;
+	failed |= flightRound( path, shared, 2, alone ) != 0;
+	munmap( shared, sizeof(flightShared) );
+	if ( failed )
+		printf( "flight: FAILED\n" );
+	return failed;
+}
+
+/////////////////
+
+static int benchSteady( long cycles )
+{
+	char spec[64];
+	setDisplaySession *session;
+	const displayID *online;
+	displayID displays[STEADY_DISPLAYS];
+	uint32_t numDisplays;
+	unsigned long allocs = 0;
+	long warmBlocks = 0, warmBytes = 0, blocks = 0, bytes = 0, mostBytes = 0;
+	long cycle, report = STEADY_WARMUP * 10;
+	uint64_t started = 0;
+	displayErr err;
+
+	// commits send events, and no hotplugs of its own
+	snprintf( spec, sizeof(spec), "sim:displays=%d,hotplug=1000,hotplugs=0", STEADY_DISPLAYS );
+	session = sessionOpen( spec, NULL );
+	if ( session == NULL )
+		return -1;
+	err = sessionDisplays( session, &online, &numDisplays );
+	if ( err == kDisplayNoErr )
+		err = sessionLoad( session );
+	if ( err != kDisplayNoErr || numDisplays != STEADY_DISPLAYS )
+	{
+		sessionClose( session );
+		return -1;
+	}
+	memcpy( displays, online, sizeof(displays) );
+	sessionSetWorkers( session, 1 );    // what the session itself does, not the pool
+
+	printf( "steady: %d displays planned, applied, relisted and asked, %ld cycles after %d to warm up, blocks and bytes still out\n",
+			STEADY_DISPLAYS, cycles, STEADY_WARMUP );
+	printf( "%9s %9s %9s %9s %11s %11s %9s\n", "cycles", "us/cycle", "allocs", "blocks", "bytes", "most bytes", "growth" );
+	cycles += STEADY_WARMUP;
+	for ( cycle = 0; cycle < cycles && err == kDisplayNoErr; cycle++ )
+	{
+		if ( cycle == STEADY_WARMUP )
+		{
+			outstanding( &warmBlocks, &warmBytes );
+			mostBytes = warmBytes;
+			allocs = allocations();
+			started = clockNanoseconds();
+		}
+		err = steadyCycle( session, displays, numDisplays, cycle );
+		if ( cycle < STEADY_WARMUP )
+			continue;
+		outstanding( &blocks, &bytes );
+		if ( bytes > mostBytes )
+			mostBytes = bytes;
+		if ( cycle + 1 == report && cycle + 1 < cycles )
+		{
+			printSteady( cycle + 1, clockNanoseconds() - started, allocations() - allocs, blocks, bytes, mostBytes, warmBytes );
+			fflush( stdout );
+			report *= 10;
+		}
+	}
+	if ( err != kDisplayNoErr )
+	{
+		printf( "failed at cycle %ld: %d\n", cycle, (int)err );
+		sessionClose( session );
+		return -1;
+	}
+	printSteady( cycle, clockNanoseconds() - started, allocations() - allocs, blocks, bytes, mostBytes, warmBytes );
+	sessionClose( session );
+	if ( blocks > warmBlocks || bytes > warmBytes )
+	{
+		printf( "still growing: %+ld blocks, %+ld bytes\n", blocks - warmBlocks, bytes - warmBytes );
+		return -1;
+	}
+	return 0;
+}
+
+static void usage()
+{
+	printf( "SetDisplayBench [-d MAXDISPLAYS] [-l LISTUS] [-c CURRENTUS] [-n CYCLES] [-R RECORDING ...] [-r RUNS] [-s SETDISPLAY]\n"
+			"                [match|batch|mirror|main|timing|policy|walls|hotplug|drm|xrandr|replay|log|flight|steady ...]\n" );
+	printf( " -d Go up to MAXDISPLAYS displays (walls), doubling from 1, default 256\n" );
+	printf( " -l What listing a display's modes takes (walls, hotplug), default 2000 us\n" );
+	printf( " -c What reading a display's current mode takes (walls, hotplug), default 200 us\n" );
+	printf( " -n Cycles to run once warmed up (steady), default 1000000\n" );
+	printf( " -R Play back RECORDING (replay), made with SetDisplay -R; can be given many times\n" );
+	printf( " -r Runs per line, the fastest is shown, default 3\n" );
+	printf( " -s The SetDisplay to run (main), default ./SetDisplay\n" );
+	printf( " With no benchmark named all of them are run.\n" );
+	exit(1);
+}
+
+int main( int argc, char **argv )
+{
+	long maxDisplays = 256;
+	long listLatency = 2000;
+	long currentLatency = 200;
+	long cycles = 1000000;
+	int runs = 3;
+	const char *setDisplay = "./SetDisplay";
+	char **recordings;
+	int numRecordings = 0;
+	int failed = 0;
+	int cc, ii;
+
+	recordings = malloc( argc * sizeof(char *) );
+	if ( recordings == NULL )
+		return 1;
+	while ( (cc = getopt( argc, argv, "c:d:l:n:R:r:s:" )) != -1 )
+	{
+		switch ( cc )
+		{
+			case 'c':
+				currentLatency = atol( optarg );
+				break;
+			case 'd':
+				maxDisplays = atol( optarg );
+				break;
+			case 'l':
+				listLatency = atol( optarg );
+				break;
+			case 'n':
+				cycles = atol( optarg );
+				break;
+			case 'R':
+				recordings[numRecordings++] = optarg;
+				break;
+			case 'r':
+				runs = atoi( optarg );
+				break;
+			case 's':
+				setDisplay = optarg;
+				break;
+			default:
+				usage();
+		}
+	}
+	if ( maxDisplays < 1 || runs < 1 || cycles < 1 )
+		usage();
+	for ( ii = optind; ii < argc; ii++ )
+	{
+		if ( strcmp( argv[ii], "match" ) != 0 && strcmp( argv[ii], "batch" ) != 0 && strcmp( argv[ii], "mirror" ) != 0 && strcmp( argv[ii], "main" ) != 0 && strcmp( argv[ii], "timing" ) != 0 &&
+				strcmp( argv[ii], "policy" ) != 0 && strcmp( argv[ii], "walls" ) != 0 && strcmp( argv[ii], "hotplug" ) != 0 && strcmp( argv[ii], "drm" ) != 0 && strcmp( argv[ii], "xrandr" ) != 0 &&
+				strcmp( argv[ii], "replay" ) != 0 && strcmp( argv[ii], "log" ) != 0 && strcmp( argv[ii], "flight" ) != 0 &&
+				strcmp( argv[ii], "steady" ) != 0 )
+			usage();
+	}
+
+	for ( ii = optind; ii < argc || ii == optind; ii++ )
+	{
+		const char *name = ii < argc ? argv[ii] : NULL;
+		if ( name == NULL || strcmp( name, "match" ) == 0 )
+			failed |= benchMatch() != 0;
+		if ( name == NULL || strcmp( name, "batch" ) == 0 )
+			failed |= benchBatch() != 0;
+		if ( name == NULL || strcmp( name, "mirror" ) == 0 )
+			failed |= benchMirror() != 0;
+		if ( name == NULL || strcmp( name, "main" ) == 0 )
+			failed |= benchMain( setDisplay, runs ) != 0;
+		if ( name == NULL || strcmp( name, "timing" ) == 0 )
+			failed |= benchTiming() != 0;
+		if ( name == NULL || strcmp( name, "policy" ) == 0 )
+			failed |= benchPolicy() != 0;
+		if ( name == NULL || strcmp( name, "walls" ) == 0 )
+			failed |= benchWalls( maxDisplays, listLatency, currentLatency, runs ) != 0;
+		if ( name == NULL || strcmp( name, "hotplug" ) == 0 )
+			failed |= benchHotplug( listLatency, currentLatency ) != 0;
+		if ( name == NULL || strcmp( name, "drm" ) == 0 )
+			failed |= benchDrm() != 0;
+		if ( (name == NULL && getenv( "DISPLAY" ) != NULL) || (name != NULL && strcmp( name, "xrandr" ) == 0) )
+			failed |= benchXRandR( runs ) != 0;
+		if ( name == NULL || strcmp( name, "replay" ) == 0 )
+			failed |= benchReplay( recordings, numRecordings, runs ) != 0;
+		if ( name == NULL || strcmp( name, "log" ) == 0 )
+			failed |= benchLog() != 0;
+		if ( name == NULL || strcmp( name, "flight" ) == 0 )
+			failed |= benchFlight() != 0;
+		if ( name == NULL || strcmp( name, "steady" ) == 0 )
+			failed |= benchSteady( cycles ) != 0;
+		if ( name == NULL )
+			break;
+	}
+	free( recordings );
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,488 @@
+/*
+gcc -O3 -o SetDisplayClient SetDisplayClient.c -lpthread
+
+SetDisplayClient.c
+
+Asks a running SetDisplay -S for the displays, their modes, the mode
+that matches, or to set the mode, over its socket (DisplayProtocol.h).
+With -n it is a load generator instead: it sends the same kind of
+request over and over from -t connections at once and reports requests
+per second and the latency percentiles.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+
+USAGE:
+
+SetDisplayClient -l                        the displays and their current modes
+SetDisplayClient -a                        every mode of every display
+SetDisplayClient -c 1024 768 32 75         the closest mode (-x exact, -z highest)
+SetDisplayClient -s 1024 768 32 75         set the closest mode
+SetDisplayClient -n 100000 -t 8 -c         load: closest lookups from 8 connections
+
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Clock.h"
+#include "DisplayPlan.h"
+#include "DisplayProtocol.h"
+#include "ModeCatalog.h"
+
+#define MAX_DISPLAYS    32
+#define MAX_CONNECTIONS 256
+
+typedef struct
+{
+	int fd;
+	void *reply;                // body of the last reply
+	size_t replySize;
+	size_t replyMax;
+} connection;
+
+typedef struct
+{
+	const char *socketPath;
+	int op;
+	int scanType;
+	int mirror;
+	int force;
+	displayMode mode;
+	displayID displays[MAX_DISPLAYS];
+	uint32_t numDisplays;
+} request;
+
+typedef struct
+{
+	const request *req;
+	long count;
+	uint64_t *latencies;
+	long failed;
+	pthread_t thread;
+} loadWorker;
+
+static int connectTo( connection *conn, const char *socketPath )
+{
+	struct sockaddr_un addr;
+
+	memset( conn, 0, sizeof(connection) );
+	if ( strlen( socketPath ) >= sizeof(addr.sun_path) )
+		return -1;
+	memset( &addr, 0, sizeof(addr) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, socketPath );
+	conn->fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( conn->fd < 0 )
+		return -1;
+	if ( connect( conn->fd, (struct sockaddr *)&addr, sizeof(addr) ) != 0 )
+	{
+		close( conn->fd );
+		return -1;
+	}
+	return 0;
+}
+
+static void disconnect( connection *conn )
+{
+	close( conn->fd );
+	free( conn->reply );
+}
+
+static int sendAll( int fd, const void *buf, size_t len )
+{
+	const char *p = buf;
+
+	while ( len > 0 )
+	{
+		ssize_t n = send( fd, p, len, 0 );
+		if ( n <= 0 )
+			return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+static int recvAll( int fd, void *buf, size_t len )
+{
+	char *p = buf;
+
+	while ( len > 0 )
+	{
+		ssize_t n = recv( fd, p, len, 0 );
+		if ( n <= 0 )
+			return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+/*
+Sends one request and waits for its reply.  Returns the reply's status,
+or -1 if the connection failed.
+*/
+static int transact( connection *conn, int op, const void *body, size_t size )
+{
+	protocolHeader header;
+
+	memset( &header, 0, sizeof(header) );
+	header.op = (uint16_t)op;
+	header.size = (uint32_t)size;
+	if ( sendAll( conn->fd, &header, sizeof(header) ) != 0 || (size > 0 && sendAll( conn->fd, body, size ) != 0) )
+		return -1;
+	if ( recvAll( conn->fd, &header, sizeof(header) ) != 0 || header.op != op )
+		return -1;
+	if ( header.size > conn->replyMax )
+	{
+		void *reply = realloc( conn->reply, header.size );
+		if ( reply == NULL )
+			return -1;
+		conn->reply = reply;
+		conn->replyMax = header.size;
+	}
+	conn->replySize = header.size;
+	if ( header.size > 0 && recvAll( conn->fd, conn->reply, header.size ) != 0 )
+		return -1;
+	return header.status;
+}
+
+static void toWire( protocolMode *wire, const displayMode *mode )
+{
+	memset( wire, 0, sizeof(protocolMode) );
+	wire->width = (uint32_t)mode->width;
+	wire->height = (uint32_t)mode->height;
+	wire->bitsPerPixel = (uint32_t)mode->bitsPerPixel;
+	wire->refresh = mode->refresh;
+}
+
+/*
+The request req->op would make of display (kNullDisplay for all of
+them, where that means something).
+*/
+static int sendRequest( connection *conn, const request *req, displayID display )
+{
+	protocolListRequest list;
+	protocolFindRequest find;
+	protocolApplyRequest apply;
+
+	switch ( req->op )
+	{
+		case PROTOCOL_DISPLAYS:
+			return transact( conn, PROTOCOL_DISPLAYS, NULL, 0 );
+		case PROTOCOL_LIST:
+			memset( &list, 0, sizeof(list) );
+			list.display = display;
+			return transact( conn, PROTOCOL_LIST, &list, sizeof(list) );
+		case PROTOCOL_FIND:
+			memset( &find, 0, sizeof(find) );
+			find.display = display;
+			find.scanType = (uint32_t)req->scanType;
+			toWire( &find.mode, &req->mode );
+			return transact( conn, PROTOCOL_FIND, &find, sizeof(find) );
+		case PROTOCOL_APPLY:
+			memset( &apply, 0, sizeof(apply) );
+			apply.display = display;
+			apply.scanType = (uint32_t)req->scanType;
+			apply.mirror = (uint32_t)req->mirror;
+			apply.force = (uint32_t)req->force;
+			toWire( &apply.mode, &req->mode );
+			return transact( conn, PROTOCOL_APPLY, &apply, sizeof(apply) );
+	}
+	return -1;
+}
+
+static void printMode( const protocolMode *mode, int showUsable )
+{
+	if ( showUsable )
+		printf( "%u %u %u %lg %s\n", mode->width, mode->height, mode->bitsPerPixel, mode->refresh,
+				mode->usable ? "Usable" : "Nonusable" );
+	else
+		printf( "%u %u %u %lg\n", mode->width, mode->height, mode->bitsPerPixel, mode->refresh );
+}
+
+static int getDisplays( connection *conn, request *req )
+{
+	const protocolCount *count;
+	const protocolDisplay *displays;
+	uint32_t ii;
+	int status;
+
+	status = transact( conn, PROTOCOL_DISPLAYS, NULL, 0 );
+	if ( status != kDisplayNoErr )
+		return status;
+	count = conn->reply;
+	displays = (const protocolDisplay *)(count + 1);
+	req->numDisplays = 0;
+	for ( ii = 0; ii < count->count && ii < MAX_DISPLAYS; ii++ )
+		req->displays[req->numDisplays++] = displays[ii].display;
+	return kDisplayNoErr;
+}
+
+static int runOnce( connection *conn, request *req )
+{
+	uint32_t ii, jj;
+	int status;
+
+	if ( req->op == PROTOCOL_APPLY )
+	{
+		const protocolApplyReply *reply;
+		status = sendRequest( conn, req, kNullDisplay );
+		if ( status != kDisplayNoErr )
+		{
+			printf( "Oops!  Mode switch failed?!?? (%d)\n", status );
+			return 1;
+		}
+		reply = conn->reply;
+		printf( "%u display(s) configured in %u commit(s), %u skipped, %.3f ms\n", reply->configured, reply->commits,
+				reply->skipped, reply->applyNanoseconds / 1e6 );
+		return 0;
+	}
+
+	if ( req->op == PROTOCOL_DISPLAYS )
+	{
+		status = transact( conn, PROTOCOL_DISPLAYS, NULL, 0 );
+		if ( status != kDisplayNoErr )
+		{
+			printf( "Cannot get displays (%d)\n", status );
+			return 1;
+		}
+		const protocolCount *count = conn->reply;
+		const protocolDisplay *displays = (const protocolDisplay *)(count + 1);
+		for ( ii = 0; ii < count->count; ii++ )
+		{
+			printf( "Display 0x%x ", (unsigned int)displays[ii].display );
+			printMode( &displays[ii].current, 0 );
+		}
+		return 0;
+	}
+	status = getDisplays( conn, req );
+	if ( status != kDisplayNoErr )
+	{
+		printf( "Cannot get displays (%d)\n", status );
+		return 1;
+	}
+	for ( ii = 0; ii < req->numDisplays; ii++ )
+	{
+		status = sendRequest( conn, req, req->displays[ii] );
+		if ( status != kDisplayNoErr )
+		{
+			printf( "Display 0x%x is invalid (%d)\n", (unsigned int)req->displays[ii], status );
+			continue;
+		}
+		if ( req->op == PROTOCOL_LIST )
+		{
+			const protocolCount *count = conn->reply;
+			const protocolMode *modes = (const protocolMode *)(count + 1);
+			printf( "------ All modes for display ------\n" );
+			for ( jj = 0; jj < count->count; jj++ )
+				printMode( &modes[jj], 1 );
+		} else {
+			printf( req->scanType == SCAN_EXACT ? "------ Exact mode for display -----\n" :
+					req->scanType == SCAN_HIGHEST ? "----- Highest mode for display ----\n" :
+					"----- Closest mode for display ----\n" );
+			printMode( conn->reply, 0 );
+		}
+		printf( "-----------------------------------\n" );
+	}
+	return 0;
+}
+
+/////////////////
+
+static void *loadThread( void *arg )
+{
+	loadWorker *worker = arg;
+	const request *req = worker->req;
+	connection conn;
+	long ii;
+
+	if ( connectTo( &conn, req->socketPath ) != 0 )
+	{
+		worker->failed = worker->count;
+		worker->count = 0;
+		return NULL;
+	}
+	for ( ii = 0; ii < worker->count; ii++ )
+	{
+		displayID display = req->numDisplays > 0 ? req->displays[ii % req->numDisplays] : kNullDisplay;
+		uint64_t start = clockNanoseconds();
+		if ( sendRequest( &conn, req, display ) != kDisplayNoErr )
+			worker->failed++;
+		worker->latencies[ii] = clockNanoseconds() - start;
+	}
+	disconnect( &conn );
+	return NULL;
+}
+
+static int compareLatency( const void *a, const void *b )
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static int runLoad( request *req, long requests, int connections )
+{
+	loadWorker workers[MAX_CONNECTIONS];
+	uint64_t *latencies, start, elapsed;
+	long done = 0, failed = 0;
+	int cc;
+
+	latencies = malloc( (size_t)requests * sizeof(uint64_t) );
+	if ( latencies == NULL )
+		return 1;
+	for ( cc = 0; cc < connections; cc++ )
+	{
+		workers[cc].req = req;
+		workers[cc].count = requests / connections + (cc < requests % connections);
+		workers[cc].latencies = latencies + done;
+		workers[cc].failed = 0;
+		done += workers[cc].count;
+	}
+	start = clockNanoseconds();
+	for ( cc = 0; cc < connections; cc++ )
+		pthread_create( &workers[cc].thread, NULL, loadThread, &workers[cc] );
+	done = 0;
+	for ( cc = 0; cc < connections; cc++ )
+	{
+		pthread_join( workers[cc].thread, NULL );
+		// a worker that couldn't connect has nothing to add
+		memmove( latencies + done, workers[cc].latencies, (size_t)workers[cc].count * sizeof(uint64_t) );
+		done += workers[cc].count;
+		failed += workers[cc].failed;
+	}
+	elapsed = clockNanoseconds() - start;
+
+	qsort( latencies, (size_t)done, sizeof(uint64_t), compareLatency );
+	printf( "%ld request(s) over %d connection(s) in %.3f s, %ld failed\n", done, connections, elapsed / 1e9, failed );
+	if ( done > 0 )
+	{
+		printf( "%.0f requests/s\n", done / (elapsed / 1e9) );
+		printf( "latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+				latencies[done / 2] / 1e3, latencies[done * 9 / 10] / 1e3, latencies[done * 99 / 100] / 1e3,
+				latencies[done * 999 / 1000] / 1e3, latencies[done - 1] / 1e3 );
+	}
+	free( latencies );
+	return failed > 0;
+}
+
+static void usage()
+{
+	printf( "SetDisplayClient [-acflMmsxz] [-S SOCKET] [-n REQUESTS [-t CONNECTIONS]] [WIDTH HEIGHT BPP REFRESH]\n" );
+	printf( " -a Show all modes of every display\n" );
+	printf( " -c Show closest match (the default)\n" );
+	printf( " -f Set displays even if they are already in the chosen mode\n" );
+	printf( " -l Show the displays and their current modes\n" );
+	printf( " -M Mirroring on\n" );
+	printf( " -m Mirroring off\n" );
+	printf( " -n Send REQUESTS requests of the kind asked for and report the rate and latencies\n" );
+	printf( " -S Socket of the SetDisplay -S to ask, default %s\n", PROTOCOL_DEFAULT_SOCKET );
+	printf( " -s Set the resolution\n" );
+	printf( " -t Connections to send the -n requests over at once, default 1\n" );
+	printf( " -x Show exact match\n" );
+	printf( " -z Show highest possible resolution\n" );
+	printf( " No args default to 1024 768 32 75\n" );
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	request req;
+	connection conn;
+	long requests = 0;
+	int connections = 1;
+	int cc, status;
+
+	memset( &req, 0, sizeof(req) );
+	req.socketPath = PROTOCOL_DEFAULT_SOCKET;
+	req.op = PROTOCOL_FIND;
+	req.scanType = SCAN_CLOSEST;
+	req.mode.width = 1024;
+	req.mode.height = 768;
+	req.mode.bitsPerPixel = 32;
+	req.mode.refresh = 75;
+
+	opterr = 0;
+	while ((cc = getopt (argc, argv, "acflMmn:S:st:xz")) != -1) {
+		switch (cc)
+			{
+			case 'a':
+				req.op = PROTOCOL_LIST;
+				break;
+			case 'c':
+				req.scanType = SCAN_CLOSEST;
+				break;
+			case 'f':
+				req.force = 1;
+				break;
+			case 'l':
+				req.op = PROTOCOL_DISPLAYS;
+				break;
+			case 'M':
+				req.mirror = MIRROR_ON;
+				break;
+			case 'm':
+				req.mirror = MIRROR_OFF;
+				break;
+			case 'n':
+				requests = atol(optarg);
+				break;
+			case 'S':
+				req.socketPath = optarg;
+				break;
+			case 's':
+				req.op = PROTOCOL_APPLY;
+				break;
+			case 't':
+				connections = atoi(optarg);
+				break;
+			case 'x':
+				req.scanType = SCAN_EXACT;
+				break;
+			case 'z':
+				req.scanType = SCAN_HIGHEST;
+				break;
+			case '?':
+				usage();
+				break;
+			}
+	}
+	if ( argc > optind )
+	{
+		if ( argc != 4+optind )
+			usage();
+		req.mode.width = atoi(argv[0+optind]);
+		req.mode.height = atoi(argv[1+optind]);
+		req.mode.bitsPerPixel = atoi(argv[2+optind]);
+		req.mode.refresh = atoi(argv[3+optind]);
+	}
+	if ( connections < 1 || connections > MAX_CONNECTIONS || requests < 0 )
+		usage();
+
+	if ( connectTo( &conn, req.socketPath ) != 0 )
+	{
+		printf( "Cannot connect to %s\n", req.socketPath );
+		exit( 1 );
+	}
+	if ( requests == 0 )
+	{
+		status = runOnce( &conn, &req );
+		disconnect( &conn );
+		exit( status );
+	}
+
+	// the load cycles through the displays the server has
+	if ( req.op != PROTOCOL_DISPLAYS && req.op != PROTOCOL_APPLY && getDisplays( &conn, &req ) != kDisplayNoErr )
+	{
+		printf( "Cannot get displays\n" );
+		exit( 1 );
+	}
+	disconnect( &conn );
+	exit( runLoad( &req, requests, connections ) );
+}
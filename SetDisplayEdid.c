@@ -0,0 +1,559 @@
+/*
+gcc -O3 -o SetDisplayEdid SetDisplayEdid.c Edid.c ModeCatalog.c
+
+SetDisplayEdid.c
+
+What SetDisplay makes of an EDID (see Edid.h): the monitor, and the
+modes it would match against when the window server lists none.  Also
+the parser's benchmark and fuzzer, since it runs on every hotplug and
+reads whatever a KVM cares to hand it.
+
+ -b  Parse every EDID given (or, with none, a built-in corpus of a
+     plain monitor, a TV with a CTA-861 extension and a 4K monitor with
+     a DisplayID extension) over and over: ns per parse, per mode list
+     and per catalog.
+ -z  Throw N mangled EDIDs at the parser (bits flipped, bytes
+     overwritten, blocks cut short or repeated, extension counts lied
+     about), starting from the given ones or the corpus, and check what
+     comes back: no mode out of range, never more than asked for.  Build
+     it with -fsanitize=address,undefined -fno-sanitize-recover=undefined
+     to have bad reads, and overflowing arithmetic on what was parsed
+     (here or in the catalog built from it), stop it.
+
+For libFuzzer build with -DEDID_LIBFUZZER -fsanitize=fuzzer,address,undefined
+instead; main goes away and LLVMFuzzerTestOneInput does the checking.
+
+USAGE:
+SetDisplayEdid [-b] [-r RUNS] [-s SEED] [-z N] [EDIDFILE ...]
+
+ -b Benchmark
+ -r Parses per EDID for -b, default 100000
+ -s Seed for -z, default 1
+ -z Fuzz with N mangled EDIDs
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Clock.h"
+#include "Edid.h"
+
+#define CORPUS_MAX      64
+#define FUZZ_MAX_SIZE   (8 * EDID_BLOCK)
+
+typedef struct
+{
+	const char *name;
+	uint8_t *edid;
+	size_t size;
+} corpusEntry;
+
+/////////////////
+// the built-in corpus
+
+static void fixChecksum( uint8_t *block )
+{
+	uint8_t sum = 0;
+	int ii;
+
+	for ( ii = 0; ii < EDID_BLOCK - 1; ii++ )
+		sum += block[ii];
+	block[EDID_BLOCK - 1] = (uint8_t)(0x100 - sum);
+}
+
+/*
+An 18 byte detailed timing descriptor.  clock in 10 kHz units.
+*/
+static void putTiming( uint8_t *d, unsigned int clock, unsigned int hActive, unsigned int hBlank,
+		unsigned int vActive, unsigned int vBlank )
+{
+	memset( d, 0, 18 );
+	d[0] = clock & 0xff;
+	d[1] = clock >> 8;
+	d[2] = hActive & 0xff;
+	d[3] = hBlank & 0xff;
+	d[4] = (uint8_t)((hActive >> 8) << 4 | (hBlank >> 8));
+	d[5] = vActive & 0xff;
+	d[6] = vBlank & 0xff;
+	d[7] = (uint8_t)((vActive >> 8) << 4 | (vBlank >> 8));
+	d[8] = 88;                  // sync offset and width, not looked at
+	d[9] = 44;
+	d[17] = 0x1e;               // digital separate sync, positive
+}
+
+static void putText( uint8_t *d, uint8_t tag, const char *text )
+{
+	size_t ii, length = strlen( text );
+
+	memset( d, 0, 18 );
+	d[3] = tag;
+	for ( ii = 0; ii < 13; ii++ )
+		d[5 + ii] = ii < length ? (uint8_t)text[ii] : ii == length ? 0x0a : 0x20;
+}
+
+static void putBase( uint8_t *b, const char *vendor, unsigned int product, const char *name, int extensions )
+{
+	unsigned int pnp = (unsigned int)(vendor[0] - '@') << 10 | (unsigned int)(vendor[1] - '@') << 5 | (unsigned int)(vendor[2] - '@');
+
+	memset( b, 0, EDID_BLOCK );
+	memcpy( b, "\x00\xff\xff\xff\xff\xff\xff\x00", 8 );
+	b[8] = pnp >> 8;
+	b[9] = pnp & 0xff;
+	b[10] = product & 0xff;
+	b[11] = product >> 8;
+	b[12] = 0x2a;               // serial
+	b[16] = 12;                 // week
+	b[17] = 24;                 // 2014
+	b[18] = 1;
+	b[19] = 4;
+	b[20] = 0xa5;               // digital, 8 bits per colour, DisplayPort
+	b[21] = 53;                 // cm
+	b[22] = 30;
+	b[24] = 0x3a;
+	b[35] = 0x21;               // 640x480@60, 800x600@60, 1024x768@60
+	b[36] = 0x08;
+	b[37] = 0x00;
+	memset( b + 38, 0x01, 16 ); // standard timings unused
+	b[38] = (1280 / 8) - 31;    // 1280x1024@60, 5:4
+	b[39] = 0x80;
+	b[40] = (1440 / 8) - 31;    // 1440x900@60, 16:10
+	b[41] = 0x00;
+	b[42] = (1680 / 8) - 31;    // 1680x1050@60
+	b[43] = 0x00;
+	b[44] = (1920 / 8) - 31;    // 1920x1080@60, 16:9
+	b[45] = 0xc0;
+	putText( b + 72, 0xfd, "" );
+	b[72 + 5] = 48;             // 48-75 Hz, 30-83 kHz, 170 MHz
+	b[72 + 6] = 75;
+	b[72 + 7] = 30;
+	b[72 + 8] = 83;
+	b[72 + 9] = 17;
+	b[72 + 10] = 0x01;
+	b[72 + 11] = 0x0a;
+	putText( b + 90, 0xfc, name );
+	putText( b + 108, 0xff, "SN0042" );
+	b[126] = (uint8_t)extensions;
+}
+
+static uint8_t *corpusMonitor( size_t *size )
+{
+	uint8_t *e = calloc( 1, EDID_BLOCK );
+
+	putBase( e, "DEL", 0xa0c4, "DELL U2414H", 0 );
+	putTiming( e + 54, 14850, 1920, 280, 1080, 45 );
+	fixChecksum( e );
+	*size = EDID_BLOCK;
+	return e;
+}
+
+static uint8_t *corpusTV( size_t *size )
+{
+	static const uint8_t vics[] = { 16 | 0x80, 4, 31, 19, 3, 18, 2, 1, 5, 20, 32, 33, 34, 93, 94, 95, 97, 98 };
+	uint8_t *e = calloc( 2, EDID_BLOCK );
+	uint8_t *c = e + EDID_BLOCK;
+	unsigned int pos;
+
+	putBase( e, "SAM", 0x0c4d, "SAMSUNG", 1 );
+	putTiming( e + 54, 14850, 1920, 280, 1080, 45 );
+	fixChecksum( e );
+
+	c[0] = 0x02;
+	c[1] = 3;
+	c[3] = 0xf0;
+	pos = 4;
+	c[pos++] = (uint8_t)(2 << 5 | sizeof(vics));
+	memcpy( c + pos, vics, sizeof(vics) );
+	pos += sizeof(vics);
+	c[pos++] = 7 << 5 | 3;      // YCbCr 4:2:0 video: 3840x2160@50 and @60
+	c[pos++] = 0x0e;
+	c[pos++] = 96;
+	c[pos++] = 97;
+	c[2] = (uint8_t)pos;
+	putTiming( c + pos, 7425, 1280, 370, 720, 30 );
+	putTiming( c + pos + 18, 2700, 720, 138, 480, 45 );
+	fixChecksum( c );
+	*size = 2 * EDID_BLOCK;
+	return e;
+}
+
+static void putDisplayIdTiming( uint8_t *t, unsigned int clock, unsigned int hActive, unsigned int hBlank,
+		unsigned int vActive, unsigned int vBlank )
+{
+	memset( t, 0, 20 );
+	clock--;
+	t[0] = clock & 0xff;
+	t[1] = (clock >> 8) & 0xff;
+	t[2] = clock >> 16;
+	t[3] = 0x84;                // preferred, 16:9
+	t[4] = (hActive - 1) & 0xff;
+	t[5] = (hActive - 1) >> 8;
+	t[6] = (hBlank - 1) & 0xff;
+	t[7] = (hBlank - 1) >> 8;
+	t[12] = (vActive - 1) & 0xff;
+	t[13] = (vActive - 1) >> 8;
+	t[14] = (vBlank - 1) & 0xff;
+	t[15] = (vBlank - 1) >> 8;
+}
+
+static uint8_t *corpus4K( size_t *size )
+{
+	uint8_t *e = calloc( 2, EDID_BLOCK );
+	uint8_t *d = e + EDID_BLOCK;
+	uint8_t sum = 0;
+	int ii;
+
+	putBase( e, "LGD", 0x5b77, "LG ULTRAFINE", 1 );
+	putTiming( e + 54, 53325, 3840, 160, 2160, 62 );
+	fixChecksum( e );
+
+	// DisplayID 1.3 section: a Type I timing block of three timings
+	d[0] = 0x70;
+	d[1] = 0x13;
+	d[2] = 3 + 60;
+	d[3] = 0x03;
+	d[4] = 0;
+	d[5] = 0x03;
+	d[6] = 0;
+	d[7] = 60;
+	putDisplayIdTiming( d + 8, 53325, 3840, 160, 2160, 62 );     // 10 kHz units
+	putDisplayIdTiming( d + 28, 26663, 3840, 160, 2160, 62 );    // 30 Hz
+	putDisplayIdTiming( d + 48, 24150, 2560, 160, 1440, 41 );
+	// the section's own checksum, then the block's
+	for ( ii = 1; ii < 5 + 3 + 60; ii++ )
+		sum += d[ii];
+	d[5 + 3 + 60] = (uint8_t)(0x100 - sum);
+	fixChecksum( d );
+	*size = 2 * EDID_BLOCK;
+	return e;
+}
+
+static size_t builtinCorpus( corpusEntry *corpus )
+{
+	corpus[0].name = "monitor";
+	corpus[0].edid = corpusMonitor( &corpus[0].size );
+	corpus[1].name = "tv (cta-861)";
+	corpus[1].edid = corpusTV( &corpus[1].size );
+	corpus[2].name = "4k (displayid)";
+	corpus[2].edid = corpus4K( &corpus[2].size );
+	return 3;
+}
+
+static size_t loadCorpus( corpusEntry *corpus, char **paths, int count )
+{
+	size_t loaded = 0;
+	int ii;
+
+	for ( ii = 0; ii < count && loaded < CORPUS_MAX; ii++ )
+	{
+		if ( edidLoad( paths[ii], &corpus[loaded].edid, &corpus[loaded].size ) != 0 )
+		{
+			printf( "No EDID in %s\n", paths[ii] );
+			continue;
+		}
+		corpus[loaded++].name = paths[ii];
+	}
+	return loaded;
+}
+
+/////////////////
+
+static void printEdid( const char *name, const uint8_t *edid, size_t size )
+{
+	displayModeDesc modes[EDID_MAX_MODES];
+	edidInfo info;
+	size_t count, ii;
+
+	printf( "%s:\n", name );
+	if ( edidParse( edid, size, &info ) != 0 )
+	{
+		printf( "  not an EDID\n" );
+		return;
+	}
+	printf( "  %s %04x serial %u, %d, EDID %d.%d, %d extension(s)", info.vendor, info.product,
+			(unsigned int)info.serial, info.year, info.version, info.revision, info.extensions );
+	if ( info.blocks != 1 + info.extensions )
+		printf( " (%d there)", info.blocks - 1 );
+	if ( info.badChecksums != 0 )
+		printf( ", %d bad checksum(s)", info.badChecksums );
+	printf( "\n" );
+	if ( info.name[0] )
+		printf( "  \"%s\"\n", info.name );
+	if ( info.hasRange )
+		printf( "  %d-%d Hz, %d-%d kHz, up to %d MHz\n", info.minVRate, info.maxVRate, info.minHRate, info.maxHRate, info.maxPixelClock );
+	count = edidModes( edid, size, modes, EDID_MAX_MODES );
+	for ( ii = 0; ii < count; ii++ )
+		printf( "  %4zu x %4zu @ %lg%s\n", modes[ii].mode.width, modes[ii].mode.height, modes[ii].mode.refresh,
+				ii == 0 && info.hasPreferred ? " (preferred)" : "" );
+}
+
+/////////////////
+// benchmark
+
+static int benchEdid( const corpusEntry *corpus, size_t count, long runs )
+{
+	displayModeDesc modes[EDID_MAX_MODES];
+	size_t ii;
+	long rr;
+
+	printf( "%-24s %6s %6s %10s %10s %10s\n", "edid", "bytes", "modes", "parse ns", "modes ns", "catalog ns" );
+	for ( ii = 0; ii < count; ii++ )
+	{
+		const corpusEntry *entry = &corpus[ii];
+		volatile size_t sink = 0;
+		uint64_t started, parseNs, modesNs, catalogNs;
+		long catalogRuns = runs / 10 ? runs / 10 : 1;
+		edidInfo info;
+		size_t numModes;
+
+		started = clockNanoseconds();
+		for ( rr = 0; rr < runs; rr++ )
+			sink += (size_t)edidParse( entry->edid, entry->size, &info ) + info.product;
+		parseNs = clockNanoseconds() - started;
+
+		started = clockNanoseconds();
+		for ( rr = 0; rr < runs; rr++ )
+			sink += edidModes( entry->edid, entry->size, modes, EDID_MAX_MODES );
+		modesNs = clockNanoseconds() - started;
+		numModes = edidModes( entry->edid, entry->size, modes, EDID_MAX_MODES );
+
+		started = clockNanoseconds();
+		for ( rr = 0; rr < catalogRuns; rr++ )
+		{
+			modeCatalog *catalog = edidCatalog( entry->edid, entry->size );
+			sink += catalog != NULL;
+			catalogDestroy( catalog );
+		}
+		catalogNs = clockNanoseconds() - started;
+		(void)sink;
+
+		printf( "%-24.24s %6zu %6zu %10.1f %10.1f %10.1f\n", entry->name, entry->size, numModes,
+				(double)parseNs / runs, (double)modesNs / runs, (double)catalogNs / catalogRuns );
+	}
+	return 0;
+}
+
+/////////////////
+// fuzzing
+
+static uint32_t fuzzRandom( uint32_t *state )
+{
+	// xorshift32
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+/*
+Everything that should hold for any input at all.  Returns 0 if it does.
+*/
+static int checkEdid( const uint8_t *edid, size_t size )
+{
+	displayModeDesc modes[EDID_MAX_MODES];
+	displayModeDesc few[4];
+	displayIdentity identity;
+	edidInfo info;
+	modeCatalog *catalog;
+	size_t count, ii;
+	int parsed = edidParse( edid, size, &info );
+
+	count = edidModes( edid, size, modes, EDID_MAX_MODES );
+	if ( count > EDID_MAX_MODES || edidModes( edid, size, few, 4 ) > 4 )
+		return -1;
+	if ( parsed != 0 && count != 0 )
+		return -1;
+	if ( parsed == 0 && (info.blocks < 1 || info.blocks > 256 || info.badChecksums > info.blocks || strlen( info.name ) > 13) )
+		return -1;
+	for ( ii = 0; ii < count; ii++ )
+	{
+		const displayMode *mode = &modes[ii].mode;
+		// 12 bits of width in a descriptor, 16 in DisplayID, doubled for interlace
+		if ( mode->width == 0 || mode->height == 0 || mode->width > 65536 || mode->height > 131072 ||
+				!(mode->refresh > 0) || !(mode->refresh <= EDID_MAX_REFRESH) || mode->bitsPerPixel != 32 || !modes[ii].usable )
+			return -1;
+	}
+	catalog = edidCatalog( edid, size );
+	if ( (catalog != NULL) != (count != 0) )
+	{
+		catalogDestroy( catalog );
+		return -1;
+	}
+	catalogDestroy( catalog );
+	edidIdentity( edid, size, &identity );
+	return 0;
+}
+
+static size_t mangle( uint8_t *out, const uint8_t *edid, size_t size, uint32_t *state )
+{
+	size_t length = size < FUZZ_MAX_SIZE ? size : FUZZ_MAX_SIZE;
+	int edits = 1 + (int)(fuzzRandom( state ) % 8);
+
+	memcpy( out, edid, length );
+	while ( edits-- > 0 )
+	{
+		uint32_t r = fuzzRandom( state );
+		size_t at = length ? fuzzRandom( state ) % length : 0;
+
+		switch ( r % 7 )
+		{
+			case 0:             // a bit
+				if ( length )
+					out[at] ^= (uint8_t)(1 << (r >> 8) % 8);
+				break;
+			case 1:             // a byte
+				if ( length )
+					out[at] = (uint8_t)(r >> 8);
+				break;
+			case 2:             // the byte everything hangs off: extension count, DTD offset, lengths
+				if ( length )
+					out[at] = (r >> 8) & 1 ? 0xff : 0x00;
+				break;
+			case 3:             // cut short
+				length = at;
+				break;
+			case 4:             // one more block, a copy of one there
+				if ( length >= EDID_BLOCK && length + EDID_BLOCK <= FUZZ_MAX_SIZE )
+				{
+					memmove( out + length, out + (at / EDID_BLOCK) * EDID_BLOCK, EDID_BLOCK );
+					length += EDID_BLOCK;
+				}
+				break;
+			case 5:             // lie about how many extensions there are
+				if ( length > 126 )
+					out[126] = (uint8_t)(r >> 8);
+				break;
+			default:            // an extension block's tag
+				if ( length >= 2 * EDID_BLOCK )
+					out[EDID_BLOCK * (1 + at % (length / EDID_BLOCK - 1))] = (r >> 8) & 1 ? 0x02 : 0x70;
+				break;
+		}
+	}
+	return length;
+}
+
+static int fuzzEdid( const corpusEntry *corpus, size_t count, long iterations, uint32_t seed )
+{
+	uint8_t *input = malloc( FUZZ_MAX_SIZE );
+	uint32_t state = seed ? seed : 1;
+	long ii, failed = 0;
+
+	if ( input == NULL )
+		return 1;
+	for ( ii = 0; ii < iterations; ii++ )
+	{
+		const corpusEntry *entry = &corpus[fuzzRandom( &state ) % count];
+		size_t length = mangle( input, entry->edid, entry->size, &state );
+		uint8_t *exact;
+
+		// a copy of exactly length bytes, so reading past it is a bad read
+		exact = malloc( length ? length : 1 );
+		if ( exact == NULL )
+			break;
+		memcpy( exact, input, length );
+		if ( checkEdid( exact, length ) != 0 )
+		{
+			char path[64];
+			FILE *file;
+
+			snprintf( path, sizeof(path), "edid-fuzz-%ld.bin", ii );
+			file = fopen( path, "wb" );
+			if ( file != NULL )
+			{
+				fwrite( exact, 1, length, file );
+				fclose( file );
+			}
+			printf( "Input %ld (from %s) fails, saved in %s\n", ii, entry->name, path );
+			failed++;
+		}
+		free( exact );
+	}
+	free( input );
+	printf( "%ld input(s), %ld failed\n", iterations, failed );
+	return failed != 0;
+}
+
+#ifdef EDID_LIBFUZZER
+
+int LLVMFuzzerTestOneInput( const uint8_t *data, size_t size )
+{
+	if ( checkEdid( data, size ) != 0 )
+		abort();
+	return 0;
+}
+
+#else
+
+static void usage()
+{
+	printf( "SetDisplayEdid [-b] [-r RUNS] [-s SEED] [-z N] [EDIDFILE ...]\n" );
+	printf( " -b Benchmark parsing the EDIDs, or a built-in corpus\n" );
+	printf( " -r Parses per EDID for -b, default 100000\n" );
+	printf( " -s Seed for -z, default 1\n" );
+	printf( " -z Fuzz the parser with N mangled EDIDs\n" );
+	printf( " With neither, print the monitor and the modes in each EDID\n" );
+	exit(1);
+}
+
+int main( int argc, char **argv )
+{
+	corpusEntry corpus[CORPUS_MAX];
+	size_t count, ii;
+	int shouldBench = 0;
+	long runs = 100000;
+	long fuzz = 0;
+	uint32_t seed = 1;
+	int cc, result = 0;
+
+	while ( (cc = getopt( argc, argv, "br:s:z:" )) != -1 )
+	{
+		switch ( cc )
+		{
+			case 'b':
+				shouldBench = 1;
+				break;
+			case 'r':
+				runs = atol( optarg );
+				break;
+			case 's':
+				seed = (uint32_t)strtoul( optarg, NULL, 0 );
+				break;
+			case 'z':
+				fuzz = atol( optarg );
+				break;
+			default:
+				usage();
+		}
+	}
+	if ( runs < 1 || fuzz < 0 )
+		usage();
+
+	if ( optind < argc )
+	{
+		count = loadCorpus( corpus, argv + optind, argc - optind );
+		if ( count == 0 )
+			return 1;
+	} else {
+		count = builtinCorpus( corpus );
+	}
+
+	if ( shouldBench )
+		result |= benchEdid( corpus, count, runs );
+	if ( fuzz )
+		result |= fuzzEdid( corpus, count, fuzz, seed );
+	if ( !shouldBench && !fuzz )
+	{
+		for ( ii = 0; ii < count; ii++ )
+			printEdid( corpus[ii].name, corpus[ii].edid, corpus[ii].size );
+	}
+	for ( ii = 0; ii < count; ii++ )
+		free( corpus[ii].edid );
+	return result;
+}
+
+#endif
@@ -0,0 +1,949 @@
+/*
+gcc -O3 -o SetDisplayFleet SetDisplayFleet.c DisplayBackend.c DisplayBackendCG.c DisplayBackendDRM.c DisplayBackendReplay.c DisplayBackendSim.c DisplayBackendXRandR.c DisplayLog.c DisplayPlan.c DisplayPolicy.c DisplayTiming.c DisplayTrace.c Edid.c ModeCache.c ModeCatalog.c SetDisplayLib.c WorkerPool.c -lpthread
+
+SetDisplayFleet.c
+
+What SetDisplay would do to every machine of a fleet, worked out
+before it is run on any of them.  The machines are a corpus of
+recordings (SetDisplay -R, see DisplayBackendReplay.c), each played
+back through the same session calls SetDisplay makes: the policy, the
+match (as modeForDisplay prints it), mirroring and, with no mode
+given, 1024 768 32 75.  Nothing is configured.  What comes out is how
+many displays end up in each mode, how many got what they asked for
+and how many only the closest thing to it, and which machines would
+change.
+
+USAGE:
+SetDisplayFleet -c CORPUS RECORDING...
+SetDisplayFleet -g MACHINES [-u KINDS] CORPUS
+SetDisplayFleet [-lMmxz] [-j WORKERS] [-P POLICY] CORPUS [WIDTH HEIGHT BPP REFRESH]
+
+ -c Put the recordings into CORPUS, each machine named after its file
+ -g Make up a CORPUS of MACHINES machines from simulated displays (-B sim)
+ -u With KINDS different kinds of machine among them, default all different
+ -j Simulate on WORKERS threads, default one for each processor
+ -l List each display of the machines that would change
+ -M, -m, -P, -x, -z As for SetDisplay
+
+Only what each machine's backend answered goes into the corpus, not
+how long it took (backendRecordingAnswers), so machines that answered
+the same (a lab bought all at once) are kept once and simulated once.  The machines are spread over
+the workers (WorkerPool.c), which steal from each other when their
+share runs out, so a few machines with long mode lists don't hold up
+the rest.
+
+The corpus is in the byte order of the machine that wrote it: a
+corpusHeader, the recordings, the recording table (offset and size of
+each), the machine table (recording and name of each) and the names,
+each ending in a NUL.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Clock.h"
+#include "SetDisplayLib.h"
+#include "WorkerPool.h"
+
+#define CORPUS_MAGIC   0x53444643       // 'SDFC'
+#define CORPUS_VERSION 1
+
+#define FLEET_EXACT   0                 // got the mode asked for
+#define FLEET_CLOSEST 1                 // got the closest the display has
+#define FLEET_HIGHEST 2                 // -z, or a rule's highest
+#define FLEET_NONE    3                 // no mode matched, left alone
+#define FLEET_OUTCOMES 4
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numMachines;
+	uint32_t numRecordings;
+	uint64_t recordingsOffset;
+	uint64_t machinesOffset;
+	uint64_t namesOffset;
+	uint64_t namesSize;
+} corpusHeader;
+
+typedef struct
+{
+	uint64_t offset;
+	uint64_t size;
+} corpusRecording;
+
+typedef struct
+{
+	uint32_t recording;
+	uint32_t name;              // offset into the names
+} corpusMachine;
+
+/////////////////
+
+/*
+A corpus being written: the recordings go straight to the file, only
+what the tables need (and a hash of each recording, to keep it once)
+stays in memory.
+*/
+typedef struct
+{
+	int fd;
+	uint64_t size;              // written so far
+	corpusRecording *recordings;
+	uint64_t *hashes;
+	uint32_t numRecordings;
+	uint32_t maxRecordings;
+	uint32_t *buckets;          // recording + 1, 0 for none
+	uint32_t numBuckets;
+	corpusMachine *machines;
+	uint32_t numMachines;
+	uint32_t maxMachines;
+	char *names;
+	uint64_t namesSize;
+	uint64_t maxNames;
+} corpusWriter;
+
+static uint64_t hashBytes( const uint8_t *data, size_t size )
+{
+	uint64_t hash = 14695981039346656037ULL;        // FNV-1a
+	size_t ii;
+
+	for ( ii = 0; ii < size; ii++ )
+		hash = (hash ^ data[ii]) * 1099511628211ULL;
+	return hash;
+}
+
+static int writeAll( int fd, const void *data, size_t size, uint64_t offset )
+{
+	const uint8_t *p = data;
+
+	while ( size > 0 )
+	{
+		ssize_t wrote = pwrite( fd, p, size, (off_t)offset );
+		if ( wrote <= 0 )
+			return -1;
+		p += wrote;
+		size -= (size_t)wrote;
+		offset += (uint64_t)wrote;
+	}
+	return 0;
+}
+
+static int corpusCreate( corpusWriter *out, const char *path )
+{
+	corpusHeader header;
+
+	memset( out, 0, sizeof(corpusWriter) );
+	out->fd = open( path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+	if ( out->fd < 0 )
+		return -1;
+	// the real header goes in last
+	memset( &header, 0, sizeof(header) );
+	out->size = sizeof(header);
+	return writeAll( out->fd, &header, sizeof(header), 0 );
+}
+
+/*
+The recording already in the corpus that is the same as data, or -1.
+*/
+static long findRecording( corpusWriter *out, uint64_t hash, const uint8_t *data, size_t size )
+{
+	uint32_t bucket;
+
+	if ( out->numBuckets == 0 )
+		return -1;
+	for ( bucket = (uint32_t)hash & (out->numBuckets - 1); out->buckets[bucket] != 0; bucket = (bucket + 1) & (out->numBuckets - 1) )
+	{
+		uint32_t rr = out->buckets[bucket] - 1;
+		uint8_t *other;
+		int same;
+
+		if ( out->hashes[rr] != hash || out->recordings[rr].size != size )
+			continue;
+		other = malloc( size ? size : 1 );
+		if ( other == NULL )
+			return -1;
+		same = pread( out->fd, other, size, (off_t)out->recordings[rr].offset ) == (ssize_t)size && memcmp( other, data, size ) == 0;
+		free( other );
+		if ( same )
+			return rr;
+	}
+	return -1;
+}
+
+static int addBucket( corpusWriter *out, uint32_t recording )
+{
+	uint32_t bucket, ii;
+
+	if ( (uint64_t)(out->numRecordings + 1) * 2 > out->numBuckets )
+	{
+		uint32_t numBuckets = out->numBuckets ? out->numBuckets * 2 : 1024;
+		uint32_t *buckets = calloc( numBuckets, sizeof(uint32_t) );
+		if ( buckets == NULL )
+			return -1;
+		for ( ii = 0; ii < out->numRecordings; ii++ )
+		{
+			for ( bucket = (uint32_t)out->hashes[ii] & (numBuckets - 1); buckets[bucket] != 0; bucket = (bucket + 1) & (numBuckets - 1) )
+				;
+			buckets[bucket] = ii + 1;
+		}
+		free( out->buckets );
+		out->buckets = buckets;
+		out->numBuckets = numBuckets;
+	}
+	for ( bucket = (uint32_t)out->hashes[recording] & (out->numBuckets - 1); out->buckets[bucket] != 0;
+			bucket = (bucket + 1) & (out->numBuckets - 1) )
+		;
+	out->buckets[bucket] = recording + 1;
+	return 0;
+}
+
+static int corpusAddMachine( corpusWriter *out, const char *name, uint32_t recording )
+{
+	size_t nameSize = strlen( name ) + 1;
+
+	if ( out->numMachines == out->maxMachines )
+	{
+		uint32_t maxMachines = out->maxMachines ? out->maxMachines * 2 : 256;
+		corpusMachine *machines = realloc( out->machines, maxMachines * sizeof(corpusMachine) );
+		if ( machines == NULL )
+			return -1;
+		out->machines = machines;
+		out->maxMachines = maxMachines;
+	}
+	while ( out->namesSize + nameSize > out->maxNames )
+	{
+		uint64_t maxNames = out->maxNames ? out->maxNames * 2 : 4096;
+		char *names = realloc( out->names, maxNames );
+		if ( names == NULL )
+			return -1;
+		out->names = names;
+		out->maxNames = maxNames;
+	}
+	out->machines[out->numMachines].recording = recording;
+	out->machines[out->numMachines].name = (uint32_t)out->namesSize;
+	out->numMachines++;
+	memcpy( out->names + out->namesSize, name, nameSize );
+	out->namesSize += nameSize;
+	return 0;
+}
+
+static int corpusAdd( corpusWriter *out, const char *name, const uint8_t *data, size_t size )
+{
+	uint64_t hash = hashBytes( data, size );
+	long recording = findRecording( out, hash, data, size );
+
+	if ( recording < 0 )
+	{
+		if ( out->numRecordings == out->maxRecordings )
+		{
+			uint32_t maxRecordings = out->maxRecordings ? out->maxRecordings * 2 : 256;
+			corpusRecording *recordings = realloc( out->recordings, maxRecordings * sizeof(corpusRecording) );
+			uint64_t *hashes = recordings ? realloc( out->hashes, maxRecordings * sizeof(uint64_t) ) : NULL;
+			if ( recordings != NULL )
+				out->recordings = recordings;
+			if ( hashes == NULL )
+				return -1;
+			out->hashes = hashes;
+			out->maxRecordings = maxRecordings;
+		}
+		if ( writeAll( out->fd, data, size, out->size ) != 0 )
+			return -1;
+		recording = out->numRecordings++;
+		out->recordings[recording].offset = out->size;
+		out->recordings[recording].size = size;
+		out->hashes[recording] = hash;
+		out->size += size;
+		if ( addBucket( out, (uint32_t)recording ) != 0 )
+			return -1;
+	}
+	return corpusAddMachine( out, name, (uint32_t)recording );
+}
+
+/*
+Writes the tables and the header and closes the file; the corpus is
+freed either way.
+*/
+static int corpusFinish( corpusWriter *out )
+{
+	corpusHeader header;
+	int err = 0;
+
+	memset( &header, 0, sizeof(header) );
+	header.magic = CORPUS_MAGIC;
+	header.version = CORPUS_VERSION;
+	header.numMachines = out->numMachines;
+	header.numRecordings = out->numRecordings;
+	header.recordingsOffset = (out->size + 7) & ~(uint64_t)7;
+	header.machinesOffset = header.recordingsOffset + (uint64_t)out->numRecordings * sizeof(corpusRecording);
+	header.namesOffset = header.machinesOffset + (uint64_t)out->numMachines * sizeof(corpusMachine);
+	header.namesSize = out->namesSize;
+	if ( writeAll( out->fd, out->recordings, out->numRecordings * sizeof(corpusRecording), header.recordingsOffset ) != 0 ||
+			writeAll( out->fd, out->machines, out->numMachines * sizeof(corpusMachine), header.machinesOffset ) != 0 ||
+			writeAll( out->fd, out->names, out->namesSize, header.namesOffset ) != 0 ||
+			writeAll( out->fd, &header, sizeof(header), 0 ) != 0 )
+		err = -1;
+	if ( close( out->fd ) != 0 )
+		err = -1;
+	free( out->recordings );
+	free( out->hashes );
+	free( out->buckets );
+	free( out->machines );
+	free( out->names );
+	return err;
+}
+
+/*
+-c: the recordings as they are, named after their files.
+*/
+static int buildCorpus( const char *path, char **recordings, int numRecordings )
+{
+	corpusWriter out;
+	int ii, err;
+
+	if ( corpusCreate( &out, path ) != 0 )
+	{
+		printf( "Cannot write %s\n", path );
+		return 1;
+	}
+	for ( ii = 0; ii < numRecordings; ii++ )
+	{
+		FILE *file = fopen( recordings[ii], "rb" );
+		const char *base = strrchr( recordings[ii], '/' );
+		char name[256];
+		uint8_t *data = NULL, *answers;
+		size_t answersSize;
+		long size = -1;
+		char *dot;
+
+		if ( file != NULL && fseek( file, 0, SEEK_END ) == 0 && (size = ftell( file )) > 0 && fseek( file, 0, SEEK_SET ) == 0 &&
+				(data = malloc( (size_t)size )) != NULL && fread( data, 1, (size_t)size, file ) != (size_t)size )
+			size = -1;
+		if ( file != NULL )
+			fclose( file );
+		if ( data == NULL || size <= 0 || backendRecordingAnswers( data, (size_t)size, &answers, &answersSize ) != 0 )
+		{
+			printf( "%s isn't a recording\n", recordings[ii] );
+			free( data );
+			corpusFinish( &out );
+			unlink( path );
+			return 1;
+		}
+		free( data );
+		snprintf( name, sizeof(name), "%s", base != NULL ? base + 1 : recordings[ii] );
+		dot = strrchr( name, '.' );
+		if ( dot != NULL && strcmp( dot, ".sdrc" ) == 0 )
+			*dot = '\0';
+		err = corpusAdd( &out, name, answers, answersSize );
+		free( answers );
+		if ( err != 0 )
+		{
+			printf( "Cannot write %s\n", path );
+			corpusFinish( &out );
+			unlink( path );
+			return 1;
+		}
+	}
+	printf( "%u machine(s), %u different, in %s\n", out.numMachines, out.numRecordings, path );
+	return corpusFinish( &out ) == 0 ? 0 : 1;
+}
+
+static uint32_t fleetRandom( uint32_t *state )
+{
+	// xorshift32, as the simulated backend makes up its modes
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/*
+-g: machines made up from simulated displays, one to three of them,
+from a few old monitors with short mode lists to ones with long lists
+of made-up resolutions, in whatever mode they happen to be.
+*/
+static int generateCorpus( const char *path, unsigned long numMachines, unsigned long kinds )
+{
+	static const long modeCounts[] = { 24, 48, 96, 144, 216, 264, 264, 400 };
+	static const char *currents[] = { "640x480", "800x600", "1024x768", "1152x864", "1280x720", "1280x800",
+			"1280x1024", "1440x900", "1680x1050", "1920x1080", "1920x1200", "2560x1440" };
+	corpusWriter out;
+	unsigned long ii;
+
+	if ( corpusCreate( &out, path ) != 0 )
+	{
+		printf( "Cannot write %s\n", path );
+		return 1;
+	}
+	for ( ii = 0; ii < numMachines; ii++ )
+	{
+		uint32_t kind = (uint32_t)(ii % kinds), state = kind * 2654435761u + 1;
+		uint32_t shape = fleetRandom( &state ) % 20;
+		char spec[160], name[32];
+		displayBackend *sim, *recorder;
+		setDisplaySession *session;
+		const displayID *displays;
+		uint32_t numDisplays;
+		uint8_t *data, *answers;
+		size_t size, answersSize;
+		int err;
+
+		snprintf( name, sizeof(name), "lab-%06lu", ii );
+		if ( ii >= kinds )
+		{
+			// the same kind as a machine already in
+			if ( corpusAddMachine( &out, name, out.machines[kind].recording ) != 0 )
+				break;
+			continue;
+		}
+		snprintf( spec, sizeof(spec), "sim:displays=%d,modes=%ld,seed=%u,shuffle=%u,current=%s",
+				shape < 10 ? 1 : shape < 17 ? 2 : 3,
+				modeCounts[fleetRandom( &state ) % (sizeof(modeCounts) / sizeof(modeCounts[0]))],
+				kind + 1, fleetRandom( &state ) % 2,
+				currents[fleetRandom( &state ) % (sizeof(currents) / sizeof(currents[0]))] );
+		sim = backendCreate( spec );
+		recorder = sim != NULL ? backendCreateRecorder( sim, NULL ) : NULL;
+		if ( recorder == NULL )
+		{
+			backendDestroy( sim );
+			break;
+		}
+		session = sessionOpenBackend( recorder, NULL );
+		if ( session == NULL )
+			break;
+		sessionSetWorkers( session, 1 );
+		err = sessionDisplays( session, &displays, &numDisplays ) != kDisplayNoErr ||
+				sessionLoad( session ) != kDisplayNoErr ||
+				backendTakeRecording( sessionBackend( session ), &data, &size ) != 0;
+		sessionClose( session );
+		if ( err )
+			break;
+		err = backendRecordingAnswers( data, size, &answers, &answersSize );
+		free( data );
+		if ( err != 0 )
+			break;
+		err = corpusAdd( &out, name, answers, answersSize );
+		free( answers );
+		if ( err != 0 )
+			break;
+	}
+	if ( ii < numMachines )
+	{
+		printf( "Cannot make machine %lu of %s\n", ii, path );
+		corpusFinish( &out );
+		unlink( path );
+		return 1;
+	}
+	printf( "%u machine(s), %u different, in %s\n", out.numMachines, out.numRecordings, path );
+	return corpusFinish( &out ) == 0 ? 0 : 1;
+}
+
+/////////////////
+
+typedef struct
+{
+	uint8_t *map;
+	size_t mapSize;
+	const corpusHeader *header;
+	const corpusRecording *recordings;
+	const corpusMachine *machines;
+	const char *names;
+} fleetCorpus;
+
+static int corpusOpen( fleetCorpus *corpus, const char *path )
+{
+	struct stat sb;
+	const corpusHeader *header;
+	uint32_t ii;
+	int fd;
+
+	memset( corpus, 0, sizeof(fleetCorpus) );
+	fd = open( path, O_RDONLY );
+	if ( fd < 0 )
+		return -1;
+	if ( fstat( fd, &sb ) != 0 || (size_t)sb.st_size < sizeof(corpusHeader) )
+	{
+		close( fd );
+		return -1;
+	}
+	corpus->map = mmap( NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( corpus->map == MAP_FAILED )
+		return -1;
+	corpus->mapSize = (size_t)sb.st_size;
+	header = corpus->header = (const corpusHeader *)corpus->map;
+
+	// everything the tables say has to be in the file
+	if ( header->magic != CORPUS_MAGIC || header->version != CORPUS_VERSION ||
+			header->recordingsOffset > corpus->mapSize ||
+			(corpus->mapSize - header->recordingsOffset) / sizeof(corpusRecording) < header->numRecordings ||
+			header->machinesOffset > corpus->mapSize ||
+			(corpus->mapSize - header->machinesOffset) / sizeof(corpusMachine) < header->numMachines ||
+			header->namesOffset > corpus->mapSize || corpus->mapSize - header->namesOffset < header->namesSize ||
+			header->recordingsOffset % 8 != 0 || header->machinesOffset % 4 != 0 ||
+			(header->namesSize > 0 && corpus->map[header->namesOffset + header->namesSize - 1] != '\0') )
+	{
+		munmap( corpus->map, corpus->mapSize );
+		return -1;
+	}
+	corpus->recordings = (const corpusRecording *)(corpus->map + header->recordingsOffset);
+	corpus->machines = (const corpusMachine *)(corpus->map + header->machinesOffset);
+	corpus->names = (const char *)corpus->map + header->namesOffset;
+	for ( ii = 0; ii < header->numRecordings; ii++ )
+	{
+		if ( corpus->recordings[ii].offset > corpus->mapSize || corpus->recordings[ii].size > corpus->mapSize - corpus->recordings[ii].offset )
+			break;
+	}
+	if ( ii < header->numRecordings )
+	{
+		munmap( corpus->map, corpus->mapSize );
+		return -1;
+	}
+	for ( ii = 0; ii < header->numMachines; ii++ )
+	{
+		if ( corpus->machines[ii].recording >= header->numRecordings || corpus->machines[ii].name >= header->namesSize )
+		{
+			munmap( corpus->map, corpus->mapSize );
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void corpusClose( fleetCorpus *corpus )
+{
+	munmap( corpus->map, corpus->mapSize );
+}
+
+/////////////////
+
+typedef struct
+{
+	displayID display;
+	displayModeDesc from;
+	displayModeDesc to;         // from again when it is left alone
+	int outcome;
+	int changes;
+} fleetDisplay;
+
+typedef struct
+{
+	fleetDisplay *displays;
+	uint32_t numDisplays;
+	int failed;                 // the recording didn't play back
+	int changes;
+} fleetResult;
+
+typedef struct
+{
+	const fleetCorpus *corpus;
+	const displayPolicy *policy;
+	int scanType;
+	displayMode wanted;
+	int mirroringOnOff;
+	fleetResult *results;       // one for each recording
+} fleetWork;
+
+/*
+How the display came by the mode planned for it, wanted and scanType
+being what it asked for after the policy.
+*/
+static int outcomeOf( const displayPlanEntry *entry, int scanType, displayMode wanted )
+{
+	const displayMode *got = &entry->mode.mode;
+
+	if ( entry->modeIndex == kNoMode )
+		return FLEET_NONE;
+	if ( scanType == SCAN_HIGHEST )
+		return FLEET_HIGHEST;
+	if ( scanType == SCAN_EXACT || (got->width == wanted.width && got->height == wanted.height &&
+			got->bitsPerPixel == wanted.bitsPerPixel && (wanted.refresh == 0 || got->refresh == wanted.refresh)) )
+		return FLEET_EXACT;
+	return FLEET_CLOSEST;
+}
+
+/*
+One recording, through what SetDisplay does with a machine: load the
+displays, plan them all (policy, match, mirroring) and look at what
+the plan would change.  Each has its own session, the workers share
+nothing but the corpus.
+*/
+static void simulateOne( void *ctx, size_t index )
+{
+	fleetWork *work = ctx;
+	const corpusRecording *recording = &work->corpus->recordings[index];
+	fleetResult *result = &work->results[index];
+	setDisplaySession *session;
+	const displayID *displays;
+	uint32_t numDisplays, ii;
+	displayPlan plan;
+	size_t jj;
+
+	result->failed = 1;
+	session = sessionOpenBackend( backendCreateReplayData( work->corpus->map + recording->offset, recording->size, 0 ), NULL );
+	if ( session == NULL )
+		return;
+	sessionSetWorkers( session, 1 );
+	sessionSetPolicy( session, work->policy );
+	if ( sessionDisplays( session, &displays, &numDisplays ) != kDisplayNoErr ||
+			(result->displays = calloc( numDisplays ? numDisplays : 1, sizeof(fleetDisplay) )) == NULL )
+	{
+		sessionClose( session );
+		return;
+	}
+	// errors show up display by display, as in SetDisplay
+	sessionLoad( session );
+	planInit( &plan );
+	sessionPlanDisplays( session, &plan, displays, numDisplays, work->scanType, work->wanted, work->mirroringOnOff, 0, NULL );
+
+	for ( ii = 0; ii < numDisplays; ii++ )
+	{
+		fleetDisplay *disp = &result->displays[ii];
+		setDisplayInfo info;
+
+		disp->display = displays[ii];
+		disp->outcome = FLEET_NONE;
+		if ( sessionInfo( session, displays[ii], &info ) == kDisplayNoErr )
+			disp->from = info.current;
+		disp->to = disp->from;
+		for ( jj = 0; jj < plan.count; jj++ )
+		{
+			const displayPlanEntry *entry = &plan.entries[jj];
+			displayMode wanted = work->wanted;
+			int scanType = work->scanType, mirroringOnOff = 0;
+
+			if ( entry->display != displays[ii] )
+				continue;
+			sessionPolicy( session, displays[ii], &scanType, &wanted, &mirroringOnOff );
+			disp->outcome = outcomeOf( entry, scanType, wanted );
+			if ( entry->modeIndex != kNoMode )
+				disp->to = entry->mode;
+			disp->changes = planEntryChanges( entry );
+			result->changes |= disp->changes;
+			break;
+		}
+	}
+	result->numDisplays = numDisplays;
+	result->failed = 0;
+	planFree( &plan );
+	sessionClose( session );
+}
+
+typedef struct
+{
+	displayMode mode;
+	unsigned long displays;
+} modeCount;
+
+typedef struct
+{
+	modeCount *counts;
+	uint32_t numCounts;
+	uint32_t *buckets;          // count + 1, 0 for none
+	uint32_t numBuckets;
+} modeTally;
+
+static uint32_t hashMode( const displayMode *mode )
+{
+	uint64_t refreshBits;
+
+	memcpy( &refreshBits, &mode->refresh, sizeof(refreshBits) );
+	return (uint32_t)(hashBytes( (const uint8_t *)&refreshBits, sizeof(refreshBits) ) ^
+			(mode->width * 73856093u) ^ (mode->height * 19349663u) ^ (mode->bitsPerPixel * 83492791u));
+}
+
+static int sameMode( const displayMode *a, const displayMode *b )
+{
+	return a->width == b->width && a->height == b->height && a->bitsPerPixel == b->bitsPerPixel && a->refresh == b->refresh;
+}
+
+static int tallyMode( modeTally *tally, const displayMode *mode, unsigned long displays )
+{
+	uint32_t bucket, ii;
+
+	if ( (tally->numCounts + 1) * 2 > tally->numBuckets )
+	{
+		uint32_t numBuckets = tally->numBuckets ? tally->numBuckets * 2 : 256;
+		uint32_t *buckets = calloc( numBuckets, sizeof(uint32_t) );
+		modeCount *counts = realloc( tally->counts, numBuckets / 2 * sizeof(modeCount) );
+		if ( counts != NULL )
+			tally->counts = counts;
+		if ( buckets == NULL || counts == NULL )
+		{
+			free( buckets );
+			return -1;
+		}
+		for ( ii = 0; ii < tally->numCounts; ii++ )
+		{
+			for ( bucket = hashMode( &counts[ii].mode ) & (numBuckets - 1); buckets[bucket] != 0; bucket = (bucket + 1) & (numBuckets - 1) )
+				;
+			buckets[bucket] = ii + 1;
+		}
+		free( tally->buckets );
+		tally->buckets = buckets;
+		tally->numBuckets = numBuckets;
+	}
+	for ( bucket = hashMode( mode ) & (tally->numBuckets - 1); tally->buckets[bucket] != 0;
+			bucket = (bucket + 1) & (tally->numBuckets - 1) )
+	{
+		modeCount *count = &tally->counts[tally->buckets[bucket] - 1];
+		if ( sameMode( &count->mode, mode ) )
+		{
+			count->displays += displays;
+			return 0;
+		}
+	}
+	tally->counts[tally->numCounts].mode = *mode;
+	tally->counts[tally->numCounts].displays = displays;
+	tally->buckets[bucket] = ++tally->numCounts;
+	return 0;
+}
+
+static int compareCounts( const void *a, const void *b )
+{
+	const modeCount *ca = a, *cb = b;
+
+	if ( ca->displays != cb->displays )
+		return ca->displays > cb->displays ? -1 : 1;
+	if ( ca->mode.width != cb->mode.width )
+		return ca->mode.width > cb->mode.width ? -1 : 1;
+	if ( ca->mode.height != cb->mode.height )
+		return ca->mode.height > cb->mode.height ? -1 : 1;
+	if ( ca->mode.bitsPerPixel != cb->mode.bitsPerPixel )
+		return ca->mode.bitsPerPixel > cb->mode.bitsPerPixel ? -1 : 1;
+	return ca->mode.refresh > cb->mode.refresh ? -1 : ca->mode.refresh < cb->mode.refresh;
+}
+
+static void printPercent( const char *what, unsigned long count, unsigned long total )
+{
+	printf( "  %-8s %10lu %6.1f%%\n", what, count, total ? 100.0 * count / total : 0.0 );
+}
+
+static int simulateFleet( const char *path, const displayPolicy *policy, int scanType, displayMode wanted,
+		int mirroringOnOff, int workers, int shouldList )
+{
+	static const char *outcomeNames[FLEET_OUTCOMES] = { "exact", "closest", "highest", "no mode" };
+	fleetCorpus corpus;
+	fleetWork work;
+	workerPool *pool;
+	modeTally tally;
+	unsigned long *uses, outcomes[FLEET_OUTCOMES] = { 0 }, numDisplays = 0, failed = 0, changed = 0;
+	uint64_t started, elapsed;
+	uint32_t ii, dd;
+
+	if ( corpusOpen( &corpus, path ) != 0 )
+	{
+		printf( "%s isn't a fleet corpus (see SetDisplayFleet -c)\n", path );
+		return 1;
+	}
+	memset( &work, 0, sizeof(work) );
+	memset( &tally, 0, sizeof(tally) );
+	work.corpus = &corpus;
+	work.policy = policy;
+	work.scanType = scanType;
+	work.wanted = wanted;
+	work.mirroringOnOff = mirroringOnOff;
+	work.results = calloc( corpus.header->numRecordings ? corpus.header->numRecordings : 1, sizeof(fleetResult) );
+	uses = calloc( corpus.header->numRecordings ? corpus.header->numRecordings : 1, sizeof(unsigned long) );
+	pool = poolCreate( workers - 1 );
+	if ( work.results == NULL || uses == NULL || pool == NULL )
+	{
+		printf( "Out of memory\n" );
+		return 1;
+	}
+
+	started = clockNanoseconds();
+	poolRun( pool, corpus.header->numRecordings, simulateOne, &work );
+	elapsed = clockNanoseconds() - started;
+	poolDestroy( pool );
+
+	// every machine counts, not just every different one
+	for ( ii = 0; ii < corpus.header->numMachines; ii++ )
+		uses[corpus.machines[ii].recording]++;
+	for ( ii = 0; ii < corpus.header->numRecordings; ii++ )
+	{
+		const fleetResult *result = &work.results[ii];
+
+		if ( result->failed )
+		{
+			failed += uses[ii];
+			continue;
+		}
+		if ( result->changes )
+			changed += uses[ii];
+		for ( dd = 0; dd < result->numDisplays; dd++ )
+		{
+			outcomes[result->displays[dd].outcome] += uses[ii];
+			numDisplays += uses[ii];
+			if ( tallyMode( &tally, &result->displays[dd].to.mode, uses[ii] ) != 0 )
+			{
+				printf( "Out of memory\n" );
+				return 1;
+			}
+		}
+	}
+
+	printf( "%u machine(s), %u different, %lu display(s), simulated in %.3f s on %d thread(s)\n",
+			corpus.header->numMachines, corpus.header->numRecordings, numDisplays, elapsed / 1e9, workers );
+	if ( failed != 0 )
+		printf( "%lu machine(s) with a recording that doesn't play back\n", failed );
+	for ( ii = 0; ii < FLEET_OUTCOMES; ii++ )
+		printPercent( outcomeNames[ii], outcomes[ii], numDisplays );
+	printf( "Resulting modes:\n" );
+	qsort( tally.counts, tally.numCounts, sizeof(modeCount), compareCounts );
+	for ( ii = 0; ii < tally.numCounts; ii++ )
+		printf( "  %10lu  %zu %zu %zu %lg\n", tally.counts[ii].displays, tally.counts[ii].mode.width, tally.counts[ii].mode.height,
+				tally.counts[ii].mode.bitsPerPixel, tally.counts[ii].mode.refresh );
+	printf( "%lu machine(s) would change:\n", changed );
+	for ( ii = 0; ii < corpus.header->numMachines; ii++ )
+	{
+		const fleetResult *result = &work.results[corpus.machines[ii].recording];
+		const char *name = corpus.names + corpus.machines[ii].name;
+
+		if ( result->failed || !result->changes )
+			continue;
+		if ( !shouldList )
+		{
+			printf( "%s\n", name );
+			continue;
+		}
+		for ( dd = 0; dd < result->numDisplays; dd++ )
+		{
+			const fleetDisplay *disp = &result->displays[dd];
+			if ( !disp->changes )
+				continue;
+			printf( "%s 0x%x %zu %zu %zu %lg -> %zu %zu %zu %lg\n", name, (unsigned int)disp->display,
+					disp->from.mode.width, disp->from.mode.height, disp->from.mode.bitsPerPixel, disp->from.mode.refresh,
+					disp->to.mode.width, disp->to.mode.height, disp->to.mode.bitsPerPixel, disp->to.mode.refresh );
+		}
+	}
+
+	for ( ii = 0; ii < corpus.header->numRecordings; ii++ )
+		free( work.results[ii].displays );
+	free( work.results );
+	free( uses );
+	free( tally.counts );
+	free( tally.buckets );
+	corpusClose( &corpus );
+	return failed == 0 ? 0 : 1;
+}
+
+static void usage()
+{
+	printf( "SetDisplayFleet -c CORPUS RECORDING...\n" );
+	printf( "SetDisplayFleet -g MACHINES [-u KINDS] CORPUS\n" );
+	printf( "SetDisplayFleet [-lMmxz] [-j WORKERS] [-P POLICY] CORPUS [WIDTH HEIGHT BPP REFRESH]\n" );
+	printf( " -c Put the recordings into CORPUS, each machine named after its file\n" );
+	printf( " -g Make up a CORPUS of MACHINES machines from simulated displays (-B sim)\n" );
+	printf( " -u With KINDS different kinds of machine among them, default all different\n" );
+	printf( " -j Simulate on WORKERS threads, default one for each processor\n" );
+	printf( " -l List each display of the machines that would change\n" );
+	printf( " -M, -m, -P, -x, -z As for SetDisplay\n" );
+	printf( " No mode defaults to 1024 768 32 75\n" );
+	exit(1);
+}
+
+int main( int argc, char **argv )
+{
+	displayMode wanted;
+	displayPolicy *policy = NULL;
+	const char *policyPath = NULL;
+	int shouldBuild = 0;
+	unsigned long generate = 0, kinds = 0;
+	int scanType = SCAN_CLOSEST;
+	int mirroringOnOff = 0;
+	int shouldList = 0;
+	long workers = sysconf( _SC_NPROCESSORS_ONLN );
+	int cc, err;
+
+	wanted.width = 1024;
+	wanted.height = 768;
+	wanted.bitsPerPixel = 32;
+	wanted.refresh = 75;
+
+	while ( (cc = getopt( argc, argv, "cg:j:lMmP:u:xz" )) != -1 )
+	{
+		switch ( cc )
+		{
+			case 'c':
+				shouldBuild = 1;
+				break;
+			case 'g':
+				generate = strtoul( optarg, NULL, 0 );
+				break;
+			case 'j':
+				workers = atol( optarg );
+				break;
+			case 'l':
+				shouldList = 1;
+				break;
+			case 'M':
+				mirroringOnOff = 2;
+				break;
+			case 'm':
+				mirroringOnOff = 1;
+				break;
+			case 'P':
+				policyPath = optarg;
+				break;
+			case 'u':
+				kinds = strtoul( optarg, NULL, 0 );
+				break;
+			case 'x':
+				scanType = SCAN_EXACT;
+				break;
+			case 'z':
+				scanType = SCAN_HIGHEST;
+				break;
+			default:
+				usage();
+		}
+	}
+
+	if ( shouldBuild )
+	{
+		if ( argc - optind < 2 )
+			usage();
+		return buildCorpus( argv[optind], argv + optind + 1, argc - optind - 1 );
+	}
+	if ( generate != 0 )
+	{
+		if ( argc - optind != 1 || generate > UINT32_MAX )
+			usage();
+		return generateCorpus( argv[optind], generate, kinds != 0 && kinds < generate ? kinds : generate );
+	}
+
+	if ( argc - optind != 1 && argc - optind != 5 )
+		usage();
+	if ( argc - optind == 5 )
+	{
+		wanted.width = atoi( argv[optind + 1] );
+		wanted.height = atoi( argv[optind + 2] );
+		wanted.bitsPerPixel = atoi( argv[optind + 3] );
+		wanted.refresh = atoi( argv[optind + 4] );
+	}
+	if ( workers < 1 )
+		workers = 1;
+	if ( policyPath != NULL )
+	{
+		policy = policyOpen( policyPath );
+		if ( policy == NULL )
+		{
+			printf( "%s isn't a compiled policy (see SetDisplayPolicy)\n", policyPath );
+			return 1;
+		}
+	}
+	err = simulateFleet( argv[optind], policy, scanType, wanted, mirroringOnOff, (int)workers, shouldList );
+	policyClose( policy );
+	return err;
+}
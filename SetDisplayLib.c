@@ -0,0 +1,1098 @@
+/*
+SetDisplayLib.c
+
+See SetDisplayLib.h.
+
+sessionLoad and sessionPlanDisplays hand one display to each worker.
+What a worker does to its display (asking the backend, building the
+catalog, matching) touches nothing else; what is shared (the cache,
+the generation counter, the plan) is done afterwards on the calling
+thread, in display order.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "SetDisplayLib.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "DisplayTrace.h"
+#include "Edid.h"
+#include "WorkerPool.h"
+
+#define SESSION_MAX_WORKERS 256
+
+typedef struct
+{
+	displayID display;
+	int identified;
+	displayIdentity identity;
+
+	modeCatalog *catalog;
+	catalogArena *arena;        // catalog, when it was made from the backend's list
+	catalogArena *spare;        // the next one is made here, see makeCatalog
+	int listed;                 // catalog was made from (or checked against) the backend's list
+	int fromCache;
+	int staleCache;
+	int fromEdid;
+	int unsettled;              // catalog is new, still to be numbered and cached
+	int haveLimits;             // limits is worked out from catalog
+	timingLimits limits;
+	unsigned long generation;
+
+	int haveCurrent;
+	displayModeDesc current;
+	long currentIndex;
+	displayID mirrorOf;
+	uint64_t fingerprint;       // of identity, current and mirrorOf when last read
+	int recheck;                // changed since, see recheckDisplay
+
+	// the last match in catalog, for asking the same again
+	int haveMatch;
+	int matchScanType;
+	displayMode matchWanted;
+	long match;
+} sessionDisplay;
+
+struct setDisplaySession
+{
+	displayBackend *backend;
+	modeCache *cache;
+
+	int discovered;
+	sessionDisplay *displays;
+	displayID *ids;
+	uint32_t numDisplays;
+	unsigned long generation;
+
+	int workers;                // 0 for one per display
+	workerPool *pool;
+
+	displayTrace *trace;
+	const displayPolicy *policy;    // sessionSetPolicy, the caller's
+
+	uint8_t *edid;              // sessionSetEdidFile, for displays that can't give their own
+	size_t edidSize;
+
+	setDisplayStats stats;
+};
+
+// the workers count too
+#define COUNT_WORK(session, what) __sync_fetch_and_add( &(session)->stats.what, 1 )
+
+setDisplaySession *sessionOpen( const char *backendSpec, const char *cachePath )
+{
+	displayBackend *backend = backendCreate( backendSpec );
+
+	if ( backend == NULL )
+		return NULL;
+	return sessionOpenBackend( backend, cachePath );
+}
+
+setDisplaySession *sessionOpenBackend( displayBackend *backend, const char *cachePath )
+{
+	setDisplaySession *session = calloc( 1, sizeof(setDisplaySession) );
+
+	if ( session == NULL )
+	{
+		backendDestroy( backend );
+		return NULL;
+	}
+	session->backend = backend;
+	if ( cachePath != NULL )
+		session->cache = cacheOpen( cachePath );
+	return session;
+}
+
+static void forgetCatalog( sessionDisplay *disp )
+{
+	catalogDestroy( disp->catalog );
+	if ( disp->arena != NULL )
+		arenaReset( disp->arena );
+	disp->catalog = NULL;
+	disp->listed = 0;
+	disp->fromCache = 0;
+	disp->staleCache = 0;
+	disp->fromEdid = 0;
+	disp->unsettled = 0;
+	disp->haveLimits = 0;
+	disp->haveMatch = 0;
+	disp->recheck = 0;
+}
+
+static void forgetDisplays( setDisplaySession *session )
+{
+	uint32_t ii;
+
+	for ( ii = 0; ii < session->numDisplays; ii++ )
+	{
+		forgetCatalog( &session->displays[ii] );
+		arenaDestroy( session->displays[ii].arena );
+		arenaDestroy( session->displays[ii].spare );
+	}
+	free( session->displays );
+	free( session->ids );
+	session->displays = NULL;
+	session->ids = NULL;
+	session->numDisplays = 0;
+	session->discovered = 0;
+}
+
+void sessionClose( setDisplaySession *session )
+{
+	if ( session == NULL )
+		return;
+	forgetDisplays( session );
+	poolDestroy( session->pool );
+	cacheClose( session->cache );
+	backendDestroy( session->backend );
+	free( session->edid );
+	free( session );
+}
+
+int sessionSaveCache( setDisplaySession *session )
+{
+	if ( session->cache == NULL )
+		return 0;
+	return cacheWrite( session->cache );
+}
+
+displayBackend *sessionBackend( setDisplaySession *session )
+{
+	return session->backend;
+}
+
+void sessionSetWorkers( setDisplaySession *session, int workers )
+{
+	session->workers = workers < 0 ? 0 : workers;
+	poolDestroy( session->pool );
+	session->pool = NULL;
+}
+
+void sessionSetTrace( setDisplaySession *session, displayTrace *trace )
+{
+	session->trace = trace;
+	session->backend->trace = trace;
+}
+
+void sessionSetPolicy( setDisplaySession *session, const displayPolicy *policy )
+{
+	session->policy = policy;
+}
+
+displayErr sessionRecord( setDisplaySession *session, const char *path )
+{
+	displayBackend *recorder = backendCreateRecorder( session->backend, path );
+
+	if ( recorder == NULL )
+		return kDisplayErrNoMemory;
+	session->backend = recorder;
+	return kDisplayNoErr;
+}
+
+int sessionSetEdidFile( setDisplaySession *session, const char *path )
+{
+	uint8_t *edid;
+	size_t size;
+
+	if ( edidLoad( path, &edid, &size ) != 0 )
+		return -1;
+	free( session->edid );
+	session->edid = edid;
+	session->edidSize = size;
+	return 0;
+}
+
+/*
+A pool for count displays, or NULL when they have to be done one after
+the other.  The calling thread is one of the workers.
+*/
+static workerPool *poolFor( setDisplaySession *session, uint32_t count )
+{
+	int wanted = session->workers ? session->workers : (int)count;
+
+	if ( wanted > SESSION_MAX_WORKERS )
+		wanted = SESSION_MAX_WORKERS;
+	if ( (uint32_t)wanted > count )
+		wanted = (int)count;
+	if ( wanted < 2 || !session->backend->concurrentQueries )
+		return NULL;
+	if ( session->pool != NULL && poolThreads( session->pool ) < wanted - 1 )
+	{
+		poolDestroy( session->pool );
+		session->pool = NULL;
+	}
+	if ( session->pool == NULL )
+		session->pool = poolCreate( wanted - 1 );
+	return session->pool;
+}
+
+static sessionDisplay *findKnownDisplay( setDisplaySession *session, displayID display )
+{
+	uint32_t ii;
+
+	for ( ii = 0; ii < session->numDisplays; ii++ )
+	{
+		if ( session->displays[ii].display == display )
+			return &session->displays[ii];
+	}
+	return NULL;
+}
+
+/*
+A display that is still there keeps what is known about it: a hotplug
+on one head costs that head, not all of them.  The displays the events
+were about were marked to be read again by sessionForget.
+*/
+static displayErr discoverDisplays( setDisplaySession *session )
+{
+	sessionDisplay *found;
+	displayID *displays;
+	uint32_t numDisplays, ii;
+	displayErr err;
+
+	err = backendCopyOnlineDisplays( session->backend, &displays, &numDisplays );
+	if ( err != kDisplayNoErr )
+	{
+		forgetDisplays( session );
+		return err;
+	}
+	found = calloc( numDisplays ? numDisplays : 1, sizeof(sessionDisplay) );
+	if ( found == NULL )
+	{
+		forgetDisplays( session );
+		free( displays );
+		return kDisplayErrNoMemory;
+	}
+	for ( ii = 0; ii < numDisplays; ii++ )
+	{
+		sessionDisplay *known = findKnownDisplay( session, displays[ii] );
+		if ( known != NULL )
+		{
+			found[ii] = *known;
+			memset( known, 0, sizeof(sessionDisplay) );    // so forgetDisplays leaves it alone
+		}
+		found[ii].display = displays[ii];
+	}
+	forgetDisplays( session );
+	session->displays = found;
+	session->ids = displays;
+	session->numDisplays = numDisplays;
+	session->discovered = 1;
+	return kDisplayNoErr;
+}
+
+displayErr sessionDisplays( setDisplaySession *session, const displayID **displays, uint32_t *numDisplays )
+{
+	displayErr err = kDisplayNoErr;
+
+	if ( !session->discovered )
+		err = discoverDisplays( session );
+	*displays = session->ids;
+	*numDisplays = session->numDisplays;
+	return err;
+}
+
+static sessionDisplay *findDisplay( setDisplaySession *session, displayID display )
+{
+	if ( !session->discovered && discoverDisplays( session ) != kDisplayNoErr )
+		return NULL;
+	return findKnownDisplay( session, display );
+}
+
+/*
+The modes in the display's EDID, or in the session's EDID file, for a
+display the backend lists no modes for.  NULL if there are none.
+*/
+static modeCatalog *catalogFromEdid( setDisplaySession *session, sessionDisplay *disp )
+{
+	uint8_t *edid;
+	size_t size;
+	modeCatalog *catalog = NULL;
+	uint64_t started;
+
+	if ( backendCopyEdid( session->backend, disp->display, &edid, &size ) == kDisplayNoErr )
+	{
+		started = traceStart( session->trace );
+		catalog = edidCatalog( edid, size );
+		traceEnd( session->trace, TRACE_CATALOG, disp->display, started );
+		free( edid );
+	}
+	if ( catalog == NULL && session->edid != NULL )
+	{
+		started = traceStart( session->trace );
+		catalog = edidCatalog( session->edid, session->edidSize );
+		traceEnd( session->trace, TRACE_CATALOG, disp->display, started );
+	}
+	return catalog;
+}
+
+/*
+A catalog of the backend's list goes in the display's spare arena, so
+that the one it replaces stays good until it's made; takeCatalog then
+empties the old one's arena in one go and the two change places.  A
+display that keeps being relisted allocates nothing for its catalogs
+once the arenas have grown to them.
+*/
+static modeCatalog *makeCatalog( sessionDisplay *disp, const displayModeDesc *modes, size_t count )
+{
+	if ( disp->spare == NULL )
+		disp->spare = arenaCreate();
+	if ( disp->spare == NULL )
+		return NULL;
+	arenaReset( disp->spare );
+	return catalogCreateIn( disp->spare, modes, count );
+}
+
+static void takeCatalog( sessionDisplay *disp, modeCatalog *catalog )
+{
+	catalogArena *arena;
+
+	forgetCatalog( disp );
+	arena = disp->arena;
+	disp->arena = disp->spare;
+	disp->spare = arena;
+	disp->catalog = catalog;
+}
+
+static displayErr listModes( setDisplaySession *session, sessionDisplay *disp )
+{
+	displayModeDesc *modes;
+	size_t count;
+	modeCatalog *catalog = NULL;
+	uint64_t started;
+	displayErr err;
+
+	err = backendCopyModes( session->backend, disp->display, &modes, &count );
+	if ( err != kDisplayNoErr )
+		return err;
+	if ( count == 0 )
+		catalog = catalogFromEdid( session, disp );
+	if ( catalog != NULL )
+	{
+		// The window server can't set these; not cached, and relisted before one is applied.
+		COUNT_WORK( session, catalogs );
+		free( modes );
+		forgetCatalog( disp );
+		disp->catalog = catalog;
+		disp->fromEdid = 1;
+		disp->unsettled = 1;
+		return kDisplayNoErr;
+	}
+	started = traceStart( session->trace );
+	catalog = makeCatalog( disp, modes, count );
+	traceEnd( session->trace, TRACE_CATALOG, disp->display, started );
+	COUNT_WORK( session, catalogs );
+	free( modes );
+	if ( catalog == NULL )
+		return kDisplayErrNoMemory;
+	takeCatalog( disp, catalog );
+	disp->listed = 1;
+	disp->unsettled = 1;
+	return kDisplayNoErr;
+}
+
+/*
+The shared half of a new catalog, done on the calling thread.
+*/
+static void settleDisplay( setDisplaySession *session, sessionDisplay *disp )
+{
+	uint64_t started;
+
+	if ( !disp->unsettled )
+		return;
+	disp->unsettled = 0;
+	disp->generation = ++session->generation;
+	if ( session->cache == NULL || !disp->listed )
+		return;
+	started = traceStart( session->trace );
+	cacheStore( session->cache, &disp->identity, disp->catalog );
+	traceEnd( session->trace, TRACE_CACHE, disp->display, started );
+}
+
+static uint64_t fingerprintMix( uint64_t hash, uint64_t value )
+{
+	int ii;
+
+	for ( ii = 0; ii < 8; ii++, value >>= 8 )
+		hash = (hash ^ (value & 0xff)) * 1099511628211ull;
+	return hash;
+}
+
+/*
+What a display's catalog has to be thrown away over: a different
+monitor, or a mode or mirroring it can't be in.  All quick to ask the
+backend for, unlike the mode list.
+*/
+static uint64_t displayFingerprint( const sessionDisplay *disp )
+{
+	uint64_t hash = 14695981039346656037ull;    // FNV-1a
+	uint64_t refresh;
+
+	memcpy( &refresh, &disp->current.mode.refresh, sizeof(refresh) );
+	hash = fingerprintMix( hash, disp->identity.vendor | (uint64_t)disp->identity.model << 32 );
+	hash = fingerprintMix( hash, disp->identity.serial );
+	hash = fingerprintMix( hash, disp->identity.edidHash );
+	hash = fingerprintMix( hash, disp->current.mode.width | (uint64_t)disp->current.mode.height << 32 );
+	hash = fingerprintMix( hash, disp->current.mode.bitsPerPixel | (uint64_t)disp->current.ioModeID << 32 );
+	hash = fingerprintMix( hash, refresh );
+	return fingerprintMix( hash, disp->mirrorOf );
+}
+
+/*
+A display sessionForget was told about, read again.  With the same
+fingerprint everything known stays, the catalog and the last match
+included.  The same monitor in another mode keeps its catalog if the
+mode is in it, to be checked against the backend's list before a
+change is applied (as one from the cache is); another monitor starts
+over.
+*/
+static void recheckDisplay( setDisplaySession *session, sessionDisplay *disp, const displayIdentity *before,
+		uint64_t fingerprint )
+{
+	disp->recheck = 0;
+	COUNT_WORK( session, rechecks );
+	if ( fingerprint == disp->fingerprint )
+	{
+		COUNT_WORK( session, kept );
+		return;
+	}
+	if ( memcmp( before, &disp->identity, sizeof(displayIdentity) ) != 0 ||
+			catalogFindMode( disp->catalog, &disp->current ) == kNoMode )
+	{
+		forgetCatalog( disp );
+		return;
+	}
+	COUNT_WORK( session, kept );
+	disp->listed = 0;
+}
+
+/*
+The hash of the display's EDID, for a backend that doesn't identify
+displays by it (Core Graphics), so that policy edid= rules match there
+as well.
+*/
+static void hashEdid( setDisplaySession *session, sessionDisplay *disp )
+{
+	displayIdentity fromEdid;
+	uint8_t *edid;
+	size_t size;
+
+	if ( backendCopyEdid( session->backend, disp->display, &edid, &size ) != kDisplayNoErr )
+		return;
+	edidIdentity( edid, size, &fromEdid );
+	disp->identity.edidHash = fromEdid.edidHash;
+	free( edid );
+}
+
+/*
+The cached catalog for the monitor if there is one and the display is
+in one of its modes, otherwise one made from the backend's list.
+*/
+static displayErr refreshDisplay( setDisplaySession *session, sessionDisplay *disp )
+{
+	displayIdentity before = disp->identity;
+	uint64_t fingerprint;
+	int stale = 0;
+	displayErr err;
+
+	if ( !disp->identified )
+	{
+		backendIdentify( session->backend, disp->display, &disp->identity );
+		if ( disp->identity.edidHash == 0 )
+			hashEdid( session, disp );
+		disp->identified = 1;
+	}
+	if ( !disp->haveCurrent )
+	{
+		err = backendCurrentMode( session->backend, disp->display, &disp->current, &disp->currentIndex );
+		if ( err != kDisplayNoErr )
+			return err;
+		disp->mirrorOf = backendMirrorOf( session->backend, disp->display );
+		disp->haveCurrent = 1;
+		fingerprint = displayFingerprint( disp );
+		if ( disp->recheck )
+			recheckDisplay( session, disp, &before, fingerprint );
+		disp->fingerprint = fingerprint;
+	}
+	if ( disp->catalog != NULL )
+		return kDisplayNoErr;
+
+	if ( session->cache != NULL )
+	{
+		uint64_t started = traceStart( session->trace );
+		disp->catalog = cacheLookup( session->cache, &disp->identity );
+		if ( disp->catalog != NULL && catalogFindMode( disp->catalog, &disp->current ) == kNoMode )
+		{
+			catalogDestroy( disp->catalog );
+			disp->catalog = NULL;
+			stale = 1;
+		}
+		traceEnd( session->trace, TRACE_CACHE, disp->display, started );
+		if ( disp->catalog != NULL )
+		{
+			disp->listed = 0;
+			disp->fromCache = 1;
+			disp->unsettled = 1;
+			return kDisplayNoErr;
+		}
+	}
+	err = listModes( session, disp );
+	disp->staleCache = stale;
+	return err;
+}
+
+displayErr sessionInfo( setDisplaySession *session, displayID display, setDisplayInfo *info )
+{
+	sessionDisplay *disp = findDisplay( session, display );
+	displayErr err;
+
+	memset( info, 0, sizeof(setDisplayInfo) );
+	info->display = display;
+	info->currentIndex = -1;
+	if ( disp == NULL )
+		return kDisplayErrIllegalArg;
+	err = refreshDisplay( session, disp );
+	settleDisplay( session, disp );
+	if ( err != kDisplayNoErr )
+		return err;
+	info->identity = disp->identity;
+	info->current = disp->current;
+	info->currentIndex = disp->listed ? disp->currentIndex : -1;
+	info->mirrorOf = disp->mirrorOf;
+	info->fromCache = disp->fromCache;
+	info->staleCache = disp->staleCache;
+	info->fromEdid = disp->fromEdid;
+	info->generation = disp->generation;
+	return kDisplayNoErr;
+}
+
+const modeCatalog *sessionCatalog( setDisplaySession *session, displayID display )
+{
+	sessionDisplay *disp = findDisplay( session, display );
+
+	return disp != NULL ? disp->catalog : NULL;
+}
+
+/*
+catalogFind, or the last answer when the same is asked of the same
+catalog again.
+*/
+static long matchDisplay( setDisplaySession *session, sessionDisplay *disp, int scanType, displayMode wanted )
+{
+	uint64_t started;
+
+	if ( disp->haveMatch && disp->matchScanType == scanType && disp->matchWanted.width == wanted.width &&
+			disp->matchWanted.height == wanted.height && disp->matchWanted.bitsPerPixel == wanted.bitsPerPixel &&
+			disp->matchWanted.refresh == wanted.refresh )
+	{
+		COUNT_WORK( session, matchesKept );
+		return disp->match;
+	}
+	started = traceStart( session->trace );
+	disp->match = catalogFind( disp->catalog, scanType, wanted );
+	traceEnd( session->trace, TRACE_MATCH, disp->display, started );
+	COUNT_WORK( session, matches );
+	disp->matchScanType = scanType;
+	disp->matchWanted = wanted;
+	disp->haveMatch = 1;
+	return disp->match;
+}
+
+/*
+What the policy says for a loaded display, if anything: its rule's
+first mode the display has, otherwise its last, matched its way.
+*/
+static const policyRule *applyPolicy( setDisplaySession *session, sessionDisplay *disp, int *scanType,
+		displayMode *wanted, int *mirroringOnOff )
+{
+	const policyRule *rule;
+	int ii;
+
+	if ( session->policy == NULL )
+		return NULL;
+	rule = policyResolve( session->policy, &disp->identity, session->numDisplays );
+	if ( rule == NULL )
+		return NULL;
+	*scanType = rule->scanType;
+	if ( rule->mirroring != 0 )
+		*mirroringOnOff = rule->mirroring;
+	for ( ii = 0; ii < rule->numTargets; ii++ )
+	{
+		*wanted = policyTargetMode( &rule->targets[ii] );
+		if ( catalogFind( disp->catalog, SCAN_EXACT, *wanted ) != kNoMode )
+			break;
+	}
+	return rule;
+}
+
+long sessionFind( setDisplaySession *session, displayID display, int scanType, displayMode wanted, displayModeDesc *found )
+{
+	sessionDisplay *disp = findDisplay( session, display );
+	long index = kNoMode;
+
+	if ( found != NULL )
+		memset( found, 0, sizeof(displayModeDesc) );
+	if ( disp == NULL )
+		return kNoMode;
+	if ( refreshDisplay( session, disp ) != kDisplayNoErr )
+	{
+		settleDisplay( session, disp );
+		return kNoMode;
+	}
+	settleDisplay( session, disp );
+	index = matchDisplay( session, disp, scanType, wanted );
+	if ( index != kNoMode && found != NULL )
+		catalogModeDesc( disp->catalog, index, found );
+	return index;
+}
+
+displayErr sessionFindBatch( setDisplaySession *session, displayID display, int scanType, const displayMode *targets,
+		size_t count, long *matches )
+{
+	sessionDisplay *disp = findDisplay( session, display );
+	displayErr err;
+	uint64_t started;
+	size_t ii;
+
+	for ( ii = 0; ii < count; ii++ )
+		matches[ii] = kNoMode;
+	if ( disp == NULL )
+		return kDisplayErrIllegalArg;
+	err = refreshDisplay( session, disp );
+	settleDisplay( session, disp );
+	if ( err != kDisplayNoErr )
+		return err;
+	started = traceStart( session->trace );
+	catalogFindBatch( disp->catalog, scanType, targets, count, matches );
+	traceEnd( session->trace, TRACE_MATCH, display, started );
+	return kDisplayNoErr;
+}
+
+const policyRule *sessionPolicy( setDisplaySession *session, displayID display, int *scanType, displayMode *wanted,
+		int *mirroringOnOff )
+{
+	sessionDisplay *disp = findDisplay( session, display );
+
+	if ( disp == NULL || session->policy == NULL )
+		return NULL;
+	if ( refreshDisplay( session, disp ) != kDisplayNoErr )
+	{
+		settleDisplay( session, disp );
+		return NULL;
+	}
+	settleDisplay( session, disp );
+	return applyPolicy( session, disp, scanType, wanted, mirroringOnOff );
+}
+
+int sessionTiming( setDisplaySession *session, displayID display, displayMode wanted, displayTiming *timing, timingLimits *limits )
+{
+	sessionDisplay *disp = findDisplay( session, display );
+	displayErr err;
+
+	memset( timing, 0, sizeof(displayTiming) );
+	if ( limits != NULL )
+		memset( limits, 0, sizeof(timingLimits) );
+	if ( disp == NULL )
+		return -1;
+	err = refreshDisplay( session, disp );
+	settleDisplay( session, disp );
+	if ( err != kDisplayNoErr )
+		return -1;
+	if ( !disp->haveLimits )
+	{
+		timingCatalogLimits( disp->catalog, &disp->limits );
+		disp->haveLimits = 1;
+	}
+	if ( limits != NULL )
+		*limits = disp->limits;
+	return timingFor( wanted.width, wanted.height, wanted.refresh > 0 ? wanted.refresh : 60, &disp->limits, timing );
+}
+
+/*
+Makes sure the catalog is the backend's list before a mode from it is
+applied.  Returns 1 when it wasn't and has been replaced.
+*/
+static int confirmCatalog( setDisplaySession *session, sessionDisplay *disp )
+{
+	displayModeDesc *modes;
+	size_t count;
+	uint64_t started;
+	int same;
+
+	if ( disp->listed )
+		return 0;
+	disp->listed = 1;
+	if ( backendCopyModes( session->backend, disp->display, &modes, &count ) != kDisplayNoErr )
+		count = 0, modes = NULL;
+	started = traceStart( session->trace );
+	same = catalogMatchesModes( disp->catalog, modes, count );
+	if ( !same )
+	{
+		modeCatalog *fresh = makeCatalog( disp, modes, count );
+		COUNT_WORK( session, catalogs );
+		if ( fresh != NULL )
+		{
+			takeCatalog( disp, fresh );
+			disp->listed = 1;
+			disp->unsettled = 1;
+		}
+	}
+	traceEnd( session->trace, TRACE_CATALOG, disp->display, started );
+	free( modes );
+	return !same;
+}
+
+/*
+Plans one display into plan, which is the caller's alone.  Touches
+nothing shared, so the workers can each do one.
+*/
+static displayPlanEntry *planDisplay( setDisplaySession *session, sessionDisplay *disp, displayPlan *plan, int scanType,
+		displayMode wanted, int mirroringOnOff, int flags, int *relisted )
+{
+	int retried = 0;
+
+	*relisted = 0;
+	for ( ;; )
+	{
+		displayPlanEntry *entry;
+		displayModeDesc chosen;
+		long index;
+
+		if ( refreshDisplay( session, disp ) != kDisplayNoErr )
+			return NULL;
+		applyPolicy( session, disp, &scanType, &wanted, &mirroringOnOff );
+		index = matchDisplay( session, disp, scanType, wanted );
+		if ( index != kNoMode )
+			catalogModeDesc( disp->catalog, index, &chosen );
+		entry = planAdd( plan, disp->display, index, index != kNoMode ? &chosen : NULL, mirroringOnOff,
+				backendMainDisplay( session->backend ), (flags & SESSION_PLAN_FORCE) ? NULL : &disp->current,
+				disp->listed ? disp->currentIndex : -1, disp->mirrorOf );
+		// Only a display that is going to change needs its real mode list.
+		if ( entry == NULL || !planEntryChanges( entry ) || (flags & SESSION_PLAN_FROM_CACHE) || retried )
+			return entry;
+		retried = 1;
+		if ( !confirmCatalog( session, disp ) )
+			return entry;
+		*relisted = 1;
+		planDropLast( plan );
+	}
+}
+
+displayPlanEntry *sessionPlan( setDisplaySession *session, displayPlan *plan, displayID display, int scanType,
+		displayMode wanted, int mirroringOnOff, int flags, int *relisted )
+{
+	sessionDisplay *disp = findDisplay( session, display );
+	displayPlanEntry *entry;
+	int dummy;
+
+	if ( relisted == NULL )
+		relisted = &dummy;
+	*relisted = 0;
+	if ( disp == NULL )
+		return NULL;
+	entry = planDisplay( session, disp, plan, scanType, wanted, mirroringOnOff, flags, relisted );
+	settleDisplay( session, disp );
+	return entry;
+}
+
+typedef struct
+{
+	setDisplaySession *session;
+	sessionDisplay **displays;
+	displayErr *errs;
+
+	// for planning
+	displayPlan *plans;
+	int *relisted;
+	int scanType;
+	displayMode wanted;
+	int mirroringOnOff;
+	int flags;
+} sessionWork;
+
+static void loadOne( void *ctx, size_t index )
+{
+	sessionWork *work = ctx;
+	if ( work->displays[index] != NULL )
+		work->errs[index] = refreshDisplay( work->session, work->displays[index] );
+}
+
+static void planOne( void *ctx, size_t index )
+{
+	sessionWork *work = ctx;
+	if ( work->displays[index] != NULL )
+		planDisplay( work->session, work->displays[index], &work->plans[index], work->scanType, work->wanted,
+				work->mirroringOnOff, work->flags, &work->relisted[index] );
+}
+
+/*
+The displays, looked up (NULL for any that isn't there), with room for
+what the workers hand back.
+*/
+static displayErr startWork( setDisplaySession *session, sessionWork *work, const displayID *displays, uint32_t count )
+{
+	uint32_t ii;
+
+	memset( work, 0, sizeof(sessionWork) );
+	work->session = session;
+	work->displays = calloc( count ? count : 1, sizeof(sessionDisplay *) );
+	work->errs = calloc( count ? count : 1, sizeof(displayErr) );
+	if ( work->displays == NULL || work->errs == NULL )
+		return kDisplayErrNoMemory;
+	for ( ii = 0; ii < count; ii++ )
+		work->displays[ii] = findDisplay( session, displays[ii] );
+	return kDisplayNoErr;
+}
+
+static void finishWork( sessionWork *work, uint32_t count )
+{
+	uint32_t ii;
+
+	for ( ii = 0; ii < count; ii++ )
+	{
+		if ( work->displays != NULL && work->displays[ii] != NULL )
+			settleDisplay( work->session, work->displays[ii] );
+		if ( work->plans != NULL )
+			planFree( &work->plans[ii] );
+	}
+	free( work->displays );
+	free( work->errs );
+	free( work->plans );
+	free( work->relisted );
+}
+
+displayErr sessionLoad( setDisplaySession *session )
+{
+	const displayID *online;
+	uint32_t numDisplays, ii;
+	sessionWork work;
+	displayErr err;
+
+	err = sessionDisplays( session, &online, &numDisplays );
+	if ( err != kDisplayNoErr )
+		return err;
+	err = startWork( session, &work, online, numDisplays );
+	if ( err == kDisplayNoErr )
+		poolRun( poolFor( session, numDisplays ), numDisplays, loadOne, &work );
+	for ( ii = 0; err == kDisplayNoErr && ii < numDisplays; ii++ )
+		err = work.errs[ii];
+	finishWork( &work, numDisplays );
+	return err;
+}
+
+/*
+The displays planned to mirror the main display, and the main display
+if it is planned too, are set to one mode they all have (see
+catalogFindCommon) instead of each to its own closest, so the mirrored
+displays show the main display's picture unscaled.  The mode is what
+the main display was asked for; with the main display not in the plan,
+the one closest to the mode it is in.  When they have no mode in common
+each keeps its own.
+*/
+static displayErr planMirrorSet( setDisplaySession *session, sessionWork *work, uint32_t count )
+{
+	displayID mainDisplay = backendMainDisplay( session->backend );
+	const modeCatalog **catalogs;
+	uint32_t *members, numMembers = 0, numMirrors = 0, ii;
+	long *positions;
+	int *relisted;
+	int scanType = work->scanType;
+	displayMode wanted = work->wanted;
+	int mirroringOnOff = work->mirroringOnOff;
+	sessionDisplay *mainDisp = NULL;
+	uint64_t started;
+	long found;
+
+	for ( ii = 0; ii < count; ii++ )
+	{
+		if ( work->plans[ii].count != 1 )
+			continue;
+		if ( work->plans[ii].entries[0].mirror == MIRROR_ON )
+			numMirrors++;
+		else if ( work->displays[ii]->display == mainDisplay )
+			mainDisp = work->displays[ii];
+	}
+	if ( numMirrors == 0 )
+		return kDisplayNoErr;
+
+	if ( mainDisp != NULL ) {
+		applyPolicy( session, mainDisp, &scanType, &wanted, &mirroringOnOff );
+	} else {
+		sessionDisplay *disp = findDisplay( session, mainDisplay );
+		displayErr err = disp != NULL ? refreshDisplay( session, disp ) : kDisplayErrFailure;
+		if ( disp != NULL )
+			settleDisplay( session, disp );
+		if ( err != kDisplayNoErr || !disp->haveCurrent )
+			return kDisplayNoErr;
+		scanType = SCAN_CLOSEST;
+		wanted = disp->current.mode;
+	}
+
+	catalogs = calloc( count, sizeof(modeCatalog *) );
+	members = calloc( count, sizeof(uint32_t) );
+	positions = calloc( count, sizeof(long) );
+	relisted = calloc( count, sizeof(int) );
+	if ( catalogs == NULL || members == NULL || positions == NULL || relisted == NULL )
+	{
+		free( catalogs );
+		free( members );
+		free( positions );
+		free( relisted );
+		return kDisplayErrNoMemory;
+	}
+	for ( ii = 0; ii < count; ii++ )
+	{
+		sessionDisplay *disp = work->displays[ii];
+		if ( work->plans[ii].count != 1 || (work->plans[ii].entries[0].mirror != MIRROR_ON && disp != mainDisp) )
+			continue;
+		// what they have in common has to come from their real lists
+		if ( !(work->flags & SESSION_PLAN_FROM_CACHE) && confirmCatalog( session, disp ) )
+			relisted[numMembers] = work->relisted[ii] = 1;
+		catalogs[numMembers] = disp->catalog;
+		members[numMembers++] = ii;
+		// first, so that it gets the mode it would get on its own when they all have it
+		if ( disp == mainDisp && numMembers > 1 )
+		{
+			const modeCatalog *catalog = catalogs[0];
+			uint32_t member = members[0];
+			int wasRelisted = relisted[0];
+			catalogs[0] = catalogs[numMembers - 1];
+			members[0] = members[numMembers - 1];
+			relisted[0] = relisted[numMembers - 1];
+			catalogs[numMembers - 1] = catalog;
+			members[numMembers - 1] = member;
+			relisted[numMembers - 1] = wasRelisted;
+		}
+	}
+
+	started = traceStart( session->trace );
+	found = catalogFindCommon( catalogs, numMembers, scanType, wanted, positions );
+	traceEnd( session->trace, TRACE_MATCH, mainDisplay, started );
+	for ( ii = 0; ii < numMembers; ii++ )
+	{
+		sessionDisplay *disp = work->displays[members[ii]];
+		displayPlan *own = &work->plans[members[ii]];
+		int mirror = own->entries[0].mirror;
+		displayModeDesc chosen;
+		int dummy;
+
+		if ( found == kNoMode ) {
+			// on its own, as before, but from the list it really has
+			if ( relisted[ii] )
+			{
+				planDropLast( own );
+				planDisplay( session, disp, own, work->scanType, work->wanted, work->mirroringOnOff, work->flags, &dummy );
+			}
+			continue;
+		}
+		catalogModeDesc( disp->catalog, positions[ii], &chosen );
+		planDropLast( own );
+		planAdd( own, disp->display, positions[ii], &chosen, mirror, mainDisplay,
+				(work->flags & SESSION_PLAN_FORCE) ? NULL : &disp->current, disp->listed ? disp->currentIndex : -1,
+				disp->mirrorOf );
+	}
+	free( catalogs );
+	free( members );
+	free( positions );
+	free( relisted );
+	return kDisplayNoErr;
+}
+
+displayErr sessionPlanDisplays( setDisplaySession *session, displayPlan *plan, const displayID *displays, uint32_t count,
+		int scanType, displayMode wanted, int mirroringOnOff, int flags, int *relisted )
+{
+	sessionWork work;
+	displayErr err;
+	uint32_t ii;
+
+	err = startWork( session, &work, displays, count );
+	if ( err == kDisplayNoErr )
+	{
+		work.plans = calloc( count ? count : 1, sizeof(displayPlan) );
+		work.relisted = calloc( count ? count : 1, sizeof(int) );
+		if ( work.plans == NULL || work.relisted == NULL )
+			err = kDisplayErrNoMemory;
+	}
+	if ( err != kDisplayNoErr )
+	{
+		finishWork( &work, 0 );
+		return err;
+	}
+	work.scanType = scanType;
+	work.wanted = wanted;
+	work.mirroringOnOff = mirroringOnOff;
+	work.flags = flags;
+	poolRun( poolFor( session, count ), count, planOne, &work );
+	err = planMirrorSet( session, &work, count );
+
+	for ( ii = 0; ii < count; ii++ )
+	{
+		if ( work.plans[ii].count == 1 && planAppend( plan, &work.plans[ii].entries[0] ) == NULL )
+			err = kDisplayErrNoMemory;
+		if ( relisted != NULL )
+			relisted[ii] = work.relisted[ii];
+	}
+	finishWork( &work, count );
+	return err;
+}
+
+displayErr sessionApply( setDisplaySession *session, displayPlan *plan, int permanently, displayPlanResult *result )
+{
+	displayErr err = planApply( session->backend, plan, permanently, result );
+	size_t ii;
+
+	for ( ii = 0; ii < plan->count; ii++ )
+	{
+		sessionDisplay *disp;
+		if ( !planEntryChanges( &plan->entries[ii] ) )
+			continue;
+		// read back, rather than assume, what the display ended up in
+		disp = findDisplay( session, plan->entries[ii].display );
+		if ( disp != NULL )
+			disp->haveCurrent = 0;
+	}
+	return err;
+}
+
+displayErr sessionVerify( setDisplaySession *session, displayPlan *plan, long timeoutMs, displayPlanResult *result )
+{
+	return planVerify( session->backend, plan, timeoutMs, result );
+}
+
+void sessionForget( setDisplaySession *session, displayID display )
+{
+	sessionDisplay *disp = findKnownDisplay( session, display );
+
+	if ( disp == NULL )
+	{
+		session->discovered = 0;
+		return;
+	}
+	// could be another monitor behind the same port now, recheckDisplay sees
+	disp->recheck = disp->catalog != NULL;
+	disp->identified = 0;
+	disp->haveCurrent = 0;
+}
+
+displayErr sessionWaitForEvents( setDisplaySession *session, long timeoutMs, displayEvent *events, size_t maxEvents,
+		size_t *numEvents )
+{
+	displayErr err = backendWaitForEvents( session->backend, timeoutMs, events, maxEvents, numEvents );
+	size_t ii;
+
+	for ( ii = 0; err == kDisplayNoErr && ii < *numEvents; ii++ )
+	{
+		if ( events[ii].flags & (DISPLAY_EVENT_ADDED | DISPLAY_EVENT_REMOVED) )
+			session->discovered = 0;
+		sessionForget( session, events[ii].display );
+	}
+	return err;
+}
+
+void sessionStats( setDisplaySession *session, setDisplayStats *stats )
+{
+	*stats = session->stats;
+}
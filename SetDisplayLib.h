@@ -0,0 +1,233 @@
+/*
+SetDisplayLib.h
+
+libsetdisplay: what SetDisplay does, for programs that would rather
+call it than run it and read what it prints.  SetDisplay itself, its
+server (-S) and its resident mode (-D) are written on top of it.
+
+A session owns a backend and, optionally, a mode cache.  It finds the
+online displays, works out each display's mode catalog and current mode
+the first time they are asked for and keeps them until told the display
+changed (sessionForget, or the events sessionWaitForEvents hands back),
+and then for as long as the display turns out to be the same monitor
+in a mode its catalog has.
+Matching is done against the catalog, setting displays goes through a
+displayPlan applied in one configuration transaction.
+
+Building it:
+
+gcc -O3 -c DisplayBackend.c DisplayBackendCG.c DisplayBackendDRM.c DisplayBackendReplay.c DisplayBackendSim.c DisplayBackendXRandR.c DisplayFlight.c DisplayLog.c DisplayPlan.c DisplayPolicy.c DisplayTiming.c DisplayTrace.c Edid.c ModeCache.c ModeCatalog.c SetDisplayLib.c WorkerPool.c
+ar rcs libsetdisplay.a DisplayBackend.o DisplayBackendCG.o DisplayBackendDRM.o DisplayBackendReplay.o DisplayBackendSim.o DisplayBackendXRandR.o DisplayFlight.o DisplayLog.o DisplayPlan.o DisplayPolicy.o DisplayTiming.o DisplayTrace.o Edid.o ModeCache.o ModeCatalog.o SetDisplayLib.o WorkerPool.o
+
+(link whatever uses it with -lpthread, on a Mac with -framework Cocoa -framework IOKit.)  Apart from
+sessionOpen saying what is wrong with a bad backend spec nothing in it
+prints; errors come back as displayErr values.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef SETDISPLAYLIB_H
+#define SETDISPLAYLIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "DisplayBackend.h"
+#include "DisplayPlan.h"
+#include "DisplayPolicy.h"
+#include "DisplayTiming.h"
+#include "DisplayTrace.h"
+#include "ModeCache.h"
+#include "ModeCatalog.h"
+
+typedef struct setDisplaySession setDisplaySession;
+
+typedef struct
+{
+	displayID display;
+	displayIdentity identity;
+	displayModeDesc current;
+	long currentIndex;          // of current in the backend's list, -1 if not known
+	displayID mirrorOf;
+	int fromCache;              // the catalog came from the mode cache, not the backend
+	int staleCache;             // the cache knew the monitor but not the mode it is in
+	int fromEdid;               // the backend listed no modes, these are the monitor's EDID's
+	unsigned long generation;   // changes whenever the catalog is replaced
+} setDisplayInfo;
+
+/*
+What the session has done for its displays, to see what keeping things
+between changes saves.  The mode lists read are the backend's
+stats.copyModes.
+*/
+typedef struct
+{
+	unsigned long catalogs;     // made from a mode list (the backend's or an EDID's)
+	unsigned long rechecks;     // displays read again after they changed
+	unsigned long kept;         // ... that kept their catalog
+	unsigned long matches;      // modes looked for in a catalog
+	unsigned long matchesKept;  // ... answered with the last one, the same having been asked of the same catalog
+} setDisplayStats;
+
+#define SESSION_PLAN_FORCE      0x1     // configure even if the display is already in the mode
+#define SESSION_PLAN_FROM_CACHE 0x2     // don't check a cached catalog against the backend (for -p)
+
+/*
+backendSpec is as for backendCreate (NULL for the default), cachePath
+may be NULL for no cache.  Returns NULL when the backend can't be made.
+The cache is only written back by sessionSaveCache.
+*/
+setDisplaySession *sessionOpen( const char *backendSpec, const char *cachePath );
+
+/*
+sessionOpen for a backend already made (a replay of a recording in
+memory, say), which the session takes, even when it returns NULL.
+*/
+setDisplaySession *sessionOpenBackend( displayBackend *backend, const char *cachePath );
+void sessionClose( setDisplaySession *session );
+int sessionSaveCache( setDisplaySession *session );
+displayBackend *sessionBackend( setDisplaySession *session );
+
+/*
+The online displays, found on first use and again after displays come
+or go.  The array belongs to the session and is good until the next
+call that takes the session.
+*/
+displayErr sessionDisplays( setDisplaySession *session, const displayID **displays, uint32_t *numDisplays );
+
+/*
+How many displays are worked on at once by sessionLoad and
+sessionPlanDisplays: 0 (the default) for all of them, 1 for one after
+the other.  Backends that can't take queries from several threads at
+once always get them one after the other.
+*/
+void sessionSetWorkers( setDisplaySession *session, int workers );
+
+/*
+Records how long every backend call, catalog and match takes into trace
+(DisplayTrace.h), which stays the caller's; NULL stops recording.
+*/
+void sessionSetTrace( setDisplaySession *session, displayTrace *trace );
+
+/*
+A compiled policy (DisplayPolicy.h), which stays the caller's.  Every
+display a rule matches is planned the rule's way, whatever the plan
+was asked for; the others as asked.  NULL stops using it.
+*/
+void sessionSetPolicy( setDisplaySession *session, const displayPolicy *policy );
+
+/*
+Records everything the backend answers, and how long each call takes,
+into path when the session is closed, for the replay backend to play
+back (DisplayBackendReplay.c).  Call it before anything else is asked.
+Returns 0, or kDisplayErrNoMemory.
+*/
+displayErr sessionRecord( setDisplaySession *session, const char *path );
+
+/*
+An EDID saved from a monitor (Edid.h), whose modes stand in for those
+of any display the backend lists none for and can't read an EDID from
+itself.  Modes made up from an EDID are never cached, and the display
+is listed again before one is applied.  Returns 0, or -1 if there is no
+EDID in path.
+*/
+int sessionSetEdidFile( setDisplaySession *session, const char *path );
+
+/*
+Gets the state (current mode, identity and catalog) of every online
+display that isn't known already, the displays in parallel.  Returns
+the first error any of them had.
+*/
+displayErr sessionLoad( setDisplaySession *session );
+
+/*
+The display's state, going to the backend only for what isn't known
+already.  sessionCatalog is the display's catalog once sessionInfo has
+succeeded for it (NULL otherwise); it stays the session's.
+*/
+displayErr sessionInfo( setDisplaySession *session, displayID display, setDisplayInfo *info );
+const modeCatalog *sessionCatalog( setDisplaySession *session, displayID display );
+
+/*
+The catalog position of the mode that scanType picks for wanted, or
+kNoMode.  found (which may be NULL) is filled in with that mode, all
+zero if there isn't one.
+*/
+long sessionFind( setDisplaySession *session, displayID display, int scanType, displayMode wanted, displayModeDesc *found );
+
+/*
+sessionFind for count targets at once (catalogFindBatch), for tools
+that try many: matches[i] is the position for targets[i], or kNoMode.
+*/
+displayErr sessionFindBatch( setDisplaySession *session, displayID display, int scanType, const displayMode *targets,
+		size_t count, long *matches );
+
+/*
+The display's rule in the session's policy, with scanType, wanted and
+mirroringOnOff set the way the rule would have the display planned
+(the rule's first mode the display has, otherwise its last).  NULL,
+and nothing set, when no rule matches.
+*/
+const policyRule *sessionPolicy( setDisplaySession *session, displayID display, int *scanType, displayMode *wanted,
+		int *mirroringOnOff );
+
+/*
+The timing wanted would take (DisplayTiming.h; a refresh of 0 is taken
+as 60 Hz) and how it compares with what the display's modes take,
+which limits (which may be NULL) is filled in with.  Returns what
+timingCheck says, or -1 if there is no such display or no timing.
+*/
+int sessionTiming( setDisplaySession *session, displayID display, displayMode wanted, displayTiming *timing, timingLimits *limits );
+
+/*
+Adds the display, set to what scanType picks for wanted, to the plan.
+Unless SESSION_PLAN_FROM_CACHE is given, a display that is going to
+change has its catalog checked against the backend's real mode list
+first and, if the list is different, matched again; *relisted (which
+may be NULL) says whether that happened.  Returns the plan entry, or
+NULL if the display couldn't be planned.
+*/
+displayPlanEntry *sessionPlan( setDisplaySession *session, displayPlan *plan, displayID display, int scanType,
+		displayMode wanted, int mirroringOnOff, int flags, int *relisted );
+
+/*
+sessionPlan for count displays at once, the displays in parallel.  The
+entries go into the plan in the order of displays; relisted, if not
+NULL, has room for count flags.  A display that couldn't be planned
+is left out.  With mirroring on, the displays that are to mirror the
+main display, and the main display if it is one of displays, are set
+to a mode they all have (catalogFindCommon) when there is one.
+*/
+displayErr sessionPlanDisplays( setDisplaySession *session, displayPlan *plan, const displayID *displays, uint32_t count,
+		int scanType, displayMode wanted, int mirroringOnOff, int flags, int *relisted );
+
+/*
+planApply, after which the displays that were changed are read back
+from the backend next time they are asked about.
+*/
+displayErr sessionApply( setDisplaySession *session, displayPlan *plan, int permanently, displayPlanResult *result );
+
+/*
+planVerify, after sessionApply: waits up to timeoutMs from the commit
+for the changed displays to read back as planned.
+*/
+displayErr sessionVerify( setDisplaySession *session, displayPlan *plan, long timeoutMs, displayPlanResult *result );
+
+/*
+Something happened to the display: its identity, current mode and
+mirroring are read again the next time it is asked about, and what
+else is known about it is thrown away only if they show it has to be
+(another monitor, or a mode its catalog doesn't have).  A display the
+session doesn't know makes it look for displays again, as a display
+added or removed does; the displays still there keep what is known.
+sessionWaitForEvents is backendWaitForEvents that does this for every
+event before handing it back.
+*/
+void sessionForget( setDisplaySession *session, displayID display );
+displayErr sessionWaitForEvents( setDisplaySession *session, long timeoutMs, displayEvent *events, size_t maxEvents,
+		size_t *numEvents );
+
+void sessionStats( setDisplaySession *session, setDisplayStats *stats );
+
+#endif
@@ -0,0 +1,387 @@
+/*
+gcc -O3 -o SetDisplayLog SetDisplayLog.c DisplayLog.c
+
+SetDisplayLog.c
+
+What SetDisplay did on this machine, from the log it keeps with -L (see
+DisplayLog.h): every run and every -D correction, with the displays it
+saw, the mode each asked for and got (exactly or only the closest), how
+long each step took, what the commit did and how long each display took
+to read back as planned.  A run that took the result of another just
+like it (-F) is there too, as reused, with that result and how long it
+waited.  The log can be read while SetDisplay is writing it.
+
+ dump     Every record, oldest first, and a line for each of its
+          displays.
+ summary  The records added up: how many runs, corrections and reused
+          runs, how long each step took (avg and max), how the displays
+          came by their modes, the modes they ended up in, and for each
+          display how many changes it took, how many it didn't and how
+          long it took to settle.  A KVM that is slow or drops changes
+          stands out there.
+
+USAGE:
+SetDisplayLog [-n RECORDS] [dump|summary] LOGFILE
+
+ -n Only the last RECORDS records
+ dump is the default.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "DisplayLog.h"
+
+#define MAX_MODES    256
+#define MAX_DISPLAYS 256
+
+static const char *kindNames[LOG_KINDS] = { "run", "correction", "reused" };
+static const char *outcomeNames[LOG_OUTCOMES] = { "exact", "closest", "highest", "no mode" };
+static const char *phaseNames[LOG_PHASES] = { "open", "displays", "match", "plan", "apply", "verify", "total" };
+
+typedef struct
+{
+	uint16_t width, height;
+	uint8_t bitsPerPixel;
+	float refresh;
+	unsigned long count;
+} modeCount;
+
+typedef struct
+{
+	uint32_t display;
+	unsigned long planned, changes, settled, mismatched, unreadable, failed;
+	uint64_t settleTotal, settleMax;       // microseconds, of the settled
+} displayCount;
+
+typedef struct
+{
+	uint64_t skip;              // records to pass over before the last -n
+	unsigned long records[LOG_KINDS];
+	unsigned long failed;       // records whose apply failed
+	uint64_t phaseTotal[LOG_KINDS][LOG_PHASES], phaseMax[LOG_KINDS][LOG_PHASES];
+	unsigned long outcomes[LOG_OUTCOMES];
+	unsigned long changed, already;
+	uint64_t first, last;
+	modeCount modes[MAX_MODES];
+	size_t numModes;
+	displayCount displays[MAX_DISPLAYS];
+	size_t numDisplays;
+} summary;
+
+static void formatTime( uint64_t microseconds, char *buf, size_t size )
+{
+	time_t seconds = (time_t)(microseconds / 1000000u);
+	struct tm tm;
+	size_t len;
+
+	localtime_r( &seconds, &tm );
+	len = strftime( buf, size, "%Y-%m-%d %H:%M:%S", &tm );
+	snprintf( buf + len, size - len, ".%03u", (unsigned int)(microseconds % 1000000u / 1000u) );
+}
+
+static const char *kindName( const logRecord *record )
+{
+	return record->kind < LOG_KINDS ? kindNames[record->kind] : "?";
+}
+
+/////////////////
+
+static int dumpRecord( void *ctx, const logRecord *record )
+{
+	uint64_t *skip = ctx;
+	char when[40];
+	int ii;
+
+	if ( *skip > 0 )
+	{
+		(*skip)--;
+		return 0;
+	}
+	formatTime( record->time, when, sizeof(when) );
+	printf( "#%llu %s pid %u %s %u %u %u %g: %u display(s)", (unsigned long long)record->seq, when,
+			(unsigned int)record->pid, kindName( record ), record->width, record->height, record->bitsPerPixel,
+			record->refresh, (unsigned int)record->numDisplays );
+	if ( record->setting )
+		printf( ", %u configured in %u commit(s), %u skipped", record->configured, record->commits, record->skipped );
+	if ( record->err != 0 )
+		printf( ", error %d", (int)record->err );
+	printf( "\n   " );
+	for ( ii = 0; ii < LOG_PHASES; ii++ )
+	{
+		if ( record->phaseMicroseconds[ii] > 0 )
+			printf( " %s %.3f", phaseNames[ii], record->phaseMicroseconds[ii] / 1e3 );
+	}
+	printf( " ms\n" );
+	for ( ii = 0; ii < record->numLogged; ii++ )
+	{
+		const logDisplay *disp = &record->displays[ii];
+		printf( "    0x%x %u %u %u %g -> ", (unsigned int)disp->display, disp->wantedWidth, disp->wantedHeight,
+				disp->wantedBitsPerPixel, disp->wantedRefresh );
+		if ( disp->outcome == LOG_NONE )
+			printf( "no mode" );
+		else
+			printf( "%u %u %u %g %s", disp->width, disp->height, disp->bitsPerPixel, disp->refresh,
+					outcomeNames[disp->outcome] );
+		if ( disp->err != 0 )
+			printf( ", configure failed (%d)", (int)disp->err );
+		else if ( disp->changed )
+			printf( ", set" );
+		else if ( record->setting && disp->outcome != LOG_NONE )
+			printf( ", already" );
+		if ( disp->verify == PLAN_VERIFY_SETTLED )
+			printf( ", read back %.3f ms after the commit", disp->settleMicroseconds / 1e3 );
+		else if ( disp->verify == PLAN_VERIFY_MISMATCH )
+			printf( ", NOT as planned %.3f ms after the commit", disp->settleMicroseconds / 1e3 );
+		else if ( disp->verify == PLAN_VERIFY_UNREADABLE )
+			printf( ", could not be read back" );
+		printf( "\n" );
+	}
+	if ( record->numDisplays > record->numLogged && record->numLogged == DISPLAYLOG_DISPLAYS )
+		printf( "    (and %u more)\n", (unsigned int)(record->numDisplays - record->numLogged) );
+	return 0;
+}
+
+/////////////////
+
+static void countMode( summary *sum, const logDisplay *disp )
+{
+	size_t ii;
+
+	for ( ii = 0; ii < sum->numModes; ii++ )
+	{
+		modeCount *mode = &sum->modes[ii];
+		if ( mode->width == disp->width && mode->height == disp->height && mode->bitsPerPixel == disp->bitsPerPixel &&
+				mode->refresh == disp->refresh )
+		{
+			mode->count++;
+			return;
+		}
+	}
+	if ( sum->numModes == MAX_MODES )
+		return;
+	sum->modes[sum->numModes].width = disp->width;
+	sum->modes[sum->numModes].height = disp->height;
+	sum->modes[sum->numModes].bitsPerPixel = disp->bitsPerPixel;
+	sum->modes[sum->numModes].refresh = disp->refresh;
+	sum->modes[sum->numModes].count = 1;
+	sum->numModes++;
+}
+
+static displayCount *countDisplay( summary *sum, uint32_t display )
+{
+	size_t ii;
+
+	for ( ii = 0; ii < sum->numDisplays; ii++ )
+	{
+		if ( sum->displays[ii].display == display )
+			return &sum->displays[ii];
+	}
+	if ( sum->numDisplays == MAX_DISPLAYS )
+		return NULL;
+	memset( &sum->displays[sum->numDisplays], 0, sizeof(displayCount) );
+	sum->displays[sum->numDisplays].display = display;
+	return &sum->displays[sum->numDisplays++];
+}
+
+static int sumRecord( void *ctx, const logRecord *record )
+{
+	summary *sum = ctx;
+	int kind = record->kind < LOG_KINDS ? record->kind : LOG_RUN;
+	int ii;
+
+	if ( sum->skip > 0 )
+	{
+		sum->skip--;
+		return 0;
+	}
+	if ( sum->first == 0 )
+		sum->first = record->time;
+	sum->last = record->time;
+	sum->records[kind]++;
+	if ( record->err != 0 )
+		sum->failed++;
+	for ( ii = 0; ii < LOG_PHASES; ii++ )
+	{
+		sum->phaseTotal[kind][ii] += record->phaseMicroseconds[ii];
+		if ( record->phaseMicroseconds[ii] > sum->phaseMax[kind][ii] )
+			sum->phaseMax[kind][ii] = record->phaseMicroseconds[ii];
+	}
+	for ( ii = 0; ii < record->numLogged; ii++ )
+	{
+		const logDisplay *disp = &record->displays[ii];
+		displayCount *count = countDisplay( sum, disp->display );
+
+		if ( disp->outcome < LOG_OUTCOMES )
+			sum->outcomes[disp->outcome]++;
+		if ( disp->outcome != LOG_NONE )
+			countMode( sum, disp );
+		if ( disp->changed )
+			sum->changed++;
+		else if ( record->setting && disp->outcome != LOG_NONE )
+			sum->already++;
+		if ( count == NULL )
+			continue;
+		count->planned++;
+		if ( disp->changed )
+			count->changes++;
+		if ( disp->err != 0 )
+			count->failed++;
+		if ( disp->verify == PLAN_VERIFY_SETTLED )
+		{
+			count->settled++;
+			count->settleTotal += disp->settleMicroseconds;
+			if ( disp->settleMicroseconds > count->settleMax )
+				count->settleMax = disp->settleMicroseconds;
+		}
+		else if ( disp->verify == PLAN_VERIFY_MISMATCH )
+			count->mismatched++;
+		else if ( disp->verify == PLAN_VERIFY_UNREADABLE )
+			count->unreadable++;
+	}
+	return 0;
+}
+
+static int byCount( const void *a, const void *b )
+{
+	const modeCount *ma = a, *mb = b;
+	return ma->count < mb->count ? 1 : ma->count > mb->count ? -1 : 0;
+}
+
+static int byTrouble( const void *a, const void *b )
+{
+	const displayCount *da = a, *db = b;
+	unsigned long ta = da->mismatched + da->unreadable + da->failed, tb = db->mismatched + db->unreadable + db->failed;
+	if ( ta != tb )
+		return ta < tb ? 1 : -1;
+	return da->display < db->display ? -1 : da->display > db->display ? 1 : 0;
+}
+
+static void printSummary( const summary *sum )
+{
+	char first[40], last[40];
+	size_t ii;
+	int kind, phase;
+
+	if ( sum->records[LOG_RUN] + sum->records[LOG_CORRECTION] + sum->records[LOG_REUSED] == 0 )
+	{
+		printf( "Nothing logged\n" );
+		return;
+	}
+	formatTime( sum->first, first, sizeof(first) );
+	formatTime( sum->last, last, sizeof(last) );
+	printf( "%lu run(s), %lu correction(s) and %lu run(s) that took another's result from %s to %s, %lu of them failed\n",
+			sum->records[LOG_RUN], sum->records[LOG_CORRECTION], sum->records[LOG_REUSED], first, last, sum->failed );
+
+	printf( "%-12s", "ms" );
+	for ( kind = 0; kind < LOG_KINDS; kind++ )
+		printf( "  %10s avg %10s max", kindNames[kind], kindNames[kind] );
+	printf( "\n" );
+	for ( phase = 0; phase < LOG_PHASES; phase++ )
+	{
+		printf( "%-12s", phaseNames[phase] );
+		for ( kind = 0; kind < LOG_KINDS; kind++ )
+		{
+			double avg = sum->records[kind] ? sum->phaseTotal[kind][phase] / 1e3 / sum->records[kind] : 0;
+			printf( "  %14.3f %14.3f", avg, sum->phaseMax[kind][phase] / 1e3 );
+		}
+		printf( "\n" );
+	}
+
+	printf( "Displays: %lu exact, %lu closest, %lu highest, %lu no mode; %lu set, %lu already as chosen\n",
+			sum->outcomes[LOG_EXACT], sum->outcomes[LOG_CLOSEST], sum->outcomes[LOG_HIGHEST], sum->outcomes[LOG_NONE],
+			sum->changed, sum->already );
+
+	printf( "------ Modes chosen ---------------\n" );
+	for ( ii = 0; ii < sum->numModes; ii++ )
+		printf( "%u %u %u %g  %lu\n", sum->modes[ii].width, sum->modes[ii].height, sum->modes[ii].bitsPerPixel,
+				sum->modes[ii].refresh, sum->modes[ii].count );
+
+	printf( "------ Displays -------------------\n" );
+	printf( "%-12s %8s %8s %8s %10s %10s %8s %8s\n", "display", "planned", "changes", "settled", "avg ms", "max ms",
+			"not", "failed" );
+	for ( ii = 0; ii < sum->numDisplays; ii++ )
+	{
+		const displayCount *count = &sum->displays[ii];
+		printf( "0x%-10x %8lu %8lu %8lu %10.3f %10.3f %8lu %8lu\n", (unsigned int)count->display, count->planned,
+				count->changes, count->settled, count->settled ? count->settleTotal / 1e3 / count->settled : 0,
+				count->settleMax / 1e3, count->mismatched + count->unreadable, count->failed );
+	}
+	printf( "-----------------------------------\n" );
+}
+
+/////////////////
+
+static void usage()
+{
+	printf( "SetDisplayLog [-n RECORDS] [dump|summary] LOGFILE\n" );
+	printf( " -n Only the last RECORDS records\n" );
+	printf( " dump is the default.\n" );
+	exit(1);
+}
+
+int main( int argc, char **argv )
+{
+	const char *command = "dump";
+	const char *path;
+	const logHeader *header;
+	displayLog *log;
+	uint64_t last = 0, kept, skip;
+	char created[40];
+	int cc;
+
+	while ( (cc = getopt( argc, argv, "n:" )) != -1 )
+	{
+		switch ( cc )
+		{
+			case 'n':
+				last = strtoull( optarg, NULL, 10 );
+				break;
+			default:
+				usage();
+		}
+	}
+	if ( argc - optind == 2 )
+		command = argv[optind++];
+	if ( argc - optind != 1 || (strcmp( command, "dump" ) != 0 && strcmp( command, "summary" ) != 0) )
+		usage();
+	path = argv[optind];
+
+	log = logOpenReading( path );
+	if ( log == NULL )
+	{
+		printf( "%s isn't a SetDisplay log (see SetDisplay -L)\n", path );
+		return 1;
+	}
+	header = logHeaderOf( log );
+	kept = header->next < header->numRecords ? header->next : header->numRecords;
+	skip = last > 0 && last < kept ? kept - last : 0;
+	formatTime( header->created, created, sizeof(created) );
+	printf( "%s: %llu record(s) written since %s, the last %llu kept\n", path, (unsigned long long)header->next,
+			created, (unsigned long long)kept );
+
+	if ( strcmp( command, "dump" ) == 0 )
+	{
+		logRead( log, dumpRecord, &skip );
+	}
+	else
+	{
+		summary *sum = calloc( 1, sizeof(summary) );
+		if ( sum == NULL )
+			return 1;
+		sum->skip = skip;
+		logRead( log, sumRecord, sum );
+		qsort( sum->modes, sum->numModes, sizeof(modeCount), byCount );
+		qsort( sum->displays, sum->numDisplays, sizeof(displayCount), byTrouble );
+		printSummary( sum );
+		free( sum );
+	}
+	logClose( log );
+	return 0;
+}
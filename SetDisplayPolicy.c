@@ -0,0 +1,150 @@
+/*
+gcc -O3 -o SetDisplayPolicy SetDisplayPolicy.c DisplayPolicy.c
+
+SetDisplayPolicy.c
+
+Compiles a fleet's display policy (see DisplayPolicy.h) for SetDisplay
+-P, lists what a compiled one has in it, and says which rule a monitor
+would go by.
+
+USAGE:
+SetDisplayPolicy -c SOURCE POLICY
+SetDisplayPolicy -l POLICY
+SetDisplayPolicy [-n HEADS] POLICY VENDOR MODEL SERIAL [EDIDHASH]
+
+ -c Compile the rules in SOURCE into POLICY
+ -l List the rules in POLICY
+ -n With HEADS displays online, default 1
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "DisplayPolicy.h"
+#include "ModeCatalog.h"
+
+static void printRule( const policyRule *rule )
+{
+	static const char *scanNames[] = { "exact", "closest", "highest" };
+	int ii;
+
+	printf( "line %u:", (unsigned int)rule->line );
+	if ( rule->match == POLICY_MATCH_EDID )
+		printf( " edid=%016llx", (unsigned long long)rule->edidHash );
+	if ( rule->match <= POLICY_MATCH_VENDOR && rule->match != POLICY_MATCH_EDID )
+		printf( " vendor=0x%x", (unsigned int)rule->vendor );
+	if ( rule->match == POLICY_MATCH_SERIAL || rule->match == POLICY_MATCH_MODEL )
+		printf( " model=0x%x", (unsigned int)rule->model );
+	if ( rule->match == POLICY_MATCH_SERIAL )
+		printf( " serial=%u", (unsigned int)rule->serial );
+	if ( rule->match == POLICY_MATCH_ANY )
+		printf( " *" );
+	if ( rule->heads != 0 )
+		printf( " heads=%u", (unsigned int)rule->heads );
+	printf( " = %s", rule->scanType <= SCAN_HIGHEST ? scanNames[rule->scanType] : "?" );
+	if ( rule->mirroring != 0 )
+		printf( " %s", rule->mirroring == 2 ? "mirror" : "nomirror" );
+	for ( ii = 0; ii < rule->numTargets; ii++ )
+	{
+		const policyTarget *target = &rule->targets[ii];
+		printf( "%s %u %u %u %lg", ii ? "," : "", (unsigned int)target->width, (unsigned int)target->height,
+				(unsigned int)target->bitsPerPixel, target->refresh / 1000.0 );
+	}
+	printf( "\n" );
+}
+
+static void usage()
+{
+	printf( "SetDisplayPolicy -c SOURCE POLICY\n" );
+	printf( "SetDisplayPolicy -l POLICY\n" );
+	printf( "SetDisplayPolicy [-n HEADS] POLICY VENDOR MODEL SERIAL [EDIDHASH]\n" );
+	printf( " -c Compile the rules in SOURCE into POLICY\n" );
+	printf( " -l List the rules in POLICY\n" );
+	printf( " -n With HEADS displays online, default 1\n" );
+	exit(1);
+}
+
+int main( int argc, char **argv )
+{
+	displayPolicy *policy;
+	displayIdentity identity;
+	const policyRule *rule;
+	int shouldCompile = 0;
+	int shouldList = 0;
+	long heads = 1;
+	int cc;
+
+	while ( (cc = getopt( argc, argv, "cln:" )) != -1 )
+	{
+		switch ( cc )
+		{
+			case 'c':
+				shouldCompile = 1;
+				break;
+			case 'l':
+				shouldList = 1;
+				break;
+			case 'n':
+				heads = atol( optarg );
+				break;
+			default:
+				usage();
+		}
+	}
+
+	if ( shouldCompile )
+	{
+		char error[256];
+		long numRules;
+
+		if ( argc - optind != 2 )
+			usage();
+		numRules = policyCompile( argv[optind], argv[optind + 1], error, sizeof(error) );
+		if ( numRules < 0 )
+		{
+			printf( "%s: %s\n", argv[optind], error );
+			return 1;
+		}
+		printf( "%ld rule(s) compiled into %s\n", numRules, argv[optind + 1] );
+		return 0;
+	}
+
+	if ( argc - optind < 1 || (shouldList && argc - optind != 1) ||
+			(!shouldList && argc - optind != 4 && argc - optind != 5) || heads < 0 )
+		usage();
+	policy = policyOpen( argv[optind] );
+	if ( policy == NULL )
+	{
+		printf( "%s isn't a compiled policy\n", argv[optind] );
+		return 1;
+	}
+
+	if ( shouldList )
+	{
+		uint32_t ii;
+
+		for ( ii = 0; ii < policyCount( policy ); ii++ )
+			printRule( policyRuleAt( policy, ii ) );
+		policyClose( policy );
+		return 0;
+	}
+
+	memset( &identity, 0, sizeof(identity) );
+	identity.vendor = (uint32_t)strtoul( argv[optind + 1], NULL, 0 );
+	identity.model = (uint32_t)strtoul( argv[optind + 2], NULL, 0 );
+	identity.serial = (uint32_t)strtoul( argv[optind + 3], NULL, 0 );
+	if ( argc - optind == 5 )
+		identity.edidHash = strtoull( argv[optind + 4], NULL, 16 );
+	rule = policyResolve( policy, &identity, (uint32_t)heads );
+	if ( rule == NULL )
+		printf( "No rule, set as SetDisplay is told\n" );
+	else
+		printRule( rule );
+	policyClose( policy );
+	return rule != NULL ? 0 : 1;
+}
@@ -386,6 +386,7 @@ int main(int argc, char **argv)
 		if ( shouldSetDisplay == 1 )
 			setdisplay( displays[ii], mirroringOnOff, verbose );
 
+		CGDisplayModeRelease( originalMode );
 	}
 	exit(0);
 }
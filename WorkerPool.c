@@ -0,0 +1,246 @@
+/*
+WorkerPool.c
+
+See WorkerPool.h.
+
+The threads sleep on a condition variable between runs.  A run splits
+the indexes into one range for each thread (the caller's too), which
+it works through from the front; one that runs out steals the back
+half of the range of another that hasn't, so a slow index (a display
+that takes long to list its modes) doesn't hold up a whole share of
+them, and a run of many quick ones (a fleet of machines, see
+SetDisplayFleet.c) isn't all spent fighting over one counter.
+
+A range is two 32-bit halves of one 64-bit word, the first index in
+the low half and the one past the last in the high, so taking from it
+and stealing from it are each one compare-and-swap.  Seeing a range
+again that was there before is harmless: the word says all there is
+to say about whose the indexes in it are.  Runs of more indexes than
+fit in 32 bits are done as several runs.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#include "WorkerPool.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define POOL_MAX_RUN 0xffffffffUL
+
+typedef struct
+{
+	volatile uint64_t range;    // low half the next index, high half the end
+	char pad[56];               // a cache line each, stealing is rare but taking isn't
+} poolSlot;
+
+typedef struct
+{
+	workerPool *pool;
+	int slot;
+} poolThreadArg;
+
+struct workerPool
+{
+	pthread_t *threads;
+	poolThreadArg *args;
+	int numThreads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned long run;          // bumped for every poolRun, the threads wait for it to change
+	int busy;                   // threads still in the current run
+	int quit;
+
+	workerFunc func;
+	void *ctx;
+	size_t base;                // added to every index of the run
+	poolSlot *slots;            // numThreads + 1, the caller's is the last
+	void *slotMemory;
+};
+
+static uint64_t packRange( uint32_t lo, uint32_t hi )
+{
+	return (uint64_t)hi << 32 | lo;
+}
+
+/*
+The next index of the slot's own range, or -1 when it is empty.
+*/
+static int64_t takeOwn( poolSlot *slot )
+{
+	for ( ;; )
+	{
+		uint64_t range = slot->range;
+		uint32_t lo = (uint32_t)range, hi = (uint32_t)(range >> 32);
+		if ( lo >= hi )
+			return -1;
+		if ( __sync_bool_compare_and_swap( &slot->range, range, packRange( lo + 1, hi ) ) )
+			return lo;
+	}
+}
+
+/*
+Takes the back half of some other slot's range (all of it when there is
+one index left), keeps all but its first index as the slot's own and
+returns that first index; -1 when every range is empty.  Only the
+owner puts a range into an empty slot, so the store doesn't race.
+*/
+static int64_t steal( workerPool *pool, int self )
+{
+	int numSlots = pool->numThreads + 1, ii;
+
+	for ( ii = 1; ii < numSlots; ii++ )
+	{
+		poolSlot *victim = &pool->slots[(self + ii) % numSlots];
+		for ( ;; )
+		{
+			uint64_t range = victim->range;
+			uint32_t lo = (uint32_t)range, hi = (uint32_t)(range >> 32), mid;
+			if ( lo >= hi )
+				break;
+			mid = lo + (hi - lo) / 2;
+			if ( __sync_bool_compare_and_swap( &victim->range, range, packRange( lo, mid ) ) )
+			{
+				pool->slots[self].range = packRange( mid + 1, hi );
+				return mid;
+			}
+		}
+	}
+	return -1;
+}
+
+static void runIndexes( workerPool *pool, int self )
+{
+	for ( ;; )
+	{
+		int64_t index = takeOwn( &pool->slots[self] );
+		if ( index < 0 )
+			index = steal( pool, self );
+		if ( index < 0 )
+			return;
+		pool->func( pool->ctx, pool->base + (size_t)index );
+	}
+}
+
+static void *poolThread( void *arg )
+{
+	workerPool *pool = ((poolThreadArg *)arg)->pool;
+	int self = ((poolThreadArg *)arg)->slot;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock( &pool->lock );
+	for ( ;; )
+	{
+		while ( pool->run == seen && !pool->quit )
+			pthread_cond_wait( &pool->start, &pool->lock );
+		if ( pool->quit )
+			break;
+		seen = pool->run;
+		pthread_mutex_unlock( &pool->lock );
+
+		runIndexes( pool, self );
+
+		pthread_mutex_lock( &pool->lock );
+		if ( --pool->busy == 0 )
+			pthread_cond_signal( &pool->done );
+	}
+	pthread_mutex_unlock( &pool->lock );
+	return NULL;
+}
+
+workerPool *poolCreate( int numThreads )
+{
+	workerPool *pool = calloc( 1, sizeof(workerPool) );
+	int ii;
+
+	if ( pool == NULL )
+		return NULL;
+	pthread_mutex_init( &pool->lock, NULL );
+	pthread_cond_init( &pool->start, NULL );
+	pthread_cond_init( &pool->done, NULL );
+	if ( numThreads > 0 && posix_memalign( &pool->slotMemory, 64, ((size_t)numThreads + 1) * sizeof(poolSlot) ) == 0 )
+	{
+		pool->slots = pool->slotMemory;
+		pool->threads = calloc( (size_t)numThreads, sizeof(pthread_t) );
+		pool->args = calloc( (size_t)numThreads, sizeof(poolThreadArg) );
+	}
+	for ( ii = 0; pool->threads != NULL && pool->args != NULL && ii < numThreads; ii++ )
+	{
+		pool->args[ii].pool = pool;
+		pool->args[ii].slot = ii;
+		pool->slots[ii].range = 0;
+		if ( pthread_create( &pool->threads[ii], NULL, poolThread, &pool->args[ii] ) != 0 )
+			break;
+		pool->numThreads++;
+	}
+	return pool;
+}
+
+void poolDestroy( workerPool *pool )
+{
+	int ii;
+
+	if ( pool == NULL )
+		return;
+	pthread_mutex_lock( &pool->lock );
+	pool->quit = 1;
+	pthread_cond_broadcast( &pool->start );
+	pthread_mutex_unlock( &pool->lock );
+	for ( ii = 0; ii < pool->numThreads; ii++ )
+		pthread_join( pool->threads[ii], NULL );
+	pthread_cond_destroy( &pool->done );
+	pthread_cond_destroy( &pool->start );
+	pthread_mutex_destroy( &pool->lock );
+	free( pool->threads );
+	free( pool->args );
+	free( pool->slotMemory );
+	free( pool );
+}
+
+int poolThreads( const workerPool *pool )
+{
+	return pool != NULL ? pool->numThreads : 0;
+}
+
+void poolRun( workerPool *pool, size_t count, workerFunc func, void *ctx )
+{
+	size_t ii, base;
+	int numSlots, self;
+
+	if ( pool == NULL || pool->numThreads == 0 || count < 2 )
+	{
+		for ( ii = 0; ii < count; ii++ )
+			func( ctx, ii );
+		return;
+	}
+
+	numSlots = pool->numThreads + 1;
+	self = pool->numThreads;
+	for ( base = 0; base < count; base += POOL_MAX_RUN )
+	{
+		uint64_t runCount = count - base < POOL_MAX_RUN ? count - base : POOL_MAX_RUN;
+		int ss;
+
+		pthread_mutex_lock( &pool->lock );
+		pool->func = func;
+		pool->ctx = ctx;
+		pool->base = base;
+		for ( ss = 0; ss < numSlots; ss++ )
+			pool->slots[ss].range = packRange( (uint32_t)(runCount * ss / numSlots), (uint32_t)(runCount * (ss + 1) / numSlots) );
+		pool->busy = pool->numThreads;
+		pool->run++;
+		pthread_cond_broadcast( &pool->start );
+		pthread_mutex_unlock( &pool->lock );
+
+		runIndexes( pool, self );
+
+		pthread_mutex_lock( &pool->lock );
+		while ( pool->busy > 0 )
+			pthread_cond_wait( &pool->done, &pool->lock );
+		pthread_mutex_unlock( &pool->lock );
+	}
+}
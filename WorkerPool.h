@@ -0,0 +1,35 @@
+/*
+WorkerPool.h
+
+A few threads kept around to run the same function over a range of
+indexes, e.g. one display each.  The thread that calls poolRun works
+too and gets back when every index has been done.
+
+Copyright (c) 2014 The University of Utah
+All Rights Reserved.
+*/
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <stddef.h>
+
+typedef void (*workerFunc)( void *ctx, size_t index );
+
+typedef struct workerPool workerPool;
+
+/*
+A pool of numThreads threads besides the caller's.  With 0 (or if no
+thread can be started) poolRun just runs everything itself.
+*/
+workerPool *poolCreate( int numThreads );
+void poolDestroy( workerPool *pool );
+int poolThreads( const workerPool *pool );
+
+/*
+Calls func( ctx, index ) for every index below count, in no particular
+order and on whichever thread gets there first.
+*/
+void poolRun( workerPool *pool, size_t count, workerFunc func, void *ctx );
+
+#endif